@@ -16,18 +16,6 @@
   You should have received a copy of the GNU Lesser General Public
   License along with this library; if not, see <http://www.gnu.org/licenses/>.
 */
-/* TODO:
-
-   1. Make BiBOP page sizes adaptive based on their size and adjust
-      dynamically.
-
-   2. Defer actual allocation of a BiBOP object until after the write
-      barrier sees the object.  This amounts to a limited 1-bit
-      reference count.  Of course, objects like I/O objects and
-      strings that contain internal pointers should immediately be
-      allocated.
- */
-
 #include "../config.h"
 #ifdef HAVE_POSIX_MEMALIGN
 #define _XOPEN_SOURCE 600
@@ -38,6 +26,7 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 #include <malloc.h>
 #include "arcueid.h"
 #include "alloc.h"
@@ -49,6 +38,36 @@
 #include <malloc.h>
 #endif
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifdef MAP_ANONYMOUS
+#define USE_MMAP_PAGES
+#endif
+#endif
+
+#if defined(HAVE_GC_THREAD) || defined(HAVE_SMP)
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_ALLOCA_H
+# include <alloca.h>
+#elif defined __GNUC__
+#ifndef alloca
+# define alloca __builtin_alloca
+#endif
+#elif defined _AIX
+# define alloca __alloca
+#elif defined _MSC_VER
+# include <malloc.h>
+# define alloca _alloca
+#else
+# include <stddef.h>
+void *alloca (size_t);
+#endif
+
 static int nprop;		/* propagator flag */
 static int mutator;		/* current mutator colour */
 static int marker;		/* current marker colour */
@@ -57,19 +76,143 @@ static arc *__arc_handle=NULL;	/* current arc handle */
 
 #define PROPAGATOR 3		/* default propagator colour */
 
+/* Bitmap and header updates made outside the collector.  With the SMP
+   dispatcher, workers allocate and run the write barrier concurrently,
+   and objects touched by different workers may share a bitmap word,
+   so these use atomic operations. */
+#ifdef HAVE_SMP
+#define BITS_OR(w, m) __atomic_fetch_or(&(w), (m), __ATOMIC_RELAXED)
+#define BITS_AND(w, m) __atomic_fetch_and(&(w), (m), __ATOMIC_RELAXED)
+#else
+#define BITS_OR(w, m) ((w) |= (m))
+#define BITS_AND(w, m) ((w) &= (m))
+#endif
+
+static inline void LSETCOLOUR(Bhdr *h, int colour)
+{
+#ifdef HAVE_SMP
+  unsigned long o = h->_size, n;
+
+  do {
+    n = (o & ~0x30000UL) | (((unsigned long)(colour)) << 16);
+  } while (!__atomic_compare_exchange_n(&h->_size, &o, n, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+  LSCOLOUR(h, colour);
+#endif
+}
+
+/* Find the bitmap group and bit of a BiBOP object */
+#define BBITS(h, bb, bit) do {					\
+    struct bibop_page *__pg = B2PG(h);				\
+    (bb) = &__pg->bits[BSLOT(h) / BIBOP_BITS];			\
+    (bit) = 1UL << (BSLOT(h) % BIBOP_BITS);			\
+  } while (0)
+
+/* Bits of the objects in a bitmap group which have a given colour */
+static inline unsigned long COLOURBITS(struct bibop_bits *bb, int colour)
+{
+  return(((colour & 1) ? bb->colour[0] : ~bb->colour[0])
+	 & ((colour & 2) ? bb->colour[1] : ~bb->colour[1]));
+}
+
+static inline int BCOLOUR(Bhdr *h)
+{
+  struct bibop_bits *bb;
+  unsigned long bit;
+
+  if (BLARGEP(h))
+    return(LCOLOUR(h));
+  BBITS(h, bb, bit);
+  return(((bb->colour[0] & bit) ? 1 : 0) | ((bb->colour[1] & bit) ? 2 : 0));
+}
+
+static inline void BSCOLOUR(Bhdr *h, int colour)
+{
+  struct bibop_bits *bb;
+  unsigned long bit;
+
+  if (BLARGEP(h)) {
+    LSETCOLOUR(h, colour);
+    return;
+  }
+  BBITS(h, bb, bit);
+  if (colour & 1)
+    BITS_OR(bb->colour[0], bit);
+  else
+    BITS_AND(bb->colour[0], ~bit);
+  if (colour & 2)
+    BITS_OR(bb->colour[1], bit);
+  else
+    BITS_AND(bb->colour[1], ~bit);
+}
+
+static inline int BYOUNGP(Bhdr *h)
+{
+  struct bibop_bits *bb;
+  unsigned long bit;
+
+  if (BLARGEP(h))
+    return(LYOUNGP(h));
+  BBITS(h, bb, bit);
+  return((bb->young & bit) != 0);
+}
+
+/* Clears the remembered flag as well */
+static inline void BCYOUNG(Bhdr *h)
+{
+  struct bibop_bits *bb;
+  unsigned long bit;
+
+  if (BLARGEP(h)) {
+    LCYOUNG(h);
+    return;
+  }
+  BBITS(h, bb, bit);
+  bb->young &= ~bit;
+  bb->rem &= ~bit;
+}
+
+static inline int BREMEMBEREDP(Bhdr *h)
+{
+  struct bibop_bits *bb;
+  unsigned long bit;
+
+  if (BLARGEP(h))
+    return(LREMEMBEREDP(h));
+  BBITS(h, bb, bit);
+  return((bb->rem & bit) != 0);
+}
+
+/* Symbols are marked by marking their buckets in the forward and
+   reverse symbol tables, which are weak, through the symbol array.
+   Returns the entry of a symbol which has not yet been marked in the
+   current epoch, or NULL if there is nothing to mark. */
+static inline struct arc_symbol *SYMMARK(arc *c, value v)
+{
+  struct arc_symbol *sp;
+
+  /* the symbol array may be growing on another worker */
+  if (SYM2ID(v) >= (unsigned long)__atomic_load_n(&c->symsize,
+						   __ATOMIC_ACQUIRE))
+    return(NULL);
+  sp = &c->symbols[SYM2ID(v)];
+  if (sp->marked == MMVAR(c, gccolour))
+    return(NULL);
+  sp->marked = MMVAR(c, gccolour);
+  return(sp);
+}
+
 #define SETMARK(b) if (BCOLOUR(b) != mutator) { BSCOLOUR(b, PROPAGATOR); nprop = 1; }
 static inline void MARKPROP(value v)
 {
   if (SYMBOL_P(v)) {
-    value symid, name, bucket;
-    arc *c = __arc_handle;
-
-    symid = INT2FIX(SYM2ID(v));
-    bucket = arc_hash_lookup2(c, c->rsymtable, symid);
-    MARKPROP(bucket);
-    name = REP(bucket)[2];	/* XXX - this is problematic */
-    bucket = arc_hash_lookup2(c, c->symtable, name);
-    MARKPROP(bucket);
+    struct arc_symbol *sp = SYMMARK(__arc_handle, v);
+
+    if (sp != NULL) {
+      MARKPROP(sp->fwd);
+      MARKPROP(sp->rev);
+    }
     return;
   }
   if (!IMMEDIATE_P(v)) {
@@ -77,107 +220,288 @@ static inline void MARKPROP(value v)
   }
 }
 
+/* Push a value onto one of the growable value arrays used by the
+   memory manager. */
+static void vpush(value **arr, int *n, int *size, value v)
+{
+  if (*n >= *size) {
+    *size = (*size == 0) ? 1024 : *size * 2;
+    *arr = (value *)realloc(*arr, *size * sizeof(value));
+    if (*arr == NULL) {
+      fprintf(stderr, "FATAL: failed to allocate memory\n");
+      exit(1);
+    }
+  }
+  (*arr)[(*n)++] = v;
+}
+
+#ifdef HAVE_SMP
+
+/* Allocation buffers.  Each worker of the SMP dispatcher allocates
+   from BiBOP pages which it takes off the free page lists for itself,
+   and keeps a nursery list of its own, so allocation needs no locking
+   apart from taking a new page.  Whenever the world is stopped for
+   garbage collection every buffer is flushed back into the global
+   state, so the collector itself is none the wiser. */
+struct mm_buffer {
+  struct bibop_page *fl[MAX_BIBOP+1]; /* pages being allocated from */
+  value *young;			/* objects allocated since the last flush */
+  int nyoung;
+  int youngsize;
+  unsigned long long youngmem;	/* bytes allocated since the last flush */
+  struct mm_buffer *next;
+};
+
+static pthread_mutex_t mmlock = PTHREAD_MUTEX_INITIALIZER;
+static struct mm_buffer *buffers; /* buffers of all workers */
+static __thread struct mm_buffer *mmbuf; /* buffer of this worker */
+static void **deferred;		/* memory to be freed at the next flush */
+static int ndeferred, deferredsize;
+
+#endif
+
+/* All new objects are born young, and are recorded in the nursery
+   rather than becoming visible to VCGC.  Large objects are only
+   placed on the large object list if they survive a minor
+   collection. */
+static inline void *young_alloc(arc *c, Bhdr *h)
+{
+#ifdef HAVE_SMP
+  if (mmbuf != NULL) {
+    mmbuf->youngmem += BSIZE(h);
+    vpush(&mmbuf->young, &mmbuf->nyoung, &mmbuf->youngsize, (value)B2D(h));
+    return(B2D(h));
+  }
+#endif
+  USEDMEM(c) += BSIZE(h);
+  YOUNGMEM(c) += BSIZE(h);
+  vpush(&YOUNG(c), &NYOUNG(c), &MMVAR(c, youngsize), (value)B2D(h));
+  return(B2D(h));
+}
+
+/* Mask of the bits in bitmap word w which correspond to actual slots
+   in the page. */
+static inline unsigned long VALIDBITS(struct bibop_page *pg, int w)
+{
+  int n = pg->nobj - w*BIBOP_BITS;
+
+  return((n >= BIBOP_BITS) ? ~0UL : (1UL << n) - 1);
+}
+
+/* BiBOP pages are obtained directly from the system with mmap where
+   possible, so that freeing a page returns its memory to the system
+   at once. */
+static void *page_alloc(arc *c, size_t size)
+{
+#ifdef USE_MMAP_PAGES
+  void *pg;
+
+  pg = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+	    -1, 0);
+  return((pg == MAP_FAILED) ? NULL : pg);
+#else
+  return(c->mem_alloc(size));
+#endif
+}
+
+static void page_free(arc *c, struct bibop_page *pg)
+{
+#ifdef USE_MMAP_PAGES
+  munmap(pg, pg->pgsize);
+#else
+  c->mem_free(pg);
+#endif
+}
+
+static struct bibop_page *new_bibop_page(arc *c, size_t osize)
+{
+  struct bibop_page *pg;
+  int nobj, nwords, stride;
+  size_t pgsize;
+
+  /* Fit as many objects into the page as its size allows, allowing
+     for the header and the bitmaps. */
+  stride = BIBOP_STRIDE(osize);
+  pgsize = BIBOPPGSIZE(c)[osize];
+  nobj = (pgsize - BIBOP_PAGE_HDR - sizeof(struct bibop_bits))*BIBOP_BITS
+    / (stride*BIBOP_BITS + sizeof(struct bibop_bits));
+  if (nobj < 1)
+    nobj = 1;
+  nwords = (nobj + BIBOP_BITS - 1) / BIBOP_BITS;
+  pgsize = BIBOP_PAGE_HDR + stride*nobj + nwords*sizeof(struct bibop_bits);
+
+  /* The page base address is properly aligned since c->mem_alloc and
+     mmap are guaranteed to return aligned addresses, and
+     BIBOP_PAGE_HDR and the stride are chosen so that the objects
+     inside the page are also aligned. */
+  pg = (struct bibop_page *)page_alloc(c, pgsize);
+  if (pg == NULL) {
+    fprintf(stderr, "FATAL: failed to allocate memory for BiBOP page\n");
+    exit(1);
+  }
+  pg->pgsize = pgsize;
+  pg->stride = stride;
+  pg->nobj = pg->nfree = nobj;
+  pg->fword = 0;
+  pg->bits = (struct bibop_bits *)BIBOP_SLOT(pg, pg->nobj);
+  memset(pg->bits, 0, nwords*sizeof(struct bibop_bits));
+  pg->next = BIBOPPG(c)[osize];
+  BIBOPPG(c)[osize] = pg;
+  pg->nextfree = BIBOPFL(c)[osize];
+  BIBOPFL(c)[osize] = pg;
+  pg->onfree = 1;
+  MMVAR(c, bibop_newpages)[osize]++;
+  return(pg);
+}
+
+#ifdef HAVE_SMP
+
+/* Give the allocation buffer of a worker a page with free slots */
+static struct bibop_page *refill_buffer(arc *c, struct bibop_page **fl,
+					size_t osize)
+{
+  struct bibop_page *pg;
+
+  pthread_mutex_lock(&mmlock);
+  pg = BIBOPFL(c)[osize];
+  if (pg == NULL)
+    pg = new_bibop_page(c, osize);
+  BIBOPFL(c)[osize] = pg->nextfree;
+  pg->nextfree = NULL;
+  *fl = pg;
+  pthread_mutex_unlock(&mmlock);
+  return(pg);
+}
+
+#endif
+
 static void *bibop_alloc(arc *c, size_t osize)
 {
-  Bhdr *h, *bpage;
-  size_t actual;
-  char *bptr;
+  struct bibop_page *pg, **fl;
+  struct bibop_bits *bb;
+  unsigned long free, bit;
   int i;
+  Bhdr *h;
 
+  /* Take a free slot from the first page of that size which has one,
+     creating a new page if there are none. */
+  fl = &BIBOPFL(c)[osize];
+#ifdef HAVE_SMP
+  if (mmbuf != NULL) {
+    fl = &mmbuf->fl[osize];
+    if (*fl == NULL)
+      refill_buffer(c, fl, osize);
+  }
+#endif
+  pg = *fl;
+  if (pg == NULL)
+    pg = new_bibop_page(c, osize);
   for (;;) {
-    /* Pull off an object from the BiBOP free list if there is an
-       available object of that size. */
-    if (BIBOPFL(c)[osize] != NULL) {
-      h = BIBOPFL(c)[osize];
-      BIBOPFL(c)[osize] = B2NB(BIBOPFL(c)[osize]);
+    bb = &pg->bits[pg->fword];
+    free = ~bb->alloc & VALIDBITS(pg, pg->fword);
+    if (free != 0)
       break;
-    }
-
-    /* Create a new BiBOP page if the free list for that size is
-       empty.  The page base address is properly aligned since
-       c->mem_alloc is guaranteed to return aligned addresses, and
-       since BiBOP objects inside the page are padded to a multiple
-       of the alignment, all objects inside will also by definition
-       be aligned. */
-    actual = ALIGN_SIZE(osize) + BHDR_ALIGN_SIZE;
-    bpage = (Bhdr *)c->mem_alloc(actual * BIBOP_PAGE_SIZE + BHDR_ALIGN_SIZE);
-    if (bpage == NULL) {
-      fprintf(stderr, "FATAL: failed to allocate memory for BiBOP page\n");
-      exit(1);
-    }
-    BSSIZE(bpage, actual * BIBOP_PAGE_SIZE + BHDR_ALIGN_SIZE);
-    bpage->_next = BIBOPPG(c)[osize];
-    BIBOPPG(c)[osize] = bpage;
-    bptr = B2D(bpage);
-    for (i=0; i<BIBOP_PAGE_SIZE; i++) {
-      h = (Bhdr *)bptr;
-      BSSIZE(h, osize);
-      BFREE(h);
-      h->_next = BIBOPFL(c)[osize];
-      BIBOPFL(c)[osize] = h;
-      bptr += actual;
-    }
+    pg->fword++;
   }
-  USEDMEM(c) += osize;
-  BSSIZE(h, osize);
-  BALLOC(h);
-  BSCOLOUR(h, mutator);		/* set to mutator colour by default */
-  h->_next = ALLOCHEAD(c);
-  ALLOCHEAD(c) = h;
-  return(B2D(h));
+  bit = free & -free;
+  i = pg->fword*BIBOP_BITS + __builtin_ctzl(free);
+  BITS_OR(bb->alloc, bit);
+  BITS_OR(bb->young, bit);
+  BITS_AND(bb->rem, ~bit);
+  h = BIBOP_SLOT(pg, i);
+  BSETHDR(h, osize, i);
+  /* set to mutator colour by default */
+  BSCOLOUR(h, mutator);
+  if (--pg->nfree == 0) {
+    *fl = pg->nextfree;
+    pg->onfree = 0;
+  }
+  return(young_alloc(c, h));
 }
 
 static void *alloc(arc *c, size_t osize)
 {
+  Lhdr *l;
   Bhdr *h;
-  size_t actual;
 
   if (osize <= MAX_BIBOP)
     return(bibop_alloc(c, osize));
 
-  /* Normal allocation.  Just append the block header size with
-     proper alignment padding. */
-  actual = osize + BHDR_ALIGN_SIZE;
-  h = (Bhdr *)c->mem_alloc(actual);
-  if (h == NULL) {
+  /* Normal allocation.  Just append the large object header. */
+  l = (Lhdr *)c->mem_alloc(osize + LHDRSIZE);
+  if (l == NULL) {
     fprintf(stderr, "FATAL: failed to allocate memory\n");
     exit(1);
   }
-  USEDMEM(c) += osize;
-  BSSIZE(h, osize);
-  BALLOC(h);
-  BSCOLOUR(h, mutator);		/* set to mutator colour by default */
-  h->_next = ALLOCHEAD(c);
-  ALLOCHEAD(c) = h;
-  return(B2D(h));
+  l->_next = NULL;
+  l->_lsize = osize;
+  h = L2B(l);
+  BSETHDR(h, 0, BLARGE);
+  LSYOUNG(h);
+  LSCOLOUR(h, mutator);		/* set to mutator colour by default */
+  return(young_alloc(c, h));
 }
 
-/* Freeing a block requires one know the previous block in the alloc
-   list.  Probably only feasible to use for the garbage collector's
-   sweeper, which already traverses the allocated list. */
+/* Return a block that is no longer on any list to its BiBOP page
+   or to the system. */
+static void release_block(arc *c, Bhdr *h)
+{
+  struct bibop_page *pg;
+  struct bibop_bits *bb;
+  unsigned long bit;
+  int size = BSIZE(h);
+
+  USEDMEM(c) -= size;
+  if (BLARGEP(h)) {
+    c->mem_free(B2L(h));
+    return;
+  }
+
+  /* For BiBOP allocated objects, freeing them just means clearing
+     their bits, and putting the page back into the list of pages
+     with free slots if it isn't already there. */
+  pg = B2PG(h);
+  BBITS(h, bb, bit);
+  bb->alloc &= ~bit;
+  bb->young &= ~bit;
+  bb->rem &= ~bit;
+  pg->nfree++;
+  if (BSLOT(h) / BIBOP_BITS < pg->fword)
+    pg->fword = BSLOT(h) / BIBOP_BITS;
+  if (!pg->onfree) {
+    pg->nextfree = BIBOPFL(c)[size];
+    BIBOPFL(c)[size] = pg;
+    pg->onfree = 1;
+  }
+}
+
+/* Freeing a large object requires one know the previous object in
+   the large object list.  Probably only feasible to use for the
+   garbage collector's sweeper, which already traverses the list. */
 static void free_block(arc *c, void *blk, void *prevblk)
 {
-  Bhdr *h, *p;
+  Bhdr *h, *ph;
+  Lhdr *l, *p;
 
   D2B(h, blk);
-  /* Unlink the block from the alloc list. */
+  l = B2L(h);
+  /* Unlink the block from the large object list. */
   if (prevblk == NULL) {
-    /* When prevblk is NULL, that implies that h == ALLOC_HEAD(c) */
-    ALLOCHEAD(c) = B2NB(h);
+    /* When prevblk is NULL, l was at the head of the list when the
+       sweeper reached it, but objects promoted out of the nursery
+       since then may have been pushed in front of it. */
+    if (LARGEHEAD(c) == l) {
+      LARGEHEAD(c) = L2NL(l);
+    } else {
+      for (p = LARGEHEAD(c); L2NL(p) != l; p = L2NL(p))
+	;
+      p->_next = L2NL(l);
+    }
   } else {
-    D2B(p, prevblk);
-    p->_next = B2NB(h);
+    D2B(ph, prevblk);
+    B2L(ph)->_next = L2NL(l);
   }
-
-  USEDMEM(c) -= BSIZE(h);
-  if (BSIZE(h) <= MAX_BIBOP) {
-    /* For BiBOP allocated objects, freeing them just means putting the
-       object back into the free list for the object size. */
-    BFREE(h);
-    h->_next = BIBOPFL(c)[BSIZE(h)];
-    BIBOPFL(c)[BSIZE(h)] = h;
-  } else
-    c->mem_free(h);
+  release_block(c, h);
 }
 
 #ifdef HAVE_POSIX_MEMALIGN
@@ -229,34 +553,79 @@ static void sysfree(void *ptr)
 
 /* The actual garbage collector */
 
+/* Set the remembered bit on a young object which is being stored into
+   some other object, so the next minor collection will treat it as a
+   root. */
+static inline void REMEMBER(value v)
+{
+  struct bibop_bits *bb;
+  unsigned long bit;
+  Bhdr *h;
+
+  if (IMMEDIATE_P(v))
+    return;
+  D2B(h, (void *)v);
+  if (BLARGEP(h)) {
+    if (LYOUNGP(h))
+      BITS_OR(h->_size, LREMEMBERED);
+    return;
+  }
+  BBITS(h, bb, bit);
+  if (bb->young & bit)
+    BITS_OR(bb->rem, bit);
+}
+
 /* The write barrier.  As required by VCGC, this marks the destination
-   with the propagator. */
+   with the propagator.  The source is remembered if it is young. */
 inline void __arc_wb(value dest, value src)
 {
   MARKPROP(dest);
+  REMEMBER(src);
+}
+
+/* Write barrier for stores into thread registers and stack
+   environments.  Threads are always scanned in full by a minor
+   collection, so there is no need to remember the source. */
+void __arc_rootwb(value dest, value src)
+{
+  MARKPROP(dest);
+}
+
+static void remember_mark(arc *c, value v, int depth)
+{
+  REMEMBER(v);
 }
 
-/* Maximum recursion depth for marking */
-#define MAX_MARK_RECURSION 16
+/* Called when an object that the minor collector scans as a root
+   (i.e. a thread) stops being one.  Any young objects it refers to
+   are remembered, as though they had been stored into it with
+   __arc_wb. */
+void __arc_unroot(arc *c, value v)
+{
+  if (IMMEDIATE_P(v))
+    return;
+  __arc_typefn(c, v)->marker(c, v, 0, remember_mark);
+}
 
+/* Marking by VCGC does not recurse.  Objects reached by mark are
+   given the propagator colour and pushed onto the mark stack, and
+   mark_drain scans them from there within the visit budget of the
+   current quantum.  Objects still on the stack at the end of a
+   quantum stay there until the next one, and a pass over the heap is
+   not finished until the stack is empty, so an epoch only needs more
+   than one pass for propagators created by the write barrier or the
+   root marker. */
 static void mark(arc *c, value v, int depth)
 {
-  typefn_t *tfn;
   Bhdr *h;
 
-  if (SYMBOL_P(v) && !NIL_P(c->symtable) && !NIL_P(c->rsymtable)) {
-    value symid, name, bucket;
-
-    /* Symbol marking is done by marking the hash buckets in the
-       forward and reverse symbol tables.  Since the symbol tables
-       are weak hashes, this prevents that particular symbol from
-       becoming swept. */
-    symid = INT2FIX(SYM2ID(v));
-    bucket = arc_hash_lookup2(c, c->rsymtable, symid);
-    mark(c, bucket, depth);
-    name = REP(bucket)[2];	/* XXX - this is problematic */
-    bucket = arc_hash_lookup2(c, c->symtable, name);
-    mark(c, bucket, depth);
+  if (SYMBOL_P(v)) {
+    struct arc_symbol *sp = SYMMARK(c, v);
+
+    if (sp != NULL) {
+      mark(c, sp->fwd, depth);
+      mark(c, sp->rev, depth);
+    }
     return;
   }
 
@@ -267,7 +636,7 @@ static void mark(arc *c, value v, int depth)
   D2B(h, (void *)v);
 
   /* special case: for a negative depth, just mark the object
-     with mutator colour, do not recurse into it.  Presently used for
+     with mutator colour, do not scan it.  Presently used for
      thread stack marker. */
   if (depth < 0) {
     --VISIT(c);
@@ -275,107 +644,310 @@ static void mark(arc *c, value v, int depth)
     return;
   }
 
-  SETMARK(h);
-  if (--VISIT(c) >= 0 && depth < MAX_MARK_RECURSION) {
+  if (BCOLOUR(h) == mutator)
+    return;
+  BSCOLOUR(h, PROPAGATOR);
+  vpush(&MMVAR(c, gcstack), &MMVAR(c, gcsp), &MMVAR(c, gcstacksize), v);
+}
+
+static void mark_drain(arc *c)
+{
+  value v;
+  Bhdr *h;
+
+  while (MMVAR(c, gcsp) > 0 && VISIT(c) > 0) {
+    v = MMVAR(c, gcstack)[--MMVAR(c, gcsp)];
+    D2B(h, (void *)v);
+    /* may have been pushed more than once */
+    if (BCOLOUR(h) == mutator)
+      continue;
+    --VISIT(c);
     MMVAR(c, gce)--;
     BSCOLOUR(h, mutator);
-    /* Recurse into the object's structure at increased depth */
-    tfn = __arc_typefn(c, v);
-    tfn->marker(c, v, depth+1, mark);
+    __arc_typefn(c, v)->marker(c, v, 0, mark);
   }
 }
 
-/* Go over all the allocated BiBOP pages and find ones which are
-   completely empty. We have to rebuild the free lists for that
-   size as well. */
+/* Go over all the allocated BiBOP pages and free the ones which are
+   completely empty.  The lists of pages with free slots are rebuilt
+   as well.  This is done at the end of every epoch, and it is also
+   where the page size for each object size is adjusted: a size that
+   needed more than one new page during the epoch gets bigger pages,
+   and a size that only released pages gets smaller ones. */
 static void free_unused_bibop(arc *c)
 {
-  Bhdr *bpage, *h, *prev, *nfl, *pfl, *pflt;
-  char *bptr;
-  int empty, i, j, actual;
+  struct bibop_page *pg, *next, *prev, *fl;
+  int i;
 
   for (i=0; i<=MAX_BIBOP; i++) {
-    actual = ALIGN_SIZE(i) + BHDR_ALIGN_SIZE;
     prev = NULL;
-    nfl = NULL;
-    for (bpage = BIBOPPG(c)[i]; bpage;) {
-      bptr = B2D(bpage);
-      empty = 1;
-      pfl = pflt = NULL;
-      for (j=0; j<BIBOP_PAGE_SIZE; j++) {
-	h = (Bhdr *)bptr;
-	if (BALLOCP(h)) {
-	  empty = 0;
-	  break;
-	} else {
-	  if (pflt == NULL)
-	    pflt = h;
-	  h->_next = pfl;
-	  pfl = h;
-	}
-	bptr += actual;
-      }
-      h = B2NB(bpage);
-      if (empty) {
+    fl = NULL;
+    for (pg = BIBOPPG(c)[i]; pg; pg = next) {
+      next = pg->next;
+      if (pg->nfree == pg->nobj) {
 	/* We are empty.  Unlink the page to be freed. */
-	if (prev == NULL) {
-	  BIBOPPG(c)[i] = h;
-	} else {
-	  prev->_next = h;
-	}
-	c->mem_free(bpage);
-      } else {
-	/* Not empty.  Previous pointer moves to it. */
-	prev = bpage;
-	/* Also join pfl to nfl if it isn't null */
-	if (pflt != NULL && pfl != NULL) {
-	  pflt->_next = nfl;
-	  nfl = pfl;
-	}
+	if (prev == NULL)
+	  BIBOPPG(c)[i] = next;
+	else
+	  prev->next = next;
+	page_free(c, pg);
+	MMVAR(c, bibop_freedpages)[i]++;
+	EPOCH(c).pages++;
+	continue;
+      }
+      prev = pg;
+      pg->onfree = (pg->nfree > 0);
+      if (pg->onfree) {
+	pg->nextfree = fl;
+	fl = pg;
       }
-      bpage = h;
     }
-    /* Now that we have a new free list, use it */
-    BIBOPFL(c)[i] = nfl;
+    BIBOPFL(c)[i] = fl;
+
+    if (MMVAR(c, bibop_newpages)[i] > 1
+	&& BIBOPPGSIZE(c)[i] < BIBOP_MAX_PAGE)
+      BIBOPPGSIZE(c)[i] *= 2;
+    else if (MMVAR(c, bibop_newpages)[i] == 0
+	     && MMVAR(c, bibop_freedpages)[i] > 0
+	     && BIBOPPGSIZE(c)[i] > BIBOP_MIN_PAGE)
+      BIBOPPGSIZE(c)[i] /= 2;
+    MMVAR(c, bibop_newpages)[i] = MMVAR(c, bibop_freedpages)[i] = 0;
   }
 }
 
+/* The nursery.  Young objects are never moved: a minor collection
+   promotes the survivors in place by clearing their young bits, and
+   large survivors are moved to the large object list.  The roots of a
+   minor collection are the roots given by c->markroots, all threads
+   (which are always scanned in full, so stores into thread registers
+   and stacks need not be remembered), and every young object the
+   write barrier has remembered. */
+
+static int minor;		/* minor collection in progress */
+
+static void minor_push(arc *c, value v)
+{
+  vpush(&MMVAR(c, mstack), &MMVAR(c, msp), &MMVAR(c, mstacksize), v);
+}
+
+/* Promote a young object.  Old objects are ignored, as any young
+   objects they refer to have been remembered.  For a negative depth,
+   the object is promoted but not scanned, as with mark. */
+static void minor_mark(arc *c, value v, int depth)
+{
+  Bhdr *h;
+
+  if (IMMEDIATE_P(v))
+    return;
+  D2B(h, (void *)v);
+  if (!BYOUNGP(h))
+    return;
+  BCYOUNG(h);
+  if (depth >= 0)
+    minor_push(c, v);
+}
+
+static void minor_thread(arc *c, value thr)
+{
+  if (NIL_P(thr))
+    return;
+  minor_mark(c, thr, -1);
+  __arc_typefn(c, thr)->marker(c, thr, 0, minor_mark);
+}
+
+static void minor_gc(arc *c)
+{
+  Bhdr *h;
+  value v;
+  int i;
+  unsigned long long st, swept = 0ULL, freed = 0ULL;
+
+  if (NYOUNG(c) == 0)
+    return;
+  st = __arc_microseconds();
+  minor = 1;
+  c->markroots(c);
+  for (v = c->vmthreads; !NIL_P(v); v = cdr(v))
+    minor_thread(c, car(v));
+  minor_thread(c, c->curthread);
+#ifdef HAVE_TRACING
+  minor_thread(c, c->tracethread);
+#endif
+  for (i=0; i<NYOUNG(c); i++) {
+    D2B(h, (void *)YOUNG(c)[i]);
+    if (BYOUNGP(h) && BREMEMBEREDP(h)) {
+      BCYOUNG(h);
+      minor_push(c, YOUNG(c)[i]);
+    }
+  }
+  while (MMVAR(c, msp) > 0) {
+    v = MMVAR(c, mstack)[--MMVAR(c, msp)];
+    __arc_typefn(c, v)->marker(c, v, 0, minor_mark);
+  }
+  minor = 0;
+
+  /* Objects still young are garbage.  All of their sweepers have to
+     run before any of them are freed, since a sweeper may still look
+     at other dead objects.  Survivors keep whatever colour they were
+     given by VCGC. */
+  for (i=0; i<NYOUNG(c); i++) {
+    v = YOUNG(c)[i];
+    D2B(h, (void *)v);
+    if (BYOUNGP(h))
+      __arc_typefn(c, v)->sweeper(c, v);
+  }
+  for (i=0; i<NYOUNG(c); i++) {
+    D2B(h, (void *)YOUNG(c)[i]);
+    if (BYOUNGP(h)) {
+      swept++;
+      freed += BSIZE(h);
+      release_block(c, h);
+    } else if (BLARGEP(h)) {
+      B2L(h)->_next = LARGEHEAD(c);
+      LARGEHEAD(c) = B2L(h);
+    }
+  }
+  EPOCH(c).minors++;
+  EPOCH(c).minor_swept += swept;
+  EPOCH(c).minor_freed += freed;
+  EPOCH(c).promoted += NYOUNG(c) - swept;
+  st = __arc_microseconds() - st;
+  EPOCH(c).minor_usec += st;
+  if (GCLOG(c) != NULL) {
+    fprintf(GCLOG(c), "{\"event\":\"minor\",\"time\":%llu,\"usec\":%llu,"
+	    "\"swept\":%llu,\"freed\":%llu,\"promoted\":%llu}\n",
+	    __arc_microseconds(), st, swept, freed, NYOUNG(c) - swept);
+    fflush(GCLOG(c));
+  }
+  NYOUNG(c) = 0;
+  YOUNGMEM(c) = 0ULL;
+  MMVAR(c, minors)++;
+}
+
 /* VCGC */
 
-static int gc(arc *c)
+/* Visit a group of objects in a BiBOP page.  Young objects are not
+   visited, since VCGC only sees them once they have been promoted. */
+static void gc_bibop_word(arc *c, struct bibop_page *pg, int w)
 {
+  struct bibop_bits *bb = &pg->bits[w];
+  unsigned long live, prop, sweep, m;
   value v;
-  unsigned long long gcst, gcet;
-  int retval = 0;
-  typefn_t *tfn;
+  Bhdr *h;
+
+  live = bb->alloc & ~bb->young;
+  if (live == 0)
+    return;
 
-  gcst = __arc_milliseconds();
-  if (GCPTR(c) == NULL) {
-    GCPTR(c) = ALLOCHEAD(c);
-    GCPPTR(c) = CNIL;
+  /* Recursively mark propagators */
+  prop = live & COLOURBITS(bb, PROPAGATOR);
+  for (m = prop; m; m &= m - 1) {
+    MMVAR(c, gce)--;
+    h = BIBOP_SLOT(pg, w*BIBOP_BITS + __builtin_ctzl(m));
+    mark(c, (value)B2D(h), 0);
+  }
+
+  /* Marking may have recoloured objects in the group, so the objects
+     to be swept can only be determined now. */
+  sweep = live & COLOURBITS(bb, sweeper);
+  MMVAR(c, gct) += __builtin_popcountl(live & ~(prop | sweep));
+  for (m = sweep; m; m &= m - 1) {
+    MMVAR(c, gce)++;
+    h = BIBOP_SLOT(pg, w*BIBOP_BITS + __builtin_ctzl(m));
+    v = (value)B2D(h);
+    __arc_typefn(c, v)->sweeper(c, v);
+    EPOCH(c).swept++;
+    EPOCH(c).freed += BSIZE(h);
+    release_block(c, h);
   }
+}
+
+/* Write the statistics of the epoch which just ended to the GC
+   event log */
+static void gclog_epoch(arc *c)
+{
+  struct gc_epoch_stats *es = &MMVAR(c, lastepoch);
 
+  fprintf(GCLOG(c), "{\"event\":\"epoch\",\"time\":%llu,\"epoch\":%llu,"
+	  "\"swept\":%llu,\"freed\":%llu,\"pages\":%llu,"
+	  "\"mark_usec\":%llu,\"sweep_usec\":%llu,\"minors\":%llu,"
+	  "\"minor_swept\":%llu,\"minor_freed\":%llu,\"promoted\":%llu,"
+	  "\"minor_usec\":%llu,\"quantum\":%d,\"memory\":%llu}\n",
+	  __arc_microseconds(), MMVAR(c, gcepochs), es->swept, es->freed,
+	  es->pages, es->mark_usec, es->sweep_usec, es->minors,
+	  es->minor_swept, es->minor_freed, es->promoted, es->minor_usec,
+	  MMVAR(c, gcquantum), USEDMEM(c));
+  fflush(GCLOG(c));
+}
+
+/* Do one quantum of work on the current VCGC pass.  Returns nonzero
+   if this finished an epoch that completed a full cycle of colours. */
+static int vcgc(arc *c)
+{
+  value v;
+  int retval = 0;
+  typefn_t *tfn;
+  struct bibop_page *pg;
+  Bhdr *h;
+  unsigned long long st, mst, markus = 0ULL;
+
+  /* A pass first visits the BiBOP pages of each size, a bitmap word
+     at a time, and then the large object list.  Time spent draining
+     the mark stack is counted as marking, and everything else as
+     sweeping. */
+  st = __arc_microseconds();
   for (VISIT(c) = MMVAR(c, gcquantum); VISIT(c) > 0;) {
+    if (MMVAR(c, gcsp) > 0) {
+      mst = __arc_microseconds();
+      mark_drain(c);
+      markus += __arc_microseconds() - mst;
+      continue;
+    }
+    if (MMVAR(c, gcsize) <= MAX_BIBOP) {
+      pg = MMVAR(c, gcpage);
+      if (pg == NULL) {
+	if (++MMVAR(c, gcsize) <= MAX_BIBOP) {
+	  MMVAR(c, gcpage) = BIBOPPG(c)[MMVAR(c, gcsize)];
+	} else {
+	  GCPTR(c) = LARGEHEAD(c);
+	  GCPPTR(c) = NULL;
+	}
+	MMVAR(c, gcword) = 0;
+      } else if (MMVAR(c, gcword)*BIBOP_BITS >= pg->nobj) {
+	MMVAR(c, gcpage) = pg->next;
+	MMVAR(c, gcword) = 0;
+      } else {
+	gc_bibop_word(c, pg, MMVAR(c, gcword)++);
+      }
+      continue;
+    }
+
     if (GCPTR(c) == NULL)
       break;			/* last heap block */
-    v = (value)B2D(GCPTR(c));
-    if (BCOLOUR(GCPTR(c)) == PROPAGATOR) {
+    h = L2B(GCPTR(c));
+    v = (value)B2D(h);
+    if (LCOLOUR(h) == PROPAGATOR) {
       MMVAR(c, gce)--;
       /* Recursively mark propagators */
       mark(c, v, 0);
-    } else if (BCOLOUR(GCPTR(c)) == sweeper) {
+    } else if (LCOLOUR(h) == sweeper) {
       MMVAR(c, gce)++;
       tfn = __arc_typefn(c, v);
       tfn->sweeper(c, v);
-      GCPTR(c) = B2NB(GCPTR(c));
-      c->free(c, (void *)v, GCPPTR(c));
+      EPOCH(c).swept++;
+      EPOCH(c).freed += BSIZE(h);
+      GCPTR(c) = L2NL(GCPTR(c));
+      c->free(c, (void *)v, (GCPPTR(c) == NULL) ? NULL
+	      : B2D(L2B(GCPPTR(c))));
       continue;
     } else {
       MMVAR(c, gct)++;
     }
-    GCPPTR(c) = (void *)v;
-    GCPTR(c) = B2NB(GCPTR(c));
+    GCPPTR(c) = GCPTR(c);
+    GCPTR(c) = L2NL(GCPTR(c));
   }
+  EPOCH(c).mark_usec += markus;
+  EPOCH(c).sweep_usec += __arc_microseconds() - st - markus;
 
   MMVAR(c, gcquantum) = (GCMAXQUANTA - GCQUANTA)/2 + ((GCMAXQUANTA - GCQUANTA)/20)*100*MMVAR(c, gce)/MMVAR(c, gct);
   if (MMVAR(c, gcquantum) < GCQUANTA)
@@ -385,8 +957,11 @@ static int gc(arc *c)
     MMVAR(c, gcquantum) = GCMAXQUANTA;
 
   /* printf("gct = %d, gce = %d, quanta = %d\n", MMVAR(c, gct), MMVAR(c, gce), MMVAR(c, gcquantum)); */
-  if (GCPTR(c) != NULL)		/* completed iteration? */
+  /* completed iteration? */
+  if (MMVAR(c, gcsize) <= MAX_BIBOP || GCPTR(c) != NULL || MMVAR(c, gcsp) > 0)
     goto endgc;
+  MMVAR(c, gcsize) = -1;
+  MMVAR(c, gcpasses)++;
 
   if (nprop == 0) { 		/* completed the epoch? */
     retval = (MMVAR(c, gccolour) % 3) == 0;
@@ -403,33 +978,316 @@ static int gc(arc *c)
 #ifdef HAVE_MALLOC_TRIM
     malloc_trim(0);
 #endif
+    MMVAR(c, gclimit) = 2*USEDMEM(c) + GCLIMIT_SLACK;
+    MMVAR(c, lastepoch) = EPOCH(c);
+    memset(&EPOCH(c), 0, sizeof(struct gc_epoch_stats));
+    if (GCLOG(c) != NULL)
+      gclog_epoch(c);
   }
   nprop = 0;
  endgc:
-  gcet = __arc_milliseconds();
-  GCMS(c) += gcet - gcst;
   return(retval);
 }
 
+#ifdef HAVE_GC_THREAD
+
+/* The collector thread.  The mutator owns the heap while it runs, and
+   gives it up only while the scheduler is blocked waiting for I/O or
+   for sleeping threads to wake up, by calling __arc_gc_release.  The
+   collector thread continues the current VCGC pass during those
+   periods, and returns the heap as soon as the mutator asks for it
+   back with __arc_gc_acquire.  The colour bits, the write barrier and
+   the allocator are only ever used by whoever holds heaplock, so none
+   of them need any further synchronisation.  Minor collections and
+   the start of each pass remain at the safepoints in the mutator,
+   since young objects may be referenced from C variables of the
+   scheduler even while it is blocked.  The mutator also goes on doing
+   its own quanta at the safepoints unless the collector thread has
+   had the heap since the last one, so a process which never blocks
+   is still collected incrementally. */
+static pthread_t gcthread;
+static pthread_mutex_t heaplock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t heapcond = PTHREAD_COND_INITIALIZER;
+static int gcthread_running;	/* collector thread started */
+static int gcthread_stop;	/* collector thread should exit */
+static int heapidle;		/* mutator has released the heap */
+static int wantheap;		/* mutator wants the heap back */
+static int gcthread_ran;	/* collector thread did a quantum since the
+				   last safepoint */
+
+static void *collector(void *arg)
+{
+  arc *c = (arc *)arg;
+  unsigned long long st;
+
+  pthread_mutex_lock(&heaplock);
+  for (;;) {
+    while (!gcthread_stop && (!heapidle || MMVAR(c, gcsize) < 0
+			      || __atomic_load_n(&wantheap, __ATOMIC_ACQUIRE)))
+      pthread_cond_wait(&heapcond, &heaplock);
+    if (gcthread_stop)
+      break;
+    st = __arc_microseconds();
+    while (MMVAR(c, gcsize) >= 0
+	   && !__atomic_load_n(&wantheap, __ATOMIC_ACQUIRE)) {
+      vcgc(c);
+      gcthread_ran = 1;
+    }
+    MMVAR(c, gcthread_us) += __arc_microseconds() - st;
+  }
+  pthread_mutex_unlock(&heaplock);
+  return(NULL);
+}
+
+static int start_collector(arc *c)
+{
+  int ret;
+
+  pthread_mutex_lock(&heaplock);
+  gcthread_stop = heapidle = wantheap = 0;
+  ret = pthread_create(&gcthread, NULL, collector, c);
+  if (ret != 0) {
+    pthread_mutex_unlock(&heaplock);
+    return(ret);
+  }
+  gcthread_running = 1;
+  return(0);
+}
+
+/* Give the heap to the collector thread.  The caller must not touch
+   any Arcueid object until it calls __arc_gc_acquire. */
+void __arc_gc_release(arc *c)
+{
+  if (!gcthread_running)
+    return;
+  heapidle = 1;
+  pthread_cond_signal(&heapcond);
+  pthread_mutex_unlock(&heaplock);
+}
+
+void __arc_gc_acquire(arc *c)
+{
+  if (!gcthread_running)
+    return;
+  __atomic_store_n(&wantheap, 1, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&heaplock);
+  __atomic_store_n(&wantheap, 0, __ATOMIC_RELAXED);
+  heapidle = 0;
+}
+
+/* Start or stop the collector thread */
+value arc_gc_thread(arc *c, value enable)
+{
+  int ret;
+
+  if (!NIL_P(enable) && !gcthread_running) {
+    ret = start_collector(c);
+    if (ret != 0) {
+      arc_err_cstrfmt(c, "error starting collector thread (%s; errno=%d)",
+		      strerror(ret), ret);
+      return(CNIL);
+    }
+  } else if (NIL_P(enable) && gcthread_running) {
+    gcthread_stop = 1;
+    pthread_cond_signal(&heapcond);
+    pthread_mutex_unlock(&heaplock);
+    pthread_join(gcthread, NULL);
+    gcthread_running = 0;
+  }
+  return(gcthread_running ? CTRUE : CNIL);
+}
+
+#else
+
+void __arc_gc_release(arc *c)
+{
+}
+
+void __arc_gc_acquire(arc *c)
+{
+}
+
+#endif
+
+#ifdef HAVE_SMP
+
+/* Return the contents of an allocation buffer to the global state.
+   Called with mmlock held, while no worker is running. */
+static void flush_buffer(arc *c, struct mm_buffer *b)
+{
+  struct bibop_page *pg, *next;
+  int i;
+
+  for (i=0; i<=MAX_BIBOP; i++) {
+    for (pg = b->fl[i]; pg; pg = next) {
+      next = pg->nextfree;
+      pg->nextfree = BIBOPFL(c)[i];
+      BIBOPFL(c)[i] = pg;
+    }
+    b->fl[i] = NULL;
+  }
+  for (i=0; i<b->nyoung; i++)
+    vpush(&YOUNG(c), &NYOUNG(c), &MMVAR(c, youngsize), b->young[i]);
+  USEDMEM(c) += b->youngmem;
+  YOUNGMEM(c) += b->youngmem;
+  b->nyoung = 0;
+  b->youngmem = 0ULL;
+}
+
+static void flush_buffers(arc *c)
+{
+  struct mm_buffer *b;
+
+  pthread_mutex_lock(&mmlock);
+  for (b = buffers; b; b = b->next)
+    flush_buffer(c, b);
+  while (ndeferred > 0)
+    free(deferred[--ndeferred]);
+  pthread_mutex_unlock(&mmlock);
+}
+
+/* Give the calling worker an allocation buffer of its own */
+void __arc_mm_attach(arc *c)
+{
+  struct mm_buffer *b;
+
+  b = (struct mm_buffer *)calloc(1, sizeof(struct mm_buffer));
+  if (b == NULL) {
+    fprintf(stderr, "FATAL: failed to allocate memory\n");
+    exit(1);
+  }
+  pthread_mutex_lock(&mmlock);
+  b->next = buffers;
+  buffers = b;
+  pthread_mutex_unlock(&mmlock);
+  mmbuf = b;
+}
+
+/* Flush and release the allocation buffer of the calling worker.  No
+   other worker may be running threads. */
+void __arc_mm_detach(arc *c)
+{
+  struct mm_buffer **p;
+
+  if (mmbuf == NULL)
+    return;
+  pthread_mutex_lock(&mmlock);
+  flush_buffer(c, mmbuf);
+  for (p = &buffers; *p != mmbuf; p = &(*p)->next)
+    ;
+  *p = mmbuf->next;
+  pthread_mutex_unlock(&mmlock);
+  free(mmbuf->young);
+  free(mmbuf);
+  mmbuf = NULL;
+}
+
+/* Bytes allocated by the calling worker since the last collection */
+unsigned long long __arc_mm_buffered(arc *c)
+{
+  return((mmbuf == NULL) ? 0ULL : mmbuf->youngmem);
+}
+
+#endif
+
+/* Free memory which workers of the SMP dispatcher may still be
+   reading without a lock, such as an old copy of the symbol array.
+   It is freed when the world is next stopped for collection.
+   Otherwise it is freed at once. */
+void __arc_defer_free(arc *c, void *ptr)
+{
+#ifdef HAVE_SMP
+  pthread_mutex_lock(&mmlock);
+  if (ndeferred >= deferredsize) {
+    deferredsize = (deferredsize == 0) ? 16 : 2*deferredsize;
+    deferred = (void **)realloc(deferred, deferredsize*sizeof(void *));
+    if (deferred == NULL) {
+      fprintf(stderr, "FATAL: failed to allocate memory\n");
+      exit(1);
+    }
+  }
+  deferred[ndeferred++] = ptr;
+  pthread_mutex_unlock(&mmlock);
+#else
+  free(ptr);
+#endif
+}
+
+/* With the SMP dispatcher, this may only be called while every other
+   worker is stopped at a safepoint. */
+static int gc(arc *c)
+{
+  unsigned long long gcst, gcet;
+  int retval;
+
+  gcst = __arc_microseconds();
+#ifdef HAVE_SMP
+  flush_buffers(c);
+#endif
+  /* Do a minor collection whenever VCGC begins a new pass over the
+     heap, so that no young object that was marked as a propagator
+     can escape the pass, or when the nursery fills up. */
+  if (MMVAR(c, gcsize) < 0 || YOUNGMEM(c) >= NURSERY_SIZE)
+    minor_gc(c);
+  if (MMVAR(c, gcsize) < 0) {
+    MMVAR(c, gcsize) = 0;
+    MMVAR(c, gcpage) = BIBOPPG(c)[0];
+    MMVAR(c, gcword) = 0;
+  }
+#ifdef HAVE_GC_THREAD
+  /* Leave the pass to the collector thread if it has had an idle
+     period since the last safepoint, unless the heap has grown so much
+     since the last epoch that it is evidently not keeping up. */
+  if (gcthread_running && gcthread_ran && USEDMEM(c) < MMVAR(c, gclimit)) {
+    gcthread_ran = 0;
+    retval = 1;
+    goto endgc;
+  }
+#endif
+  retval = vcgc(c);
+#ifdef HAVE_GC_THREAD
+ endgc:
+#endif
+  gcet = __arc_microseconds();
+  GCUS(c) += gcet - gcst;
+  if (GCLOG(c) != NULL && gcet - gcst >= GCLOG_PAUSE_USEC) {
+    fprintf(GCLOG(c), "{\"event\":\"pause\",\"time\":%llu,\"usec\":%llu}\n",
+	    gcst, gcet - gcst);
+    fflush(GCLOG(c));
+  }
+  return(retval);
+}
+
+/* Mark a root.  Root markers must use this rather than marking
+   directly, as the same root marker is used by both VCGC and the
+   minor collector. */
+void __arc_markprop(arc *c, value p)
+{
+  if (minor)
+    minor_mark(c, p, 0);
+  else
+    MARKPROP(p);
+}
+
 /* Default root marker */
 static void markroots(arc *c)
 {
-  MARKPROP(c->symtable);
-  MARKPROP(c->rsymtable);
-  MARKPROP(c->genv);
-  MARKPROP(c->builtins);
-  MARKPROP(c->typedesc);
-  MARKPROP(c->curthread);
-  MARKPROP(c->vmthreads);
-  MARKPROP(c->declarations);
+  __arc_markprop(c, c->symtable);
+  __arc_markprop(c, c->rsymtable);
+  __arc_markprop(c, c->genv);
+  __arc_markprop(c, c->builtins);
+  __arc_markprop(c, c->typedesc);
+  __arc_markprop(c, c->curthread);
+  __arc_markprop(c, c->vmthreads);
+  __arc_markprop(c, c->declarations);
 #ifdef HAVE_TRACING
-  MARKPROP(c->tracethread);
+  __arc_markprop(c, c->tracethread);
 #endif
 }
 
 value arc_current_gc_milliseconds(arc *c)
 {
-  return(__arc_ull2val(c, GCMS(c)));
+  return(__arc_ull2val(c, GCUS(c) / 1000ULL));
 }
 
 value arc_memory(arc *c)
@@ -437,8 +1295,146 @@ value arc_memory(arc *c)
   return(__arc_ull2val(c, USEDMEM(c)));
 }
 
+/* Occupancy of the BiBOP pages.  Returns a list with an entry for
+   every object size which has pages allocated, of the form (size
+   page-size pages slots used), where page-size is the size of the
+   next page which will be created for that object size. */
+value arc_bibop_stats(arc *c)
+{
+  struct bibop_page *pg;
+  value stats = CNIL, entry;
+  int i, npages, nslots, nused;
+
+  for (i=MAX_BIBOP; i>=0; i--) {
+    if (BIBOPPG(c)[i] == NULL)
+      continue;
+    npages = nslots = nused = 0;
+    for (pg = BIBOPPG(c)[i]; pg; pg = pg->next) {
+      npages++;
+      nslots += pg->nobj;
+      nused += pg->nobj - pg->nfree;
+    }
+    entry = cons(c, INT2FIX(nused), CNIL);
+    entry = cons(c, INT2FIX(nslots), entry);
+    entry = cons(c, INT2FIX(npages), entry);
+    entry = cons(c, INT2FIX(BIBOPPGSIZE(c)[i]), entry);
+    entry = cons(c, INT2FIX(i), entry);
+    stats = cons(c, entry, stats);
+  }
+  return(stats);
+}
+
+/* Bytes allocated to objects of each type.  The heap may not be
+   modified while it is being walked, so this is done before any of
+   the result is built. */
+static void type_census(arc *c, unsigned long long *bytes)
+{
+  struct bibop_page *pg;
+  unsigned long m;
+  Lhdr *l;
+  Bhdr *h;
+  int i, w;
+
+  for (i=0; i<=T_MAX; i++)
+    bytes[i] = 0ULL;
+  for (i=0; i<=MAX_BIBOP; i++) {
+    for (pg = BIBOPPG(c)[i]; pg; pg = pg->next) {
+      for (w=0; w*BIBOP_BITS < pg->nobj; w++) {
+	for (m = pg->bits[w].alloc; m; m &= m - 1) {
+	  h = BIBOP_SLOT(pg, w*BIBOP_BITS + __builtin_ctzl(m));
+	  bytes[BTYPE(B2D(h)) & T_MAX] += i;
+	}
+      }
+    }
+  }
+  for (l = LARGEHEAD(c); l; l = L2NL(l))
+    bytes[BTYPE(B2D(L2B(l))) & T_MAX] += BSIZE(L2B(l));
+  /* large objects still in the nursery are not on the list */
+  for (i=0; i<NYOUNG(c); i++) {
+    D2B(h, (void *)YOUNG(c)[i]);
+    if (BLARGEP(h))
+      bytes[BTYPE(YOUNG(c)[i]) & T_MAX] += BSIZE(h);
+  }
+}
+
+static void gcstat(arc *c, value tbl, const char *name, value val)
+{
+  arc_hash_insert(c, tbl, arc_intern_cstr(c, name), val);
+}
+
+/* Return a table of garbage collector statistics.  The per-epoch
+   figures are those of the last completed epoch, and the types entry
+   is a table of the number of bytes currently allocated to objects of
+   each type, whether they are live or not yet swept. */
+value arc_gc_stats(arc *c)
+{
+  unsigned long long bytes[T_MAX+1];
+  struct gc_epoch_stats es = MMVAR(c, lastepoch);
+  value stats, types;
+  int i;
+
+  type_census(c, bytes);
+  stats = arc_mkhash(c, 5);
+  gcstat(c, stats, "epochs", __arc_ull2val(c, MMVAR(c, gcepochs)));
+  gcstat(c, stats, "passes", __arc_ull2val(c, MMVAR(c, gcpasses)));
+  gcstat(c, stats, "minors", __arc_ull2val(c, MMVAR(c, minors)));
+  gcstat(c, stats, "quantum", INT2FIX(MMVAR(c, gcquantum)));
+  gcstat(c, stats, "memory", __arc_ull2val(c, USEDMEM(c)));
+  gcstat(c, stats, "gc-usec", __arc_ull2val(c, GCUS(c)));
+  gcstat(c, stats, "gc-thread-usec", __arc_ull2val(c, MMVAR(c, gcthread_us)));
+  gcstat(c, stats, "swept", __arc_ull2val(c, es.swept));
+  gcstat(c, stats, "freed", __arc_ull2val(c, es.freed));
+  gcstat(c, stats, "pages-released", __arc_ull2val(c, es.pages));
+  gcstat(c, stats, "mark-usec", __arc_ull2val(c, es.mark_usec));
+  gcstat(c, stats, "sweep-usec", __arc_ull2val(c, es.sweep_usec));
+  gcstat(c, stats, "epoch-minors", __arc_ull2val(c, es.minors));
+  gcstat(c, stats, "minor-swept", __arc_ull2val(c, es.minor_swept));
+  gcstat(c, stats, "minor-freed", __arc_ull2val(c, es.minor_freed));
+  gcstat(c, stats, "promoted", __arc_ull2val(c, es.promoted));
+  gcstat(c, stats, "minor-usec", __arc_ull2val(c, es.minor_usec));
+  types = arc_mkhash(c, 5);
+  for (i=0; i<=T_MAX; i++) {
+    if (bytes[i] != 0ULL)
+      gcstat(c, types, TYPENAME(i), __arc_ull2val(c, bytes[i]));
+  }
+  gcstat(c, stats, "types", types);
+  return(stats);
+}
+
+/* Start writing GC events to the named file, as JSON objects one per
+   line, or stop writing them if filename is nil. */
+value arc_gc_log(arc *c, value filename)
+{
+  char *cfn;
+  FILE *fp;
+  int len;
+
+  if (NIL_P(filename)) {
+    if (GCLOG(c) != NULL)
+      fclose(GCLOG(c));
+    GCLOG(c) = NULL;
+    return(CNIL);
+  }
+  TYPECHECK(filename, T_STRING);
+  len = FIX2INT(arc_strutflen(c, filename));
+  cfn = alloca(sizeof(char)*(len+2));
+  arc_str2cstr(c, filename, cfn);
+  fp = fopen(cfn, "a");
+  if (fp == NULL) {
+    int en = errno;
+    arc_err_cstrfmt(c, "error opening GC log %s (%s; errno=%d)",
+		    cfn, strerror(en), en);
+    return(CNIL);
+  }
+  if (GCLOG(c) != NULL)
+    fclose(GCLOG(c));
+  GCLOG(c) = fp;
+  return(CTRUE);
+}
+
 void arc_init_memmgr(arc *c)
 {
+  char *logname;
   int i;
 
   c->mem_alloc = sysalloc;
@@ -452,10 +1448,30 @@ void arc_init_memmgr(arc *c)
   for (i=0; i<=MAX_BIBOP; i++) {
     BIBOPFL(c)[i] = NULL;
     BIBOPPG(c)[i] = NULL;
+    BIBOPPGSIZE(c)[i] = BIBOP_INIT_PAGE;
+    MMVAR(c, bibop_newpages)[i] = MMVAR(c, bibop_freedpages)[i] = 0;
   }
-  ALLOCHEAD(c) = NULL;
-  GCMS(c) = 0ULL;
+  LARGEHEAD(c) = NULL;
+  YOUNG(c) = NULL;
+  NYOUNG(c) = 0;
+  MMVAR(c, youngsize) = 0;
+  YOUNGMEM(c) = 0ULL;
+  MMVAR(c, mstack) = NULL;
+  MMVAR(c, mstacksize) = 0;
+  MMVAR(c, msp) = 0;
+  MMVAR(c, minors) = 0ULL;
+  minor = 0;
+  GCUS(c) = 0ULL;
   USEDMEM(c) = 0ULL;
+  memset(&EPOCH(c), 0, sizeof(struct gc_epoch_stats));
+  memset(&MMVAR(c, lastepoch), 0, sizeof(struct gc_epoch_stats));
+  GCLOG(c) = NULL;
+  logname = getenv("ARCUEID_GC_LOG");
+  if (logname != NULL && *logname != '\0') {
+    GCLOG(c) = fopen(logname, "a");
+    if (GCLOG(c) == NULL)
+      fprintf(stderr, "WARNING: failed to open GC log %s\n", logname);
+  }
 
   nprop = 0;
   MMVAR(c, gcepochs) = 0;
@@ -463,9 +1479,20 @@ void arc_init_memmgr(arc *c)
   MMVAR(c, gcquantum) = GCQUANTA;	/* default GC quantum */
   MMVAR(c, gce) = 0;
   MMVAR(c, gct) = 1;
+  MMVAR(c, gcsize) = -1;
+  MMVAR(c, gcpasses) = 0ULL;
+  MMVAR(c, gcstack) = NULL;
+  MMVAR(c, gcsp) = 0;
+  MMVAR(c, gcstacksize) = 0;
+  MMVAR(c, gclimit) = GCLIMIT_SLACK;
+  MMVAR(c, gcthread_us) = 0ULL;
   GCPTR(c) = NULL;
   mutator = 0;
   marker = 1;
   sweeper = 2;
   __arc_handle = c;
+#ifdef HAVE_GC_THREAD
+  if (start_collector(c) != 0)
+    fprintf(stderr, "WARNING: failed to start collector thread\n");
+#endif
 }
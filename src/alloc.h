@@ -25,79 +25,198 @@
 #define GCQUANTA 64
 #define GCMAXQUANTA GCQUANTA*64
 
-/* Memory block header */
+/* Object header.  Every object is immediately preceded by a single
+   word, which holds the number of the slot it occupies in its BiBOP
+   page and the size of the object.  The GC state of BiBOP objects is
+   kept in the side bitmaps of the page (see struct bibop_page below),
+   so objects in a BiBOP page need no other header.  Objects too large
+   for BiBOP allocation are allocated individually and carry an extra
+   link word and their size (see Lhdr), and keep their GC state in
+   the header word. */
 typedef struct Bhdr_t {
-  unsigned long _size;		/* low bit of _size is alloc/free flag */
-  struct Bhdr_t *_next;
+  unsigned long _size;
   char _data[1];
 } Bhdr;
 
-/* Actual size of a block header */
-#define BHDRSIZE ((long)(((Bhdr *)0)->_data))
-
 /* alignment */
 #define ALIGN_BITS 4
 #define ALIGN (1 << ALIGN_BITS)
 #define ALIGN_SIZE(size) ((size + ALIGN - 1) & ~(ALIGN - 1))
-#define BHDR_ALIGN_SIZE (ALIGN_SIZE(BHDRSIZE))
-#define BIBOP_ALIGN_SIZE (ALIGN_SIZE(BIBOPPSIZE))
 #define ALIGN_PTR(ptr) ((void *)(((value)ptr + ALIGN - 1) & ~(ALIGN - 1)))
 
-/* Block header padding.  If ALIGN_SIZE is not the same as BHDRSIZE, actual
-   data should begin at _data[BPAD] so that the data is properly
-   aligned.  Generally true on 32-bit architectures, but not on 64-bit
-   architectures. */
-#define BPAD (BHDR_ALIGN_SIZE - BHDRSIZE)
-
-#define B2D(bp) ((void *)((bp)->_data + BPAD))
-#define D2B(b, dp) (b) = (Bhdr *)(((char *)(dp)) - (char *)(((Bhdr *)0)->_data + BPAD))
-#define B2NB(b) ((Bhdr *)(b)->_next)
+/* Header of a large object.  The padding keeps the object aligned
+   as long as mem_alloc returns aligned memory. */
+#define LHDRWORDS (sizeof(void *) + sizeof(size_t) + sizeof(unsigned long))
+typedef struct Lhdr_t {
+  struct Lhdr_t *_next;
+  size_t _lsize;		/* size of the object */
+  char _pad[(ALIGN - LHDRWORDS % ALIGN) % ALIGN];
+  Bhdr _hdr;
+} Lhdr;
 
-/* The size of a block includes not just the size but the following
-   information in the low-order bits
-
-   0 - Allocated or not flag (used only for BiBOP objects)
-   1-2 - The object's GC colour.  A colour of 3 is the propagator.
-   3+ - The object's actual size
+/* Actual size of a block header */
+#define BHDRSIZE ((long)(((Bhdr *)0)->_data))
+/* Actual size of a large object header */
+#define LHDRSIZE ((long)(((Lhdr *)0)->_hdr._data))
+
+#define B2D(bp) ((void *)((bp)->_data))
+#define D2B(b, dp) (b) = (Bhdr *)(((char *)(dp)) - BHDRSIZE)
+#define L2B(lp) (&(lp)->_hdr)
+#define B2L(bp) ((Lhdr *)(((char *)(bp)) - (LHDRSIZE - BHDRSIZE)))
+#define L2NL(lp) ((lp)->_next)
+
+/* The header word contains the following:
+
+   0-15 - The slot number of the object in its BiBOP page, or BLARGE
+          for a large object.
+   16-17 - The object's GC colour (large objects only).  A colour of 3
+           is the propagator.
+   18 - Young flag (large objects only).  Set while the object is
+        still in the nursery.
+   19 - Remembered flag (large objects only).  Set by the write
+        barrier when a young object is stored into another object.
+   20+ - The object's actual size (BiBOP objects only)
+
+   The size of a BiBOP object is at most MAX_BIBOP, so it fits in the
+   12 bits left where long is 32 bits wide.  The size of a large
+   object is kept in _lsize of its Lhdr instead.
  */
-#define BSSIZE(bp, size) (bp)->_size = ((((bp)->_size) & 0x03) | ((size) << 3))
-#define BSIZE(bp) ((bp)->_size >> 3)
-
-/* Allocated flag */
-#define BALLOC(bp) ((bp)->_size |= (0x1))
-#define BFREE(bp) ((bp)->_size &= ~(0x1))
-#define BALLOCP(bp) ((bp->_size & 0x1) == 0x1)
-
-/* Colour */
-#define BSCOLOUR(bp, colour) (bp)->_size = ((((bp)->_size) & ~0x06) | ((colour) << 1))
-#define BCOLOUR(bp) ((((bp)->_size) >> 1) & 0x03)
+#define BLARGE 0xffff
+#define BSETHDR(bp, size, slot) (bp)->_size = ((((unsigned long)(size)) << 20) | (slot))
+#define BSLOT(bp) ((int)((bp)->_size & 0xffff))
+#define BLARGEP(bp) (BSLOT(bp) == BLARGE)
+#define BSIZE(bp) (BLARGEP(bp) ? B2L(bp)->_lsize : ((bp)->_size >> 20))
+
+/* Colour and generation of large objects */
+#define LSCOLOUR(bp, colour) (bp)->_size = ((((bp)->_size) & ~0x30000UL) | (((unsigned long)(colour)) << 16))
+#define LCOLOUR(bp) ((((bp)->_size) >> 16) & 0x03)
+#define LSYOUNG(bp) ((bp)->_size |= 0x40000UL)
+#define LCYOUNG(bp) ((bp)->_size &= ~0xc0000UL)
+#define LYOUNGP(bp) (((bp)->_size & 0x40000UL) != 0)
+#define LREMEMBERED 0x80000UL
+#define LREMEMBER(bp) ((bp)->_size |= LREMEMBERED)
+#define LREMEMBEREDP(bp) (((bp)->_size & LREMEMBERED) != 0)
 
 /* Maximum size of objects subject to BiBOP allocation */
 #define MAX_BIBOP 512
 
-/* Number of objects in each BiBOP page */
-#define BIBOP_PAGE_SIZE 64
+/* Limits on the size in bytes of a BiBOP page.  Each size starts out
+   with pages of BIBOP_INIT_PAGE bytes, and the page size is adjusted
+   at the end of every epoch according to how quickly objects of that
+   size are being allocated. */
+#define BIBOP_MIN_PAGE 4096
+#define BIBOP_INIT_PAGE 16384
+#define BIBOP_MAX_PAGE 262144
+
+/* Side bitmaps for a group of BIBOP_BITS slots in a BiBOP page.  Bit
+   n of each word describes slot n of the group.  The colour of a slot
+   is given by the corresponding bits of colour[0] (low bit) and
+   colour[1] (high bit). */
+#define BIBOP_BITS (8*sizeof(unsigned long))
+
+struct bibop_bits {
+  unsigned long alloc;		/* slot is allocated */
+  unsigned long colour[2];	/* GC colour */
+  unsigned long young;		/* object is in the nursery */
+  unsigned long rem;		/* object has been remembered */
+};
+
+/* A BiBOP page.  The slots follow the page header directly, and the
+   bitmaps follow the slots.  Each slot is a header word followed by
+   the object, padded so that every object is aligned. */
+struct bibop_page {
+  struct bibop_page *next;	/* next page of the same size */
+  struct bibop_page *nextfree;	/* next page with free slots */
+  struct bibop_bits *bits;	/* side bitmaps */
+  int stride;			/* distance between slots */
+  int nobj;			/* number of slots */
+  int nfree;			/* number of free slots */
+  int fword;			/* first bitmap word with free slots */
+  int onfree;			/* on the free page list? */
+  size_t pgsize;		/* actual size of the page */
+};
+
+#define BIBOP_STRIDE(size) (ALIGN_SIZE((size) + BHDRSIZE))
+/* Offset of the first slot in a page, chosen so that the object in
+   each slot is aligned. */
+#define BIBOP_PAGE_HDR (ALIGN_SIZE(sizeof(struct bibop_page)) + ALIGN - BHDRSIZE)
+#define BIBOP_SLOT(pg, i) ((Bhdr *)(((char *)(pg)) + BIBOP_PAGE_HDR + (i)*(pg)->stride))
+#define B2PG(bp) ((struct bibop_page *)(((char *)(bp)) - BSLOT(bp)*BIBOP_STRIDE(BSIZE(bp)) - BIBOP_PAGE_HDR))
+
+/* Number of bytes which may be allocated in the nursery before a
+   minor collection is forced at the next safepoint */
+#define NURSERY_SIZE (1 << 20)
+
+/* When the collector thread is in use, the mutator only does VCGC work
+   itself once the heap has grown to twice its size at the end of the
+   last epoch plus this many bytes. */
+#define GCLIMIT_SLACK (4*NURSERY_SIZE)
+
+/* gc() calls which take at least this many microseconds are written
+   to the GC event log as pauses */
+#define GCLOG_PAUSE_USEC 1000
+
+/* Statistics kept for each GC epoch */
+struct gc_epoch_stats {
+  unsigned long long swept;	/* objects swept by VCGC */
+  unsigned long long freed;	/* bytes freed by VCGC */
+  unsigned long long minors;	/* number of minor collections */
+  unsigned long long minor_swept; /* objects freed by minor collections */
+  unsigned long long minor_freed; /* bytes freed by minor collections */
+  unsigned long long promoted;	/* objects promoted out of the nursery */
+  unsigned long long pages;	/* BiBOP pages released */
+  unsigned long long mark_usec;	/* time spent marking */
+  unsigned long long sweep_usec; /* time spent visiting and sweeping */
+  unsigned long long minor_usec; /* time spent in minor collections */
+};
 
 struct mm_ctx {
-  /* The BiBOP free lists */
-  Bhdr *bibop_fl[MAX_BIBOP+1];
+  /* BiBOP pages with free slots */
+  struct bibop_page *bibop_fl[MAX_BIBOP+1];
   /* The actual BiBOP pages */
-  Bhdr *bibop_pages[MAX_BIBOP+1];
-
-  /* The allocated list */
-  Bhdr *alloc_head;
+  struct bibop_page *bibop_pages[MAX_BIBOP+1];
+  /* Size of new BiBOP pages */
+  int bibop_pgsize[MAX_BIBOP+1];
+  /* BiBOP pages created and released during the current epoch */
+  int bibop_newpages[MAX_BIBOP+1];
+  int bibop_freedpages[MAX_BIBOP+1];
+
+  /* Large objects that have left the nursery */
+  Lhdr *large_head;
+
+  /* The nursery: objects allocated since the last minor collection */
+  value *young;
+  int nyoung;
+  int youngsize;
+  unsigned long long youngmem;	/* bytes allocated in the nursery */
+  value *mstack;		/* minor collection mark stack */
+  int mstacksize;
+  int msp;
+  unsigned long long minors;	/* number of minor collections */
 
   /* GC statistics */
-  unsigned long long gc_milliseconds;
+  unsigned long long gc_microseconds;
   unsigned long long usedmem;
+  struct gc_epoch_stats epoch;	/* the epoch in progress */
+  struct gc_epoch_stats lastepoch; /* the last completed epoch */
+  FILE *gclog;			/* GC event log, or NULL */
 
   /* variables used by VCGC */
   int gcquantum;		/* garbage collector visit max */
   unsigned long long gcepochs;	/* number of GC epochs */
   unsigned long long gccolour;	/* current GC colour */
   unsigned long long gcnruns;	/* number of GC runs */
-  Bhdr *gcptr;			/* running pointer used by collector */
-  void *gcpptr;			/* previous pointer */
+  unsigned long long gcpasses;	/* number of completed passes */
+  value *gcstack;		/* VCGC mark stack */
+  int gcsp;
+  int gcstacksize;
+  int gcsize;			/* BiBOP size being visited, -1 if idle */
+  struct bibop_page *gcpage;	/* BiBOP page being visited */
+  int gcword;			/* next bitmap word to visit */
+  Lhdr *gcptr;			/* running pointer used by collector */
+  Lhdr *gcpptr;			/* previous pointer */
+  unsigned long long gclimit;	/* heap size the collector thread must beat */
+  unsigned long long gcthread_us; /* time spent in the collector thread */
   int visit;			/* visited node count for gc */
   int gce;
   int gct;
@@ -106,16 +225,30 @@ struct mm_ctx {
 #define MMVAR(c, var) (((struct mm_ctx *)c->alloc_ctx)->var)
 #define BIBOPFL(c) (MMVAR(c, bibop_fl))
 #define BIBOPPG(c) (MMVAR(c, bibop_pages))
-#define ALLOCHEAD(c) (MMVAR(c, alloc_head))
-#define GCMS(c) (MMVAR(c, gc_milliseconds))
+#define BIBOPPGSIZE(c) (MMVAR(c, bibop_pgsize))
+#define LARGEHEAD(c) (MMVAR(c, large_head))
+#define YOUNG(c) (MMVAR(c, young))
+#define NYOUNG(c) (MMVAR(c, nyoung))
+#define YOUNGMEM(c) (MMVAR(c, youngmem))
+#define GCUS(c) (MMVAR(c, gc_microseconds))
 #define USEDMEM(c) (MMVAR(c, usedmem))
 #define VISIT(c) (MMVAR(c, visit))
 #define GCPTR(c) (MMVAR(c, gcptr))
 #define GCPPTR(c) (MMVAR(c, gcpptr))
+#define EPOCH(c) (MMVAR(c, epoch))
+#define GCLOG(c) (MMVAR(c, gclog))
 
 extern void __arc_markprop(arc *c, value p);
 extern value arc_current_gc_milliseconds(arc *c);
 extern value arc_memory(arc *c);
+extern value arc_bibop_stats(arc *c);
+extern value arc_gc_stats(arc *c);
+extern value arc_gc_log(arc *c, value filename);
+extern value arc_gc_thread(arc *c, value enable);
 extern void arc_init_memmgr(arc *c);
+extern void __arc_defer_free(arc *c, void *ptr);
+extern void __arc_mm_attach(arc *c);
+extern void __arc_mm_detach(arc *c);
+extern unsigned long long __arc_mm_buffered(arc *c);
 
 #endif
@@ -53,6 +53,15 @@
 void *alloca (size_t);
 #endif
 
+/* Names of the types, indexed by type number */
+const char *__arc_typenames[T_MAX+1] = {
+  "nil", "t", "fixnum", "bignum", "flonum", "rational", "complex",
+  "char", "string", "symbol", "cons", "table", "tablevec", "tbucket",
+  "tagged", "exception", "input", "output", "thread", "vector",
+  "continuation", "closure", "code", "environment", "ccode", "custom",
+  "channel", "typedesc", "wtable", "num", "int", "regexp"
+};
+
 void __arc_null_marker(arc *c, value v, int depth,
 			void (*markfn)(arc *, value, int))
 {
@@ -133,8 +142,8 @@ AFFDEF(arc_is)
   ARARG(list);
   AFBEGIN;
   /* Tail call */
-  AFTCALL(arc_mkaff(c, pairwise, CNIL), arc_mkaff(c, is2, CNIL),
-	  AV(list), CNIL, CNIL);
+  AFTCALLF(pairwise, arc_aff(c, is2),
+	   AV(list), CNIL, CNIL);
   AFEND;
 }
 AFFEND
@@ -166,7 +175,7 @@ AFFDEF(arc_iso2)
      iscmp if available.  If neither is available, then they cannot
      be compared.  */
   if (tfn->isocmp != NULL) {
-    AFTCALL(arc_mkaff(c, tfn->isocmp, CNIL), AV(a), AV(b), AV(vh1), AV(vh2));
+    AFTCALLF(tfn->isocmp, AV(a), AV(b), AV(vh1), AV(vh2));
   } else if (tfn->iscmp != NULL) {
     ARETURN(tfn->iscmp(c, AV(a), AV(b)));
   }
@@ -180,11 +189,11 @@ AFFDEF(arc_iso)
   ARARG(list);
   AFBEGIN;
   /* Call pairwise with new visithashes */
-  AFTCALL(arc_mkaff(c, pairwise, CNIL),
-	  arc_mkaff(c, arc_iso2, CNIL),
-	  AV(list),
-	  arc_mkhash(c, ARC_HASHBITS),
-	  arc_mkhash(c, ARC_HASHBITS));
+  AFTCALLF(pairwise,
+	   arc_aff(c, arc_iso2),
+	   AV(list),
+	   arc_mkhash(c, ARC_HASHBITS),
+	   arc_mkhash(c, ARC_HASHBITS));
   AFEND;
 }
 AFFEND
@@ -393,12 +402,12 @@ static AFFDEF(tagged_pprint)
   if (!BOUND_P(AV(visithash)))
     WV(visithash, arc_mkhash(c, ARC_HASHBITS));
 
-  WV(dw, arc_mkaff(c, __arc_disp_write, CNIL));
+  WV(dw, arc_aff(c, __arc_disp_write));
   if (!NIL_P(__arc_visit(c, AV(sexpr), AV(visithash)))) {
     /* already visited at some point. Do not recurse further */
     AFTCALL(AV(dw), arc_mkstringc(c, "(...)"), CTRUE, AV(fp), AV(visithash));
   }
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
+  WV(wc, arc_aff(c, arc_writec));
 
   AFCALL(AV(dw), arc_mkstringc(c, "#(tagged "), CTRUE, AV(fp), AV(visithash));
   AFCALL(AV(dw), car(AV(sexpr)), AV(disp), AV(fp), AV(visithash));
@@ -503,8 +512,8 @@ AFFDEF(arc_coerce)
     arc_err_cstrfmt(c, "cannot coerce");
     ARETURN(AV(obj));
   }
-  AFTCALL(arc_mkaff(c, tfn->xcoerce, CNIL), AV(obj),
-	  INT2FIX(typesym2type(c, AV(typesym))), AV(args));
+  AFTCALLF(tfn->xcoerce, AV(obj),
+	   INT2FIX(typesym2type(c, AV(typesym))), AV(args));
   AFEND;
 }
 AFFEND
@@ -576,9 +585,9 @@ AFFDEF(arc_gt)
   ARARG(list);
   AFBEGIN;
   /* tail call */
-  AFTCALL(arc_mkaff(c, pairwise2, CNIL),
-	  arc_mkccode(c, 2, gt2, CNIL),
-	  AV(list));
+  AFTCALLF(pairwise2,
+	   arc_mkccode(c, 2, gt2, CNIL),
+	   AV(list));
   AFEND;
 }
 AFFEND
@@ -588,9 +597,9 @@ AFFDEF(arc_lt)
   ARARG(list);
   AFBEGIN;
   /* tail call */
-  AFTCALL(arc_mkaff(c, pairwise2, CNIL),
-	  arc_mkccode(c, 2, lt2, CNIL),
-	  AV(list));
+  AFTCALLF(pairwise2,
+	   arc_mkccode(c, 2, lt2, CNIL),
+	   AV(list));
   AFEND;
 }
 AFFEND
@@ -602,9 +611,9 @@ AFFDEF(arc_sref)
 
   if (TYPE(AV(com)) == T_TABLE) {
     if (NIL_P(AV(val))) {
-      AFCALL(arc_mkaff(c, arc_xhash_delete, CNIL), AV(com), AV(ind));
+      AFCALLF(arc_xhash_delete, AV(com), AV(ind));
     } else {
-      AFCALL(arc_mkaff(c, arc_xhash_insert, CNIL), AV(com), AV(ind), AV(val));
+      AFCALLF(arc_xhash_insert, AV(com), AV(ind), AV(val));
     }
   } else if (TYPE(AV(com)) == T_STRING) {
     if (TYPE(AV(val)) != T_CHAR) {
@@ -823,6 +832,7 @@ static struct {
 
   /* Table Operations */
   { "table", -2, arc_newtable },
+  { "swisstable", -2, arc_newstable },
   { "maptable", -2, arc_xhash_map },
 
   /* Evaluation */
@@ -839,11 +849,16 @@ static struct {
   /* Basic I/O primitives */
   { "readb", -2, arc_readb },
   { "readc", -2, arc_readc },
+  { "readline", -2, arc_readline },
+  { "readbytes", -2, arc_readbytes },
+  { "readstring", -2, arc_readstring },
   { "peekc", -2, arc_peekc },
   { "ungetc", -2, arc_ungetc },
   { "sread", -2, arc_sread },
   { "writeb", -2, arc_writeb },
   { "writec", -2, arc_writec },
+  { "writebytes", -2, arc_writebytes },
+  { "copy-port", -2, arc_copy_port },
   { "infile", -2, arc_infile },
   { "outfile", -2, arc_outfile },
   { "instring", -2, arc_instring2 },
@@ -922,6 +937,12 @@ static struct {
   { "quit", -2, arc_quit },
   { "setuid", 1, arc_setuid },
   { "memory", 0, arc_memory },
+  { "bibop-stats", 0, arc_bibop_stats },
+  { "gc-stats", 0, arc_gc_stats },
+  { "gc-log", 1, arc_gc_log },
+#ifdef HAVE_GC_THREAD
+  { "gc-thread", 1, arc_gc_thread },
+#endif
   /* miscellaneous */
   { "sref", -2, arc_sref },
   { "len", 1, arc_len },
@@ -929,18 +950,40 @@ static struct {
   { "declare", 2, arc_declare },
 #ifdef HAVE_TRACING
   { "trace", 1, arc_trace },
+#endif
+#ifdef HAVE_VMPROFILE
+  { "vm-profile", 0, arc_vm_profile },
+  { "vm-profile-reset", 0, arc_vm_profile_reset },
 #endif
   {NULL, 0, NULL }
 };
 
+/* The global environment maps each symbol to a binding cell, a cons
+   whose car is the value of the symbol (CUNBOUND if it has none) and
+   whose cdr is the symbol itself.  Compiled code refers to the cells
+   of the globals it uses directly, so a cell stays in the global
+   environment once it is created, and binding or unbinding a symbol
+   only changes the contents of its cell. */
+value arc_gcell(arc *c, value sym)
+{
+  value cell;
+
+  cell = arc_hash_lookup(c, c->genv, sym);
+  if (cell == CUNBOUND) {
+    cell = cons(c, CUNBOUND, sym);
+    arc_hash_insert(c, c->genv, sym, cell);
+  }
+  return(cell);
+}
+
 value arc_bound(arc *c, value sym)
 {
-  return((arc_hash_lookup(c, c->genv, sym) == CUNBOUND) ? CNIL: CTRUE);
+  return((arc_gbind(c, sym) == CUNBOUND) ? CNIL: CTRUE);
 }
 
 value arc_bindsym(arc *c, value sym, value binding)
 {
-  return(arc_hash_insert(c, c->genv, sym, binding));
+  return(scar(arc_gcell(c, sym), binding));
 }
 
 value arc_bindcstr(arc *c, const char *csym, value binding)
@@ -951,17 +994,21 @@ value arc_bindcstr(arc *c, const char *csym, value binding)
 
 value arc_gbind_cstr(arc *c, const char *csym)
 {
-  return(arc_hash_lookup(c, c->genv, arc_intern_cstr(c, csym)));
+  return(arc_gbind(c, arc_intern_cstr(c, csym)));
 }
 
 value arc_gbind(arc *c, value sym)
 {
-  return(arc_hash_lookup(c, c->genv, sym));
+  value cell;
+
+  cell = arc_hash_lookup(c, c->genv, sym);
+  return((cell == CUNBOUND) ? CUNBOUND : car(cell));
 }
 
 value arc_declare(arc *c, value decl, value val)
 {
-  if (decl != ARC_BUILTIN(c, S_ATSTRINGS)) {
+  if (decl != ARC_BUILTIN(c, S_ATSTRINGS)
+      && decl != ARC_BUILTIN(c, S_SWISSTABLES)) {
     arc_err_cstrfmt(c, "unknown declaration");
     return(CNIL);
   }
@@ -1011,6 +1058,7 @@ void arc_init_builtins(arc *c)
 void arc_init(arc *c)
 {
   c->ctrue = (value)2; /* stand-in for CTRUE until properly defined */
+  c->symbols = NULL;
   /* Initialise memory manager first */
   arc_init_memmgr(c);
   /* Initialise built-in data type definitions */
@@ -1022,6 +1070,7 @@ void arc_init(arc *c)
 
   /* Create builtins table */
   c->builtins = arc_mkvector(c, BI_last+1);
+  SVINDEX(c->builtins, BI_affs, arc_mkhash(c, ARC_HASHBITS));
 
   /* Create declarations table */
   c->declarations = arc_mkhash(c, ARC_HASHBITS);
@@ -1044,6 +1093,9 @@ void arc_deinit(arc *c)
 {
   if (c->alloc_ctx == NULL)
     return;
+  free(c->symbols);
+  c->symbols = NULL;
+  c->symsize = 0;
   c->symtable = CNIL;
   c->rsymtable = CNIL;
   c->genv = CNIL;
@@ -1052,8 +1104,12 @@ void arc_deinit(arc *c)
   c->curthread = CNIL;
   c->vmthreads = CNIL;
   c->declarations = CNIL;
+  arc_deinit_threads(c);
 #ifdef HAVE_TRACING
   c->tracethread = CNIL;
+#endif
+#ifdef HAVE_GC_THREAD
+  arc_gc_thread(c, CNIL);
 #endif
   /* perform three iterations to clear */
   while (c->gc(c) == 0)
@@ -1062,6 +1118,7 @@ void arc_deinit(arc *c)
     ;
   while (c->gc(c) == 0)
     ;
+  arc_gc_log(c, CNIL);
   free(c->alloc_ctx);
   c->alloc_ctx = NULL;
 }
@@ -88,6 +88,17 @@ enum tr_states_t {
   TR_RC
 };
 
+/* An entry in the symbol array.  The forward and reverse symbol
+   tables are weak, and a symbol stays alive only as long as its
+   buckets in both tables do, so marking a symbol means marking the
+   buckets recorded here.  A bucket is reset to nil when it is swept. */
+struct arc_symbol {
+  value name;			/* name of the symbol */
+  value fwd;			/* bucket in the forward symbol table */
+  value rev;			/* bucket in the reverse symbol table */
+  unsigned long long marked;	/* GC colour count when last marked */
+};
+
 /* Type functions */
 struct typefn_t {
   /* Marker */
@@ -145,6 +156,8 @@ struct arc {
   value symtable;		/* global symbol table */
   value rsymtable;		/* reverse global symbol table */
   int lastsym;			/* last symbol index created */
+  struct arc_symbol *symbols;	/* symbols indexed by ID */
+  int symsize;			/* allocated size of symbols */
   value genv;			/* global environment */
   value builtins;		/* built-in data */
   value ctrue;			/* true */
@@ -157,6 +170,19 @@ struct arc {
   int stksize;			/* default stack size for threads */
   value tracethread;		/* tracing thread */
   unsigned long quantum;	/* default quantum */
+  int nworkers;			/* worker threads used by the dispatcher */
+  value runqhead;		/* ready queue (head), linked through threads */
+  value runqtail;		/* ready queue (tail) */
+  int nrunq;			/* number of threads in the ready queue */
+  int nthreads;			/* number of live threads */
+  int ndead;			/* dead threads not yet off vmthreads */
+  value *timers;		/* sleeping threads, heap on wakeup time */
+  int ntimers;			/* number of sleeping threads */
+  int timersize;		/* allocated size of timers */
+  int epollfd;			/* epoll instance for Tiowait threads */
+  value *iowaiters;		/* threads waiting on each fd, by fd */
+  int niowaiters;		/* allocated size of iowaiters */
+  int niowait;			/* number of threads waiting for I/O */
   void (*errhandler)(struct arc *, value, value); /* catch-all error handler */
 
   /* declarations */
@@ -188,6 +214,12 @@ extern void __arc_null_sweeper(arc *c, value v);
 #define ENV_FLAG 0x0c
 #define ENV_P(x) (((value)(x)&0xf)==ENV_FLAG)
 
+/* Characters */
+#define CHAR_FLAG 0x0a
+#define RUNE2CHAR(r) ((value)(((unsigned long)(r))<<8|CHAR_FLAG))
+#define CHAR2RUNE(x) ((Rune)(((unsigned long)(x))>>8))
+#define CHAR_P(x) (((value)(x)&0xff)==CHAR_FLAG)
+
 /* Special constants -- non-zero and non-fixnum constants */
 #define CNIL ((value)0)
 /* #define CTRUE ((value)2) */
@@ -237,6 +269,8 @@ static inline enum arc_types TYPE(value v)
     return(T_SYMBOL);
   if (ENV_P(v))
     return(T_ENV);
+  if (CHAR_P(v))
+    return(T_CHAR);
   if (v == CNIL)
     return(T_NIL);
   if (v == CUNDEF || v == CUNBOUND)
@@ -249,6 +283,10 @@ static inline enum arc_types TYPE(value v)
 }
 
 extern inline void __arc_wb(value x, value y);
+extern void __arc_rootwb(value x, value y);
+extern void __arc_unroot(arc *c, value v);
+extern void __arc_gc_release(arc *c);
+extern void __arc_gc_acquire(arc *c);
 
 #define TYPENAME(tnum) (((tnum) >= 0 && (tnum) <= T_MAX) ? (__arc_typenames[tnum]) : "unknown")
 
@@ -359,6 +397,7 @@ extern int arc_coerce(arc *c, value thr);
 extern value arc_mkccode(arc *c, int argc, value (*cfunc)(),
 			 value name);
 extern value arc_mkaff(arc *c, int (*aff)(arc *, value), value name);
+extern value arc_aff(arc *c, int (*aff)(arc *, value));
 extern value arc_mkaff2(arc *c, int (*aff)(arc *, value), value name,
 			value env);
 extern int __arc_affapply(arc *c, value thr, value ccont, value func, ...);
@@ -424,6 +463,7 @@ extern value arc_bindsym(arc *c, value sym, value binding);
 extern value arc_bindcstr(arc *c, const char *csym, value binding);
 extern value arc_gbind_cstr(arc *c, const char *csym);
 extern value arc_gbind(arc *c, value sym);
+extern value arc_gcell(arc *c, value sym);
 
 /* Environments */
 extern void __arc_mkenv(arc *c, value thr, int prevsize, int extrasize);
@@ -437,6 +477,7 @@ extern void arc_init_memmgr(arc *c);
 extern void arc_init_datatypes(arc *c);
 extern void arc_init_symtable(arc *c);
 extern void arc_init_threads(arc *c);
+extern void arc_deinit_threads(arc *c);
 extern void arc_init(arc *c);
 extern void arc_deinit(arc *c);
 
@@ -525,6 +566,11 @@ extern value __arc_disasm_inst(arc *c, value *base, value *inst, int *instlen);
     return(__arc_affapply(c, thr, __arc_mkcont(c, thr, __LINE__), func, __VA_ARGS__, CLASTARG)); case __LINE__:; \
   } while (0)
 
+/* Call an AFF given its C function rather than an AFF object.  This
+   uses the shared AFF object for the function (see arc_aff), so no
+   object is created for the call. */
+#define AFCALLF(fn, ...) AFCALL(arc_aff(c, fn), __VA_ARGS__)
+
 /* call giving args as a list */
 #define AFCALL2(func, argv)						\
   do {									\
@@ -538,6 +584,9 @@ extern value __arc_disasm_inst(arc *c, value *base, value *inst, int *instlen);
     return(__arc_affapply(c, thr, CNIL, func, __VA_ARGS__, CLASTARG)); \
   } while (0)
 
+/* Tail call an AFF given its C function */
+#define AFTCALLF(fn, ...) AFTCALL(arc_aff(c, fn), __VA_ARGS__)
+
 /* tail call giving args as a list */
 #define AFTCALL2(func, argv)						\
   do {									\
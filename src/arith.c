@@ -135,7 +135,7 @@ static AFFDEF(fixnum_pprint)
   strrep = alloca(sizeof(char)*(len+1));
   snprintf(strrep, len+1, "%ld", FIX2INT(AV(sexpr)));
   vstr = arc_mkstringc(c, strrep);
-  AFTCALL(arc_mkaff(c, arc_disp, CNIL), vstr, AV(fp));
+  AFTCALLF(arc_disp, vstr, AV(fp));
   AFEND;
 }
 AFFEND
@@ -194,7 +194,7 @@ static AFFDEF(flonum_pprint)
   outstr = (char *)alloca(sizeof(char)*(len+2));
   snprintf(outstr, len+1, "%g", val);
   vstr = arc_mkstringc(c, outstr);
-  AFTCALL(arc_mkaff(c, arc_disp, CNIL), vstr, AV(fp));
+  AFTCALLF(arc_disp, vstr, AV(fp));
   AFEND;
 }
 AFFEND
@@ -382,7 +382,7 @@ static AFFDEF(complex_pprint)
   outstr = (char *)alloca(sizeof(char)*(len+2));
   snprintf(outstr, len+1, "%g%+gi", creal(val), cimag(val));
   vstr = arc_mkstringc(c, outstr);
-  AFTCALL(arc_mkaff(c, arc_disp, CNIL), vstr, AV(fp));
+  AFTCALLF(arc_disp, vstr, AV(fp));
   AFEND;
 }
 AFFEND
@@ -547,7 +547,7 @@ static AFFDEF(bignum_pprint)
   mpz_get_str(outstr, 10, REPBNUM(AV(n)));
   psv = arc_mkstringc(c, outstr);
   free(outstr);
-  AFTCALL(arc_mkaff(c, arc_disp, CNIL), psv, AV(fp));
+  AFTCALLF(arc_disp, psv, AV(fp));
   AFEND;
 }
 AFFEND
@@ -722,7 +722,7 @@ static AFFDEF(rational_pprint)
   mpq_get_str(outstr, 10, REPRAT(AV(q)));
   psv = arc_mkstringc(c, outstr);
   free(outstr);
-  AFTCALL(arc_mkaff(c, arc_disp, CNIL), psv, AV(fp));
+  AFTCALLF(arc_disp, psv, AV(fp));
   AFEND;
 }
 AFFEND
@@ -1009,39 +1009,27 @@ value arc_mkrationall(arc *c, long num, long den)
 
 #endif
 
-static int hibit(unsigned long n)
-{
-  int ret;
-
-  if (!n)
-    return(0);
-  ret = 1;
-  while (n >>= 1 && n)
-    ret++;
-  return(ret);
-}
-
 value __arc_mul2(arc *c, value arg1, value arg2)
 {
-  if (TYPE(arg1) == T_FIXNUM && TYPE(arg2) == T_FIXNUM) {
+  if (FIXNUM_P(arg1) && FIXNUM_P(arg2)) {
     long varg1, varg2;
+    value prod;
 
+    if (!__arc_fxmul(arg1, arg2, &prod))
+      return(prod);
+
+    /* The product does not fit in a fixnum.  Promote to bignum or
+       flonum as needed. */
     varg1 = FIX2INT(arg1);
     varg2 = FIX2INT(arg2);
-
-    /* Check to see if the size of the product will fit in a fixnum.
-       Promote to bignum or flonum as needed. */
-    if (hibit(ABS(varg1)) + hibit(ABS(varg2)) >= hibit(FIXNUM_MAX)) {
 #ifdef HAVE_GMP_H
-      return(mul_bignum(c, arc_mkbignuml(c, varg1),
-			arc_mkbignuml(c, varg2)));
+    return(mul_bignum(c, arc_mkbignuml(c, varg1),
+		      arc_mkbignuml(c, varg2)));
 #else
-      /* Multiply as flonums in this case */
-      return(mul_flonum(c, arc_mkflonum(c, (double)varg1),
-			arc_mkflonum(c, (double)varg2)));
+    /* Multiply as flonums in this case */
+    return(mul_flonum(c, arc_mkflonum(c, (double)varg1),
+		      arc_mkflonum(c, (double)varg2)));
 #endif
-    }
-    return(INT2FIX(varg1 * varg2));
   }
 
   TYPE_CASES(mul, arg1, arg2);
@@ -1179,7 +1167,7 @@ AFFDEF(__arc_add2_string)
 {
   AARG(arg1, arg2);
   AFBEGIN;
-  AFCALL(arc_mkaff(c, arc_coerce, CNIL), AV(arg2), ARC_BUILTIN(c, S_STRING));
+  AFCALLF(arc_coerce, AV(arg2), ARC_BUILTIN(c, S_STRING));
   WV(arg2, AFCRV);
   ARETURN(arc_strcat(c, AV(arg1), AV(arg2)));
   AFEND;
@@ -1189,18 +1177,18 @@ AFFEND
 value __arc_add2(arc *c, value arg1, value arg2)
 {
   long fixnum_sum;
+  value sum;
 
-  if (TYPE(arg1) == T_FIXNUM && TYPE(arg2) == T_FIXNUM) {
+  if (FIXNUM_P(arg1) && FIXNUM_P(arg2)) {
+    if (!__arc_fxadd(arg1, arg2, &sum))
+      return(sum);
     fixnum_sum = FIX2INT(arg1) + FIX2INT(arg2);
-    if (ABS(fixnum_sum) > FIXNUM_MAX) {
 #ifdef HAVE_GMP_H
-      return(arc_mkbignuml(c, fixnum_sum));
+    return(arc_mkbignuml(c, fixnum_sum));
 #else
 /* without bignum support, we extend to flonum */
-      return(arc_mkflonum(c, (double)fixnum_sum));
+    return(arc_mkflonum(c, (double)fixnum_sum));
 #endif
-    }
-    return(INT2FIX(fixnum_sum));
   } 
 
   /* Frankly, I think overloading + in this way is a mistake,
@@ -1226,34 +1214,34 @@ value __arc_add2(arc *c, value arg1, value arg2)
   if (NIL_P(arg1) && TYPE(arg2) == T_CHAR) {
     Rune data[1];
 
-    data[0] = *((Rune *)REP(arg2));
+    data[0] = arc_char2rune(c, arg2);
     return(arc_mkstring(c, data, 1));
   }
 
   if (NIL_P(arg2) && TYPE(arg1) == T_CHAR) {
     Rune data[1];
 
-    data[0] = *((Rune *)REP(arg1));
+    data[0] = arc_char2rune(c, arg1);
     return(arc_mkstring(c, data, 1));
   }
 
   if (TYPE(arg1) == T_CHAR && TYPE(arg2) == T_CHAR) {
     Rune data1, data2;
 
-    data1 = *((Rune *)REP(arg1));
-    data2 = *((Rune *)REP(arg2));
+    data1 = arc_char2rune(c, arg1);
+    data2 = arc_char2rune(c, arg2);
     return(arc_strcat(c, arc_mkstring(c, &data1, 1), 
 		      arc_mkstring(c, &data2, 1)));
   }
 
   if (TYPE(arg1) == T_STRING && TYPE(arg2) == T_CHAR) {
-    return(arc_strcatc(c, arg1, *((Rune *)REP(arg2))));
+    return(arc_strcatc(c, arg1, arc_char2rune(c, arg2)));
   }
 
   if (TYPE(arg1) == T_CHAR && TYPE(arg2) == T_STRING) {
     Rune data[1];
 
-    data[0] = *((Rune *)REP(arg1));
+    data[0] = arc_char2rune(c, arg1);
     return(arc_strcat(c, arc_mkstring(c, data, 1), arg2));
   }
 
@@ -1370,18 +1358,18 @@ AFFEND
 value __arc_sub2(arc *c, value arg1, value arg2)
 {
   long fixnum_diff;
+  value diff;
 
-  if (TYPE(arg1) == T_FIXNUM && TYPE(arg2) == T_FIXNUM) {
+  if (FIXNUM_P(arg1) && FIXNUM_P(arg2)) {
+    if (!__arc_fxsub(arg1, arg2, &diff))
+      return(diff);
     fixnum_diff = FIX2INT(arg1) - FIX2INT(arg2);
-    if (ABS(fixnum_diff) > FIXNUM_MAX) {
 #ifdef HAVE_GMP_H
-      return(arc_mkbignuml(c, fixnum_diff));
+    return(arc_mkbignuml(c, fixnum_diff));
 #else
-      /* promote to flonum */
-      return(arc_mkflonum(c, (double)fixnum_diff));
+    /* promote to flonum */
+    return(arc_mkflonum(c, (double)fixnum_diff));
 #endif
-    }
-    return(INT2FIX(fixnum_diff));
   } 
 
   TYPE_CASES(sub, arg1, arg2);
@@ -38,6 +38,85 @@
 #define REPFLO(f) *((double *)REP(f))
 #define REPCPX(z) *((double complex *)REP(z))
 
+/* Fixnum arithmetic.  Each of these returns zero and stores the result
+   in *r if the result of the operation on the two fixnums a and b is
+   itself a fixnum, and returns nonzero otherwise, in which case the
+   caller has to promote.  With the compiler's overflow builtins the
+   operation is done directly on the tagged values: (2x+1) + 2y is the
+   tag of x+y, and overflows exactly when x+y is out of range. */
+#ifdef HAVE_BUILTIN_OVERFLOW
+
+/* The one tagged value the builtins allow that is not a fixnum, as
+   FIXNUM_MIN is -FIXNUM_MAX. */
+#define FIXNUM_TAG_OUT ((long)(LONG_MIN | FIXNUM_FLAG))
+
+static inline int __arc_fxadd(value a, value b, value *r)
+{
+  long s;
+
+  if (__builtin_add_overflow((long)a, (long)b - FIXNUM_FLAG, &s)
+      || s == FIXNUM_TAG_OUT)
+    return(1);
+  *r = (value)s;
+  return(0);
+}
+
+static inline int __arc_fxsub(value a, value b, value *r)
+{
+  long s;
+
+  if (__builtin_sub_overflow((long)a, (long)b - FIXNUM_FLAG, &s)
+      || s == FIXNUM_TAG_OUT)
+    return(1);
+  *r = (value)s;
+  return(0);
+}
+
+static inline int __arc_fxmul(value a, value b, value *r)
+{
+  long s;
+
+  if (__builtin_mul_overflow(FIX2INT(a), (long)b - FIXNUM_FLAG, &s)
+      || (s | FIXNUM_FLAG) == FIXNUM_TAG_OUT)
+    return(1);
+  *r = (value)(s | FIXNUM_FLAG);
+  return(0);
+}
+
+#else
+
+static inline int __arc_fxadd(value a, value b, value *r)
+{
+  long s = FIX2INT(a) + FIX2INT(b);
+
+  if (ABS(s) > FIXNUM_MAX)
+    return(1);
+  *r = INT2FIX(s);
+  return(0);
+}
+
+static inline int __arc_fxsub(value a, value b, value *r)
+{
+  long s = FIX2INT(a) - FIX2INT(b);
+
+  if (ABS(s) > FIXNUM_MAX)
+    return(1);
+  *r = INT2FIX(s);
+  return(0);
+}
+
+static inline int __arc_fxmul(value a, value b, value *r)
+{
+  long x = FIX2INT(a), y = FIX2INT(b);
+
+  if (x != 0 && ABS(y) > FIXNUM_MAX / ABS(x))
+    return(1);
+  *r = INT2FIX(x*y);
+  return(0);
+}
+
+#endif
+
 extern value arc_mkflonum(arc *c, double val);
 extern value arc_mkcomplex(arc *c, double complex z);
 extern value arc_mkbignuml(arc *c, long val);
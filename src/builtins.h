@@ -25,7 +25,8 @@ enum {
   BI_io=0,			/* builtin I/O data */
   BI_syms=1,			/* builtin symbols */
   BI_charesc=2,			/* character escapes */
-  BI_last=2
+  BI_affs=3,			/* shared AFF objects (see arc_aff) */
+  BI_last=3
 };
 
 enum builtin_syms {
@@ -112,6 +113,7 @@ enum builtin_syms {
   S_SEEK_END,			/* SEEK_END */
   S_LOADPATH,			/* loadpath* */
   S_RXMATCH,			/* regex match */
+  S_SWISSTABLES,		/* swisstables */
 
   S_THE_END			/* end of the line */
 };
@@ -19,6 +19,8 @@
 #include <stdarg.h>
 #include "arcueid.h"
 #include "vmengine.h"
+#include "builtins.h"
+#include "hash.h"
 
 #ifdef HAVE_ALLOCA_H
 # include <alloca.h>
@@ -46,8 +48,33 @@ struct cfunc_t {
     } aff_t;
   } cfunc;
   int argc;
+  int unlocked;			/* may run without the runtime lock */
 };
 
+/* AFFs which only touch objects with locks of their own, and so may
+   be run by the SMP dispatcher without the runtime lock (see
+   __arc_thr_trampoline) */
+#define MAX_UNLOCKED 16
+static int (*unlocked_affs[MAX_UNLOCKED])(arc *, value);
+static int nunlocked;
+
+void __arc_aff_unlocked(int (*xaff)(arc *, value))
+{
+  int i;
+
+  for (i=0; i<nunlocked; i++) {
+    if (unlocked_affs[i] == xaff)
+      return;
+  }
+  if (nunlocked < MAX_UNLOCKED)
+    unlocked_affs[nunlocked++] = xaff;
+}
+
+int __arc_ccode_unlocked(arc *c, value cfn)
+{
+  return(((struct cfunc_t *)REP(cfn))->unlocked);
+}
+
 static AFFDEF(cfunc_pprint)
 {
   AARG(sexpr, disp, fp);
@@ -58,8 +85,8 @@ static AFFDEF(cfunc_pprint)
 
   (void)visithash;
   (void)disp;
-  WV(dw, arc_mkaff(c, __arc_disp_write, CNIL));
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
+  WV(dw, arc_aff(c, __arc_disp_write));
+  WV(wc, arc_aff(c, arc_writec));
   AFCALL(AV(dw), arc_mkstringc(c, "#<procedure"), CTRUE, AV(fp), AV(visithash));
   rep = (struct cfunc_t *)REP(AV(sexpr));
   if (!NIL_P(rep->name)) {
@@ -99,6 +126,7 @@ value arc_mkccode(arc *c, int argc, value (*cfunc)(), value name)
   rcfn->name = name;
   rcfn->cfunc.sff = cfunc;
   rcfn->argc = argc;
+  rcfn->unlocked = 0;
   return(cfn);
 }
 
@@ -106,10 +134,15 @@ value arc_mkaff2(arc *c, int (*xaff)(arc *, value), value name, value env)
 {
   value aff = arc_mkccode(c, -2, NULL, name);
   struct cfunc_t *rcfn;
+  int i;
 
   rcfn = (struct cfunc_t *)REP(aff);
   rcfn->cfunc.aff_t.aff = xaff;
   rcfn->cfunc.aff_t.env = env;
+  for (i=0; i<nunlocked; i++) {
+    if (unlocked_affs[i] == xaff)
+      rcfn->unlocked = 1;
+  }
   return(aff);
 }
 
@@ -118,6 +151,30 @@ value arc_mkaff(arc *c, int (*xaff)(arc *, value), value name)
   return(arc_mkaff2(c, xaff, name, CNIL));
 }
 
+/* Get the shared, anonymous AFF object for xaff.  AFF objects without
+   an environment are never modified, so rather than making a new one
+   every time an AFF is called, one is made the first time and kept in
+   the BI_affs table of the builtins, keyed by the address of the C
+   function.  The table has a lock of its own, so this may also be
+   used by AFFs run without the runtime lock.  Two workers may both
+   make the object for the same function, in which case the one made
+   last is kept, which does no harm. */
+value arc_aff(arc *c, int (*xaff)(arc *, value))
+{
+  value tbl, key, aff;
+
+  /* before the builtins are set up, just make a fresh one */
+  if (NIL_P(c->builtins) || NIL_P(tbl = VINDEX(c->builtins, BI_affs)))
+    return(arc_mkaff(c, xaff, CNIL));
+  key = INT2FIX((long)xaff);
+  aff = arc_hash_lookup(c, tbl, key);
+  if (!BOUND_P(aff)) {
+    aff = arc_mkaff(c, xaff, CNIL);
+    arc_hash_insert(c, tbl, key, aff);
+  }
+  return(aff);
+}
+
 /* same as below, but with rest arguments */
 static void affenvr(arc *c, value thr, int minenv, int optenv, int dsenv)
 {
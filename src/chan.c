@@ -27,12 +27,18 @@
    4 - Head of list of threads waiting to send to the channel (cons)
        This is actually a list of thread-value pairs.
    5 - Tail of list of threads waiting to send to the channel
+   6 - Lock of the channel (see __arc_objlock)
+
+   Channel operations may be run by the SMP dispatcher without the
+   runtime lock, so everything they do to a channel is done while
+   holding its lock, which is let go before they yield.
  */
 
 #define XCHAN_RHEAD(chan) (REP((chan))[3])
 #define XCHAN_RTAIL(chan) (REP((chan))[4])
 #define XCHAN_SHEAD(chan) (REP((chan))[5])
 #define XCHAN_STAIL(chan) (REP((chan))[6])
+#define XCHAN_LOCK(chan) (REP((chan))[7])
 
 #define CHAN_HASDATA(chan) (VINDEX(chan, 0))
 #define CHAN_DATA(chan) (VINDEX(chan, 1))
@@ -47,7 +53,7 @@
 #define SCHAN_RTAIL(chan, val) (SVINDEX(chan, 3, val))
 #define SCHAN_SHEAD(chan, val) (SVINDEX(chan, 4, val))
 #define SCHAN_STAIL(chan, val) (SVINDEX(chan, 5, val))
-#define CHAN_SIZE 6
+#define CHAN_SIZE 7
 
 value arc_mkchan(arc *c)
 {
@@ -60,6 +66,7 @@ value arc_mkchan(arc *c)
   SCHAN_RTAIL(chan, CNIL);
   SCHAN_SHEAD(chan, CNIL);
   SCHAN_STAIL(chan, CNIL);
+  XCHAN_LOCK(chan) = INT2FIX(0);
   return(chan);
 }
 
@@ -70,8 +77,8 @@ static AFFDEF(chan_pprint)
   AFBEGIN;
   (void)disp;
   (void)sexpr;
-  AFTCALL(arc_mkaff(c, __arc_disp_write, CNIL), arc_mkstringc(c, "#<chan>"),
-	  CTRUE, AV(fp), AV(visithash));
+  AFTCALLF(__arc_disp_write, arc_mkstringc(c, "#<chan>"),
+	   CTRUE, AV(fp), AV(visithash));
   AFEND;
 }
 AFFEND
@@ -83,12 +90,16 @@ AFFDEF(arc_recv_channel)
   AFBEGIN;
 
   TYPECHECK(AV(chan), T_CHAN);
-  while (NIL_P(CHAN_HASDATA(AV(chan)))) {
+  for (;;) {
+    OBJLOCK(c, XCHAN_LOCK(AV(chan)));
+    if (!NIL_P(CHAN_HASDATA(AV(chan))))
+      break;
     /* We have no value that can be received from the channel.  Enqueue
        the calling thread and freeze it into Trecv state.  This should
        never happen with a recursive call to arc_recv_channel. */
     __arc_enqueue(c, thr, &XCHAN_RHEAD(AV(chan)), &XCHAN_RTAIL(AV(chan)));
     TSTATE(thr) = Trecv;
+    OBJUNLOCK(c, XCHAN_LOCK(AV(chan)));
     AYIELD();
   }
 
@@ -96,12 +107,17 @@ AFFDEF(arc_recv_channel)
      channel. Read it, and see if there is any thread waiting to send. */
   SCHAN_HASDATA(AV(chan), CNIL);
   val = CHAN_DATA(AV(chan));
-  xthr = __arc_dequeue(c, &XCHAN_SHEAD(AV(chan)), &XCHAN_STAIL(AV(chan)));
-  if (!NIL_P(xthr)) {
+  while (!NIL_P(xthr = __arc_dequeue(c, &XCHAN_SHEAD(AV(chan)),
+				      &XCHAN_STAIL(AV(chan))))) {
     /* There is at least one thread waiting to send on this channel.
-       Wake it up so it can send already. */
-    TSTATE(xthr) = Tready;
+       Wake it up so it can send already.  Threads that were killed
+       while waiting are skipped. */
+    if (TSTATE(xthr) == Tsend) {
+      __arc_wakeup(c, xthr);
+      break;
+    }
   }
+  OBJUNLOCK(c, XCHAN_LOCK(AV(chan)));
   ARETURN(val);
   AFEND;
 }
@@ -114,7 +130,10 @@ AFFDEF(arc_send_channel)
   AFBEGIN;
 
   TYPECHECK(AV(chan), T_CHAN);
-  while (!NIL_P(CHAN_HASDATA(AV(chan)))) {
+  for (;;) {
+    OBJLOCK(c, XCHAN_LOCK(AV(chan)));
+    if (NIL_P(CHAN_HASDATA(AV(chan))))
+      break;
     /* There is a value in the channel that was written that has not
        yet been read.  Enqueue the thread. */
     __arc_enqueue(c, thr, &XCHAN_SHEAD(AV(chan)), &XCHAN_STAIL(AV(chan)));
@@ -123,6 +142,7 @@ AFFDEF(arc_send_channel)
        runnable and return us to the dispatcher so some other thread
        can be made to run instead. */
     TSTATE(thr) = Tsend;
+    OBJUNLOCK(c, XCHAN_LOCK(AV(chan)));
     AYIELD();
   }
 
@@ -130,12 +150,17 @@ AFFDEF(arc_send_channel)
      see if there is any thread waiting to receive. */
   SCHAN_HASDATA(AV(chan), CTRUE);
   SCHAN_DATA(AV(chan), AV(val));
-  xthr = __arc_dequeue(c, &XCHAN_RHEAD(AV(chan)), &XCHAN_RTAIL(AV(chan)));
-  if (!NIL_P(xthr)) {
+  while (!NIL_P(xthr = __arc_dequeue(c, &XCHAN_RHEAD(AV(chan)),
+				      &XCHAN_RTAIL(AV(chan))))) {
     /* There is at least one thread waiting to receive on this channel.
-       Wake it up so it can receive. */
-    TSTATE(xthr) = Tready;
+       Wake it up so it can receive.  Threads that were killed while
+       waiting are skipped. */
+    if (TSTATE(xthr) == Trecv) {
+      __arc_wakeup(c, xthr);
+      break;
+    }
   }
+  OBJUNLOCK(c, XCHAN_LOCK(AV(chan)));
   ARETURN(AV(val));
   AFEND;
 }
@@ -148,20 +173,27 @@ AFFEND
 AFFDEF(__arc_recv_rvchan)
 {
   AARG(chan);
+  value val;
   AFBEGIN;
 
   TYPECHECK(AV(chan), T_CHAN);
-  while (NIL_P(CHAN_HASDATA(AV(chan)))) {
+  for (;;) {
+    OBJLOCK(c, XCHAN_LOCK(AV(chan)));
+    if (!NIL_P(CHAN_HASDATA(AV(chan))))
+      break;
     /* We have no value that can be received from the channel.  Enqueue
        the calling thread and freeze it into Trecv state.  This should
        never happen with a recursive call to arc_recv_channel. */
     __arc_enqueue(c, thr, &XCHAN_RHEAD(AV(chan)), &XCHAN_RTAIL(AV(chan)));
     TSTATE(thr) = Trecv;
+    OBJUNLOCK(c, XCHAN_LOCK(AV(chan)));
     AYIELD();
   }
 
   /* Return the channel data */
-  ARETURN(CHAN_DATA(AV(chan)));
+  val = CHAN_DATA(AV(chan));
+  OBJUNLOCK(c, XCHAN_LOCK(AV(chan)));
+  ARETURN(val);
   AFEND;
 }
 AFFEND
@@ -170,14 +202,16 @@ value __arc_send_rvchan(arc *c, value chan, value val)
 {
   value xthr;
 
+  OBJLOCK(c, XCHAN_LOCK(chan));
   SCHAN_HASDATA(chan, CTRUE);
   SCHAN_DATA(chan, val);
-  ;
   while ((xthr = __arc_dequeue(c, &XCHAN_RHEAD(chan), &XCHAN_RTAIL(chan))) != CNIL) {
     /* There is at least one thread waiting to receive on this channel.
        Wake it up so it can receive. */
-    TSTATE(xthr) = Tready;
+    if (TSTATE(xthr) == Trecv)
+      __arc_wakeup(c, xthr);
   }
+  OBJUNLOCK(c, XCHAN_LOCK(chan));
   return(val);
 }
 
@@ -33,8 +33,8 @@ static AFFDEF(clos_pprint)
   AOARG(visithash);
   AFBEGIN;
 
-  AFTCALL(arc_mkaff(c, __arc_disp_write, CNIL), CLOS_CODE(AV(sexpr)),
-	  AV(disp), AV(fp), AV(visithash));
+  AFTCALLF(__arc_disp_write, CLOS_CODE(AV(sexpr)),
+	   AV(disp), AV(fp), AV(visithash));
   AFEND;
 }
 AFFEND
@@ -37,7 +37,7 @@ static value get_lineno(arc *c, value obj)
    it is not a macro, return nil. */
 static int ismacro(arc *c, value op)
 {
-  while (arc_type(c, op = arc_hash_lookup(c, c->genv, op)) == T_SYMBOL)
+  while (arc_type(c, op = arc_gbind(c, op)) == T_SYMBOL)
     ;
   if (arc_type(c, op) == ARC_BUILTIN(c, S_MAC))
     return(op);
@@ -169,8 +169,9 @@ static value compile_ident(arc *c, value ident, value ctx, value env,
     }
   } else {
     /* If the variable is not bound in the current environment, it's
-       a global symbol. */
-    arc_emit1(c, ctx, ildg, find_literal(c, ctx, ident), get_lineno(c, CNIL));
+       a global symbol, referred to by its binding cell. */
+    arc_emit1(c, ctx, ildg, find_literal(c, ctx, arc_gcell(c, ident)),
+	      get_lineno(c, CNIL));
   }
   return(compile_continuation(c, ctx, cont));
 
@@ -190,23 +191,23 @@ static AFFDEF(compile_if)
   /* If the next is the end of the line, compile the tail end if no
      additional */
   if (NIL_P(cdr(AV(args)))) {
-    AFTCALL(arc_mkaff(c, arc_compile, CNIL), car(AV(args)), AV(ctx),
-	    AV(env), AV(cont));
+    AFTCALLF(arc_compile, car(AV(args)), AV(ctx),
+	     AV(env), AV(cont));
   }
 
   /* In the final case, we have the conditional (car), the then portion
      (cadr), and the else portion (cddr). */
   /* First, compile the conditional */
-  AFCALL(arc_mkaff(c, arc_compile, CNIL), car(AV(args)), AV(ctx),
-	 AV(env), CNIL);
+  AFCALLF(arc_compile, car(AV(args)), AV(ctx),
+	  AV(env), CNIL);
   /* this jump address will be the address of the jf instruction
      which we are about to generate.  We have to patch it with the
      address of the start of the else portion once we know it. */
   WV(jumpaddr, CCTX_VCPTR(AV(ctx)));
   arc_emit1(c, AV(ctx), ijf, INT2FIX(0), get_lineno(c, AV(args)));
   /* compile the then portion */
-  AFCALL(arc_mkaff(c, arc_compile, CNIL), cadr(AV(args)), AV(ctx),
-	 AV(env), CNIL);
+  AFCALLF(arc_compile, cadr(AV(args)), AV(ctx),
+	  AV(env), CNIL);
   /* This second jump target should be patched with the address of the
      unconditional jump at the end.  It should be patched after the else
      portion is compiled. */
@@ -218,8 +219,8 @@ static AFFDEF(compile_if)
 		FIX2INT(CCTX_VCPTR(AV(ctx))));
   /* compile the else portion, which should be treated as though it were
      an if as well */
-  AFCALL(arc_mkaff(c, compile_if, CNIL), cddr(AV(args)), AV(ctx),
-	 AV(env), AV(cont));
+  AFCALLF(compile_if, cddr(AV(args)), AV(ctx),
+	  AV(env), AV(cont));
   /* Fix the target address of the conditional jump at the end of the
      then portion (jumpaddr2) */
   arc_jmpoffset(c, AV(ctx), FIX2INT(AV(jumpaddr2)),
@@ -292,7 +293,7 @@ static AFFDEF(destructure)
       WV(jumpaddr, CCTX_VCPTR(AV(ctx)));
       arc_emit1(c, AV(ctx), ijbnd, INT2FIX(0), get_lineno(c, AV(arg)));
       /* compile the optional argument's definition */
-      AFCALL(arc_mkaff(c, arc_compile, CNIL), oargdef, AV(ctx), AV(env), CNIL);
+      AFCALLF(arc_compile, oargdef, AV(ctx), AV(env), CNIL);
       arc_jmpoffset(c, AV(ctx), FIX2INT(AV(jumpaddr)), 
 		    FIX2INT(CCTX_VCPTR(AV(ctx))));
       arc_emit1(c, AV(ctx), iste0, AV(idx), get_lineno(c, AV(arg)));
@@ -307,21 +308,21 @@ static AFFDEF(destructure)
   if (!NIL_P(car(AV(arg))) && !NIL_P(cdr(AV(arg)))) {
     arc_emit(c, AV(ctx), ipush, get_lineno(c, AV(arg)));
     arc_emit(c, AV(ctx), idcar, get_lineno(c, AV(arg)));
-    AFCALL(arc_mkaff(c, destructure, CNIL), car(AV(arg)), AV(ctx),
-	   AV(env), AV(idx), CTRUE);
+    AFCALLF(destructure, car(AV(arg)), AV(ctx),
+	    AV(env), AV(idx), CTRUE);
     WV(idx, AFCRV);
     arc_emit(c, AV(ctx), ipop, get_lineno(c, AV(arg)));
     arc_emit(c, AV(ctx), idcdr, get_lineno(c, AV(arg)));
-    AFTCALL(arc_mkaff(c, destructure, CNIL), cdr(AV(arg)), AV(ctx),
-	    AV(env), AV(idx), CNIL);
+    AFTCALLF(destructure, cdr(AV(arg)), AV(ctx),
+	     AV(env), AV(idx), CNIL);
   } else if (!NIL_P(car(AV(arg))) && NIL_P(cdr(AV(arg)))) {
     arc_emit(c, AV(ctx), idcar, get_lineno(c, AV(arg)));
-    AFTCALL(arc_mkaff(c, destructure, CNIL), car(AV(arg)), AV(ctx),
-	    AV(env), AV(idx), CTRUE);
+    AFTCALLF(destructure, car(AV(arg)), AV(ctx),
+	     AV(env), AV(idx), CTRUE);
   } else if (NIL_P(car(AV(arg))) && !NIL_P(cdr(AV(arg)))) {
     arc_emit(c, AV(ctx), idcdr, get_lineno(c, AV(arg)));
-    AFTCALL(arc_mkaff(c, destructure, CNIL), cdr(AV(arg)), AV(ctx),
-	    AV(env), AV(idx));
+    AFTCALLF(destructure, cdr(AV(arg)), AV(ctx),
+	     AV(env), AV(idx));
   }
   ARETURN(AV(idx));
   AFEND;
@@ -409,7 +410,7 @@ static AFFDEF(compile_args)
       WV(jumpaddr, CCTX_VCPTR(AV(ctx)));
       arc_emit1(c, AV(ctx), ijbnd, INT2FIX(0), get_lineno(c, oarg));
       /* compile the optional argument's definition */
-      AFCALL(arc_mkaff(c, arc_compile, CNIL), oargdef, AV(ctx), AV(env), CNIL);
+      AFCALLF(arc_compile, oargdef, AV(ctx), AV(env), CNIL);
       arc_emit1(c, AV(ctx), iste0, AV(idx),
 		get_lineno(c, car(AV(args))));
       arc_jmpoffset(c, AV(ctx), FIX2INT(AV(jumpaddr)), 
@@ -457,8 +458,8 @@ static AFFDEF(compile_args)
     arc_emit1(c, AV(ctx), ilde0, cdr(elem), get_lineno(c, AV(args)));
     /* ... then we generate car and cdr instructions to reach each of
        the names to which we do the destructuring. */
-    AFCALL(arc_mkaff(c, destructure, CNIL),
-	   car(elem), AV(ctx), AV(env), AV(idx));
+    AFCALLF(destructure,
+	    car(elem), AV(ctx), AV(env), AV(idx));
     WV(idx, AFCRV);
     WV(dsb, cdr(AV(dsb)));
   }
@@ -486,16 +487,16 @@ static AFFDEF(compile_fn)
   WV(nctx, arc_mkcctx(c));
   /* copy the CODE_SRC from the original ctx to this one */
   SCCTX_SRC(AV(nctx), CCTX_SRC(AV(ctx)));
-  AFCALL(arc_mkaff(c, compile_args, CNIL),
-	 AV(args), AV(nctx), AV(env));
+  AFCALLF(compile_args,
+	  AV(args), AV(nctx), AV(env));
   WV(nenv, AFCRV);
   /* the body of a fn works as an implicit do/progn */
   for (; AV(body); WV(body, cdr(AV(body)))) {
     /* The last statement in the body gets compiled with the 
        continuation flag set true. */
-    AFCALL(arc_mkaff(c, arc_compile, CNIL),
-	   car(AV(body)), AV(nctx), AV(nenv),
-	   (NIL_P(cdr(AV(body)))) ? CTRUE : CNIL);
+    AFCALLF(arc_compile,
+	    car(AV(body)), AV(nctx), AV(nenv),
+	    (NIL_P(cdr(AV(body)))) ? CTRUE : CNIL);
     WV(stmts, INT2FIX(FIX2INT(AV(stmts)) + 1));
   }
   /* if we have an empty list of statements add a nil instruction */
@@ -549,7 +550,7 @@ static AFFDEF(splicing)
   if (car(AV(expr)) == ARC_BUILTIN(c, S_UNQUOTESP))
     ARETURN(CTRUE);
   if (car(AV(expr)) == ARC_BUILTIN(c, S_UNQUOTE))
-    AFTCALL(arc_mkaff(c, splicing, CNIL), cadr(AV(expr)));
+    AFTCALLF(splicing, cadr(AV(expr)));
   ARETURN(CNIL);
   AFEND;
 }
@@ -573,11 +574,11 @@ static AFFDEF(qqappends)
 {
   AARG(exprs);
   AFBEGIN;
-  AFCALL(arc_mkaff(c, arc_rreduce, CNIL),
-	 arc_mkaff(c, qqappend, CNIL),
-	 AV(exprs));
+  AFCALLF(arc_rreduce,
+	  arc_aff(c, qqappend),
+	  AV(exprs));
   WV(exprs, AFCRV);
-  AFCALL(arc_mkaff(c, splicing, CNIL), AFCRV);
+  AFCALLF(splicing, AFCRV);
   if (NIL_P(AFCRV))
     ARETURN(AV(exprs));
   ARETURN(cons(c, ARC_BUILTIN(c, S_APPEND), cons(c, AV(exprs), CNIL)));
@@ -590,7 +591,7 @@ static AFFDEF(qqcons)
   AARG(expr1, expr2);
   value operator;
   AFBEGIN;
-  AFCALL(arc_mkaff(c, splicing, CNIL), AV(expr1));
+  AFCALLF(splicing, AV(expr1));
   operator = (NIL_P(AFCRV)) ? ARC_BUILTIN(c, S_CONS) :  ARC_BUILTIN(c, S_DLIST);
   /* XXX unoptimised version -- this results in the list being evaluated at
      runtime, well, more or less in the same way as the old code had... */
@@ -603,7 +604,7 @@ static AFFDEF(qqlist)
 {
   AARG(expr);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, qqcons, CNIL), AV(expr), CNIL);
+  AFTCALLF(qqcons, AV(expr), CNIL);
   AFEND;
 }
 AFFEND
@@ -616,18 +617,18 @@ static AFFDEF(qqtransform)
   AVAR(expansion);
   AFBEGIN;
   if (CONS_P(AV(expr)) && car(AV(expr)) == ARC_BUILTIN(c, S_UNQUOTE))
-    AFTCALL(arc_mkaff(c, qqlist, CNIL), cadr(AV(expr)));
+    AFTCALLF(qqlist, cadr(AV(expr)));
   if (CONS_P(AV(expr)) && car(AV(expr)) == ARC_BUILTIN(c, S_UNQUOTESP))
     ARETURN(cadr(AV(expr)));
   if (CONS_P(AV(expr)) && car(AV(expr)) == ARC_BUILTIN(c, S_QQUOTE)) {
-    AFCALL(arc_mkaff(c, qqexpand, CNIL), cadr(AV(expr)));
+    AFCALLF(qqexpand, cadr(AV(expr)));
     WV(expansion, AFCRV);
-    AFTCALL(arc_mkaff(c, qqlist, CNIL),
-	    cons(c, ARC_BUILTIN(c, S_QQUOTE),
-		 cons(c, AV(expansion), CNIL)));
+    AFTCALLF(qqlist,
+	     cons(c, ARC_BUILTIN(c, S_QQUOTE),
+		  cons(c, AV(expansion), CNIL)));
   }
-  AFCALL(arc_mkaff(c, qqexpand, CNIL), AV(expr));
-  AFTCALL(arc_mkaff(c, qqlist, CNIL), AFCRV);
+  AFCALLF(qqexpand, AV(expr));
+  AFTCALLF(qqlist, AFCRV);
   AFEND;
 }
 AFFEND
@@ -655,9 +656,9 @@ static AFFDEF(qqexpandlist)
     arc_err_cstrfmt_line(c, get_lineno(c, AV(expr)), "invalid use of unquote-splicing");
     ARETURN(CNIL);
   }
-  AFCALL(arc_mkaff(c, qqtransform, CNIL), car(AV(expr)));
+  AFCALLF(qqtransform, car(AV(expr)));
   WV(trans, AFCRV);
-  AFCALL(arc_mkaff(c, qqexpandlist, CNIL), cdr(AV(expr)));
+  AFCALLF(qqexpandlist, cdr(AV(expr)));
   ARETURN(cons(c, AV(trans), AFCRV));
   AFEND;
 }
@@ -689,13 +690,13 @@ static AFFDEF(qqexpand)
     ARETURN(CNIL);
   }
   if (car(AV(expr)) == ARC_BUILTIN(c, S_QQUOTE)) {
-    AFCALL(arc_mkaff(c, qqexpand, CNIL), cadr(AV(expr)));
+    AFCALLF(qqexpand, cadr(AV(expr)));
     ARETURN(cons(c, ARC_BUILTIN(c, S_EVAL),
 		 cons(c, cons(c, ARC_BUILTIN(c, S_QQUOTE),
 			      cons(c, AFCRV, CNIL)), CNIL)));
   }
-  AFCALL(arc_mkaff(c, qqexpandlist, CNIL), AV(expr));
-  AFTCALL(arc_mkaff(c, qqappends, CNIL), AFCRV);
+  AFCALLF(qqexpandlist, AV(expr));
+  AFTCALLF(qqappends, AFCRV);
   AFEND;
 }
 AFFEND
@@ -704,7 +705,7 @@ AFFDEF(arc_quasiquote)
 {
   AARG(expr);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, qqexpand, CNIL), AV(expr));
+  AFTCALLF(qqexpand, AV(expr));
   AFEND;
 }
 AFFEND
@@ -716,7 +717,7 @@ static AFFDEF(compile_assign)
   AVAR(a, val, envvar);
   AFBEGIN;
   while (AV(expr) != CNIL) {
-    AFCALL(arc_mkaff(c, macex, CNIL), car(AV(expr)), CTRUE);
+    AFCALLF(macex, car(AV(expr)), CTRUE);
     WV(a, AFCRV);
     WV(val, cadr(AV(expr)));
     if (AV(a) == CNIL) {
@@ -724,8 +725,8 @@ static AFFDEF(compile_assign)
     } else if (AV(a) == ARC_BUILTIN(c, S_T)) {
       arc_err_cstrfmt_line(c, get_lineno(c, AV(expr)), "Can't rebind t");
     } else {
-      AFCALL(arc_mkaff(c, arc_compile, CNIL), AV(val), AV(ctx),
-	     AV(env), CNIL);
+      AFCALLF(arc_compile, AV(val), AV(ctx),
+	      AV(env), CNIL);
       idx = frameno = 0;
       WV(envvar, find_var(c, AV(a), AV(env), &frameno, &idx));
       if (AV(envvar) == CTRUE) {
@@ -737,7 +738,8 @@ static AFFDEF(compile_assign)
 	}
       } else {
 	/* global symbol */
-	arc_emit1(c, AV(ctx), istg, find_literal(c, AV(ctx), AV(a)),
+	arc_emit1(c, AV(ctx), istg,
+		  find_literal(c, AV(ctx), arc_gcell(c, AV(a))),
 		  get_lineno(c, AV(expr)));
       }
     }
@@ -771,8 +773,8 @@ static int (*spform(arc *c, value ident))(arc *, value)
     WV(expr, cdr(AV(expr)));						\
     for (WV(count, FIX2INT(0)); AV(expr); WV(expr, cdr(AV(expr))),	\
 	   FIXINC(count)) {						\
-      AFCALL(arc_mkaff(c, arc_compile, CNIL), car(AV(expr)),	        \
-	     AV(ctx), AV(env), CNIL);					\
+      AFCALLF(arc_compile, car(AV(expr)),				\
+	      AV(ctx), AV(env), CNIL);					\
       if (cdr(AV(expr)) != CNIL)					\
 	arc_emit(c, AV(ctx), ipush, get_lineno(c, AV(expr)));		\
     }									\
@@ -796,11 +798,11 @@ static AFFDEF(compile_inlinen)
 {
   AARG(inst, expr, ctx, env, cont, base);
   AFBEGIN;
-  AFCALL(arc_mkaff(c, arc_compile, CNIL), AV(base), AV(ctx), AV(env), CNIL);
+  AFCALLF(arc_compile, AV(base), AV(ctx), AV(env), CNIL);
   for (WV(expr, cdr(AV(expr))); AV(expr); WV(expr,cdr(AV(expr)))) {
     arc_emit(c, AV(ctx), ipush, get_lineno(c, AV(expr)));
-    AFCALL(arc_mkaff(c, arc_compile, CNIL), car(AV(expr)), AV(ctx),
-	   AV(env), CNIL);
+    AFCALLF(arc_compile, car(AV(expr)), AV(ctx),
+	    AV(env), CNIL);
     arc_emit(c, AV(ctx), AV(inst), get_lineno(c, AV(expr)));
   }
   ARETURN(compile_continuation(c, AV(ctx), AV(cont)));
@@ -820,12 +822,12 @@ static AFFDEF(compile_inlinen2)
 			 "operator requires at least one argument");
     ARETURN(CNIL);
   } else if (AV(xelen) == INT2FIX(1)) {
-    AFTCALL(arc_mkaff(c, compile_inlinen, CNIL), AV(inst),
-	    AV(expr), AV(ctx), AV(env), AV(cont), AV(base));
+    AFTCALLF(compile_inlinen, AV(inst),
+	     AV(expr), AV(ctx), AV(env), AV(cont), AV(base));
   }
-  AFTCALL(arc_mkaff(c, compile_inlinen, CNIL), AV(inst),
-	  cons(c, car(AV(expr)), cdr(AV(xexpr))), AV(ctx),
-	  AV(env), AV(cont), car(AV(xexpr)));
+  AFTCALLF(compile_inlinen, AV(inst),
+	   cons(c, car(AV(expr)), cdr(AV(xexpr))), AV(ctx),
+	   AV(env), AV(cont), car(AV(xexpr)));
   AFEND;
 }
 AFFEND
@@ -838,13 +840,13 @@ static AFFDEF(inline_plus)
   xexpr = cdr(AV(expr));
   xelen = arc_list_length(c, xexpr);
   if (xelen == INT2FIX(0))
-    AFTCALL(arc_mkaff(c, arc_compile, CNIL), INT2FIX(0), AV(ctx),
-	    AV(env), AV(cont));
+    AFTCALLF(arc_compile, INT2FIX(0), AV(ctx),
+	     AV(env), AV(cont));
   if (xelen == INT2FIX(1))
-    AFTCALL(arc_mkaff(c, arc_compile, CNIL), car(xexpr), AV(ctx),
-	    AV(env), AV(cont));
-  AFTCALL(arc_mkaff(c, compile_inlinen2, CNIL), iadd,
-	  AV(expr), AV(ctx), AV(env), AV(cont), INT2FIX(0));
+    AFTCALLF(arc_compile, car(xexpr), AV(ctx),
+	     AV(env), AV(cont));
+  AFTCALLF(compile_inlinen2, iadd,
+	   AV(expr), AV(ctx), AV(env), AV(cont), INT2FIX(0));
   AFEND;
 }
 AFFEND
@@ -853,8 +855,8 @@ static AFFDEF(inline_times)
 {
   AARG(expr, ctx, env, cont);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, compile_inlinen, CNIL), imul,
-	  AV(expr), AV(ctx), AV(env), AV(cont), INT2FIX(1));
+  AFTCALLF(compile_inlinen, imul,
+	   AV(expr), AV(ctx), AV(env), AV(cont), INT2FIX(1));
   AFEND;
 }
 AFFEND
@@ -863,8 +865,8 @@ static AFFDEF(inline_minus)
 {
   AARG(expr, ctx, env, cont);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, compile_inlinen2, CNIL), isub,
-	  AV(expr), AV(ctx), AV(env), AV(cont), INT2FIX(0));
+  AFTCALLF(compile_inlinen2, isub,
+	   AV(expr), AV(ctx), AV(env), AV(cont), INT2FIX(0));
   AFEND;
 }
 AFFEND
@@ -873,8 +875,8 @@ static AFFDEF(inline_div)
 {
   AARG(expr, ctx, env, cont);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, compile_inlinen2, CNIL), idiv,
-	  AV(expr), AV(ctx), AV(env), AV(cont), INT2FIX(1));
+  AFTCALLF(compile_inlinen2, idiv,
+	   AV(expr), AV(ctx), AV(env), AV(cont), INT2FIX(1));
   AFEND;
 }
 AFFEND
@@ -914,8 +916,8 @@ static AFFDEF(compile_compose)
 
   composer = cdr(car(AV(expr)));
   cargs = cdr(AV(expr));
-  AFTCALL(arc_mkaff(c, arc_compile, CNIL), fold(c, composer, cargs),
-	  AV(ctx), AV(env), AV(cont));
+  AFTCALLF(arc_compile, fold(c, composer, cargs),
+	   AV(ctx), AV(env), AV(cont));
   AFEND;
 }
 AFFEND
@@ -937,8 +939,8 @@ static AFFDEF(compile_complement)
   complemented = car(complemented);
   result = cons(c, ARC_BUILTIN(c, S_NO),
 		cons(c, cons(c, complemented, cargs), CNIL));
-  AFTCALL(arc_mkaff(c, arc_compile, CNIL), result,
-	  AV(ctx), AV(env), AV(cont));
+  AFTCALLF(arc_compile, result,
+	   AV(ctx), AV(env), AV(cont));
   AFEND;
 }
 AFFEND
@@ -957,7 +959,7 @@ static AFFDEF(compile_apply)
   if (SYMBOL_P(AV(fname)) && !NIL_P(mac = ismacro(c, AV(fname)))) {
     /* Apply the macro by calling it.  Compile the results. */
     AFCALL2(arc_rep(c, mac), AV(args));
-    AFTCALL(arc_mkaff(c, arc_compile, CNIL), AFCRV, AV(ctx), AV(env), AV(cont));
+    AFTCALLF(arc_compile, AFCRV, AV(ctx), AV(env), AV(cont));
     /* tail call: doesn't return -- never gets here */
     ARETURN(AFCRV);
   }
@@ -972,12 +974,12 @@ static AFFDEF(compile_apply)
   /* Traverse the arguments, compiling each and pushing them on the stack */
   for (WV(nargs, INT2FIX(0)); AV(nahd); WV(nahd, cdr(AV(nahd))),
 	 WV(nargs, INT2FIX(FIX2INT(AV(nargs)) + 1))) {
-    AFCALL(arc_mkaff(c, arc_compile, CNIL), car(AV(nahd)),
-	   AV(ctx), AV(env), CNIL);
+    AFCALLF(arc_compile, car(AV(nahd)),
+	    AV(ctx), AV(env), CNIL);
     arc_emit(c, AV(ctx), ipush, get_lineno(c, AV(expr)));
   }
   /* compile the function name, which should load it into the value register */
-  AFCALL(arc_mkaff(c, arc_compile, CNIL), AV(fname), AV(ctx), AV(env), CNIL);
+  AFCALLF(arc_compile, AV(fname), AV(ctx), AV(env), CNIL);
 
   /* If this is a tail call, create a menv instruction to overwrite the
      current environment just before performing the application */
@@ -1018,8 +1020,8 @@ static AFFDEF(compile_andf)
   body = cons(c, cons(c, ARC_BUILTIN(c, S_AND), body), CNIL);
   body = cons(c, cons(c, ARC_BUILTIN(c, S_FN),
 		      cons(c, uniqs, body)), andargs);
-  AFTCALL(arc_mkaff(c, arc_compile, CNIL), body, AV(ctx),
-	  AV(env), AV(cont));
+  AFTCALLF(arc_compile, body, AV(ctx),
+	   AV(env), AV(cont));
   AFEND;
 }
 AFFEND
@@ -1033,8 +1035,8 @@ static AFFDEF(compile_list)
 
   /* Special forms: if/fn/quote/quasiquote/assign */
   if ((fun = spform(c, car(AV(nexpr)))) != NULL) {
-    AFTCALL(arc_mkaff(c, fun, CNIL), cdr(AV(nexpr)), AV(ctx), AV(env),
-	    AV(cont));
+    AFTCALLF(fun, cdr(AV(nexpr)), AV(ctx), AV(env),
+	     AV(cont));
   }
 
   /* expand all ssyntax within the expression if it isn't a special form */
@@ -1044,7 +1046,7 @@ static AFFDEF(compile_list)
     value result = CNIL;
 
     if (SYMBOL_P(car(AV(xs)))) {
-      AFCALL(arc_mkaff(c, arc_ssexpand, CNIL), car(AV(xs)));
+      AFCALLF(arc_ssexpand, car(AV(xs)));
       result = AFCRV;
     }
     if (NIL_P(result))
@@ -1056,7 +1058,7 @@ static AFFDEF(compile_list)
 
   /* Inline functions (cons, car, cdr, +, -, *, /) */
   if ((fun = inline_func(c, car(AV(expr)))) != NULL) {
-    AFTCALL(arc_mkaff(c, fun, CNIL), AV(expr), AV(ctx), AV(env), AV(cont));
+    AFTCALLF(fun, AV(expr), AV(ctx), AV(env), AV(cont));
   }
 
   /*  the next three clauses could be removed without changing semantics
@@ -1068,25 +1070,25 @@ static AFFDEF(compile_list)
   /* compose in a functional position */
   if (CONS_P(car(AV(expr)))
       && car(car(AV(expr))) == ARC_BUILTIN(c, S_COMPOSE)) {
-    AFTCALL(arc_mkaff(c, compile_compose, CNIL), AV(expr), AV(ctx), AV(env),
-	    AV(cont));
+    AFTCALLF(compile_compose, AV(expr), AV(ctx), AV(env),
+	     AV(cont));
   }
 
   /* complement in a functional position */
   if (CONS_P(car(AV(expr)))
       && car(car(AV(expr))) == ARC_BUILTIN(c, S_COMPLEMENT)) {
-    AFTCALL(arc_mkaff(c, compile_complement, CNIL), AV(expr), AV(ctx),
-	    AV(env), AV(cont));
+    AFTCALLF(compile_complement, AV(expr), AV(ctx),
+	     AV(env), AV(cont));
   }
 
   /* andf in a functional position */
   if (CONS_P(car(AV(expr))) && car(car(AV(expr))) == ARC_BUILTIN(c, S_ANDF)) {
-    AFTCALL(arc_mkaff(c, compile_andf, CNIL), AV(expr), AV(ctx),
-	    AV(env), AV(cont));
+    AFTCALLF(compile_andf, AV(expr), AV(ctx),
+	     AV(env), AV(cont));
   }
 
-  AFTCALL(arc_mkaff(c, compile_apply, CNIL), AV(expr), AV(ctx), AV(env),
-	  AV(cont));
+  AFTCALLF(compile_apply, AV(expr), AV(ctx), AV(env),
+	   AV(cont));
   AFEND;
 }
 AFFEND
@@ -1108,18 +1110,18 @@ AFFDEF(arc_compile)
   }
 
   if (SYMBOL_P(AV(expr))) {
-    AFCALL(arc_mkaff(c, arc_ssexpand, CNIL), AV(expr));
+    AFCALLF(arc_ssexpand, AV(expr));
     WV(ssx, AFCRV);
     if (NIL_P(AV(ssx))) {
       ARETURN(compile_ident(c, AV(expr), AV(ctx), AV(env), AV(cont)));
     }
-    AFTCALL(arc_mkaff(c, arc_compile, CNIL), AV(ssx), AV(ctx),
-	    AV(env), AV(cont));
+    AFTCALLF(arc_compile, AV(ssx), AV(ctx),
+	     AV(env), AV(cont));
   }
 
   if (CONS_P(AV(expr))) {
-    AFTCALL(arc_mkaff(c, compile_list, CNIL), AV(expr), AV(ctx),
-	    AV(env), AV(cont));
+    AFTCALLF(compile_list, AV(expr), AV(ctx),
+	     AV(env), AV(cont));
   }
   arc_err_cstrfmt_line(c, get_lineno(c, AV(expr)), "invalid_expression");
   ARETURN(AV(ctx));
@@ -1131,7 +1133,7 @@ AFFDEF(arc_macex)
 {
   AARG(e);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, macex, CNIL), AV(e), CTRUE);
+  AFTCALLF(macex, AV(e), CTRUE);
   AFEND;
 }
 AFFEND
@@ -1140,7 +1142,7 @@ AFFDEF(arc_macex1)
 {
   AARG(e);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, macex, CNIL), AV(e), CNIL);
+  AFTCALLF(macex, AV(e), CNIL);
   AFEND;
 }
 AFFEND
@@ -1175,10 +1177,10 @@ AFFEND
 static AFFDEF(duringthunk)
 {
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, arc_compile, CNIL),
-	  __arc_getenv(c, thr, 1, 0), /* AV(expr) */
-	  __arc_getenv(c, thr, 1, 2), /* AV(ctx) */
-	  CNIL, CTRUE);
+  AFTCALLF(arc_compile,
+	   __arc_getenv(c, thr, 1, 0), /* AV(expr) */
+	   __arc_getenv(c, thr, 1, 2), /* AV(ctx) */
+	   CNIL, CTRUE);
   AFEND;
 }
 AFFEND
@@ -1206,12 +1208,12 @@ AFFDEF(arc_eval)
   WV(ctx, arc_mkcctx(c));
   if (BOUND_P(AV(lndata)))
     arc_cctx_mksrc(c, AV(ctx));
-  AFCALL(arc_mkaff(c, arc_dynamic_wind, CNIL),
-	 arc_mkaff2(c, beforethunk, CNIL, TENVR(thr)),
-	 arc_mkaff2(c, duringthunk, CNIL, TENVR(thr)),
-	 arc_mkaff2(c, afterthunk, CNIL, TENVR(thr)));
+  AFCALLF(arc_dynamic_wind,
+	  arc_mkaff2(c, beforethunk, CNIL, TENVR(thr)),
+	  arc_mkaff2(c, duringthunk, CNIL, TENVR(thr)),
+	  arc_mkaff2(c, afterthunk, CNIL, TENVR(thr)));
   /*
-  AFCALL(arc_mkaff(c, arc_compile, CNIL), AV(expr), AV(ctx), CNIL, CTRUE);
+  AFCALLF(arc_compile, AV(expr), AV(ctx), CNIL, CTRUE);
   */
   code = arc_cctx2code(c, AV(ctx));
   clos = arc_mkclos(c, code, CNIL);
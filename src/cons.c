@@ -69,11 +69,11 @@ static AFFDEF(cons_pprint)
 
   if (!NIL_P(__arc_visit(c, AV(sexpr), AV(visithash)))) {
     /* already visited at some point. Do not recurse further */
-    AFTCALL(arc_mkaff(c, __arc_disp_write, CNIL), arc_mkstringc(c, "(...)"),
+    AFTCALLF(__arc_disp_write, arc_mkstringc(c, "(...)"),
 	   CTRUE, AV(fp), AV(visithash));
   }
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
-  WV(dw, arc_mkaff(c, __arc_disp_write, CNIL));
+  WV(wc, arc_aff(c, arc_writec));
+  WV(dw, arc_aff(c, __arc_disp_write));
   AFCALL(AV(wc), arc_mkchar(c, '('), AV(fp));
   while (TYPE(AV(sexpr)) == T_CONS) {
     if (!NIL_P(__arc_visitp(c, car(AV(sexpr)), AV(visithash)))) {
@@ -133,7 +133,7 @@ static AFFDEF(cons_isocmp)
   if (__arc_visit2(c, AV(v2), AV(vh2), vhh1) != CNIL)
     ARETURN(CNIL);
   /* Recursive comparisons */
-  WV(iso2, arc_mkaff(c, arc_iso2, CNIL));
+  WV(iso2, arc_aff(c, arc_iso2));
   AFCALL(AV(iso2), car(AV(v1)), car(AV(v2)), AV(vh1), AV(vh2));
   if (NIL_P(AFCRV))
     ARETURN(CNIL);
@@ -197,12 +197,12 @@ AFFDEF(cons_xhash)
     ARETURN(AV(length));
 
   /* Visit car */
-  AFCALL(arc_mkaff(c, arc_xhash_increment, CNIL), car(AV(obj)), AV(ehs),
-	 AV(visithash));
+  AFCALLF(arc_xhash_increment, car(AV(obj)), AV(ehs),
+	  AV(visithash));
   WV(length, __arc_add2(c, AV(length), AFCRV));
   /* Visit cdr */
-  AFCALL(arc_mkaff(c, arc_xhash_increment, CNIL), cdr(AV(obj)), AV(ehs),
-	 AV(visithash));
+  AFCALLF(arc_xhash_increment, cdr(AV(obj)), AV(ehs),
+	  AV(visithash));
   ARETURN(__arc_add2(c, AV(length), AFCRV));
   AFEND;
 }
@@ -290,7 +290,7 @@ AFFDEF(arc_dlist)
   AFBEGIN;
   if (NIL_P(cdr(AV(xs))))
     ARETURN(car(AV(xs)));
-  AFCALL2(arc_mkaff(c, arc_dlist, CNIL), cdr(AV(xs)));
+  AFCALL2(arc_aff(c, arc_dlist), cdr(AV(xs)));
   ARETURN(cons(c, car(AV(xs)), AFCRV));
   AFEND;
 }
@@ -323,10 +323,10 @@ AFFDEF(arc_append)
     ARETURN(car(AV(args)));
   WV(a, car(AV(args)));
   if (NIL_P(AV(a)))
-    AFTCALL2(arc_mkaff(c, arc_append, CNIL), cdr(AV(args)));
-  AFCALL(arc_mkaff(c, arc_apply, CNIL),
-	 arc_mkaff(c, arc_append, CNIL),
-	 cdr(AV(a)), cdr(AV(args)));
+    AFTCALL2(arc_aff(c, arc_append), cdr(AV(args)));
+  AFCALLF(arc_apply,
+	  arc_aff(c, arc_append),
+	  cdr(AV(a)), cdr(AV(args)));
   ARETURN(cons(c, car(AV(a)), AFCRV));
   AFEND;
 }
@@ -342,8 +342,8 @@ AFFDEF(arc_reduce)
   }
   if (!NIL_P(cdr(AV(xs))) && !NIL_P(cddr(AV(xs)))) {
     AFCALL(AV(f), car(AV(xs)), cadr(AV(xs)));
-    AFTCALL(arc_mkaff(c, arc_reduce, CNIL), AV(f),
-	    cons(c, AFCRV, cddr(AV(xs))));
+    AFTCALLF(arc_reduce, AV(f),
+	     cons(c, AFCRV, cddr(AV(xs))));
   }
   AFCALL2(AV(f), AV(xs));
   AFEND;
@@ -359,7 +359,7 @@ AFFDEF(arc_rreduce)
     ARETURN(CNIL);
   }
   if (!NIL_P(cdr(AV(xs))) && !NIL_P(cddr(AV(xs)))) {
-    AFCALL(arc_mkaff(c, arc_rreduce, CNIL), AV(f), cdr(AV(xs)));
+    AFCALLF(arc_rreduce, AV(f), cdr(AV(xs)));
     AFTCALL(AV(f), car(AV(xs)), AFCRV);
   }
   AFCALL2(AV(f), AV(xs));
@@ -412,8 +412,8 @@ static AFFDEF(cons_xcoerce)
        Same form causes an error in other Arc implementations.
      */
     for (; CONS_P(AV(obj)); WV(obj, cdr(AV(obj)))) {
-      AFCALL(arc_mkaff(c, arc_coerce, CNIL), car(AV(obj)),
-	     ARC_BUILTIN(c, S_STRING), AV(arg));
+      AFCALLF(arc_coerce, car(AV(obj)),
+	      ARC_BUILTIN(c, S_STRING), AV(arg));
       WV(str, arc_strcat(c, AV(str), AFCRV));
     }
     if (!NIL_P(AV(obj))) {
@@ -451,7 +451,7 @@ static AFFDEF(cons_xcoerce)
       }
       key = car(cell);
       val = cdr(cell);
-      AFCALL(arc_mkaff(c, arc_xhash_insert, CNIL), AV(hash), key, val);
+      AFCALLF(arc_xhash_insert, AV(hash), key, val);
       WV(obj, cdr(AV(obj)));
     }
     ARETURN(AV(hash));
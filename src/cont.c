@@ -175,8 +175,10 @@ value __arc_cont2heap(arc *c, value thr, value cont)
     cont = heap_cont(c, thr, cont);
     if (NIL_P(initcont))
       initcont = cont;
-    if (!NIL_P(oldcont))
+    if (!NIL_P(oldcont)) {
+      __arc_wb(CONT_CONT(oldcont), cont);
       CONT_CONT(oldcont) = cont;
+    }
     oldcont = cont;
     cont = nextcont(c, thr, cont);
   };
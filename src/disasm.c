@@ -17,8 +17,12 @@
   along with this library. If not, see <http://www.gnu.org/licenses/>
 */
 #include <stdio.h>
+#include <string.h>
+#include "../config.h"
 #include "arcueid.h"
 #include "vmengine.h"
+#include "arith.h"
+#include "hash.h"
 
 #ifdef HAVE_ALLOCA_H
 # include <alloca.h>
@@ -92,3 +96,43 @@ value __arc_disasm_inst(arc *c, value *base, value *inst, int *instlen)
     *instlen = nops + 1;
   return(vstr);
 }
+
+#ifdef HAVE_VMPROFILE
+
+/* Return the counts collected by the bytecode profiler.  The result
+   is a table mapping the name of each instruction executed to the
+   number of times it was executed, and the names of each pair of
+   instructions executed in sequence, separated by a space, to the
+   number of times the pair was seen. */
+value arc_vm_profile(arc *c)
+{
+  value prof;
+  char buf[64];
+  int i, j;
+
+  prof = arc_mkhash(c, ARC_HASHBITS);
+  for (i=0; i<VMPROF_NOPS; i++) {
+    if (__arc_vmprof_count[i] == 0ULL)
+      continue;
+    arc_hash_insert(c, prof, arc_mkstringc(c, disasm_opcodes[INT2FIX(i)]),
+		    __arc_ull2val(c, __arc_vmprof_count[i]));
+    for (j=0; j<VMPROF_NOPS; j++) {
+      if (__arc_vmprof_pairs[i][j] == 0ULL)
+	continue;
+      snprintf(buf, sizeof(buf), "%s %s", disasm_opcodes[INT2FIX(i)],
+	       disasm_opcodes[INT2FIX(j)]);
+      arc_hash_insert(c, prof, arc_mkstringc(c, buf),
+		      __arc_ull2val(c, __arc_vmprof_pairs[i][j]));
+    }
+  }
+  return(prof);
+}
+
+value arc_vm_profile_reset(arc *c)
+{
+  memset(__arc_vmprof_count, 0, sizeof(__arc_vmprof_count));
+  memset(__arc_vmprof_pairs, 0, sizeof(__arc_vmprof_pairs));
+  return(CNIL);
+}
+
+#endif
@@ -103,9 +103,9 @@ static const char *disasm_opcodes[] = {
 	"??",
 	"??",
 	"??",
+	"addfx",
 	"??",
-	"??",
-	"??",
+	"subfx",
 	"??",
 	"??",
 	"??",
@@ -147,7 +147,7 @@ static const char *disasm_opcodes[] = {
 	"??",
 	"??",
 	"??",
-	"??",
+	"cont",
 	"??",
 	"??",
 	"??",
@@ -275,13 +275,6 @@ static const char *disasm_opcodes[] = {
 	"??",
 	"ste",
 	"??",
-	"cont",
-	"??",
-	"??",
-	"??",
-	"??",
-	"??",
-	"??",
 	"??",
 	"??",
 	"??",
@@ -324,11 +317,13 @@ static const char *disasm_opcodes[] = {
 	"??",
 	"??",
 	"??",
+	"pushldg",
 	"??",
 	"??",
 	"??",
 	"??",
 	"??",
+	"lde0push",
 	"??",
 	"??",
 	"??",
@@ -350,14 +345,19 @@ static const char *disasm_opcodes[] = {
 	"??",
 	"??",
 	"??",
+	"pushldi",
 	"??",
+	"ldipush",
 	"??",
 	"??",
 	"??",
+	"ldlcls",
 	"??",
 	"??",
 	"??",
+	"ldiadd",
 	"??",
+	"ldisub",
 	"??",
 	"??",
 	"??",
@@ -449,6 +449,7 @@ static const char *disasm_opcodes[] = {
 	"??",
 	"??",
 	"??",
+	"ldgapply",
 	"??",
 	"??",
 	"??",
@@ -470,18 +471,17 @@ static const char *disasm_opcodes[] = {
 	"??",
 	"??",
 	"??",
+	"contlde0",
 	"??",
 	"??",
 	"??",
 	"??",
 	"??",
+	"menvapply",
 	"??",
 	"??",
 	"??",
-	"??",
-	"??",
-	"??",
-	"??",
+	"ldepush",
 	"??",
 	"??",
 	"??",
@@ -166,10 +166,11 @@ inline value __arc_putenv0(arc *c, value thr, int iindx, value val)
     value *base = SENV_PTR(TSTOP(thr), TENVR(thr));
     int count = FIX2INT(*(base + 1));
     ptr = (base + count + 1 - iindx);
+    __arc_rootwb(*ptr, val);
   } else {
     ptr = &XVINDEX(TENVR(thr), iindx+1);
+    __arc_wb(*ptr, val);
   }
-  __arc_wb(*ptr, val);
   *ptr = val;
   return(val);
 }
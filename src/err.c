@@ -67,7 +67,7 @@ static AFFDEF(savetexh)
   __arc_putenv(c, thr, 1, 1, TEXH(thr));
   /* (= *exh (cons cont handler)) */
   nexh = cons(c, __arc_getenv(c, thr, 1, 0), __arc_getenv(c, thr, 2, 0));
-  __arc_wb(TEXH(thr), nexh);
+  __arc_rootwb(TEXH(thr), nexh);
   TEXH(thr) = nexh;
   AFEND;
 }
@@ -79,7 +79,7 @@ static AFFDEF(restoretexh)
   AFBEGIN;
   /* (= *exh old) */
   old = __arc_getenv(c, thr, 1, 1);
-  __arc_wb(TEXH(thr), old);
+  __arc_rootwb(TEXH(thr), old);
   TEXH(thr) = old;
   AFEND;
 }
@@ -101,10 +101,10 @@ static AFFDEF(ccchandler)
   (void)cont;
   SENVR(thr, __arc_env2heap(c, thr, TENVR(thr)));
   /* (dynamic-wind ... thunk ...) */
-  AFTCALL(arc_mkaff(c, arc_dynamic_wind, CNIL),
-	  arc_mkaff2(c, savetexh, CNIL, TENVR(thr)),
-	  __arc_getenv(c, thr, 1, 1), /* thunk from arc_on_err */
-	  arc_mkaff2(c, restoretexh, CNIL, TENVR(thr)));
+  AFTCALLF(arc_dynamic_wind,
+	   arc_mkaff2(c, savetexh, CNIL, TENVR(thr)),
+	   __arc_getenv(c, thr, 1, 1), /* thunk from arc_on_err */
+	   arc_mkaff2(c, restoretexh, CNIL, TENVR(thr)));
   AFEND;
 }
 AFFEND
@@ -119,8 +119,8 @@ AFFDEF(arc_on_err)
   (void)handler;
   (void)thunk;
   SENVR(thr, __arc_env2heap(c, thr, TENVR(thr)));
-  AFCALL(arc_mkaff(c, arc_callcc, CNIL), arc_mkaff2(c, ccchandler, CNIL,
-						    TENVR(thr)));
+  AFCALLF(arc_callcc, arc_mkaff2(c, ccchandler, CNIL,
+				 TENVR(thr)));
   ret = AFCRV;
   if (TYPE(ret) != T_EXCEPTION)
     ARETURN(ret);
@@ -162,7 +162,7 @@ AFFDEF(arc_err)
        handler if one is set, and longjmp away.  The thread becomes
        broken if this happens. */
     /* First we need to reroot to the root */
-    AFCALL(arc_mkaff(c, __arc_reroot, CNIL), TBCH(thr));
+    AFCALLF(__arc_reroot, TBCH(thr));
     TSTATE(thr) = Tbroken;
     if (c->errhandler != NULL)
       c->errhandler(c, thr, arc_details(c, AV(exc)));
@@ -183,15 +183,15 @@ AFFEND
 static void va_err_cstrfmt(arc *c, const char *fmt, va_list ap)
 {
   char cstr[1000];
-  value str;
+  value str, thr;
 
   vsnprintf(cstr, sizeof(char)*1000, fmt, ap);
   str = arc_mkstringc(c, cstr);
   /* This is how we can invoke arc_err from a non-AFF */
-  __arc_mkenv(c, c->curthread, 0, 0);	/* null env required */
-  __arc_affapply(c, c->curthread, CNIL, arc_mkaff(c, arc_err, CNIL), str,
-		 CLASTARG);
-  longjmp(TEJMP(c->curthread), 1);
+  thr = __arc_curthread(c);
+  __arc_mkenv(c, thr, 0, 0);	/* null env required */
+  __arc_affapply(c, thr, CNIL, arc_mkaff(c, arc_err, CNIL), str, CLASTARG);
+  longjmp(TEJMP(thr), 1);
 }
 
 void arc_err_cstrfmt(arc *c, const char *fmt, ...)
@@ -209,7 +209,7 @@ void arc_err_cstrfmt_line(arc *c, value fileline, const char *fmt, ...)
   char *namestr;
   char *filelinestr;
   char cstr[1000];
-  value str;
+  value str, thr;
   int len;
 
   va_start(ap, fmt);
@@ -229,10 +229,10 @@ void arc_err_cstrfmt_line(arc *c, value fileline, const char *fmt, ...)
   str = arc_mkstringc(c, cstr);
   str = arc_strcat(c, arc_mkstringc(c, filelinestr), str);
   /* This is how we can invoke arc_err from a non-AFF */
-  __arc_mkenv(c, c->curthread, 0, 0);	/* null env required */
-  __arc_affapply(c, c->curthread, CNIL, arc_mkaff(c, arc_err, CNIL), str,
-		 CLASTARG);
-  longjmp(TEJMP(c->curthread), 1);
+  thr = __arc_curthread(c);
+  __arc_mkenv(c, thr, 0, 0);	/* null env required */
+  __arc_affapply(c, thr, CNIL, arc_mkaff(c, arc_err, CNIL), str, CLASTARG);
+  longjmp(TEJMP(thr), 1);
 }
 
 static AFFDEF(exception_pprint)
@@ -241,8 +241,8 @@ static AFFDEF(exception_pprint)
   AOARG(visithash);
   AVAR(dw, wc);
   AFBEGIN;
-  WV(dw, arc_mkaff(c, __arc_disp_write, CNIL));
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
+  WV(dw, arc_aff(c, __arc_disp_write));
+  WV(wc, arc_aff(c, arc_writec));
   AFCALL(AV(dw), arc_mkstringc(c, "#<exception: "), CTRUE, AV(fp), CNIL);
   AFCALL(AV(dw), arc_details(c, AV(sexpr)), AV(disp), AV(fp), AV(visithash));
   AFCALL(AV(wc), arc_mkchar(c, '>'), AV(fp));
@@ -20,11 +20,20 @@
 */
 
 #include "../config.h"
+#ifdef HAVE_SPLICE
+#define _GNU_SOURCE		/* for splice(2) */
+#endif
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/select.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include "arcueid.h"
 #include "builtins.h"
 #include "io.h"
@@ -169,6 +178,100 @@ static AFFDEF(fio_getb)
 }
 AFFEND
 
+/* Input file ports read through their own buffer rather than stdio's,
+   with read(2), as that will not block once fio_ready says there is
+   something to read.  A regular file is always ready, however, and
+   reading it may still take a while, so other workers may run
+   meanwhile. */
+static AFFDEF(fio_fill)
+{
+  AARG(fio);
+  struct io_t *io;
+  ssize_t n;
+  int fd, rtd;
+  AFBEGIN;
+  io = IO(AV(fio));
+  fd = fileno(FIODATA(AV(fio))->fp);
+  OBJLOCK(c, io->lock);
+  BLOCK_BEGIN(c, rtd);
+  do {
+    n = read(fd, io->rbuf + io->rblen, IO_BUFSIZE - io->rblen);
+  } while (n < 0 && errno == EINTR);
+  if (n > 0)
+    io->rblen += n;
+  OBJUNLOCK(c, io->lock);
+  BLOCK_END(c, rtd);
+  if (n < 0) {
+    int en = errno;
+
+    arc_err_cstrfmt(c, "error reading file (%s; errno=%d)", strerror(en), en);
+    ARETURN(CNIL);
+  }
+  if (n == 0)
+    ARETURN(CNIL);
+  ARETURN(INT2FIX(n));
+  AFEND;
+}
+AFFEND
+
+/* Largest block moved by one call to fio_read or fio_write */
+#define FIO_BLOCKSIZE (4*IO_BUFSIZE)
+
+static AFFDEF(fio_read)
+{
+  AARG(fio, vec, off, n);
+  unsigned char buf[FIO_BLOCKSIZE];
+  ssize_t rb;
+  int i, fd, rtd;
+  AFBEGIN;
+  rb = FIX2INT(AV(n));
+  if (rb > FIO_BLOCKSIZE)
+    rb = FIO_BLOCKSIZE;
+  fd = fileno(FIODATA(AV(fio))->fp);
+  BLOCK_BEGIN(c, rtd);
+  do {
+    rb = read(fd, buf, rb);
+  } while (rb < 0 && errno == EINTR);
+  BLOCK_END(c, rtd);
+  if (rb < 0) {
+    int en = errno;
+
+    arc_err_cstrfmt(c, "error reading file (%s; errno=%d)", strerror(en), en);
+    ARETURN(CNIL);
+  }
+  if (rb == 0)
+    ARETURN(CNIL);
+  for (i=0; i<rb; i++)
+    XVINDEX(AV(vec), FIX2INT(AV(off)) + i) = INT2FIX(buf[i]);
+  ARETURN(INT2FIX(rb));
+  AFEND;
+}
+AFFEND
+
+static AFFDEF(fio_write)
+{
+  AARG(fio, vec, off, n);
+  unsigned char buf[FIO_BLOCKSIZE];
+  size_t wb;
+  int i, len;
+  AFBEGIN;
+  len = FIX2INT(AV(n));
+  if (len > FIO_BLOCKSIZE)
+    len = FIO_BLOCKSIZE;
+  for (i=0; i<len; i++)
+    buf[i] = (unsigned char)FIX2INT(XVINDEX(AV(vec), FIX2INT(AV(off)) + i));
+  wb = fwrite(buf, 1, len, FIODATA(AV(fio))->fp);
+  if (wb == 0 && len > 0) {
+    int en = errno;
+
+    arc_err_cstrfmt(c, "error writing file (%s; errno=%d)", strerror(en), en);
+    ARETURN(CNIL);
+  }
+  ARETURN(INT2FIX(wb));
+  AFEND;
+}
+AFFEND
+
 static AFFDEF(fio_putb)
 {
   AARG(fio, byte);
@@ -193,6 +296,27 @@ static AFFDEF(fio_seek)
     ARETURN(CNIL);
   }
 
+  if (IO(AV(fio))->rbuf != NULL) {
+    long long noff;
+    off_t rv;
+
+    /* The file offset is past whatever is still in the read buffer.
+       The buffer is discarded after seeking, as well as any
+       character pushed back with ungetc. */
+    if (!__arc_val2ll(c, AV(offset), &noff)) {
+      arc_err_cstrfmt(c, "invalid seek offset");
+      ARETURN(CNIL);
+    }
+    OBJLOCK(c, IO(AV(fio))->lock);
+    if (FIX2INT(AV(whence)) == SEEK_CUR)
+      noff -= IO(AV(fio))->rblen - IO(AV(fio))->rbpos;
+    rv = lseek(fileno(FIODATA(AV(fio))->fp), (off_t)noff, FIX2INT(AV(whence)));
+    IO(AV(fio))->rbpos = IO(AV(fio))->rblen = 0;
+    OBJUNLOCK(c, IO(AV(fio))->lock);
+    IO(AV(fio))->ungetrune = -1;
+    ARETURN(INT2FIX((rv < 0) ? -1 : 0));
+  }
+
 #ifdef HAVE_FSEEKO
   {
     long long noff;
@@ -222,6 +346,14 @@ static AFFDEF(fio_tell)
 {
   AARG(fio);
   AFBEGIN;
+  if (IO(AV(fio))->rbuf != NULL) {
+    off_t offset;
+
+    offset = lseek(fileno(FIODATA(AV(fio))->fp), 0, SEEK_CUR);
+    if (offset >= 0)
+      offset -= IO(AV(fio))->rblen - IO(AV(fio))->rbpos;
+    ARETURN(__arc_ll2val(c, (long long)offset));
+  }
 #ifdef HAVE_FSEEKO
   off_t offset;
 
@@ -237,6 +369,52 @@ static AFFDEF(fio_tell)
 }
 AFFEND
 
+/* Input ports are only read around stdio when they have a read
+   buffer, and output ports have to be flushed first. */
+static AFFDEF(fio_fd)
+{
+  AARG(fio);
+  AFBEGIN;
+  if (TYPE(AV(fio)) == T_INPORT && IO(AV(fio))->rbuf == NULL)
+    ARETURN(CNIL);
+  if (TYPE(AV(fio)) == T_OUTPORT)
+    fflush(FIODATA(AV(fio))->fp);
+  ARETURN(INT2FIX(fileno(FIODATA(AV(fio))->fp)));
+  AFEND;
+}
+AFFEND
+
+/* Have the kernel move up to count bytes from infd to outfd, with
+   splice(2) if infd is a pipe and sendfile(2) otherwise.  Returns the
+   number of bytes moved, 0 at end of file, or -1 with errno set.
+   errno is EINVAL or ENOSYS if the two cannot be copied this way. */
+long __arc_fdcopy(int infd, int outfd, long count)
+{
+  long rv;
+  struct stat st;
+
+  if (fstat(infd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+#ifdef HAVE_SPLICE
+    do {
+      rv = splice(infd, NULL, outfd, NULL, count, SPLICE_F_MOVE|SPLICE_F_MORE);
+    } while (rv < 0 && errno == EINTR);
+    return(rv);
+#else
+    errno = ENOSYS;
+    return(-1);
+#endif
+  }
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE)
+  do {
+    rv = sendfile(outfd, infd, NULL, count);
+  } while (rv < 0 && errno == EINTR);
+  return(rv);
+#else
+  errno = ENOSYS;
+  return(-1);
+#endif
+}
+
 static AFFDEF(pio_close)
 {
   AARG(fio);
@@ -273,6 +451,8 @@ static value mkfio(arc *c, int type, FILE *fd, value name)
   IO(fio)->name = name;
   FIODATA(fio)->closed = 0;
   FIODATA(fio)->fp = fd;
+  if (type == T_INPORT)
+    __arc_io_rbuf(c, fio);
   return(fio);
 }
 
@@ -373,6 +553,10 @@ void __arc_init_fio(arc *c)
   SVINDEX(io_ops, IO_seek, arc_mkaff(c, fio_seek, CNIL));
   SVINDEX(io_ops, IO_tell, arc_mkaff(c, fio_tell, CNIL));
   SVINDEX(io_ops, IO_close, arc_mkaff(c, fio_close, CNIL));
+  SVINDEX(io_ops, IO_fill, arc_mkaff(c, fio_fill, CNIL));
+  SVINDEX(io_ops, IO_read, arc_mkaff(c, fio_read, CNIL));
+  SVINDEX(io_ops, IO_write, arc_mkaff(c, fio_write, CNIL));
+  SVINDEX(io_ops, IO_fd, arc_mkaff(c, fio_fd, CNIL));
   SVINDEX(VINDEX(c->builtins, BI_io), BI_io_fp, io_ops);
 
   io_ops = arc_mkvector(c, IO_last+1);
@@ -384,6 +568,10 @@ void __arc_init_fio(arc *c)
   SVINDEX(io_ops, IO_seek, arc_mkaff(c, fio_seek, CNIL));
   SVINDEX(io_ops, IO_tell, arc_mkaff(c, fio_tell, CNIL));
   SVINDEX(io_ops, IO_close, arc_mkaff(c, pio_close, CNIL));
+  SVINDEX(io_ops, IO_fill, arc_mkaff(c, fio_fill, CNIL));
+  SVINDEX(io_ops, IO_read, arc_mkaff(c, fio_read, CNIL));
+  SVINDEX(io_ops, IO_write, arc_mkaff(c, fio_write, CNIL));
+  SVINDEX(io_ops, IO_fd, arc_mkaff(c, fio_fd, CNIL));
   SVINDEX(VINDEX(c->builtins, BI_io), BI_io_pfp, io_ops);
 
   arc_bindsym(c, ARC_BUILTIN(c, S_STDIN_FD),
@@ -16,13 +16,19 @@
   You should have received a copy of the GNU Lesser General Public
   License along with this library; if not, see <http://www.gnu.org/licenses/>.
 */
+#include <string.h>
 #include "arcueid.h"
 #include "alloc.h"
 #include "arith.h"
 #include "vmengine.h"
 #include "hash.h"
+#include "builtins.h"
 #include "../config.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #if SIZEOF_LONG >= 8
 
 /* This is the 64-bit hashing function defined by Bob Jenkins in
@@ -150,6 +156,9 @@ unsigned long arc_hash_increment(arc *c, value v, arc_hs *s)
   case T_SYMBOL:
     arc_hash_update(s, (unsigned long)SYM2ID(v));
     break;
+  case T_CHAR:
+    arc_hash_update(s, (unsigned long)CHAR2RUNE(v));
+    break;
   default:
     tfn = __arc_typefn(c, v);
     if (tfn->hash == NULL) {
@@ -177,24 +186,49 @@ unsigned long arc_hash(arc *c, value v)
   return(arc_hash_level(c, v, 0));
 }
 
-/* Arcueid's hash table data type.  A hash table is simply a four-tuple,
+/* Arcueid's hash table data type.  A hash table is simply a five-tuple,
    with the elements as follows:
 
    0 - The actual table itself (a vector)
    1 - Number of hash bits (a fixnum)
    2 - Number of entries total (a fixnum)
    3 - Load limit (a fixnum)
+   4 - Number of tombstones if this is a Swiss table (a fixnum), or
+       nil for any other table (see below)
+   5 - Lock of the table (see __arc_objlock)
+
+   Ordinary tables keep their entries in the table vector itself,
+   each slot taking three consecutive elements of it:
+
+   0 - The original hash value computed for the key (fixnum)
+   1 - The key of this element
+   2 - The value of this element
+
+   The key of a slot which is not in use is CUNBOUND or CUNDEF (see
+   below), so a lookup never has to look beyond the table vector.
 
-   Hash buckets are triples with the elements as follows:
+   Weak tables cannot do this, as their entries must go away once
+   nothing else refers to them.  The table vector of a weak table
+   instead holds hash buckets, objects with the elements as follows:
 
    0 - The index of the element in the current hash table (fixnum)
    1 - The key of this element
    2 - The value of this element
    3 - The table to which this element belongs
    4 - The original hash value computed for this element
+
+   Swiss tables are ordinary tables whose table vector is followed by
+   a control byte for every slot, after the last element of the
+   vector, where the garbage collector does not look.  The control
+   byte of a slot in use holds seven bits of the hash value of its
+   key, and the slots are searched sixteen at a time, comparing a
+   group of control bytes at once with SSE2 where it is available, so
+   that keys are only looked at when those seven bits match.  They
+   can be made with arc_mkstable, or from Arc with (swisstable), or
+   for every (table) with (declare 'swisstables t).
 */
 
-#define HASH_SIZE (4)
+#define HASH_SIZE (6)
 #define HASH_TABLE(t) (REP(t)[0])
 #define HASH_INDEX(t, i) (VINDEX(HASH_TABLE(t), (i)))
 #define HASH_BITS(t) (FIX2INT(REP(t)[1]))
@@ -203,6 +237,9 @@ unsigned long arc_hash(arc *c, value v)
 #define SET_HASHBITS(t, n) (REP(t)[1] = INT2FIX(n))
 #define SET_NENTRIES(t, n) (REP(t)[2] = INT2FIX(n))
 #define SET_LLIMIT(t, n) (REP(t)[3] = INT2FIX(n))
+#define HASH_TOMBSTONES(t) (FIX2INT(REP(t)[4]))
+#define SET_TOMBSTONES(t, n) (REP(t)[4] = INT2FIX(n))
+#define HASH_LOCK(t) (REP(t)[5])
 
 #define BUCKET_SIZE (5)
 #define BINDEX(t) (FIX2INT(REP(t)[0]))
@@ -212,9 +249,18 @@ unsigned long arc_hash(arc *c, value v)
 #define BTABLE(t) (REP(t)[3])
 #define BHASHVAL(t) (REP(t)[4])
 
+#define WEAKP(t) (TYPE(t) == T_WTABLE)
+#define SWISSP(t) (REP(t)[4] != CNIL)
+
+#define ENTRY_SIZE (3)
+#define EHASHVAL(v, i) (XVINDEX(v, (i)*ENTRY_SIZE))
+#define EKEY(v, i) (XVINDEX(v, (i)*ENTRY_SIZE+1))
+#define EVALUE(v, i) (XVINDEX(v, (i)*ENTRY_SIZE+2))
+
 #define HASHSIZE(n) ((unsigned long)1 << (n))
 #define HASHMASK(n) (HASHSIZE(n)-1)
 #define MAX_LOAD_FACTOR 70	/* percentage */
+#define SWISS_LOAD_FACTOR 87	/* percentage, for Swiss tables */
 /* linear probing */
 #define PROBE(i) (i)
 
@@ -229,6 +275,115 @@ unsigned long arc_hash(arc *c, value v)
    elements which remain unused. */
 #define EMPTYP(x) (((x) == CUNBOUND) || ((x) == CUNDEF))
 
+/* Swiss tables are searched a group of GROUP_SIZE slots at a time,
+   going from group to group in the same way as PROBE goes from slot
+   to slot.  The control byte of a slot is CTRL_EMPTY if it was never
+   used (its key is CUNBOUND), CTRL_DELETED if it is a tombstone (its
+   key is CUNDEF), or else CTRL_H2 of the hash value of its key.  The
+   group is chosen by the low bits of the hash value, and CTRL_H2 is
+   taken from bits which stay the same when it is kept as a fixnum. */
+#define GROUP_BITS 4
+#define GROUP_SIZE (1 << GROUP_BITS)
+#define NGROUPS(t) (TABLESIZE(t) >> GROUP_BITS)
+#define GROUPMASK(t) (NGROUPS(t)-1)
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+#define CTRL_H2(hv) (((hv) >> 24) & 0x7f)
+#define SCTRL(tv) ((unsigned char *)&XVINDEX((tv), VECLEN(tv)))
+#define GROUP_CTRL(tv, g) (SCTRL(tv) + (g)*GROUP_SIZE)
+
+/* Bit i of what these return is set if control byte i of the group
+   at ctrl is b, or if slot i is free (empty or a tombstone) */
+#if defined(__SSE2__)
+static inline unsigned int group_match(const unsigned char *ctrl,
+				       unsigned char b)
+{
+  __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+
+  return((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b))));
+}
+
+static inline unsigned int group_match_free(const unsigned char *ctrl)
+{
+  /* only CTRL_EMPTY and CTRL_DELETED have their top bit set */
+  return((unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl)));
+}
+#else
+static inline unsigned int group_match(const unsigned char *ctrl,
+				       unsigned char b)
+{
+  unsigned int m = 0;
+  int i;
+
+  for (i=0; i<GROUP_SIZE; i++)
+    m |= (unsigned)(ctrl[i] == b) << i;
+  return(m);
+}
+
+static inline unsigned int group_match_free(const unsigned char *ctrl)
+{
+  unsigned int m = 0;
+  int i;
+
+  for (i=0; i<GROUP_SIZE; i++)
+    m |= (unsigned)(ctrl[i] >> 7) << i;
+  return(m);
+}
+#endif
+
+/* The slots in group g of the table vector of a Swiss table which
+   hold keys whose hash value is hv, as a bit mask */
+static inline unsigned int swiss_candidates(value tv, unsigned int g,
+					    unsigned int hv)
+{
+  unsigned int m, r = 0;
+
+  for (m = group_match(GROUP_CTRL(tv, g), CTRL_H2(hv)); m != 0; m &= m-1) {
+    if (EHASHVAL(tv, g*GROUP_SIZE + __builtin_ctz(m)) == INT2FIX(hv))
+      r |= m & -m;
+  }
+  return(r);
+}
+
+/* The key, value and hash value in slot i of either kind of table.
+   The key is CUNBOUND or CUNDEF if the slot is empty. */
+static inline value slot_key(value hash, int i)
+{
+  value e;
+
+  if (!WEAKP(hash))
+    return(EKEY(HASH_TABLE(hash), i));
+  e = HASH_INDEX(hash, i);
+  return(EMPTYP(e) ? e : BKEY(e));
+}
+
+static inline value slot_value(value hash, int i)
+{
+  if (!WEAKP(hash))
+    return(EVALUE(HASH_TABLE(hash), i));
+  return(BVALUE(HASH_INDEX(hash, i)));
+}
+
+static inline value slot_hashval(value hash, int i)
+{
+  if (!WEAKP(hash))
+    return(EHASHVAL(HASH_TABLE(hash), i));
+  return(BHASHVAL(HASH_INDEX(hash, i)));
+}
+
+static void slot_setvalue(value hash, int i, value val)
+{
+  value e;
+
+  if (!WEAKP(hash)) {
+    SVINDEX(HASH_TABLE(hash), i*ENTRY_SIZE+2, val);
+    return;
+  }
+  e = HASH_INDEX(hash, i);
+  __arc_wb(BVALUE(e), val);
+  BVALUE(e) = val;
+}
+
 static AFFDEF(hash_pprint)
 {
   AARG(sexpr, disp, fp);
@@ -241,15 +396,15 @@ static AFFDEF(hash_pprint)
 
   if (!NIL_P(__arc_visit(c, AV(sexpr), AV(visithash)))) {
     /* already visited at some point. Do not recurse further */
-    AFTCALL(arc_mkaff(c, __arc_disp_write, CNIL), arc_mkstringc(c, "(...)"),
+    AFTCALLF(__arc_disp_write, arc_mkstringc(c, "(...)"),
 	   CTRUE, AV(fp), AV(visithash));
   }
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
-  WV(dw, arc_mkaff(c, __arc_disp_write, CNIL));
+  WV(wc, arc_aff(c, arc_writec));
+  WV(dw, arc_aff(c, __arc_disp_write));
   AFCALL(AV(dw), arc_mkstringc(c, "#hash("), CTRUE, AV(fp), CNIL);
   WV(state, CNIL);
   for (;;) {
-    AFCALL(arc_mkaff(c, arc_xhash_iter, CNIL), AV(sexpr), AV(state));
+    AFCALLF(arc_xhash_iter, AV(sexpr), AV(state));
     WV(state, AFCRV);
     if (NIL_P(AV(state)))
       goto finished;
@@ -326,15 +481,16 @@ static AFFDEF(hash_isocmp)
   /* Two hash tables must have identical numbers of entries to be isomorphic */
   if (HASH_NENTRIES(AV(v1)) != HASH_NENTRIES(AV(v2)))
     ARETURN(CNIL);
-  WV(tbl, HASH_TABLE(AV(v1)));
-  WV(iso2, arc_mkaff(c, arc_iso2, CNIL));
-  for (WV(i, INT2FIX(0)); FIX2INT(AV(i))<VECLEN(AV(tbl));
+  WV(tbl, AV(v1));
+  WV(iso2, arc_aff(c, arc_iso2));
+  for (WV(i, INT2FIX(0)); FIX2INT(AV(i))<TABLESIZE(AV(tbl));
        WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
-    WV(e, VINDEX(AV(tbl), FIX2INT(AV(i))));
+    WV(e, slot_key(AV(tbl), FIX2INT(AV(i))));
     if (EMPTYP(AV(e)))
       continue;
-    WV(v2val, arc_hash_lookup(c, AV(v2), BKEY(AV(e))));
-    AFCALL(AV(iso2), BVALUE(AV(e)), AV(v2val), AV(vh1), AV(vh2));
+    WV(v2val, arc_hash_lookup(c, AV(v2), AV(e)));
+    AFCALL(AV(iso2), slot_value(AV(tbl), FIX2INT(AV(i))), AV(v2val),
+	   AV(vh1), AV(vh2));
     if (NIL_P(AFCRV))
       ARETURN(CNIL);
   }
@@ -347,7 +503,7 @@ static AFFDEF(xhash_apply)
 {
   AARG(tbl, key, dflt);
   AFBEGIN;
-  AFCALL(arc_mkaff(c, arc_xhash_lookup, CNIL), AV(tbl), AV(key));
+  AFCALLF(arc_xhash_lookup, AV(tbl), AV(key));
   if (BOUND_P(AFCRV))
     ARETURN(AFCRV);
   ARETURN(AV(dflt));
@@ -355,10 +511,15 @@ static AFFDEF(xhash_apply)
 }
 AFFEND
 
-/* A hash can be applied with an index and an optional default value */
+/* A hash can be applied with an index and an optional default value.
+   This runs without the runtime lock under the SMP dispatcher (see
+   vmengine.c), so keys which arc_hash hashes the same way as
+   arc_xhash and which arc_is2 compares the same way as arc_iso are
+   looked up here, under the lock of the table.  Any other key needs
+   xhash_apply, which runs with the runtime lock. */
 static int hash_apply(arc *c, value thr, value tbl)
 {
-  value key, dflt = CNIL;
+  value key, val, dflt = CNIL;
 
   if (arc_thr_argc(c, thr) == 2) {
     dflt = arc_thr_pop(c, thr);
@@ -368,9 +529,15 @@ static int hash_apply(arc *c, value thr, value tbl)
     return(TR_RC);
   }
   key = arc_thr_pop(c, thr);
+  if (TYPE(key) == T_FIXNUM || TYPE(key) == T_SYMBOL
+      || TYPE(key) == T_STRING) {
+    val = arc_hash_lookup(c, tbl, key);
+    arc_thr_set_valr(c, thr, BOUND_P(val) ? val : dflt);
+    return(TR_RC);
+  }
   /* This is one way one can make a tail call from a non-AFF. */
   __arc_mkenv(c, thr, 0, 0);	/* null env required */
-  __arc_affapply(c, thr, CNIL, arc_mkaff(c, xhash_apply, CNIL), tbl, key, dflt,
+  __arc_affapply(c, thr, CNIL, arc_aff(c, xhash_apply), tbl, key, dflt,
 		 CLASTARG);
   return(TR_FNAPP);
 }
@@ -378,43 +545,117 @@ static int hash_apply(arc *c, value thr, value tbl)
 int arc_hash_length(arc *c, value hash)
 {
   int count, i;
-  value e, tbl;
 
   count = 0;
-  tbl = HASH_TABLE(hash);
-  for (i=0; i<VECLEN(tbl); i++) {
-    e = VINDEX(tbl, i);
-    if (EMPTYP(e))
+  for (i=0; i<TABLESIZE(hash); i++) {
+    if (EMPTYP(slot_key(hash, i)))
       continue;
     count++;
   }
   return(count);
 }
 
-value arc_mkhash(arc *c, int hashbits)
+/* Make an empty table vector with 2^hashbits slots */
+static value mktablevec(arc *c, int weak, int hashbits)
 {
-  value hash, hv;
+  value tv;
   int i;
 
-  hash = arc_mkobject(c, sizeof(value)*HASH_SIZE, T_TABLE);
+  if (weak) {
+    tv = arc_mkvector(c, HASHSIZE(hashbits));
+    ((struct cell *)tv)->_type = T_TABLEVEC;
+    for (i=0; i<HASHSIZE(hashbits); i++)
+      XVINDEX(tv, i) = CUNBOUND;
+    return(tv);
+  }
+  tv = arc_mkvector(c, HASHSIZE(hashbits)*ENTRY_SIZE);
+  for (i=0; i<HASHSIZE(hashbits); i++)
+    EKEY(tv, i) = CUNBOUND;
+  return(tv);
+}
+
+/* Make an empty table vector for a Swiss table with 2^hashbits slots,
+   with their control bytes after it */
+static value mkswissvec(arc *c, int hashbits)
+{
+  value tv;
+  int i, len = HASHSIZE(hashbits)*ENTRY_SIZE;
+
+  tv = arc_mkobject(c, (len+1)*sizeof(value) + HASHSIZE(hashbits), T_VECTOR);
+  REP(tv)[0] = INT2FIX(len);
+  for (i=0; i<len; i++)
+    XVINDEX(tv, i) = CNIL;
+  for (i=0; i<HASHSIZE(hashbits); i++)
+    EKEY(tv, i) = CUNBOUND;
+  memset(SCTRL(tv), CTRL_EMPTY, HASHSIZE(hashbits));
+  return(tv);
+}
+
+static int load_limit(value hash, int hashbits)
+{
+  if (SWISSP(hash))
+    return((HASHSIZE(hashbits)*SWISS_LOAD_FACTOR) / 100);
+  return((HASHSIZE(hashbits)*MAX_LOAD_FACTOR) / 100);
+}
+
+static value mktable(arc *c, int hashbits, int type, int swiss)
+{
+  value hash, hv;
+
+  hash = arc_mkobject(c, sizeof(value)*HASH_SIZE, type);
+  REP(hash)[4] = CNIL;
+  HASH_LOCK(hash) = INT2FIX(0);
+  if (swiss) {
+    /* at least one whole group */
+    if (hashbits < GROUP_BITS)
+      hashbits = GROUP_BITS;
+    SET_TOMBSTONES(hash, 0);
+    hv = mkswissvec(c, hashbits);
+  } else {
+    hv = mktablevec(c, type == T_WTABLE, hashbits);
+  }
   SET_HASHBITS(hash, hashbits);
   SET_NENTRIES(hash, 0);
-  SET_LLIMIT(hash, (HASHSIZE(hashbits)*MAX_LOAD_FACTOR) / 100);
-  hv = arc_mkvector(c, HASHSIZE(hashbits));
-  ((struct cell *)hv)->_type = T_TABLEVEC;
+  SET_LLIMIT(hash, load_limit(hash, hashbits));
   HASH_TABLE(hash) = hv;
-  
-  for (i=0; i<HASHSIZE(hashbits); i++)
-    XVINDEX(HASH_TABLE(hash), i) = CUNBOUND;
   return(hash);
 }
 
+value arc_mkhash(arc *c, int hashbits)
+{
+  return(mktable(c, hashbits, T_TABLE, 0));
+}
+
+/* Make a Swiss table */
+value arc_mkstable(arc *c, int hashbits)
+{
+  return(mktable(c, hashbits, T_TABLE, 1));
+}
+
+/* (table) makes Swiss tables if swisstables has been declared */
 AFFDEF(arc_newtable)
 {
   AOARG(constructor);
   AVAR(tbl);
   AFBEGIN;
-  WV(tbl, arc_mkhash(c, ARC_HASHBITS));
+  if (arc_declared(c, ARC_BUILTIN(c, S_SWISSTABLES)) == CTRUE)
+    WV(tbl, arc_mkstable(c, ARC_HASHBITS));
+  else
+    WV(tbl, arc_mkhash(c, ARC_HASHBITS));
+  if (BOUND_P(AV(constructor))) {
+    AFCALL(AV(constructor), AV(tbl));
+  }
+  ARETURN(AV(tbl));
+  AFEND;
+}
+AFFEND
+
+AFFDEF(arc_newstable)
+{
+  AOARG(constructor);
+  AVAR(tbl);
+  AFBEGIN;
+  WV(tbl, arc_mkstable(c, ARC_HASHBITS));
   if (BOUND_P(AV(constructor))) {
     AFCALL(AV(constructor), AV(tbl));
   }
@@ -430,30 +671,81 @@ static void hashtable_expand(arc *c, value hash)
   value oldtbl, newtbl, e;
 
   nhashbits = HASH_BITS(hash) + 1;
-  newtbl = arc_mkvector(c, HASHSIZE(nhashbits));
-  ((struct cell *)newtbl)->_type = T_TABLEVEC;
-  for (i=0; i<HASHSIZE(nhashbits); i++)
-    XVINDEX(newtbl, i) = CUNBOUND;
+  newtbl = mktablevec(c, WEAKP(hash), nhashbits);
   oldtbl = HASH_TABLE(hash);
   /* Search for active keys and move them into the new table */
-  for (i=0; i<VECLEN(oldtbl); i++) {
-    e = VINDEX(oldtbl, i);
-    if (EMPTYP(e))
+  for (i=0; i<TABLESIZE(hash); i++) {
+    if (EMPTYP(slot_key(hash, i)))
+      continue;
+    hv = (unsigned int)FIX2INT(slot_hashval(hash, i));
+    index = hv & HASHMASK(nhashbits);
+    if (!WEAKP(hash)) {
+      for (j=0; EKEY(newtbl, index) != CUNBOUND; j++)
+	index = (index + PROBE(j)) & HASHMASK(nhashbits);
+      EHASHVAL(newtbl, index) = EHASHVAL(oldtbl, i);
+      SVINDEX(newtbl, index*ENTRY_SIZE+1, EKEY(oldtbl, i));
+      SVINDEX(newtbl, index*ENTRY_SIZE+2, EVALUE(oldtbl, i));
       continue;
+    }
+    e = VINDEX(oldtbl, i);
     /* remove the old link now that we have a copy */
     SVINDEX(oldtbl, i, CUNBOUND);
-    /* insert the old key into the new table */
-    hv = (unsigned int)FIX2INT(BHASHVAL(e));
-    index = hv & HASHMASK(nhashbits);
+    /* insert the old bucket into the new table */
     for (j=0; !EMPTYP(VINDEX(newtbl, index)); j++)
       index = (index + PROBE(j)) & HASHMASK(nhashbits);
+    __arc_wb(BTABLE(e), newtbl);
     BTABLE(e) = newtbl;
     XVINDEX(newtbl, index) =  e;
     SBINDEX(e, index);		/* change index */
     SVINDEX(oldtbl, i, CUNBOUND);
   }
   SET_HASHBITS(hash, nhashbits);
-  SET_LLIMIT(hash, (HASHSIZE(nhashbits)*MAX_LOAD_FACTOR) / 100);
+  SET_LLIMIT(hash, load_limit(hash, nhashbits));
+  __arc_wb(HASH_TABLE(hash), newtbl);
+  HASH_TABLE(hash) = newtbl;
+}
+
+/* Find a free slot in the table vector of a Swiss table with 2^hashbits
+   slots for a key whose hash value is hv */
+static int swiss_free_slot(value tv, int hashbits, unsigned int hv)
+{
+  unsigned int g, i, m, gmask = HASHMASK(hashbits - GROUP_BITS);
+
+  g = hv & gmask;
+  for (i=0;; i++) {
+    g = (g + PROBE(i)) & gmask;
+    m = group_match_free(GROUP_CTRL(tv, g));
+    if (m != 0)
+      return(g*GROUP_SIZE + __builtin_ctz(m));
+  }
+}
+
+/* Move the entries of a Swiss table into a new table vector with
+   2^nhashbits slots, which may be the same size as the old one if it
+   is only being rid of tombstones.  The keys are not hashed again, as
+   their hash values are kept in the table. */
+static void swiss_rebuild(arc *c, value hash, int nhashbits)
+{
+  value oldtbl, newtbl;
+  unsigned int hv;
+  int i, index;
+
+  oldtbl = HASH_TABLE(hash);
+  newtbl = mkswissvec(c, nhashbits);
+  for (i=0; i<TABLESIZE(hash); i++) {
+    if (SCTRL(oldtbl)[i] & CTRL_EMPTY)
+      continue;
+    hv = (unsigned int)FIX2INT(EHASHVAL(oldtbl, i));
+    index = swiss_free_slot(newtbl, nhashbits, hv);
+    SCTRL(newtbl)[index] = SCTRL(oldtbl)[i];
+    EHASHVAL(newtbl, index) = EHASHVAL(oldtbl, i);
+    SVINDEX(newtbl, index*ENTRY_SIZE+1, EKEY(oldtbl, i));
+    SVINDEX(newtbl, index*ENTRY_SIZE+2, EVALUE(oldtbl, i));
+  }
+  SET_HASHBITS(hash, nhashbits);
+  SET_LLIMIT(hash, load_limit(hash, nhashbits));
+  SET_TOMBSTONES(hash, 0);
+  __arc_wb(HASH_TABLE(hash), newtbl);
   HASH_TABLE(hash) = newtbl;
 }
 
@@ -473,6 +765,14 @@ static void hb_sweeper(arc *c, value v)
     value t = BTABLE(v);
 
     SVINDEX(t, BINDEX(v), CUNDEF);
+    /* Buckets of the symbol tables are also referenced by the
+       symbol array, which must forget them. */
+    if (c->symbols == NULL)
+      return;
+    if (!NIL_P(c->symtable) && t == HASH_TABLE(c->symtable))
+      c->symbols[FIX2INT(BVALUE(v))].fwd = CNIL;
+    else if (!NIL_P(c->rsymtable) && t == HASH_TABLE(c->rsymtable))
+      c->symbols[FIX2INT(BKEY(v))].rev = CNIL;
   }
 }
 
@@ -493,113 +793,241 @@ static value mkhashbucket(arc *c, value key, value val, int index, value table,
   return(bucket);
 }
 
-static value hash_lookup(arc *c, value hash, value key, unsigned int *index)
+/* Put a new entry into the empty slot index of a table */
+static void slot_insert(arc *c, value hash, int index, value key, value val,
+			value hashcode)
 {
-  unsigned int hv, i;
-  value e;
+  value tv = HASH_TABLE(hash);
 
-  hv = arc_hash(c, key);
-  *index = hv & TABLEMASK(hash);
-  for (i=0;; i++) {
-    *index = (*index + PROBE(i)) & TABLEMASK(hash);
-    e = HASH_INDEX(hash, *index);
+  if (WEAKP(hash)) {
+    SVINDEX(tv, index, mkhashbucket(c, key, val, index, hash, hashcode));
+    return;
+  }
+  EHASHVAL(tv, index) = hashcode;
+  SVINDEX(tv, index*ENTRY_SIZE+1, key);
+  SVINDEX(tv, index*ENTRY_SIZE+2, val);
+  if (SWISSP(hash)) {
+    if (SCTRL(tv)[index] == CTRL_DELETED)
+      SET_TOMBSTONES(hash, HASH_TOMBSTONES(hash)-1);
+    SCTRL(tv)[index] = CTRL_H2((unsigned int)FIX2INT(hashcode));
+  }
+}
+
+/* Remove the entry in slot index of a table, leaving a tombstone.  A
+   Swiss table only needs one if the group of the slot has no empty
+   slots: a search which reaches a group with an empty slot stops
+   there, so no search can have gone past it to find a key.  Groups
+   with an empty slot never lose it until the table is rebuilt. */
+static void slot_delete(arc *c, value hash, int index)
+{
+  value tv = HASH_TABLE(hash);
+
+  if (WEAKP(hash)) {
+    BTABLE(VINDEX(tv, index)) = CNIL;
+    SVINDEX(tv, index, CUNDEF);
+  } else if (SWISSP(hash)) {
+    if (group_match(GROUP_CTRL(tv, index >> GROUP_BITS), CTRL_EMPTY) != 0) {
+      SCTRL(tv)[index] = CTRL_EMPTY;
+      SVINDEX(tv, index*ENTRY_SIZE+1, CUNBOUND);
+    } else {
+      SCTRL(tv)[index] = CTRL_DELETED;
+      SVINDEX(tv, index*ENTRY_SIZE+1, CUNDEF);
+      SET_TOMBSTONES(hash, HASH_TOMBSTONES(hash)+1);
+    }
+    SVINDEX(tv, index*ENTRY_SIZE+2, CNIL);
+  } else {
+    SVINDEX(tv, index*ENTRY_SIZE+1, CUNDEF);
+    SVINDEX(tv, index*ENTRY_SIZE+2, CNIL);
+  }
+  SET_NENTRIES(hash, HASH_NENTRIES(hash)-1);
+}
+
+/* Look for key, whose hash value is hv, in a Swiss table.  Works the
+   same way as hash_find below, except that the insertion slot is the
+   first free one, which may be empty rather than a tombstone. */
+static int swiss_find(arc *c, value hash, value key, unsigned int hv,
+		      int *ins)
+{
+  value tv = HASH_TABLE(hash);
+  unsigned int g, i, m;
+  int index;
+
+  *ins = -1;
+  g = hv & GROUPMASK(hash);
+  for (i=0; i<NGROUPS(hash); i++) {
+    g = (g + PROBE(i)) & GROUPMASK(hash);
+    for (m = swiss_candidates(tv, g, hv); m != 0; m &= m-1) {
+      index = g*GROUP_SIZE + __builtin_ctz(m);
+      if (arc_is2(c, EKEY(tv, index), key) == CTRUE)
+	return(index);
+    }
+    if (*ins < 0 && (m = group_match_free(GROUP_CTRL(tv, g))) != 0)
+      *ins = g*GROUP_SIZE + __builtin_ctz(m);
+    /* an empty slot means the key was never put any further along */
+    if (group_match(GROUP_CTRL(tv, g), CTRL_EMPTY) != 0)
+      break;
+  }
+  return(-1);
+}
+
+/* Look for key, whose hash value is hv, in a table.  Returns the index
+   of the slot holding it, or -1 if it is not there.  In that case,
+   *ins is set to the slot where it should be inserted: the first
+   tombstone found along the way, or else the empty slot which ended
+   the search.  The hash values of the keys are kept in the table, so
+   keys are only compared when the hash values match. */
+static int hash_find(arc *c, value hash, value key, unsigned int hv, int *ins)
+{
+  unsigned int index, i;
+  value k, fhv = INT2FIX(hv);
+
+  if (SWISSP(hash))
+    return(swiss_find(c, hash, key, hv, ins));
+  *ins = -1;
+  index = hv & TABLEMASK(hash);
+  for (i=0; i<TABLESIZE(hash); i++) {
+    index = (index + PROBE(i)) & TABLEMASK(hash);
+    k = slot_key(hash, index);
     /* CUNBOUND means there was never any element at that index, so we
        can stop. */
-    if (e == CUNBOUND)
-      return(CUNBOUND);
+    if (k == CUNBOUND)
+      break;
     /* CUNDEF means that there was an element at that index, but it was
        deleted at some point, so we may need to continue probing. */
-    if (e == CUNDEF)
+    if (k == CUNDEF) {
+      if (*ins < 0)
+	*ins = index;
       continue;
-    if (arc_is2(c, BKEY(e), key) == CTRUE)
-      return(BVALUE(e));
+    }
+    if (slot_hashval(hash, index) == fhv && arc_is2(c, k, key) == CTRUE)
+      return(index);
+  }
+  if (*ins < 0)
+    *ins = index;
+  return(-1);
+}
+
+/* Find the slot for a key known not to be in a table */
+static int hash_free_slot(value hash, unsigned int hv)
+{
+  unsigned int index, i;
+
+  if (SWISSP(hash))
+    return(swiss_free_slot(HASH_TABLE(hash), HASH_BITS(hash), hv));
+  index = hv & TABLEMASK(hash);
+  for (i=0;; i++) {
+    index = (index + PROBE(i)) & TABLEMASK(hash);
+    if (EMPTYP(slot_key(hash, index)))
+      return(index);
   }
-  return(CUNBOUND);
+}
+
+/* Add a new entry for key, which is not in the table, at slot ins
+   unless the table has to be expanded first.  Tombstones count
+   against the load limit of a Swiss table, and if they are what takes
+   it over, it is rebuilt at the same size to get rid of them. */
+static void hash_add(arc *c, value hash, value key, value val,
+		     unsigned int hv, int ins)
+{
+  if (SWISSP(hash)) {
+    if (SCTRL(HASH_TABLE(hash))[ins] == CTRL_EMPTY
+	&& HASH_NENTRIES(hash) + HASH_TOMBSTONES(hash) + 1 > HASH_LLIMIT(hash)) {
+      if ((HASH_NENTRIES(hash)+1)*2 <= HASH_LLIMIT(hash))
+	swiss_rebuild(c, hash, HASH_BITS(hash));
+      else
+	swiss_rebuild(c, hash, HASH_BITS(hash)+1);
+      ins = hash_free_slot(hash, hv);
+    }
+  } else if (HASH_NENTRIES(hash)+1 > HASH_LLIMIT(hash)) {
+    hashtable_expand(c, hash);
+    ins = hash_free_slot(hash, hv);
+  }
+  SET_NENTRIES(hash, HASH_NENTRIES(hash)+1);
+  slot_insert(c, hash, ins, key, val, INT2FIX(hv));
+}
+
+static value hash_lookup(arc *c, value hash, value key, unsigned int hv,
+			 int *index)
+{
+  int ins;
+
+  *index = hash_find(c, hash, key, hv, &ins);
+  return((*index < 0) ? CUNBOUND : slot_value(hash, *index));
 }
 
 /* These functions will only work for simple keys for which a basic hash
    is available.  They are a convenience because most hash tables are
    indexed by strings, symbols, numbers, and other simple objects.  In
-   particular, symbol tables are indexed in that way. */
+   particular, symbol tables are indexed in that way.  They hold the
+   lock of the table while they look at it, so they may be used
+   without the runtime lock.  The key is hashed before the lock is
+   taken, as that can raise an error. */
 
 value arc_hash_insert(arc *c, value hash, value key, value val)
 {
-  unsigned int hv, index, i;
-  value e;
+  unsigned int hv;
+  int index, ins;
 
-  index = 0;
-  /* First of all, look for the key if a binding already exists for it */
-  e = hash_lookup(c, hash, key, &index);
-  if (BOUND_P(e)) {
-    /* if we are already bound, overwrite the old value */
-    e = VINDEX(HASH_TABLE(hash), index);
-    BVALUE(e) = val;
-    return(val);
-  }
-  /* Not yet bound.  Look for a slot where we can put it */
-  if (HASH_NENTRIES(hash)+1 > HASH_LLIMIT(hash))
-    hashtable_expand(c, hash);
-  SET_NENTRIES(hash, HASH_NENTRIES(hash)+1);
+  /* The key is hashed only once, whether or not it is already there */
   hv = arc_hash(c, key);
-  index = hv & TABLEMASK(hash);
-  for (i=0;; i++) {
-    e = VINDEX(HASH_TABLE(hash), index);
-    /* If we see an empty bucket in our search, or if we see a bucket
-       whose key is the same as the key specified, we have found the
-       place where the element should go. This second case should never
-       happen, based on what we did above, but hey, belt and suspenders. */
-    if (EMPTYP(e) || arc_is2(c, BKEY(e), key) == CTRUE)
-      break;
-    /* We found a bucket, but it is occupied by some other key. Continue
-       probing. */
-    index = (index + PROBE(i)) & TABLEMASK(hash);
-  }
-
-  if (EMPTYP(e)) {
-    /* No such key in the hash table yet.  Create a bucket and
-       assign it to the table. */
-    e = mkhashbucket(c, key, val, index, hash, INT2FIX(hv));
-    SVINDEX(HASH_TABLE(hash), index, e);
+  OBJLOCK(c, HASH_LOCK(hash));
+  index = hash_find(c, hash, key, hv, &ins);
+  if (index >= 0) {
+    /* if we are already bound, overwrite the old value */
+    slot_setvalue(hash, index, val);
   } else {
-    /* The key already exists.  Use the current bucket but change the
-       value to the value specified. */
-    BVALUE(e) = val;
+    /* Not yet bound.  Put it where the search for it ended. */
+    hash_add(c, hash, key, val, hv, ins);
   }
+  OBJUNLOCK(c, HASH_LOCK(hash));
   return(val);
 }
 
 value arc_hash_lookup(arc *c, value tbl, value key)
 {
-  unsigned int index;
+  unsigned int hv;
+  int index;
+  value val;
 
-  return(hash_lookup(c, tbl, key, &index));
+  hv = arc_hash(c, key);
+  OBJLOCK(c, HASH_LOCK(tbl));
+  val = hash_lookup(c, tbl, key, hv, &index);
+  OBJUNLOCK(c, HASH_LOCK(tbl));
+  return(val);
 }
 
 /* Slightly different version which returns the actual hash bucket
-   with the key and value if a binding is available. */
+   with the key and value if a binding is available.  Only weak tables
+   have buckets, so this is only meaningful for them. */
 value arc_hash_lookup2(arc *c, value hash, value key)
 {
-  unsigned int index;
+  unsigned int hv;
+  int index;
   value val;
 
-  val = hash_lookup(c, hash, key, &index);
-  if (val == CUNBOUND)
-    return(CUNBOUND);
-  return(HASH_INDEX(hash, index));
+  hv = arc_hash(c, key);
+  OBJLOCK(c, HASH_LOCK(hash));
+  val = hash_lookup(c, hash, key, hv, &index);
+  if (val != CUNBOUND && WEAKP(hash))
+    val = HASH_INDEX(hash, index);
+  else
+    val = CUNBOUND;
+  OBJUNLOCK(c, HASH_LOCK(hash));
+  return(val);
 }
 
 value arc_hash_delete(arc *c, value hash, value key)
 {
-  unsigned int index;
-  value v, e;
+  unsigned int hv;
+  int index;
+  value v;
 
-  v = hash_lookup(c, hash, key, &index);
-  if (v != CUNBOUND) {
-    e = VINDEX(HASH_TABLE(hash), index);
-    BTABLE(e) = CNIL;
-    SVINDEX(HASH_TABLE(hash), index, CUNDEF);
-    SET_NENTRIES(hash, HASH_NENTRIES(hash)-1);
-  }
+  hv = arc_hash(c, key);
+  OBJLOCK(c, HASH_LOCK(hash));
+  v = hash_lookup(c, hash, key, hv, &index);
+  if (v != CUNBOUND)
+    slot_delete(c, hash, index);
+  OBJUNLOCK(c, HASH_LOCK(hash));
   return(v);
 }
 
@@ -678,7 +1106,7 @@ AFFDEF(arc_xhash_increment)
       WV(length, INT2FIX(tfn->hash(c, AV(v), &hs)));
     else if (tfn->xhash != NULL) {
       encode_hs(c, AV(ehs), &hs);
-      AFTCALL(arc_mkaff(c, tfn->xhash, CNIL), AV(v), AV(ehs), AV(length), AV(visithash));
+      AFTCALLF(tfn->xhash, AV(v), AV(ehs), AV(length), AV(visithash));
     } else {
       arc_err_cstrfmt(c, "no type-specific hasher found for type %d", TYPE(v));
     }
@@ -703,7 +1131,7 @@ AFFDEF(arc_xhash)
     WV(level, INT2FIX(0));
   arc_hash_init(&s, FIX2INT(AV(level)));
   encode_hs(c, AV(ehs), &s);
-  AFCALL(arc_mkaff(c, arc_xhash_increment, CNIL), AV(v), AV(ehs));
+  AFCALLF(arc_xhash_increment, AV(v), AV(ehs));
   len = AFCRV;
   decode_hs(c, &s, AV(ehs));
   final = arc_hash_final(&s, FIX2INT(len));
@@ -712,44 +1140,93 @@ AFFDEF(arc_xhash)
 }
 AFFEND
 
-/* Returns unbound or the hash bucket */
-AFFDEF(xhash_lookup)
+/* The hash value of a key as kept in a table.  Only the low bits of
+   what arc_xhash computes are kept, the same as arc_hash. */
+#define XHASHVAL(v) ((unsigned int)FIX2INT(v))
+
+/* AFF version of hash_find.  Given the hash value hv of key, returns
+   the index of the slot holding it, or if it is not there, -(ins+1)
+   where ins is the slot where it should be inserted. */
+static AFFDEF(xhash_find)
 {
-  AARG(hash, key);
-  AVAR(e, index, i);
-  unsigned int hv;
+  AARG(hash, key, hv);
+  AVAR(k, index, i, ins);
   AFBEGIN;
-  AFCALL(arc_mkaff(c, arc_xhash, CNIL), AV(key));
-  hv = FIX2INT(AFCRV);
-  WV(index, INT2FIX(hv & TABLEMASK(AV(hash))));
-  for (WV(i, INT2FIX(0));; WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
+  WV(ins, INT2FIX(-1));
+  WV(index, INT2FIX(XHASHVAL(AV(hv)) & TABLEMASK(AV(hash))));
+  for (WV(i, INT2FIX(0)); FIX2INT(AV(i)) < TABLESIZE(AV(hash));
+       WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
     WV(index, INT2FIX((FIX2INT(AV(index)) + PROBE(FIX2INT(AV(i)))) & TABLEMASK(AV(hash))));
-    WV(e, HASH_INDEX(AV(hash), FIX2INT(AV(index))));
+    WV(k, slot_key(AV(hash), FIX2INT(AV(index))));
     /* CUNBOUND means there was never any element at that index, so we
        can stop. */
-    if (AV(e) == CUNBOUND)
-      ARETURN(CUNBOUND);
+    if (AV(k) == CUNBOUND)
+      break;
     /* CUNDEF means that there was an element at that index, but it was
        deleted at some point, so we may need to continue probing. */
-    if (AV(e) == CUNDEF)
+    if (AV(k) == CUNDEF) {
+      if (FIX2INT(AV(ins)) < 0)
+	WV(ins, AV(index));
+      continue;
+    }
+    if (slot_hashval(AV(hash), FIX2INT(AV(index)))
+	!= INT2FIX(XHASHVAL(AV(hv))))
       continue;
-    AFCALL(arc_mkaff(c, arc_iso, CNIL), BKEY(AV(e)), AV(key));
+    AFCALLF(arc_iso, AV(k), AV(key));
     if (AFCRV == CTRUE)
-      ARETURN(cons(c, AV(index), AV(e)));
+      ARETURN(AV(index));
   }
-  ARETURN(CUNBOUND);
+  if (FIX2INT(AV(ins)) < 0)
+    WV(ins, AV(index));
+  ARETURN(INT2FIX(-FIX2INT(AV(ins)) - 1));
   AFEND;
 }
 AFFEND
 
-AFFDEF(arc_xhash_lookup2)
+/* AFF version of swiss_find, returning the same as xhash_find */
+static AFFDEF(xswiss_find)
 {
-  AARG(tbl, key);
+  AARG(hash, key, hv);
+  AVAR(g, i, m, index, ins);
+  unsigned int mfree;
   AFBEGIN;
-  AFCALL(arc_mkaff(c, xhash_lookup, CNIL), AV(tbl), AV(key));
-  if (BOUND_P(AFCRV))
-    ARETURN(cdr(AFCRV));
-  ARETURN(CUNBOUND);
+  WV(ins, INT2FIX(-1));
+  WV(g, INT2FIX(XHASHVAL(AV(hv)) & GROUPMASK(AV(hash))));
+  for (WV(i, INT2FIX(0)); FIX2INT(AV(i)) < NGROUPS(AV(hash));
+       WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
+    WV(g, INT2FIX((FIX2INT(AV(g)) + PROBE(FIX2INT(AV(i)))) & GROUPMASK(AV(hash))));
+    WV(m, INT2FIX(swiss_candidates(HASH_TABLE(AV(hash)), FIX2INT(AV(g)),
+				   XHASHVAL(AV(hv)))));
+    while (AV(m) != INT2FIX(0)) {
+      WV(index, INT2FIX(FIX2INT(AV(g))*GROUP_SIZE
+			+ __builtin_ctz(FIX2INT(AV(m)))));
+      WV(m, INT2FIX(FIX2INT(AV(m)) & (FIX2INT(AV(m)) - 1)));
+      AFCALLF(arc_iso, slot_key(AV(hash), FIX2INT(AV(index))), AV(key));
+      if (AFCRV == CTRUE)
+	ARETURN(AV(index));
+    }
+    mfree = group_match_free(GROUP_CTRL(HASH_TABLE(AV(hash)), FIX2INT(AV(g))));
+    if (FIX2INT(AV(ins)) < 0 && mfree != 0)
+      WV(ins, INT2FIX(FIX2INT(AV(g))*GROUP_SIZE + __builtin_ctz(mfree)));
+    /* an empty slot means the key was never put any further along */
+    if (group_match(GROUP_CTRL(HASH_TABLE(AV(hash)), FIX2INT(AV(g))),
+		    CTRL_EMPTY) != 0)
+      break;
+  }
+  ARETURN(INT2FIX(-FIX2INT(AV(ins)) - 1));
+  AFEND;
+}
+AFFEND
+
+/* Returns the index of the slot holding key, or a negative fixnum if
+   it is not there (see xhash_find) */
+static AFFDEF(xhash_lookup)
+{
+  AARG(hash, key);
+  AFBEGIN;
+  AFCALLF(arc_xhash, AV(key));
+  AFTCALLF(SWISSP(AV(hash)) ? xswiss_find : xhash_find, AV(hash), AV(key),
+	   AFCRV);
   AFEND;
 }
 AFFEND
@@ -757,51 +1234,42 @@ AFFEND
 AFFDEF(arc_xhash_insert)
 {
   AARG(hash, key, val);
-  AVAR(hv, index, i, e);
+  AVAR(hv, tbl);
+  value index;
+  int ins, done;
   AFBEGIN;
 
-  /* First, look for the key if a binding already exists for it */
-  AFCALL(arc_mkaff(c, arc_xhash_lookup2, CNIL), AV(hash), AV(key));
-  if (BOUND_P(AFCRV)) {
-    WV(e, AFCRV);
-    BVALUE(AV(e)) = AV(val);
-    ARETURN(AV(val));
-  }
-
-  /* Not already bound, so we need to create a new binding */
-  if (HASH_NENTRIES(AV(hash))+1 > HASH_LLIMIT(AV(hash)))
-    hashtable_expand(c, AV(hash));
-  SET_NENTRIES(AV(hash), HASH_NENTRIES(AV(hash))+1);
-  AFCALL(arc_mkaff(c, arc_xhash, CNIL), AV(key));
+  /* The key is hashed only once, whether or not it is already there */
+  AFCALLF(arc_xhash, AV(key));
   WV(hv, AFCRV);
-  WV(index, INT2FIX(FIX2INT(AV(hv)) & TABLEMASK(AV(hash))));
-  for (WV(i, INT2FIX(0));; WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
-    WV(e, VINDEX(HASH_TABLE(AV(hash)), FIX2INT(AV(index))));
-    /* If we see an empty bucket in our search, or if we see a bucket
-       whose key is the same as the key specified, we have found the
-       place where the element should go. */
-    if (EMPTYP(AV(e)))
-      break;
-    AFCALL(arc_mkaff(c, arc_iso, CNIL), BKEY(AV(e)), AV(key));
-    if (AFCRV == CTRUE)
-      break;
-    /* We found a bucket, but it is occupied by some other key. Continue
-       probing. */
-    WV(index, INT2FIX((FIX2INT(AV(index)) + PROBE(FIX2INT(AV(i)))) & TABLEMASK(AV(hash))));
-  }
-
-  if (EMPTYP(AV(e))) {
-    /* No such key in the hash table yet.  Create a bucket and
-       assign it to the table. */
-    WV(e, mkhashbucket(c, AV(key), AV(val), FIX2INT(AV(index)), AV(hash),
-		       AV(hv)));
-    SVINDEX(HASH_TABLE(AV(hash)), FIX2INT(AV(index)), AV(e));
-  } else {
-    /* The key already exists.  Use the current bucket but change the
-       value to the value specified. */
-    BVALUE(AV(e)) = val;
+  for (;;) {
+    WV(tbl, HASH_TABLE(AV(hash)));
+    AFCALLF(SWISSP(AV(hash)) ? xswiss_find : xhash_find, AV(hash), AV(key),
+	    AV(hv));
+    index = AFCRV;
+    /* Comparing keys with arc_iso can let other threads run, and if
+       they rebuilt the table or took the slot found, search again. */
+    done = 0;
+    OBJLOCK(c, HASH_LOCK(AV(hash)));
+    if (HASH_TABLE(AV(hash)) == AV(tbl)) {
+      if (FIX2INT(index) >= 0) {
+	if (!EMPTYP(slot_key(AV(hash), FIX2INT(index)))) {
+	  slot_setvalue(AV(hash), FIX2INT(index), AV(val));
+	  done = 1;
+	}
+      } else {
+	/* Not already bound.  Put it where the search for it ended. */
+	ins = -FIX2INT(index) - 1;
+	if (EMPTYP(slot_key(AV(hash), ins))) {
+	  hash_add(c, AV(hash), AV(key), AV(val), XHASHVAL(AV(hv)), ins);
+	  done = 1;
+	}
+      }
+    }
+    OBJUNLOCK(c, HASH_LOCK(AV(hash)));
+    if (done)
+      ARETURN(AV(val));
   }
-  ARETURN(AV(val));
   AFEND;
 }
 AFFEND
@@ -810,9 +1278,9 @@ AFFDEF(arc_xhash_lookup)
 {
   AARG(tbl, key);
   AFBEGIN;
-  AFCALL(arc_mkaff(c, arc_xhash_lookup2, CNIL), AV(tbl), AV(key));
-  if (BOUND_P(AFCRV))
-    ARETURN(BVALUE(AFCRV));
+  AFCALLF(xhash_lookup, AV(tbl), AV(key));
+  if (FIX2INT(AFCRV) >= 0)
+    ARETURN(slot_value(AV(tbl), FIX2INT(AFCRV)));
   ARETURN(CUNBOUND);
   AFEND;
 }
@@ -821,18 +1289,27 @@ AFFEND
 AFFDEF(arc_xhash_delete)
 {
   AARG(tbl, key);
-  value index, e;
+  AVAR(tv);
+  value val;
+  int index;
   AFBEGIN;
-  AFCALL(arc_mkaff(c, arc_xhash_lookup2, CNIL), AV(tbl), AV(key));
-  if (!BOUND_P(AFCRV))
-    ARETURN(CUNBOUND);
-
-  index = car(AFCRV);
-  e = VINDEX(HASH_TABLE(AV(tbl)), FIX2INT(index));
-  BTABLE(e) = CNIL;
-  SVINDEX(HASH_TABLE(AV(tbl)), FIX2INT(index), CUNDEF);
-  SET_NENTRIES(AV(tbl), HASH_NENTRIES(AV(tbl))-1);
-  ARETURN(BVALUE(e));
+  for (;;) {
+    WV(tv, HASH_TABLE(AV(tbl)));
+    AFCALLF(xhash_lookup, AV(tbl), AV(key));
+    index = FIX2INT(AFCRV);
+    if (index < 0)
+      ARETURN(CUNBOUND);
+    /* search again if the table changed meanwhile, as for insertion */
+    val = CUNDEF;
+    OBJLOCK(c, HASH_LOCK(AV(tbl)));
+    if (HASH_TABLE(AV(tbl)) == AV(tv) && !EMPTYP(slot_key(AV(tbl), index))) {
+      val = slot_value(AV(tbl), index);
+      slot_delete(c, AV(tbl), index);
+    }
+    OBJUNLOCK(c, HASH_LOCK(AV(tbl)));
+    if (val != CUNDEF)
+      ARETURN(val);
+  }
   AFEND;
 }
 AFFEND
@@ -840,20 +1317,20 @@ AFFEND
 AFFDEF(arc_xhash_iter)
 {
   AARG(hash, state);
-  value index, keyval, e;
+  value index, keyval, k;
   AFBEGIN;
   if (NIL_P(AV(state)))
     WV(state, cons(c, cons(c, CNIL, CNIL), INT2FIX(0)));
   keyval = car(AV(state));
   index = cdr(AV(state));
-  while (FIX2INT(index) < VECLEN(HASH_TABLE(AV(hash)))) {
-    e = VINDEX(HASH_TABLE(AV(hash)), FIX2INT(index));
+  while (FIX2INT(index) < TABLESIZE(AV(hash))) {
+    k = slot_key(AV(hash), FIX2INT(index));
     index = __arc_add2(c, index, INT2FIX(1));
-    if (EMPTYP(e))
+    if (EMPTYP(k))
       continue;
     scdr(AV(state), index);
-    scar(keyval, BKEY(e));
-    scdr(keyval, BVALUE(e));
+    scar(keyval, k);
+    scdr(keyval, slot_value(AV(hash), FIX2INT(index)-1));
     ARETURN(AV(state));
   }
   ARETURN(CNIL);
@@ -869,7 +1346,7 @@ AFFDEF(arc_xhash_map)
 
   WV(state, CNIL);
   for (;;) {
-    AFCALL(arc_mkaff(c, arc_xhash_iter, CNIL), AV(table), AV(state));
+    AFCALLF(arc_xhash_iter, AV(table), AV(state));
     WV(state, AFCRV);
     if (NIL_P(AV(state)))
       ARETURN(AV(table));
@@ -892,7 +1369,7 @@ static AFFDEF(hash_xcoerce)
   if (FIX2INT(AV(stype)) == T_CONS) {
     WV(list, WV(state, CNIL));
     for (;;) {
-      AFCALL(arc_mkaff(c, arc_xhash_iter, CNIL), AV(obj), AV(state));
+      AFCALLF(arc_xhash_iter, AV(obj), AV(state));
       WV(state, AFCRV);
       if (NIL_P(AV(state))) {
 	ARETURN(AV(list));
@@ -925,18 +1402,18 @@ AFFDEF(hash_xhash)
   /* Iterate over all keys and values */
   WV(state, CNIL);
   for (;;) {
-    AFCALL(arc_mkaff(c, arc_xhash_iter, CNIL), AV(obj), AV(state));
+    AFCALLF(arc_xhash_iter, AV(obj), AV(state));
     WV(state, AFCRV);
     if (NIL_P(AV(state))) {
       ARETURN(AV(length));
     }
     /* increment the hash over the key */
-    AFCALL(arc_mkaff(c, arc_xhash_increment, CNIL), car(car(AV(state))),
-	   AV(ehs), AV(visithash));
+    AFCALLF(arc_xhash_increment, car(car(AV(state))),
+	    AV(ehs), AV(visithash));
     WV(length, __arc_add2(c, AV(length), AFCRV));
     /* increment the hash over the value */
-    AFCALL(arc_mkaff(c, arc_xhash_increment, CNIL), cdr(car(AV(state))),
-	   AV(ehs), AV(visithash));
+    AFCALLF(arc_xhash_increment, cdr(car(AV(state))),
+	    AV(ehs), AV(visithash));
     WV(length, __arc_add2(c, AV(length), AFCRV));
   }
   /* never get here? */
@@ -959,10 +1436,7 @@ static void wtable_marker(arc *c, value v, int depth,
 /* Make a weak table */
 value arc_mkwtable(arc *c, int hashbits)
 {
-  value tbl = arc_mkhash(c, hashbits);
-
-  ((struct cell *)tbl)->_type = T_WTABLE;
-  return(tbl);
+  return(mktable(c, hashbits, T_WTABLE, 0));
 }
 
 /* Type function tables */
@@ -27,14 +27,15 @@ extern unsigned long arc_hash_increment(arc *c, value v, arc_hs *s);
 extern unsigned long arc_hash(arc *c, value v);
 extern value arc_mkhash(arc *c, int hashbits);
 extern value arc_mkwtable(arc *c, int hashbits);
+extern value arc_mkstable(arc *c, int hashbits);
 extern int arc_newtable(arc *c, value thr);
+extern int arc_newstable(arc *c, value thr);
 extern value arc_hash_lookup(arc *c, value tbl, value key);
 extern value arc_hash_lookup2(arc *c, value tbl, value key);
 extern value arc_hash_insert(arc *c, value hash, value key, value val);
 extern value arc_hash_delete(arc *c, value hash, value key);
 extern int arc_hash_length(arc *c, value hash);
 extern int arc_xhash_lookup(arc *c, value thr);
-extern int arc_xhash_lookup2(arc *c, value thr);
 extern int arc_xhash_delete(arc *c, value thr);
 extern int arc_xhash_insert(arc *c, value thr);
 extern int arc_xhash_increment(arc *c, value thr);
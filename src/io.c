@@ -26,6 +26,9 @@
   design, although it might not be the way the PG-Arc reference
   implementation behaves.
 */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include "arcueid.h"
 #include "utf.h"
 #include "builtins.h"
@@ -93,9 +96,21 @@ value __arc_allocio(arc *c, int type, struct typefn_t *tfn, size_t xdsize)
   IO(io)->io_tfn = tfn;
   IO(io)->ungetrune = -1;
   IO(io)->io_ops = CNIL;
+  IO(io)->rbuf = NULL;
+  IO(io)->rbpos = IO(io)->rblen = 0;
+  IO(io)->lock = INT2FIX(0);
   return(io);
 }
 
+/* Give an input port a read buffer.  The port must have an IO_fill
+   operation.  If no memory is available for the buffer the port just
+   stays unbuffered. */
+void __arc_io_rbuf(arc *c, value io)
+{
+  IO(io)->rbuf = (unsigned char *)malloc(IO_BUFSIZE);
+  IO(io)->rbpos = IO(io)->rblen = 0;
+}
+
 static void io_marker(arc *c, value v, int depth,
 		      void (*markfn)(arc *, value, int))
 {
@@ -107,6 +122,10 @@ static void io_marker(arc *c, value v, int depth,
 static void io_sweeper(arc *c, value v)
 {
   IO(v)->io_tfn->sweeper(c, v);
+  if (IO(v)->rbuf != NULL) {
+    free(IO(v)->rbuf);
+    IO(v)->rbuf = NULL;
+  }
 }
 
 static AFFDEF(io_pprint)
@@ -116,8 +135,8 @@ static AFFDEF(io_pprint)
   AVAR(dw, wc);
   AFBEGIN;
 
-  WV(dw, arc_mkaff(c, __arc_disp_write, CNIL));
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
+  WV(dw, arc_aff(c, __arc_disp_write));
+  WV(wc, arc_aff(c, arc_writec));
   if (TYPE(AV(sexpr)) == T_INPORT) {
     AFCALL(AV(dw), arc_mkstringc(c, "#<input-port:"), CTRUE,
 	   AV(fp), AV(visithash));
@@ -133,8 +152,8 @@ static AFFDEF(io_pprint)
 	   AV(fp), AV(visithash));
   }
   if (IO(AV(sexpr))->io_tfn->pprint != NULL) {
-    AFCALL(arc_mkaff(c, IO(AV(sexpr))->io_tfn->pprint, CNIL), AV(sexpr),
-	   AV(disp), AV(fp), AV(visithash));
+    AFCALLF(IO(AV(sexpr))->io_tfn->pprint, AV(sexpr),
+	    AV(disp), AV(fp), AV(visithash));
   }
   AFCALL(AV(wc), arc_mkchar(c, '>'), AV(fp));
   ARETURN(CNIL);
@@ -147,6 +166,80 @@ static unsigned long io_hash(arc *c, value v, arc_hs *s)
   return(IO(v)->io_tfn->hash(c, v, s));
 }
 
+/* Refill the read buffer of a buffered port, keeping any bytes which
+   have not been read yet.  Returns CNIL at end of file. */
+static AFFDEF(io_fill)
+{
+  AARG(fd);
+  struct io_t *io;
+  AFBEGIN;
+  io = IO(AV(fd));
+  if (io->rbpos > 0) {
+    OBJLOCK(c, io->lock);
+    memmove(io->rbuf, io->rbuf + io->rbpos, io->rblen - io->rbpos);
+    io->rblen -= io->rbpos;
+    io->rbpos = 0;
+    OBJUNLOCK(c, io->lock);
+  }
+  AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_ready), AV(fd));
+  if (AFCRV == CNIL) {
+    arc_err_cstrfmt(c, "port is not ready for reading");
+    ARETURN(CNIL);
+  }
+  AFTCALL(VINDEX(IO(AV(fd))->io_ops, IO_fill), AV(fd));
+  AFEND;
+}
+AFFEND
+
+/* Decode a character from the read buffer of fd if a whole one is
+   there, returning -1 if more bytes are needed.  Invalid bytes are
+   decoded one at a time into Runeerror, as chartorune does. */
+static int rbuf_getc(value fd)
+{
+  struct io_t *io = IO(fd);
+  int avail = io->rblen - io->rbpos;
+  Rune ch;
+
+  if (avail <= 0 || !fullrune((char *)io->rbuf + io->rbpos, avail))
+    return(-1);
+  io->rbpos += chartorune(&ch, (char *)io->rbuf + io->rbpos);
+  return(ch);
+}
+
+/* Put the character ungotten on fd back into its read buffer as the
+   bytes of its UTF-8 encoding, so that byte reads see those bytes
+   rather than the whole character.  The buffer grows past
+   IO_BUFSIZE if need be; it is not filled again until it has been
+   drained to less than a character. */
+static void rbuf_unget(arc *c, value fd)
+{
+  struct io_t *io = IO(fd);
+  char cbuf[UTFmax];
+  int len, left;
+
+  if (io->ungetrune < 0)
+    return;
+  len = runetochar(cbuf, &io->ungetrune);
+  io->ungetrune = -1;
+  OBJLOCK(c, io->lock);
+  if (io->rbpos < len) {
+    left = io->rblen - io->rbpos;
+    if (left + len > IO_BUFSIZE) {
+      io->rbuf = (unsigned char *)realloc(io->rbuf, left + len);
+      if (io->rbuf == NULL) {
+	fprintf(stderr, "FATAL: failed to allocate memory\n");
+	exit(1);
+      }
+    }
+    memmove(io->rbuf + len, io->rbuf + io->rbpos, left);
+    io->rbpos = len;
+    io->rblen = left + len;
+  }
+  io->rbpos -= len;
+  memcpy(io->rbuf + io->rbpos, cbuf, len);
+  OBJUNLOCK(c, io->lock);
+}
+
 AFFDEF(arc_readb)
 {
   AOARG(fd);
@@ -157,6 +250,9 @@ AFFDEF(arc_readb)
     STDIN(fd);
 
   IO_TYPECHECK(AV(fd));
+  /* Bytes in the read buffer can be had without asking the port */
+  if (IO(AV(fd))->rbpos < IO(AV(fd))->rblen && IO(AV(fd))->ungetrune < 0)
+    ARETURN(INT2FIX(IO(AV(fd))->rbuf[IO(AV(fd))->rbpos++]));
   CHECK_CLOSED(AV(fd));
   /* Note that if there is an unget value available, it will return
      the whole *CHARACTER*, not a possible byte within the character!
@@ -168,6 +264,15 @@ AFFDEF(arc_readb)
     return(INT2FIX(ch));
   }
 
+  if (IO(AV(fd))->rbuf != NULL) {
+    if (IO(AV(fd))->rbpos >= IO(AV(fd))->rblen) {
+      AFCALLF(io_fill, AV(fd));
+      if (NIL_P(AFCRV))
+	ARETURN(CNIL);
+    }
+    ARETURN(INT2FIX(IO(AV(fd))->rbuf[IO(AV(fd))->rbpos++]));
+  }
+
   AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_ready), AV(fd));
   if (AFCRV == CNIL) {
     arc_err_cstrfmt(c, "port is not ready for reading");
@@ -184,19 +289,30 @@ AFFDEF(arc_readc)
   AVAR(chr, buf, i, readb);
   char cbuf[UTFmax];    /* this is always destroyed */
   Rune ch;
-  int j;
+  int j, r;
   AFBEGIN;
 
   if (!BOUND_P(AV(fd)))
     STDIN(fd);
 
   IO_TYPECHECK(AV(fd));
+  if (IO(AV(fd))->ungetrune < 0 && (r = rbuf_getc(AV(fd))) >= 0)
+    ARETURN(arc_mkchar(c, r));
   CHECK_CLOSED(AV(fd));
   if (IO(AV(fd))->ungetrune >= 0) {
     ch = IO(AV(fd))->ungetrune;
     IO(AV(fd))->ungetrune = -1;
     ARETURN(arc_mkchar(c, ch));
   }
+  if (IO(AV(fd))->rbuf != NULL) {
+    /* get more bytes until there is a whole character */
+    while ((r = rbuf_getc(AV(fd))) < 0) {
+      AFCALLF(io_fill, AV(fd));
+      if (NIL_P(AFCRV))
+	ARETURN(CNIL);
+    }
+    ARETURN(arc_mkchar(c, r));
+  }
   if (IO(AV(fd))->flags & IO_FLAG_GETB_IS_GETC) {
     AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_getb), AV(fd));
     if (NIL_P(AFCRV))
@@ -205,7 +321,7 @@ AFFDEF(arc_readc)
   }
   WV(buf, arc_mkvector(c, UTFmax));
   /* XXX - should put this in builtins */
-  WV(readb, arc_mkaff(c, arc_readb, CNIL));
+  WV(readb, arc_aff(c, arc_readb));
   for (WV(i, INT2FIX(0)); FIX2INT(AV(i)) < UTFmax; WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
     AFCALL(AV(readb), AV(fd));
     WV(chr, AFCRV);
@@ -225,6 +341,457 @@ AFFDEF(arc_readc)
 }
 AFFEND
 
+/* Put n runes at position len of the line being built in buf,
+   doubling buf first if they do not fit.  The buffer may be returned
+   as a new string. */
+static value linebuf_put(arc *c, value buf, int len, const Rune *runes, int n)
+{
+  int size, i;
+
+  size = arc_strlen(c, buf);
+  if (len + n > size) {
+    while (size < len + n)
+      size *= 2;
+    buf = arc_strcat(c, buf, arc_mkstringlen(c, size - arc_strlen(c, buf)));
+  }
+  for (i=0; i<n; i++)
+    arc_strsetindex(c, buf, len + i, runes[i]);
+  return(buf);
+}
+
+#define LINEBUF_INIT 64
+
+/* Read a line, not including the newline that ends it.  Like the
+   definition in arc.arc this replaces, the first character is taken
+   as part of the line even if it is a newline.  Whole runs of the
+   line are decoded straight out of the read buffer of a buffered
+   port; other ports are read a character at a time with readc.  The
+   characters go into a scratch buffer that doubles as it fills, and
+   the line is made from it once at the end. */
+AFFDEF(arc_readline)
+{
+  AOARG(fd);
+  AVAR(buf, len, readc);
+  struct io_t *io;
+  Rune *runes, ch;
+  int n, r;
+  AFBEGIN;
+
+  if (!BOUND_P(AV(fd)))
+    STDIN(fd);
+  IO_TYPECHECK(AV(fd));
+  WV(readc, arc_aff(c, arc_readc));
+  AFCALL(AV(readc), AV(fd));
+  if (NIL_P(AFCRV))
+    ARETURN(CNIL);
+  ch = arc_char2rune(c, AFCRV);
+  WV(buf, linebuf_put(c, arc_mkstringlen(c, LINEBUF_INIT), 0, &ch, 1));
+  WV(len, INT2FIX(1));
+  for (;;) {
+    io = IO(AV(fd));
+    if (io->rbuf != NULL && io->ungetrune < 0) {
+      runes = (Rune *)alloca((io->rblen - io->rbpos + 1) * sizeof(Rune));
+      n = 0;
+      while ((r = rbuf_getc(AV(fd))) >= 0 && r != '\n')
+	runes[n++] = r;
+      WV(buf, linebuf_put(c, AV(buf), FIX2INT(AV(len)), runes, n));
+      WV(len, INT2FIX(FIX2INT(AV(len)) + n));
+      if (r == '\n')
+	break;
+    }
+    AFCALL(AV(readc), AV(fd));
+    if (NIL_P(AFCRV) || arc_char2rune(c, AFCRV) == '\n')
+      break;
+    ch = arc_char2rune(c, AFCRV);
+    WV(buf, linebuf_put(c, AV(buf), FIX2INT(AV(len)), &ch, 1));
+    WV(len, INT2FIX(FIX2INT(AV(len)) + 1));
+  }
+  ARETURN(arc_substr(c, AV(buf), 0, FIX2INT(AV(len))));
+  AFEND;
+}
+AFFEND
+
+/* Read n bytes into a vector of fixnums, or fewer if end of file
+   comes first, returning nil at end of file.  Whatever is in the read
+   buffer of a buffered port is used first.  Large reads go straight
+   to the port's IO_read, a block at a time, and ports without one
+   are read with readb. */
+AFFDEF(arc_readbytes)
+{
+  AARG(n);
+  AOARG(fd);
+  AVAR(vec, got);
+  struct io_t *io;
+  int cnt, i;
+  value nvec;
+  AFBEGIN;
+
+  if (!BOUND_P(AV(fd)))
+    STDIN(fd);
+  IO_TYPECHECK(AV(fd));
+  if (!FIXNUM_P(AV(n)) || FIX2INT(AV(n)) < 0) {
+    arc_err_cstrfmt(c, "readbytes: invalid byte count");
+    ARETURN(CNIL);
+  }
+  CHECK_CLOSED(AV(fd));
+  WV(vec, arc_mkvector(c, FIX2INT(AV(n))));
+  WV(got, INT2FIX(0));
+  if (IO(AV(fd))->rbuf != NULL)
+    rbuf_unget(c, AV(fd));
+  if (FIX2INT(AV(n)) > 0 && IO(AV(fd))->ungetrune >= 0) {
+    /* ports without a read buffer read characters anyway */
+    XVINDEX(AV(vec), 0) = INT2FIX(IO(AV(fd))->ungetrune);
+    IO(AV(fd))->ungetrune = -1;
+    WV(got, INT2FIX(1));
+  }
+  while (FIX2INT(AV(got)) < FIX2INT(AV(n))) {
+    io = IO(AV(fd));
+    cnt = FIX2INT(AV(n)) - FIX2INT(AV(got));
+    if (io->rbpos < io->rblen) {
+      if (cnt > io->rblen - io->rbpos)
+	cnt = io->rblen - io->rbpos;
+      for (i=0; i<cnt; i++)
+	XVINDEX(AV(vec), FIX2INT(AV(got)) + i) = INT2FIX(io->rbuf[io->rbpos++]);
+      WV(got, INT2FIX(FIX2INT(AV(got)) + cnt));
+      continue;
+    }
+    if (io->rbuf != NULL && cnt < IO_BUFSIZE) {
+      AFCALLF(io_fill, AV(fd));
+      if (NIL_P(AFCRV))
+	break;
+      continue;
+    }
+    if (NIL_P(VINDEX(io->io_ops, IO_read))) {
+      AFCALLF(arc_readb, AV(fd));
+      if (NIL_P(AFCRV))
+	break;
+      SVINDEX(AV(vec), FIX2INT(AV(got)), AFCRV);
+      WV(got, INT2FIX(FIX2INT(AV(got)) + 1));
+      continue;
+    }
+    AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_ready), AV(fd));
+    if (AFCRV == CNIL) {
+      arc_err_cstrfmt(c, "port is not ready for reading");
+      ARETURN(CNIL);
+    }
+    AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_read), AV(fd), AV(vec), AV(got),
+	   INT2FIX(FIX2INT(AV(n)) - FIX2INT(AV(got))));
+    if (NIL_P(AFCRV))
+      break;
+    WV(got, INT2FIX(FIX2INT(AV(got)) + FIX2INT(AFCRV)));
+  }
+  if (FIX2INT(AV(got)) == 0 && FIX2INT(AV(n)) > 0)
+    ARETURN(CNIL);
+  if (FIX2INT(AV(got)) < FIX2INT(AV(n))) {
+    nvec = arc_mkvector(c, FIX2INT(AV(got)));
+    for (i=0; i<FIX2INT(AV(got)); i++)
+      XVINDEX(nvec, i) = XVINDEX(AV(vec), i);
+    ARETURN(nvec);
+  }
+  ARETURN(AV(vec));
+  AFEND;
+}
+AFFEND
+
+/* Read a string of n characters, or fewer if end of file comes
+   first, returning nil at end of file. */
+AFFDEF(arc_readstring)
+{
+  AARG(n);
+  AOARG(fd);
+  AVAR(str, got, readc, vec);
+  struct io_t *io;
+  int i, r;
+  AFBEGIN;
+
+  if (!BOUND_P(AV(fd)))
+    STDIN(fd);
+  IO_TYPECHECK(AV(fd));
+  if (!FIXNUM_P(AV(n)) || FIX2INT(AV(n)) < 0) {
+    arc_err_cstrfmt(c, "readstring: invalid character count");
+    ARETURN(CNIL);
+  }
+  WV(str, arc_mkstringlen(c, FIX2INT(AV(n))));
+  WV(got, INT2FIX(0));
+  WV(readc, arc_aff(c, arc_readc));
+  while (FIX2INT(AV(got)) < FIX2INT(AV(n))) {
+    io = IO(AV(fd));
+    if (io->ungetrune < 0 && io->rbuf != NULL) {
+      /* decode as much as possible straight from the read buffer */
+      for (i=FIX2INT(AV(got));
+	   i < FIX2INT(AV(n)) && (r = rbuf_getc(AV(fd))) >= 0; i++)
+	arc_strsetindex(c, AV(str), i, r);
+      WV(got, INT2FIX(i));
+      if (i == FIX2INT(AV(n)))
+	break;
+    } else if (io->ungetrune < 0 && (io->flags & IO_FLAG_GETB_IS_GETC)
+	       && !NIL_P(VINDEX(io->io_ops, IO_read))) {
+      /* ports whose bytes are characters can be read a block at a
+	 time */
+      CHECK_CLOSED(AV(fd));
+      AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_ready), AV(fd));
+      if (AFCRV == CNIL) {
+	arc_err_cstrfmt(c, "port is not ready for reading");
+	ARETURN(CNIL);
+      }
+      WV(vec, arc_mkvector(c, FIX2INT(AV(n)) - FIX2INT(AV(got))));
+      AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_read), AV(fd), AV(vec),
+	     INT2FIX(0), INT2FIX(VECLEN(AV(vec))));
+      if (NIL_P(AFCRV))
+	break;
+      for (i=0; i<FIX2INT(AFCRV); i++)
+	arc_strsetindex(c, AV(str), FIX2INT(AV(got)) + i,
+			FIX2INT(XVINDEX(AV(vec), i)));
+      WV(got, INT2FIX(FIX2INT(AV(got)) + FIX2INT(AFCRV)));
+      continue;
+    }
+    AFCALL(AV(readc), AV(fd));
+    if (NIL_P(AFCRV))
+      break;
+    arc_strsetindex(c, AV(str), FIX2INT(AV(got)), arc_char2rune(c, AFCRV));
+    WV(got, INT2FIX(FIX2INT(AV(got)) + 1));
+  }
+  if (FIX2INT(AV(got)) == 0 && FIX2INT(AV(n)) > 0)
+    ARETURN(CNIL);
+  if (FIX2INT(AV(got)) < FIX2INT(AV(n)))
+    ARETURN(arc_substr(c, AV(str), 0, FIX2INT(AV(got))));
+  ARETURN(AV(str));
+  AFEND;
+}
+AFFEND
+
+/* Write a vector or list of bytes, a block at a time with the port's
+   IO_write if it has one, and returns the bytes. */
+AFFDEF(arc_writebytes)
+{
+  AARG(bytes);
+  AOARG(fd);
+  AVAR(vec, off);
+  value v;
+  int i;
+  AFBEGIN;
+
+  if (arc_thr_argc(c, thr) == 0) {
+    arc_err_cstrfmt(c, "writebytes: too few arguments");
+    return(CNIL);
+  }
+
+  if (!BOUND_P(AV(fd)))
+    STDOUT(fd);
+
+  IOW_TYPECHECK(AV(fd));
+  if (TYPE(AV(bytes)) == T_VECTOR) {
+    WV(vec, AV(bytes));
+  } else if (NIL_P(AV(bytes)) || TYPE(AV(bytes)) == T_CONS) {
+    WV(vec, arc_mkvector(c, FIX2INT(arc_list_length(c, AV(bytes)))));
+    for (i=0, v=AV(bytes); CONS_P(v); v=cdr(v), i++)
+      XVINDEX(AV(vec), i) = car(v);
+  } else {
+    arc_err_cstrfmt(c, "writebytes: expected a vector or list of bytes");
+    ARETURN(CNIL);
+  }
+  for (i=0; i<VECLEN(AV(vec)); i++) {
+    if (!FIXNUM_P(XVINDEX(AV(vec), i)) || FIX2INT(XVINDEX(AV(vec), i)) < 0
+	|| FIX2INT(XVINDEX(AV(vec), i)) > 255) {
+      arc_err_cstrfmt(c, "writebytes: invalid byte");
+      ARETURN(CNIL);
+    }
+  }
+  CHECK_CLOSED(AV(fd));
+  for (WV(off, INT2FIX(0)); FIX2INT(AV(off)) < VECLEN(AV(vec));) {
+    if (NIL_P(VINDEX(IO(AV(fd))->io_ops, IO_write))) {
+      AFCALLF(arc_writeb,
+	      XVINDEX(AV(vec), FIX2INT(AV(off))), AV(fd));
+      WV(off, INT2FIX(FIX2INT(AV(off)) + 1));
+      continue;
+    }
+    AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_wready), AV(fd));
+    if (AFCRV == CNIL) {
+      arc_err_cstrfmt(c, "port is not ready for writing");
+      ARETURN(CNIL);
+    }
+    AFCALL(VINDEX(IO(AV(fd))->io_ops, IO_write), AV(fd), AV(vec), AV(off),
+	   INT2FIX(VECLEN(AV(vec)) - FIX2INT(AV(off))));
+    if (NIL_P(AFCRV))
+      ARETURN(CNIL);
+    WV(off, INT2FIX(FIX2INT(AV(off)) + FIX2INT(AFCRV)));
+  }
+  ARETURN(AV(bytes));
+  AFEND;
+}
+AFFEND
+
+/* Largest amount copy-port has the kernel move at a time, and the
+   size of the blocks it copies otherwise. */
+#define COPY_KBLOCKSIZE (1 << 20)
+#define COPY_BLOCKSIZE (4*IO_BUFSIZE)
+
+/* How much of cnt bytes may still be copied if no more than n bytes
+   are to be copied in all, done already having been. */
+static int copy_left(value n, value done, int cnt)
+{
+  if (BOUND_P(n) && FIX2INT(n) - FIX2INT(done) < cnt)
+    return(FIX2INT(n) - FIX2INT(done));
+  return(cnt);
+}
+
+/* UTF-8 encode the characters in runes, read from in, into a vector
+   of no more than max bytes.  A character which does not fit is put
+   back on in. */
+static value copy_encode(arc *c, value in, value runes, int max)
+{
+  char *cbuf;
+  Rune r;
+  int i, j, len;
+  value vec;
+
+  cbuf = (char *)alloca(UTFmax * VECLEN(runes));
+  for (i=0, len=0; i<VECLEN(runes); i++) {
+    r = FIX2INT(XVINDEX(runes, i));
+    j = runetochar(cbuf + len, &r);
+    if (len + j > max) {
+      IO(in)->ungetrune = r;
+      break;
+    }
+    len += j;
+  }
+  vec = arc_mkvector(c, len);
+  for (i=0; i<len; i++)
+    XVINDEX(vec, i) = INT2FIX((unsigned char)cbuf[i]);
+  return(vec);
+}
+
+/* Copy from one port to another until end of file, or until n bytes
+   have been copied, returning the number of bytes copied.  Anything
+   in the read buffer of the input port goes first.  If both ports
+   have file descriptors, the rest is moved by the kernel with no
+   copying through Arcueid at all, waiting for the output port to be
+   writable again whenever it fills up.  Otherwise it is copied a
+   block at a time with readbytes and writebytes, with the characters
+   read from ports whose bytes are characters UTF-8 encoded. */
+AFFDEF(arc_copy_port)
+{
+  AARG(in, out);
+  AOARG(n);
+  AVAR(done, infd, outfd, vec);
+  struct io_t *io;
+  char cbuf[UTFmax];
+  int cnt, i, rtd;
+  long rv;
+  AFBEGIN;
+
+  IO_TYPECHECK(AV(in));
+  IOW_TYPECHECK(AV(out));
+  if (BOUND_P(AV(n)) && (!FIXNUM_P(AV(n)) || FIX2INT(AV(n)) < 0)) {
+    arc_err_cstrfmt(c, "copy-port: invalid byte count");
+    ARETURN(CNIL);
+  }
+  CHECK_CLOSED(AV(in));
+  CHECK_CLOSED(AV(out));
+  WV(done, INT2FIX(0));
+
+  /* whatever has already been read from the input port, with a
+     character put back on it encoded as its UTF-8 bytes.  Ports
+     whose bytes are characters get theirs back from readbytes. */
+  io = IO(AV(in));
+  if (io->rbuf != NULL) {
+    rbuf_unget(c, AV(in));
+  } else if (io->ungetrune >= 0 && !(io->flags & IO_FLAG_GETB_IS_GETC)) {
+    cnt = runetochar(cbuf, &io->ungetrune);
+    /* a character is not split, so one which does not fit stays */
+    if (copy_left(AV(n), AV(done), cnt) == cnt) {
+      WV(vec, arc_mkvector(c, cnt));
+      for (i=0; i<cnt; i++)
+	XVINDEX(AV(vec), i) = INT2FIX((unsigned char)cbuf[i]);
+      IO(AV(in))->ungetrune = -1;
+      WV(done, INT2FIX(cnt));
+      AFCALLF(arc_writebytes, AV(vec), AV(out));
+    }
+  }
+  io = IO(AV(in));
+  cnt = copy_left(AV(n), AV(done), io->rblen - io->rbpos);
+  if (cnt > 0) {
+    WV(vec, arc_mkvector(c, cnt));
+    io = IO(AV(in));
+    for (i=0; i<cnt; i++)
+      XVINDEX(AV(vec), i) = INT2FIX(io->rbuf[io->rbpos++]);
+    WV(done, INT2FIX(cnt));
+    AFCALLF(arc_writebytes, AV(vec), AV(out));
+  }
+
+  if (!NIL_P(VINDEX(IO(AV(in))->io_ops, IO_fd))
+      && !NIL_P(VINDEX(IO(AV(out))->io_ops, IO_fd))) {
+    AFCALL(VINDEX(IO(AV(in))->io_ops, IO_fd), AV(in));
+    WV(infd, AFCRV);
+    AFCALL(VINDEX(IO(AV(out))->io_ops, IO_fd), AV(out));
+    WV(outfd, AFCRV);
+  }
+  while (FIXNUM_P(AV(infd)) && FIXNUM_P(AV(outfd))) {
+    if (copy_left(AV(n), AV(done), COPY_KBLOCKSIZE) == 0)
+      ARETURN(AV(done));
+    /* The output port may be a non-blocking socket, but the input
+       port has to be ready before the kernel is asked to copy from
+       it, so that it is the output that runs out of room if
+       anything. */
+    AFCALL(VINDEX(IO(AV(in))->io_ops, IO_ready), AV(in));
+    if (AFCRV == CNIL) {
+      arc_err_cstrfmt(c, "port is not ready for reading");
+      ARETURN(CNIL);
+    }
+    cnt = copy_left(AV(n), AV(done), COPY_KBLOCKSIZE);
+    BLOCK_BEGIN(c, rtd);
+    rv = __arc_fdcopy(FIX2INT(AV(infd)), FIX2INT(AV(outfd)), cnt);
+    BLOCK_END(c, rtd);
+    if (rv > 0) {
+      WV(done, INT2FIX(FIX2INT(AV(done)) + rv));
+      continue;
+    }
+    if (rv == 0)
+      ARETURN(AV(done));
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      AIOWAITW(FIX2INT(AV(outfd)));
+      continue;
+    }
+    /* the kernel cannot copy between these, so copy them ourselves */
+    if (errno == EINVAL || errno == ENOSYS)
+      break;
+    {
+      int en = errno;
+
+      arc_err_cstrfmt(c, "copy-port: error copying (%s; errno=%d)",
+		      strerror(en), en);
+      ARETURN(CNIL);
+    }
+  }
+
+  for (;;) {
+    cnt = copy_left(AV(n), AV(done), COPY_BLOCKSIZE);
+    if (cnt == 0)
+      break;
+    if (IO(AV(in))->flags & IO_FLAG_GETB_IS_GETC) {
+      /* read no more characters than can be encoded in cnt bytes */
+      AFCALLF(arc_readbytes, INT2FIX((cnt < UTFmax) ? 1 : cnt / UTFmax),
+	      AV(in));
+      if (NIL_P(AFCRV))
+	break;
+      WV(vec, copy_encode(c, AV(in), AFCRV,
+			  copy_left(AV(n), AV(done), COPY_BLOCKSIZE)));
+      if (VECLEN(AV(vec)) == 0)
+	break;
+    } else {
+      AFCALLF(arc_readbytes, INT2FIX(cnt), AV(in));
+      if (NIL_P(AFCRV))
+	break;
+      WV(vec, AFCRV);
+    }
+    AFCALLF(arc_writebytes, AV(vec), AV(out));
+    WV(done, INT2FIX(FIX2INT(AV(done)) + VECLEN(AV(vec))));
+  }
+  ARETURN(AV(done));
+  AFEND;
+}
+AFFEND
+
 AFFDEF(arc_writeb)
 {
   AARG(byte);
@@ -277,7 +844,7 @@ AFFDEF(arc_writec)
     ARETURN(arc_mkchar(c, FIX2INT(AFCRV)));
   }
   /* XXX - should put this in builtins */
-  WV(writeb, arc_mkaff(c, arc_writeb, CNIL));
+  WV(writeb, arc_aff(c, arc_writeb));
   ch = arc_char2rune(c, AV(chr));
   WV(nbytes, INT2FIX(runetochar(cbuf, &ch)));
   /* Convert C char array into Arcueid vector of fixnums */
@@ -298,6 +865,10 @@ AFFDEF(arc_close)
   AFBEGIN;
   for (; !NIL_P(AV(list)); WV(list, cdr(AV(list)))) {
     AFCALL(VINDEX(IO(car(AV(list)))->io_ops, IO_close), car(AV(list)));
+    /* anything still buffered is lost */
+    OBJLOCK(c, IO(car(AV(list)))->lock);
+    IO(car(AV(list)))->rbpos = IO(car(AV(list)))->rblen = 0;
+    OBJUNLOCK(c, IO(car(AV(list)))->lock);
   }
   ARETURN(CNIL);
   AFEND;
@@ -340,7 +911,7 @@ AFFDEF(arc_rewind)
 {
   AARG(fp);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, arc_seek, CNIL), AV(fp), INT2FIX(0), INT2FIX(SEEK_SET));
+  AFTCALLF(arc_seek, AV(fp), INT2FIX(0), INT2FIX(SEEK_SET));
   AFEND;
 }
 AFFEND
@@ -399,11 +970,11 @@ AFFDEF(__arc_disp_write)
     snprintf(strrep, len+1, utype, TYPE(AV(arg)), (void *)AV(arg));
     vstr = arc_mkstringc(c, strrep);
 
-    AFTCALL(arc_mkaff(c, arc_disp, CNIL), vstr, AV(outport));
+    AFTCALLF(arc_disp, vstr, AV(outport));
     ARETURN(CNIL);
   }
-  AFTCALL(arc_mkaff(c, tfn->pprint, CNIL), AV(arg), AV(disp), AV(outport),
-	  AV(visithash));
+  AFTCALLF(tfn->pprint, AV(arg), AV(disp), AV(outport),
+	   AV(visithash));
   AFEND;
 }
 AFFEND
@@ -413,7 +984,7 @@ AFFDEF(arc_disp)
   AARG(arg);
   AOARG(outport);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, __arc_disp_write, CNIL), AV(arg), CTRUE, AV(outport));
+  AFTCALLF(__arc_disp_write, AV(arg), CTRUE, AV(outport));
   AFEND;
 }
 AFFEND
@@ -423,7 +994,7 @@ AFFDEF(arc_write)
   AARG(arg);
   AOARG(outport);
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, __arc_disp_write, CNIL), AV(arg), CNIL, AV(outport));
+  AFTCALLF(__arc_disp_write, AV(arg), CNIL, AV(outport));
   AFEND;
 }
 AFFEND
@@ -462,7 +1033,7 @@ AFFDEF(arc_peekc)
   AFBEGIN;
   if (!BOUND_P(AV(fd)))
     STDIN(fd);
-  AFCALL(arc_mkaff(c, arc_readc, CNIL), AV(fd));
+  AFCALLF(arc_readc, AV(fd));
   WV(ch, AFCRV);
   arc_ungetc_rune(c, arc_char2rune(c, AV(ch)), AV(fd));
   ARETURN(AV(ch));
@@ -39,6 +39,26 @@
    * IO_seek - seek in the I/O source
    * IO_tell - get the offset in the I/O source
    * IO_close - close the I/O source
+   * IO_fill - only for ports with a read buffer (see below).  Called
+     after IO_ready, it should append whatever bytes are available to
+     the read buffer, without waiting for more.  Returns the number of
+     bytes read, or CNIL on end of file.
+   * IO_read - block read.  Given a vector, an offset and a count, read
+     at most that many bytes into the vector at that offset.  Called
+     after IO_ready, and should not wait for more than is available.
+     Returns the number of bytes read, or CNIL on end of file.
+   * IO_write - block write.  Given a vector, an offset and a count,
+     write at most that many bytes from the vector.  Called after
+     IO_wready.  Returns the number of bytes written.
+   * IO_fd - the file descriptor underlying the port as a fixnum, or
+     CNIL if the port has none or cannot be read or written around
+     its own buffering.  Any output buffered in user space must be
+     flushed first.  This lets copy-port have the kernel move the
+     data between two ports.
+
+   Ports which do not provide IO_read or IO_write (CNIL in io_ops) are
+   read and written a byte at a time with IO_getb and IO_putb instead,
+   and ports without IO_fd are copied with IO_read and IO_write.
 */
 enum {
   IO_closed_p=0,
@@ -49,19 +69,38 @@ enum {
   IO_seek=5,
   IO_tell=6,
   IO_close=7,
-  IO_last=7
+  IO_fill=8,
+  IO_read=9,
+  IO_write=10,
+  IO_fd=11,
+  IO_last=11
 };
 
 /* getb actually returns a Unicode character rather than a byte */
 #define IO_FLAG_GETB_IS_GETC 1
 
-/* A basic I/O structure. */
+/* Size of the read buffer of buffered input ports */
+#define IO_BUFSIZE 4096
+
+/* A basic I/O structure.  Input ports may have a read buffer, which
+   readb, readc and readline consume directly, only going through
+   IO_ready and IO_fill when it runs dry.  Bytes rbpos to rblen-1 of
+   rbuf have not been read yet.
+
+   IO_fill lets go of the runtime lock while it waits in read(2) (see
+   BLOCK_BEGIN), holding the lock of the port instead, so anything
+   else which moves bytes around in the buffer or changes rblen must
+   hold that lock too.  Just reading bytes from it needs no lock. */
 struct io_t {
   unsigned int flags;
   value name;
   Rune ungetrune;
   struct typefn_t *io_tfn;
   value io_ops;
+  unsigned char *rbuf;
+  int rbpos;
+  int rblen;
+  value lock;			/* see __arc_objlock */
   char data[1];
 };
 
@@ -71,6 +110,8 @@ struct io_t {
 
 extern value __arc_allocio(arc *c, int type, struct typefn_t *tfn,
 			   size_t xdsize);
+extern void __arc_io_rbuf(arc *c, value io);
+extern long __arc_fdcopy(int infd, int outfd, long count);
 
 extern void __arc_init_sio(arc *c);
 extern void __arc_init_fio(arc *c);
@@ -117,6 +158,10 @@ extern value arc_mvfile(arc *c, value oldname, value newname);
 /* General I/O functions */
 extern int arc_readb(arc *c, value thr);
 extern int arc_readc(arc *c, value thr);
+extern int arc_readline(arc *c, value thr);
+extern int arc_readbytes(arc *c, value thr);
+extern int arc_readstring(arc *c, value thr);
+extern int arc_writebytes(arc *c, value thr);
 extern int arc_writeb(arc *c, value thr);
 extern int arc_writec(arc *c, value thr);
 extern int arc_close(arc *c, value thr);
@@ -171,6 +216,11 @@ extern int arc_load(arc *c, value thr);
 /* General I/O functions */
 extern int arc_readb(arc *c, value thr);
 extern int arc_readc(arc *c, value thr);
+extern int arc_readline(arc *c, value thr);
+extern int arc_readbytes(arc *c, value thr);
+extern int arc_readstring(arc *c, value thr);
+extern int arc_writebytes(arc *c, value thr);
+extern int arc_copy_port(arc *c, value thr);
 extern int arc_writeb(arc *c, value thr);
 extern int arc_writec(arc *c, value thr);
 extern int arc_close(arc *c, value thr);
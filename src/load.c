@@ -87,8 +87,8 @@ static AFFDEF(duringthunk)
 {
   AVAR(sread, eval, sexpr);
   AFBEGIN;
-  WV(sread, arc_mkaff(c, arc_sread, CNIL));
-  WV(eval, arc_mkaff(c, arc_eval, CNIL));
+  WV(sread, arc_aff(c, arc_sread));
+  WV(eval, arc_aff(c, arc_eval));
   /* This performs the actual load. */
   for (;;) {
     AFCALL(AV(sread), LOAD_FP, CNIL, LNDATA);
@@ -105,7 +105,7 @@ AFFEND
 static AFFDEF(afterthunk)
 {
   AFBEGIN;
-  AFTCALL(arc_mkaff(c, arc_close, CNIL), LOAD_FP);
+  AFTCALLF(arc_close, LOAD_FP);
   AFEND;
 }
 AFFEND
@@ -119,13 +119,13 @@ AFFDEF(arc_load)
 
   /* Try to load a file specified as an absolute path directly */
   if (__arc_is_absolute_path(c, AV(loadfile))) {
-    AFCALL(arc_mkaff(c, arc_infile, CNIL), AV(loadfile));
+    AFCALLF(arc_infile, AV(loadfile));
     WV(fp, AFCRV);
     WV(lndata, arc_mkhash(c, ARC_HASHBITS));
-    AFCALL(arc_mkaff(c, arc_dynamic_wind, CNIL),
-	   arc_mkaff2(c, beforethunk, CNIL, TENVR(thr)),
-	   arc_mkaff2(c, duringthunk, CNIL, TENVR(thr)),
-	   arc_mkaff2(c, afterthunk, CNIL, TENVR(thr)));
+    AFCALLF(arc_dynamic_wind,
+	    arc_mkaff2(c, beforethunk, CNIL, TENVR(thr)),
+	    arc_mkaff2(c, duringthunk, CNIL, TENVR(thr)),
+	    arc_mkaff2(c, afterthunk, CNIL, TENVR(thr)));
     ARETURN(CNIL);
   }
 
@@ -138,16 +138,16 @@ AFFDEF(arc_load)
       continue;
     }
     /* first open the file. */
-    AFCALL(arc_mkaff(c, arc_infile, CNIL), AV(ldf));
+    AFCALLF(arc_infile, AV(ldf));
     WV(fp, AFCRV);
     /* The actual load takes place in the duringthunk. The
        after thunk will take care of closing the file
        whatever happens. */
     WV(lndata, arc_mkhash(c, ARC_HASHBITS));
-    AFCALL(arc_mkaff(c, arc_dynamic_wind, CNIL),
-	   arc_mkaff2(c, beforethunk, CNIL, TENVR(thr)),
-	   arc_mkaff2(c, duringthunk, CNIL, TENVR(thr)),
-	   arc_mkaff2(c, afterthunk, CNIL, TENVR(thr)));
+    AFCALLF(arc_dynamic_wind,
+	    arc_mkaff2(c, beforethunk, CNIL, TENVR(thr)),
+	    arc_mkaff2(c, duringthunk, CNIL, TENVR(thr)),
+	    arc_mkaff2(c, afterthunk, CNIL, TENVR(thr)));
     ARETURN(CNIL);
   }
   {
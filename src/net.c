@@ -20,9 +20,9 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
 #include <time.h>
 #include <sys/utsname.h>
-#include <sys/select.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/socket.h>
@@ -99,32 +99,17 @@ static AFFDEF(sock_closed_p)
 }
 AFFEND
 
+/* Sockets are non-blocking.  Rather than checking for readiness up
+   front, the operations on them wait for the socket with AIOWAITR or
+   AIOWAITW whenever a call would block, and then try again. */
+#define WOULDBLOCK(en) ((en) == EAGAIN || (en) == EWOULDBLOCK)
+
 static AFFDEF(sock_ready)
 {
   AARG(sock);
-  fd_set rfds;
-  int retval;
-  struct timeval tv;
   AFBEGIN;
-  for (;;) {
-    FD_ZERO(&rfds);
-    FD_SET(SOCKDATA(AV(sock))->fd, &rfds);
-    tv.tv_usec = tv.tv_sec = 0;
-    retval = select(SOCKDATA(AV(sock))->fd+1, &rfds, NULL, NULL, &tv);
-    if (retval == -1) {
-      int en = errno;
-
-      arc_err_cstrfmt(c, "error checking socket for reading (%s; errno=%d)",
-		      strerror(en), en);
-      ARETURN(CNIL);
-    }
-
-    if (FD_ISSET(SOCKDATA(AV(sock))->fd, &rfds))
-      ARETURN(CTRUE);
-
-    /* We have to wait */
-    AIOWAITR(SOCKDATA(AV(sock))->fd);
-  }
+  (void)sock;
+  ARETURN(CTRUE);
   AFEND;
 }
 AFFEND
@@ -132,41 +117,96 @@ AFFEND
 static AFFDEF(sock_wready)
 {
   AARG(sock);
-  fd_set wfds;
-  int retval;
-  struct timeval tv;
   AFBEGIN;
-  for (;;) {
-    FD_ZERO(&wfds);
-    FD_SET(SOCKDATA(AV(sock))->fd, &wfds);
-    tv.tv_usec = tv.tv_sec = 0;
-    retval = select(SOCKDATA(AV(sock))->fd+1, NULL, &wfds, NULL, &tv);
-    if (retval == -1) {
-      int en = errno;
+  (void)sock;
+  ARETURN(CTRUE);
+  AFEND;
+}
+AFFEND
 
-      arc_err_cstrfmt(c, "error checking socket for writing (%s; errno=%d)",
-		      strerror(en), en);
-      ARETURN(CNIL);
-    }
+static AFFDEF(sock_getb)
+{
+  AARG(sock);
+  char ch;
+  int rb;
+  AFBEGIN;
 
-    if (FD_ISSET(SOCKDATA(AV(sock))->fd, &wfds))
-      ARETURN(CTRUE);
+  for (;;) {
+    rb = recv(SOCKDATA(AV(sock))->fd, (void *)&ch, sizeof(ch), 0);
+    if (rb >= 0 || (errno != EINTR && !WOULDBLOCK(errno)))
+      break;
+    if (errno != EINTR)
+      AIOWAITR(SOCKDATA(AV(sock))->fd);
+  }
+  if (rb == 0)
+    ARETURN(CNIL);
+  if (rb < 0) {
+    int en = errno;
 
-    /* We have to wait */
-    AIOWAITW(SOCKDATA(AV(sock))->fd);
+    arc_err_cstrfmt(c, "error reading socket (%s; errno=%d)", strerror(en), en);
+    ARETURN(CNIL);
   }
+
+  ARETURN(INT2FIX(ch));
   AFEND;
 }
 AFFEND
 
-static AFFDEF(sock_getb)
+static AFFDEF(sock_fill)
 {
   AARG(sock);
-  char ch;
+  struct io_t *io;
   int rb;
   AFBEGIN;
 
-  rb = recv(SOCKDATA(AV(sock))->fd, (void *)&ch, sizeof(ch), 0);
+  for (;;) {
+    /* sockets do not block, but rblen must still only change under
+       the lock of the port (see io.h) */
+    io = IO(AV(sock));
+    OBJLOCK(c, io->lock);
+    rb = recv(SOCKDATA(AV(sock))->fd, (void *)(io->rbuf + io->rblen),
+	      IO_BUFSIZE - io->rblen, 0);
+    if (rb > 0)
+      io->rblen += rb;
+    OBJUNLOCK(c, io->lock);
+    if (rb >= 0 || (errno != EINTR && !WOULDBLOCK(errno)))
+      break;
+    if (errno != EINTR)
+      AIOWAITR(SOCKDATA(AV(sock))->fd);
+  }
+  if (rb == 0)
+    ARETURN(CNIL);
+  if (rb < 0) {
+    int en = errno;
+
+    arc_err_cstrfmt(c, "error reading socket (%s; errno=%d)", strerror(en), en);
+    ARETURN(CNIL);
+  }
+  ARETURN(INT2FIX(rb));
+  AFEND;
+}
+AFFEND
+
+/* Largest block moved by one call to sock_read or sock_write */
+#define SOCK_BLOCKSIZE (4*IO_BUFSIZE)
+
+static AFFDEF(sock_read)
+{
+  AARG(sock, vec, off, n);
+  unsigned char buf[SOCK_BLOCKSIZE];
+  int rb, i;
+  AFBEGIN;
+
+  for (;;) {
+    rb = FIX2INT(AV(n));
+    if (rb > SOCK_BLOCKSIZE)
+      rb = SOCK_BLOCKSIZE;
+    rb = recv(SOCKDATA(AV(sock))->fd, (void *)buf, rb, 0);
+    if (rb >= 0 || (errno != EINTR && !WOULDBLOCK(errno)))
+      break;
+    if (errno != EINTR)
+      AIOWAITR(SOCKDATA(AV(sock))->fd);
+  }
   if (rb == 0)
     ARETURN(CNIL);
   if (rb < 0) {
@@ -175,8 +215,38 @@ static AFFDEF(sock_getb)
     arc_err_cstrfmt(c, "error reading socket (%s; errno=%d)", strerror(en), en);
     ARETURN(CNIL);
   }
+  for (i=0; i<rb; i++)
+    XVINDEX(AV(vec), FIX2INT(AV(off)) + i) = INT2FIX(buf[i]);
+  ARETURN(INT2FIX(rb));
+  AFEND;
+}
+AFFEND
 
-  ARETURN(INT2FIX(ch));
+static AFFDEF(sock_write)
+{
+  AARG(sock, vec, off, n);
+  unsigned char buf[SOCK_BLOCKSIZE];
+  int wb, i, len;
+  AFBEGIN;
+  for (;;) {
+    len = FIX2INT(AV(n));
+    if (len > SOCK_BLOCKSIZE)
+      len = SOCK_BLOCKSIZE;
+    for (i=0; i<len; i++)
+      buf[i] = (unsigned char)FIX2INT(XVINDEX(AV(vec), FIX2INT(AV(off)) + i));
+    wb = send(SOCKDATA(AV(sock))->fd, (void *)buf, len, 0);
+    if (wb >= 0 || (errno != EINTR && !WOULDBLOCK(errno)))
+      break;
+    if (errno != EINTR)
+      AIOWAITW(SOCKDATA(AV(sock))->fd);
+  }
+  if (wb < 0) {
+    int en = errno;
+
+    arc_err_cstrfmt(c, "error writing socket (%s; errno=%d)", strerror(en), en);
+    ARETURN(CNIL);
+  }
+  ARETURN(INT2FIX(wb));
   AFEND;
 }
 AFFEND
@@ -187,8 +257,14 @@ static AFFDEF(sock_putb)
   unsigned char ch;
   int wb;
   AFBEGIN;
-  ch = (char)(FIX2INT(AV(byte)) & 0xff);
-  wb = send(SOCKDATA(AV(sock))->fd, (void *)&ch, sizeof(ch), 0);
+  for (;;) {
+    ch = (char)(FIX2INT(AV(byte)) & 0xff);
+    wb = send(SOCKDATA(AV(sock))->fd, (void *)&ch, sizeof(ch), 0);
+    if (wb >= 0 || (errno != EINTR && !WOULDBLOCK(errno)))
+      break;
+    if (errno != EINTR)
+      AIOWAITW(SOCKDATA(AV(sock))->fd);
+  }
   if (wb < 0) {
     int en = errno;
 
@@ -200,6 +276,15 @@ static AFFDEF(sock_putb)
 }
 AFFEND
 
+static AFFDEF(sock_fd)
+{
+  AARG(sock);
+  AFBEGIN;
+  ARETURN(INT2FIX(SOCKDATA(AV(sock))->fd));
+  AFEND;
+}
+AFFEND
+
 static AFFDEF(sock_seek)
 {
   AARG(sock, offset, whence);
@@ -241,6 +326,7 @@ static value mksocket(arc *c, int type, int sockfd, int ai_family, int socktype)
 {
   value sock;
 
+  fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
   sock = __arc_allocio(c, type, &sock_tfn, sizeof(struct sock_t));
   IO(sock)->flags = 0;
   IO(sock)->io_ops = VINDEX(VINDEX(c->builtins, BI_io), BI_io_sock);
@@ -250,6 +336,8 @@ static value mksocket(arc *c, int type, int sockfd, int ai_family, int socktype)
   SOCKDATA(sock)->addr = NULL;
   SOCKDATA(sock)->ai_family = ai_family;
   SOCKDATA(sock)->socktype = socktype;
+  if (type == T_INPORT)
+    __arc_io_rbuf(c, sock);
   return(sock);
 }
 
@@ -266,6 +354,10 @@ void __arc_init_sockio(arc *c)
   SVINDEX(io_ops, IO_seek, arc_mkaff(c, sock_seek, CNIL));
   SVINDEX(io_ops, IO_tell, arc_mkaff(c, sock_tell, CNIL));
   SVINDEX(io_ops, IO_close, arc_mkaff(c, sock_close, CNIL));
+  SVINDEX(io_ops, IO_fill, arc_mkaff(c, sock_fill, CNIL));
+  SVINDEX(io_ops, IO_read, arc_mkaff(c, sock_read, CNIL));
+  SVINDEX(io_ops, IO_write, arc_mkaff(c, sock_write, CNIL));
+  SVINDEX(io_ops, IO_fd, arc_mkaff(c, sock_fd, CNIL));
   SVINDEX(VINDEX(c->builtins, BI_io), BI_io_sock, io_ops);
 }
 
@@ -280,7 +372,8 @@ AFFDEF(arc_open_socket)
   AFBEGIN;
 
   TYPECHECK(AV(port), T_FIXNUM);
-  if (FIX2INT(AV(port)) < 1 || FIX2INT(AV(port)) > 65535) {
+  /* port 0 has the system choose a free port */
+  if (FIX2INT(AV(port)) < 0 || FIX2INT(AV(port)) > 65535) {
     arc_err_cstrfmt(c, "open-socket: port number %d out of range", FIX2INT(AV(port)));
     ARETURN(CNIL);
   }
@@ -348,15 +441,16 @@ AFFDEF(arc_socket_accept)
   TYPECHECK(AV(sock), T_INPORT);
   /* XXX - find a way to verify that sock really is a socket */
 
-  /* Check if it's open for reading.  If not it will block the thread */
-  AFCALL(VINDEX(IO(AV(sock))->io_ops, IO_ready), AV(sock));
-  if (AFCRV == CNIL) {
-    arc_err_cstrfmt(c, "socket is not ready for reading");
-    ARETURN(CNIL);
+  /* Wait for a connection if there is none yet */
+  for (;;) {
+    addr_size = sizeof(struct sockaddr_storage);
+    newfd = accept(SOCKDATA(AV(sock))->fd, (struct sockaddr *)&their_addr,
+		   &addr_size);
+    if (newfd >= 0 || (errno != EINTR && !WOULDBLOCK(errno)))
+      break;
+    if (errno != EINTR)
+      AIOWAITR(SOCKDATA(AV(sock))->fd);
   }
-
-  addr_size = sizeof(struct sockaddr_storage);
-  newfd = accept(SOCKDATA(AV(sock))->fd, (struct sockaddr *)&their_addr, &addr_size);
   if (newfd < 0) {
     int en = errno;
 
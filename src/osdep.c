@@ -68,6 +68,23 @@ unsigned long long __arc_milliseconds(void)
 #endif
 }
 
+/* Same as __arc_milliseconds, but with microsecond resolution.  Used
+   for timing things that are usually much shorter than a millisecond,
+   like garbage collector pauses. */
+unsigned long long __arc_microseconds(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec tp;
+
+  if (clock_gettime(CLOCK_REALTIME, &tp) < 0)
+    return((unsigned long long)time(NULL)*1000000LL);
+  return(((unsigned long long)tp.tv_sec)*1000000LL
+	 + ((unsigned long long)tp.tv_nsec / 1000LL));
+#else
+  return((unsigned long long)time(NULL)*1000000LL);
+#endif
+}
+
 value arc_seconds(arc *c)
 {
   return(__arc_ull2val(c, __arc_milliseconds() / 1000ULL));
@@ -114,12 +131,12 @@ AFFDEF(arc_timedate)
   (void)ignored;
 
   if (BOUND_P(AV(arg))) {
-    AFCALL(arc_mkaff(c, arc_coerce, CNIL), AV(arg),
-	   ARC_BUILTIN(c, S_FIXNUM));
+    AFCALLF(arc_coerce, AV(arg),
+	    ARC_BUILTIN(c, S_FIXNUM));
     fnv = AFCRV;
     if (NIL_P(fnv)) {
-      AFCALL(arc_mkaff(c, arc_coerce, CNIL), AV(arg),
-	     ARC_BUILTIN(c, S_FLONUM));
+      AFCALLF(arc_coerce, AV(arg),
+	      ARC_BUILTIN(c, S_FLONUM));
       fnv = AFCRV;
       tm = (time_t)REPFLO(fnv);
     } else {
@@ -173,15 +190,15 @@ AFFDEF(arc_system)
   AFBEGIN;
   WV(pf, arc_pipe_from(c, AV(cmd)));
   for (;;) {
-    AFCALL(arc_mkaff(c, arc_readc, CNIL), AV(pf));
+    AFCALLF(arc_readc, AV(pf));
     if (NIL_P(AFCRV))
       goto finished;
-    AFCALL(arc_mkaff(c, arc_writec, CNIL), AFCRV);
+    AFCALLF(arc_writec, AFCRV);
   }
  finished:
   /* XXX - find out a way to get the original return value of the
      command to return it properly. */
-  AFCALL(arc_mkaff(c, arc_close, CNIL), AV(pf));
+  AFCALLF(arc_close, AV(pf));
   ARETURN(CTRUE);
   AFEND;
 }
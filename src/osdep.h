@@ -21,6 +21,7 @@
 
 /* OS-dependent functions */
 extern unsigned long long __arc_milliseconds(void);
+extern unsigned long long __arc_microseconds(void);
 extern value arc_seconds(arc *c);
 extern value arc_msec(arc *c);
 extern value arc_current_process_milliseconds(arc *c);
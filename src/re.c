@@ -18,6 +18,7 @@
 */
 #include <string.h>
 #include "arcueid.h"
+#include "vmengine.h"
 #include "regexp.h"
 
 #ifdef HAVE_ALLOCA_H
@@ -94,8 +95,8 @@ static AFFDEF(regex_pprint)
 
   (void)visithash;
   (void)disp;
-  WV(dw, arc_mkaff(c, __arc_disp_write, CNIL));
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
+  WV(dw, arc_aff(c, __arc_disp_write));
+  WV(wc, arc_aff(c, arc_writec));
   AFCALL(AV(wc), arc_mkchar(c, 'r'), AV(fp));
   AFCALL(AV(wc), arc_mkchar(c, '/'), AV(fp));
 
@@ -148,19 +149,27 @@ AFFEND
 
 #define MAX_RS 32
 
-value arc_regexp_match(arc *c, value regexp, value str)
+/* Strings at least this long are matched without the runtime lock
+   (see regex_apply) */
+#define REGEX_UNLOCKED_LEN 1024
+
+static int regexp_exec(arc *c, value regexp, value str, Resub *rs)
 {
-  Reprog *rp;
-  Resub rs[MAX_RS];
-  int i, rv;
   struct regexp_t *rxdata;
-  value subexprs = CNIL;
+  int i;
 
   rxdata = (struct regexp_t *)REP(regexp);
-  rp = rxdata->rp;
   for (i=0; i<MAX_RS; i++)
     rs[i].csp = rs[i].cep = -1;
-  if ((rv = rregexec(c, rp, str, rs, 10)) >= 0) {
+  return(rregexec(c, rxdata->rp, str, rs, 10));
+}
+
+static value regexp_result(arc *c, value str, int rv, Resub *rs)
+{
+  int i;
+  value subexprs = CNIL;
+
+  if (rv >= 0) {
     /* handle substring matches */
     for (i=MAX_RS-1; i>=0; i--) {
       value sstr;
@@ -178,10 +187,24 @@ value arc_regexp_match(arc *c, value regexp, value str)
   return(CNIL);
 }
 
-/* A regex can be applied to a string value */
+value arc_regexp_match(arc *c, value regexp, value str)
+{
+  Resub rs[MAX_RS];
+
+  return(regexp_result(c, str, regexp_exec(c, regexp, str, rs), rs));
+}
+
+/* A regex can be applied to a string value.  Matching a long string
+   can take a while, and touches nothing but the regex and the
+   string, so other workers of the SMP dispatcher may run meanwhile.
+   The match is then done on a copy of the string, which no other
+   thread can change underneath it, kept on the stack where the
+   collector can see it.  The regex is still in the value register. */
 static int regex_apply(arc *c, value thr, value rx)
 {
   value str;
+  Resub rs[MAX_RS];
+  int rv, rtd;
 
   if (arc_thr_argc(c, thr) != 1) {
     arc_err_cstrfmt(c, "application of a regex expects 1 argument, given %d",
@@ -193,7 +216,17 @@ static int regex_apply(arc *c, value thr, value rx)
     arc_err_cstrfmt(c, "application of a regex expects type <string> as argument");
     return(TR_RC);
   }
-  arc_thr_set_valr(c, thr, arc_regexp_match(c, rx, str));
+  if (arc_strlen(c, str) < REGEX_UNLOCKED_LEN) {
+    arc_thr_set_valr(c, thr, arc_regexp_match(c, rx, str));
+    return(TR_RC);
+  }
+  str = arc_substr(c, str, 0, arc_strlen(c, str));
+  arc_thr_push(c, thr, str);
+  BLOCK_BEGIN(c, rtd);
+  rv = regexp_exec(c, rx, str, rs);
+  BLOCK_END(c, rtd);
+  arc_thr_pop(c, thr);
+  arc_thr_set_valr(c, thr, regexp_result(c, str, rv, rs));
   return(TR_RC);
 }
 
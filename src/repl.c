@@ -204,7 +204,9 @@ static AFFDEF(rl_getb)
       add_history(line_read);
       next_history();		/* not sure why this is needed... */
       rlstr = arc_mkstringc(c, line_read);
-      RLDATA(AV(rlio))->str = arc_strcatc(c, rlstr, '\n');
+      rlstr = arc_strcatc(c, rlstr, '\n');
+      __arc_wb(RLDATA(AV(rlio))->str, rlstr);
+      RLDATA(AV(rlio))->str = rlstr;
       WV(len, arc_strlen(c, RLDATA(AV(rlio))->str));
       RLDATA(AV(rlio))->idx = 0;
     }
@@ -391,9 +393,9 @@ AFFDEF(compile_something)
   AFBEGIN;
   TQUANTA(thr) = QUANTA;	/* needed so macros can execute */
   WV(sio, arc_instring(c, AV(something), CNIL));
-  AFCALL(arc_mkaff(c, arc_sread, CNIL), AV(sio), CNIL);
+  AFCALLF(arc_sread, AV(sio), CNIL);
   sexpr = AFCRV;
-  AFTCALL(arc_mkaff(c, arc_compile, CNIL), sexpr, arc_mkcctx(c), CNIL, CTRUE);
+  AFTCALLF(arc_compile, sexpr, arc_mkcctx(c), CNIL, CTRUE);
   AFEND;
 }
 AFFEND
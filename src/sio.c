@@ -24,12 +24,20 @@
 #include "builtins.h"
 #include "io.h"
 
+/* The string of an output port has room to spare, and only its first
+   len characters have been written.  It grows geometrically, so that
+   building up a string a character at a time takes amortised constant
+   time per character.  arc_inside trims it to size. */
 struct stringio_t {
   int closed;
   value str;
   int idx;
+  int len;
 };
 
+/* Smallest string an output port allocates */
+#define SIO_MINSIZE 64
+
 static typefn_t stringio_tfn;
 
 #define SIODATA(sio) (IODATA(sio, struct stringio_t *))
@@ -49,6 +57,26 @@ static unsigned long sio_hash(arc *c, value v, arc_hs *s)
   return(len);
 }
 
+/* Make room in the string of sio for at least n characters */
+static void sio_reserve(arc *c, value sio, int n)
+{
+  value str;
+  int size, i;
+
+  size = (NIL_P(SIODATA(sio)->str)) ? 0 : arc_strlen(c, SIODATA(sio)->str);
+  if (n <= size)
+    return;
+  if (size < SIO_MINSIZE)
+    size = SIO_MINSIZE;
+  while (size < n)
+    size *= 2;
+  str = arc_mkstringlen(c, size);
+  for (i=0; i<SIODATA(sio)->len; i++)
+    arc_strsetindex(c, str, i, arc_strindex(c, SIODATA(sio)->str, i));
+  __arc_wb(SIODATA(sio)->str, str);
+  SIODATA(sio)->str = str;
+}
+
 static AFFDEF(sio_closed_p)
 {
   AARG(sio);
@@ -80,11 +108,9 @@ AFFEND
 static AFFDEF(sio_getb)
 {
   AARG(sio);
-  int len;
   Rune r;
   AFBEGIN;
-  len = arc_strlen(c, SIODATA(AV(sio))->str);
-  if (SIODATA(AV(sio))->idx >= len)
+  if (SIODATA(AV(sio))->idx >= SIODATA(AV(sio))->len)
     ARETURN(CNIL);
   r = arc_strindex(c, SIODATA(AV(sio))->str, SIODATA(AV(sio))->idx++);
   ARETURN(INT2FIX(r));
@@ -95,25 +121,65 @@ AFFEND
 static AFFDEF(sio_putb)
 {
   AARG(sio, byte);
-  int len;
+  int idx;
 
   AFBEGIN;
-  if (SIODATA(AV(sio))->str == CNIL)
-    SIODATA(AV(sio))->str = arc_mkstringlen(c, 0);
-  len = arc_strlen(c, SIODATA(AV(sio))->str);
-  if (SIODATA(AV(sio))->idx >= len) {
-    SIODATA(AV(sio))->idx = len+1;
-    SIODATA(AV(sio))->str = arc_strcatc(c, SIODATA(AV(sio))->str,
-					(Rune)FIX2INT(AV(byte)));
-  } else {
-    arc_strsetindex(c, SIODATA(AV(sio))->str, SIODATA(AV(sio))->idx,
-		    (Rune)FIX2INT(AV(byte)));
+  idx = SIODATA(AV(sio))->idx;
+  if (idx >= SIODATA(AV(sio))->len) {
+    idx = SIODATA(AV(sio))->len;
+    sio_reserve(c, AV(sio), idx+1);
+    SIODATA(AV(sio))->len = idx+1;
   }
+  arc_strsetindex(c, SIODATA(AV(sio))->str, idx, (Rune)FIX2INT(AV(byte)));
+  SIODATA(AV(sio))->idx = idx+1;
   ARETURN(AV(byte));
   AFEND;
 }
 AFFEND
 
+/* The "bytes" of a string port are the characters of its string */
+static AFFDEF(sio_read)
+{
+  AARG(sio, vec, off, n);
+  int i, cnt;
+  AFBEGIN;
+  cnt = SIODATA(AV(sio))->len - SIODATA(AV(sio))->idx;
+  if (cnt <= 0)
+    ARETURN(CNIL);
+  if (cnt > FIX2INT(AV(n)))
+    cnt = FIX2INT(AV(n));
+  for (i=0; i<cnt; i++) {
+    XVINDEX(AV(vec), FIX2INT(AV(off)) + i)
+      = INT2FIX(arc_strindex(c, SIODATA(AV(sio))->str,
+			     SIODATA(AV(sio))->idx++));
+  }
+  ARETURN(INT2FIX(cnt));
+  AFEND;
+}
+AFFEND
+
+static AFFDEF(sio_write)
+{
+  AARG(sio, vec, off, n);
+  int len, nlen, i, idx;
+  AFBEGIN;
+  len = SIODATA(AV(sio))->len;
+  idx = (SIODATA(AV(sio))->idx > len) ? len : SIODATA(AV(sio))->idx;
+  nlen = idx + FIX2INT(AV(n));
+  if (nlen > len) {
+    sio_reserve(c, AV(sio), nlen);
+    SIODATA(AV(sio))->len = nlen;
+  }
+  for (i=0; i<FIX2INT(AV(n)); i++) {
+    arc_strsetindex(c, SIODATA(AV(sio))->str, idx + i,
+		    (Rune)FIX2INT(XVINDEX(AV(vec), FIX2INT(AV(off)) + i)));
+  }
+  SIODATA(AV(sio))->idx = nlen;
+  ARETURN(AV(n));
+  AFEND;
+}
+AFFEND
+
 static AFFDEF(sio_seek)
 {
   AARG(sio, offset, whence);
@@ -125,7 +191,7 @@ static AFFDEF(sio_seek)
     ARETURN(CNIL);
   }
 
-  len = arc_strlen(c, SIODATA(AV(sio))->str);
+  len = SIODATA(AV(sio))->len;
   switch (FIX2INT(AV(whence))) {
   case SEEK_SET:
     noffset = FIX2INT(AV(offset));
@@ -179,6 +245,7 @@ static value mkstringio(arc *c, int type, value string, value name)
   SIODATA(sio)->closed = 0;
   SIODATA(sio)->idx = 0;
   SIODATA(sio)->str = string;
+  SIODATA(sio)->len = (NIL_P(string)) ? 0 : arc_strlen(c, string);
   return(sio);
 }
 
@@ -218,9 +285,17 @@ AFFEND
 
 value arc_inside(arc *c, value sio)
 {
+  value str;
+
   /* XXX type checks */
   if (NIL_P(SIODATA(sio)->str))
     return(arc_mkstringc(c, ""));
+  if (SIODATA(sio)->len < arc_strlen(c, SIODATA(sio)->str)) {
+    /* the port keeps the trimmed string, so doing this again is free */
+    str = arc_substr(c, SIODATA(sio)->str, 0, SIODATA(sio)->len);
+    __arc_wb(SIODATA(sio)->str, str);
+    SIODATA(sio)->str = str;
+  }
   return(SIODATA(sio)->str);
 }
 
@@ -237,6 +312,8 @@ void __arc_init_sio(arc *c)
   SVINDEX(io_ops, IO_seek, arc_mkaff(c, sio_seek, CNIL));
   SVINDEX(io_ops, IO_tell, arc_mkaff(c, sio_tell, CNIL));
   SVINDEX(io_ops, IO_close, arc_mkaff(c, sio_close, CNIL));
+  SVINDEX(io_ops, IO_read, arc_mkaff(c, sio_read, CNIL));
+  SVINDEX(io_ops, IO_write, arc_mkaff(c, sio_write, CNIL));
   SVINDEX(VINDEX(c->builtins, BI_io), BI_io_strio, io_ops);
 }
 
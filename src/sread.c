@@ -160,15 +160,15 @@ static int issym(Rune ch)
 }
 
 #define SCAN(fp, lndata, ch)			\
-  AFCALL(arc_mkaff(c, scan, CNIL), fp, lndata);	\
+  AFCALLF(scan, fp, lndata);			\
   WV(ch, AFCRV)
 
 #define READ(fp, eof, lndata, val)				\
-  AFCALL(arc_mkaff(c, arc_sread, CNIL), fp, eof, lndata);	\
+  AFCALLF(arc_sread, fp, eof, lndata);				\
   WV(val, AFCRV)
 
 #define READC(fp, val)					\
-  AFCALL(arc_mkaff(c, arc_readc, CNIL), fp);	\
+  AFCALLF(arc_readc, fp);			\
   WV(val, AFCRV);					\
   if (NIL_P(AV(val))) {					\
     arc_err_cstrfmt(c, "unexpected end of source");	\
@@ -176,11 +176,11 @@ static int issym(Rune ch)
   }
 
 #define READC2(fp, val, r)					\
-  AFCALL(arc_mkaff(c, arc_readc, CNIL), fp);			\
+  AFCALLF(arc_readc, fp);					\
   WV(val, AFCRV);						\
   r = (NIL_P(AV(val))) ? Runeerror : arc_char2rune(c, AV(val))	\
 
-#define READ_COMMENT(fd, lndata) AFCALL(arc_mkaff(c, read_comment, CNIL), fd, CNIL, lndata)
+#define READ_COMMENT(fd, lndata) AFCALLF(read_comment, fd, CNIL, lndata)
 
 /* Read up to the first non-symbol character from fp.
    This also serves to read a regex, which is something of the
@@ -262,7 +262,7 @@ static AFFDEF(getsymbol)
       goto finished;		/* no more to read */
     }
     /* write character to buffer */
-    AFCALL(arc_mkaff(c, arc_writec, CNIL), AV(ch), AV(buf));
+    AFCALLF(arc_writec, AV(ch), AV(buf));
   }
  finished:
   /* If the final state was state 5, we have a normal symbol or
@@ -308,31 +308,31 @@ AFFDEF(arc_sread)
     /* cannot use switch here: interferes with the case statement implicitly
        created by AFBEGIN! */
     if (r == '(') {
-      WV(func, arc_mkaff(c, read_list, CNIL));
+      WV(func, arc_aff(c, read_list));
     } else if (r == ')') {
       arc_err_cstrfmt(c, "misplaced right paren");
       ARETURN(CNIL);
     } else if (r == '[') {
-      WV(func, arc_mkaff(c, read_anonf, CNIL));
+      WV(func, arc_aff(c, read_anonf));
     } else if (r == ']') {
       arc_err_cstrfmt(c, "misplaced right bracket");
       ARETURN(CNIL);
     } else if (r == '\'') {
-      WV(func, arc_mkaff(c, read_quote, CNIL));
+      WV(func, arc_aff(c, read_quote));
     } else if (r == '`') {
-      WV(func, arc_mkaff(c, read_qquote, CNIL));
+      WV(func, arc_aff(c, read_qquote));
     } else if (r == ',') {
-      WV(func, arc_mkaff(c, read_comma, CNIL));
+      WV(func, arc_aff(c, read_comma));
     } else if (r == '"') {
-      WV(func, arc_mkaff(c, read_string, CNIL));
+      WV(func, arc_aff(c, read_string));
     } else if (r == '#') {
-      WV(func, arc_mkaff(c, read_char, CNIL));
+      WV(func, arc_aff(c, read_char));
     } else if (r == ';') {
       READ_COMMENT(AV(fp), AV(lndata));
       continue;
     } else {
       arc_ungetc_rune(c, r, AV(fp));
-      WV(func, arc_mkaff(c, read_symbol, CNIL));
+      WV(func, arc_aff(c, read_symbol));
     }
     if (BOUND_P(AV(lndata))) {
       value result;
@@ -358,7 +358,7 @@ static AFFDEF(scan)
   AVAR(ch);
   AFBEGIN;
   for (;;) {
-    AFCALL(arc_mkaff(c, arc_readc, CNIL), AV(fp));
+    AFCALLF(arc_readc, AV(fp));
     WV(ch, AFCRV);
     if (NIL_P(AV(ch)))
       ARETURN(CNIL);
@@ -482,8 +482,8 @@ static AFFDEF(read_quote)
   AOARG(lndata);
   AFBEGIN;
   (void)lndata;
-  AFTCALL(arc_mkaff(c, readq, CNIL), AV(fp), ARC_BUILTIN(c, S_QUOTE),
-	  AV(eof), AV(lndata));
+  AFTCALLF(readq, AV(fp), ARC_BUILTIN(c, S_QUOTE),
+	   AV(eof), AV(lndata));
   AFEND;
 }
 AFFEND
@@ -494,8 +494,8 @@ static AFFDEF(read_qquote)
   AOARG(lndata);
   AFBEGIN;
   (void)lndata;
-  AFTCALL(arc_mkaff(c, readq, CNIL), AV(fp), ARC_BUILTIN(c, S_QQUOTE),
-	  AV(eof), AV(lndata));
+  AFTCALLF(readq, AV(fp), ARC_BUILTIN(c, S_QQUOTE),
+	   AV(eof), AV(lndata));
   AFEND;
 }
 AFFEND
@@ -513,13 +513,13 @@ static AFFDEF(read_comma)
   r = arc_char2rune(c, AV(ch));
   /* unquote-splicing */
   if (r == '@') {
-    AFTCALL(arc_mkaff(c, readq, CNIL), AV(fp),
-	    ARC_BUILTIN(c, S_UNQUOTESP), AV(eof), AV(lndata));
+    AFTCALLF(readq, AV(fp),
+	     ARC_BUILTIN(c, S_UNQUOTESP), AV(eof), AV(lndata));
   }
   /* normal unquote. */
   arc_ungetc_rune(c, r, AV(fp));
-  AFTCALL(arc_mkaff(c, readq, CNIL), AV(fp), ARC_BUILTIN(c, S_UNQUOTE),
-	  AV(eof), AV(lndata));
+  AFTCALLF(readq, AV(fp), ARC_BUILTIN(c, S_UNQUOTE),
+	   AV(eof), AV(lndata));
   AFEND;
 }
 AFFEND
@@ -583,11 +583,11 @@ static AFFDEF(codestring)
   /* Get the current position after reading. Break the string up
      again at that point, and pass the remainder of the string back
      to codestring recursively. */
-  AFCALL(arc_mkaff(c, arc_tell, CNIL), AV(in));
+  AFCALLF(arc_tell, AV(in));
   i = FIX2INT(AFCRV);
   rlen = arc_strlen(c, AV(rest));
-  AFCALL(arc_mkaff(c, codestring, CNIL),
-	 arc_substr(c, AV(rest), i, rlen), AV(lndata));
+  AFCALLF(codestring,
+	  arc_substr(c, AV(rest), i, rlen), AV(lndata));
   /* We then combine the pre-@-sign portion of the string (ss),
      the post-@-sign portion (that became sexpr after reading), and the
      results of the recursive call to codestring on the portion of the
@@ -605,7 +605,7 @@ static AFFDEF(read_atstring)
   AVAR(cs, p);
   AFBEGIN;
   if (atpos(c, AV(s), 0) >= 0) {
-    AFCALL(arc_mkaff(c, codestring, CNIL), AV(s), AV(lndata));
+    AFCALLF(codestring, AV(s), AV(lndata));
     WV(cs, AFCRV);
     for (WV(p, AV(cs)); AV(p); WV(p, cdr(AV(p)))) {
       if (TYPE(car(AV(p))) == T_STRING)
@@ -638,8 +638,8 @@ AFFDEF(read_string)
       if (r == '\"') {
 	/* end of string */
 	if (arc_declared(c, ARC_BUILTIN(c, S_ATSTRINGS))) {
-	  AFTCALL(arc_mkaff(c, read_atstring, CNIL),
-		  arc_inside(c, AV(buf)), AV(lndata));
+	  AFTCALLF(read_atstring,
+		   arc_inside(c, AV(buf)), AV(lndata));
 	}
 	ARETURN(arc_inside(c, AV(buf)));
       }
@@ -655,7 +655,7 @@ AFFDEF(read_string)
       }
 
       /* Otherwise, just add the character to our string buffer */
-      AFCALL(arc_mkaff(c, arc_writec, CNIL), arc_mkchar(c, r), AV(buf));
+      AFCALLF(arc_writec, arc_mkchar(c, r), AV(buf));
       continue;
     }
 
@@ -688,7 +688,7 @@ AFFDEF(read_string)
 	arc_err_cstrfmt(c, "unknown escape code");
 	ARETURN(CNIL);
       }
-      AFCALL(arc_mkaff(c, arc_writec, CNIL), arc_mkchar(c, r), AV(buf));
+      AFCALLF(arc_writec, arc_mkchar(c, r), AV(buf));
       WV(state, INT2FIX(1));
       continue;
     }
@@ -697,9 +697,9 @@ AFFDEF(read_string)
       /* Unicode escape */
       if (FIX2INT(AV(digcount)) >= 5) {
 	arc_ungetc_rune(c, r, AV(fp));
-	AFCALL(arc_mkaff(c, arc_writec, CNIL),
-	       arc_mkchar(c, FIX2INT(AV(escrune))),
-	       AV(buf));
+	AFCALLF(arc_writec,
+		arc_mkchar(c, FIX2INT(AV(escrune))),
+		AV(buf));
 	WV(state, INT2FIX(1));
 	continue;
       }
@@ -760,7 +760,7 @@ static AFFDEF(read_char)
     ARETURN(arc_mkchar(c, r));
   }
   arc_ungetc_rune(c, r, AV(fp));
-  AFCALL(arc_mkaff(c, getsymbol, CNIL), AV(fp));
+  AFCALLF(getsymbol, AV(fp));
   tok = AFCRV;
   /* no AFCALLs after this point? */
   if (arc_strlen(c, tok) == 1)	/* single character */
@@ -861,7 +861,7 @@ static AFFDEF(read_symbol)
   AFBEGIN;
   (void)lndata;
   (void)eof;
-  AFCALL(arc_mkaff(c, getsymbol, CNIL), AV(fp));
+  AFCALLF(getsymbol, AV(fp));
   WV(sym, AFCRV);
   if (TYPE(AV(sym)) == T_REGEXP)
     return(AV(sym));
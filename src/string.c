@@ -17,6 +17,7 @@
   License along with this library; if not, see <http://www.gnu.org/licenses/>.
 */
 #include <inttypes.h>
+#include <limits.h>
 #include <string.h>
 #include "arcueid.h"
 #include "utf.h"
@@ -24,6 +25,33 @@
 #include "builtins.h"
 #include "hash.h"
 
+/* Vector operations used by the string kernels below, on AVX2 or SSE2
+   when the compiler targets them.  Without either the kernels are
+   plain loops over the characters. */
+#if defined(__AVX2__)
+#include <immintrin.h>
+typedef __m256i svec;
+#define SV_BYTES 32
+#define SV_FULL 0xffffffffU
+#define sv_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define sv_set16(x) _mm256_set1_epi16((short)(x))
+#define sv_set32(x) _mm256_set1_epi32((int)(x))
+#define sv_eq16(a, b) _mm256_cmpeq_epi16((a), (b))
+#define sv_eq32(a, b) _mm256_cmpeq_epi32((a), (b))
+#define sv_mask(v) ((unsigned)_mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128i svec;
+#define SV_BYTES 16
+#define SV_FULL 0xffffU
+#define sv_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define sv_set16(x) _mm_set1_epi16((short)(x))
+#define sv_set32(x) _mm_set1_epi32((int)(x))
+#define sv_eq16(a, b) _mm_cmpeq_epi16((a), (b))
+#define sv_eq32(a, b) _mm_cmpeq_epi32((a), (b))
+#define sv_mask(v) ((unsigned)_mm_movemask_epi8(v))
+#endif
+
 #ifdef HAVE_ALLOCA_H
 # include <alloca.h>
 #elif defined __GNUC__
@@ -40,13 +68,186 @@
 void *alloca (size_t);
 #endif
 
+/* Strings are kept one, two or four bytes to a character (Latin-1,
+   UCS-2 or UCS-4), as narrow as the widest character stored in them
+   so far allows.  Storing a character too wide for a string makes a
+   wider copy of its characters, which the string forwards to from then
+   on through wide, since a string object cannot grow in place.  There
+   is always a zero character just past the end. */
 typedef struct {
   int len;
-  Rune str[1];
+  int width;
+  value wide;
+  union {
+    unsigned char c1[1];
+    uint16_t c2[1];
+    Rune c4[1];
+  } data;
 } string;
 
 #define STRREP(v) ((string *)REP(v))
 
+/* The string holding the characters of v */
+#define STRBODY(v) ((NIL_P(STRREP(v)->wide)) ? STRREP(v) : STRREP(STRREP(v)->wide))
+
+/* Bytes needed to store a character */
+#define RUNEWIDTH(r) (((r) < 0x100) ? 1 : ((r) < 0x10000) ? 2 : 4)
+
+static inline Rune sbget(string *s, int i)
+{
+  switch (s->width) {
+  case 1:
+    return(s->data.c1[i]);
+  case 2:
+    return(s->data.c2[i]);
+  default:
+    return(s->data.c4[i]);
+  }
+}
+
+static inline void sbset(string *s, int i, Rune r)
+{
+  switch (s->width) {
+  case 1:
+    s->data.c1[i] = (unsigned char)r;
+    break;
+  case 2:
+    s->data.c2[i] = (uint16_t)r;
+    break;
+  default:
+    s->data.c4[i] = r;
+    break;
+  }
+}
+
+/* Copy n characters from src starting at sidx into dest at didx */
+static void sbcopy(string *dest, int didx, string *src, int sidx, int n)
+{
+  int i;
+
+  if (dest->width == src->width) {
+    memcpy(dest->data.c1 + didx*dest->width, src->data.c1 + sidx*src->width,
+	   n*src->width);
+    return;
+  }
+  for (i=0; i<n; i++)
+    sbset(dest, didx + i, sbget(src, sidx + i));
+}
+
+static value mkstringw(arc *c, int length, int width)
+{
+  value str;
+  string *strdata;
+
+  str = arc_mkobject(c, sizeof(string) - sizeof(strdata->data)
+		     + (length+1)*width, T_STRING);
+  strdata = STRREP(str);
+  strdata->len = length;
+  strdata->width = width;
+  strdata->wide = CNIL;
+  sbset(strdata, length, 0);
+  return(str);
+}
+
+/* Index of the first character of s equal to ch, or -1.  Latin-1
+   strings are left to memchr, which the C library vectorises. */
+static int sbchr(string *s, Rune ch)
+{
+  int i = 0;
+  unsigned char *p;
+#ifdef SV_BYTES
+  svec needle;
+  unsigned m;
+#endif
+
+  switch (s->width) {
+  case 1:
+    p = memchr(s->data.c1, ch, s->len);
+    return((p == NULL) ? -1 : p - s->data.c1);
+  case 2:
+#ifdef SV_BYTES
+    needle = sv_set16(ch);
+    for (; i + SV_BYTES/2 <= s->len; i += SV_BYTES/2) {
+      m = sv_mask(sv_eq16(sv_load(s->data.c2 + i), needle));
+      if (m != 0)
+	return(i + __builtin_ctz(m)/2);
+    }
+#endif
+    break;
+  default:
+#ifdef SV_BYTES
+    needle = sv_set32(ch);
+    for (; i + SV_BYTES/4 <= s->len; i += SV_BYTES/4) {
+      m = sv_mask(sv_eq32(sv_load(s->data.c4 + i), needle));
+      if (m != 0)
+	return(i + __builtin_ctz(m)/4);
+    }
+#endif
+    break;
+  }
+  for (; i<s->len; i++) {
+    if (sbget(s, i) == ch)
+      return(i);
+  }
+  return(-1);
+}
+
+/* Index of the first of the first n characters at which s1 and s2
+   differ, or n if they do not. */
+static int sbmismatch(string *s1, string *s2, int n)
+{
+  int i = 0;
+#ifdef SV_BYTES
+  unsigned m;
+#endif
+
+  if (s1->width == s2->width) {
+    switch (s1->width) {
+    case 1:
+      /* memcmp is vectorised by the C library */
+      if (memcmp(s1->data.c1, s2->data.c1, n) == 0)
+	return(n);
+      break;
+#ifdef SV_BYTES
+    case 2:
+      for (; i + SV_BYTES/2 <= n; i += SV_BYTES/2) {
+	m = sv_mask(sv_eq16(sv_load(s1->data.c2 + i),
+			    sv_load(s2->data.c2 + i)));
+	if (m != SV_FULL)
+	  return(i + __builtin_ctz(~m)/2);
+      }
+      break;
+    default:
+      for (; i + SV_BYTES/4 <= n; i += SV_BYTES/4) {
+	m = sv_mask(sv_eq32(sv_load(s1->data.c4 + i),
+			    sv_load(s2->data.c4 + i)));
+	if (m != SV_FULL)
+	  return(i + __builtin_ctz(~m)/4);
+      }
+      break;
+#endif
+    }
+  }
+  for (; i<n; i++) {
+    if (sbget(s1, i) != sbget(s2, i))
+      return(i);
+  }
+  return(n);
+}
+
+/* Make v wide enough for characters width bytes wide */
+static void widen(arc *c, value v, int width)
+{
+  value nstr;
+  string *s;
+
+  s = STRBODY(v);
+  nstr = mkstringw(c, s->len, width);
+  sbcopy(STRREP(nstr), 0, s, 0, s->len);
+  __arc_wb(STRREP(v)->wide, nstr);
+  STRREP(v)->wide = nstr;
+}
+
 #define FIXINC(x) WV(x, INT2FIX(FIX2INT(AV(x)) + 1))
 
 static char *escape_lookup[32] = {
@@ -93,7 +294,7 @@ static AFFDEF(string_pprint)
   AFBEGIN;
 
   (void)visithash;
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
+  WV(wc, arc_aff(c, arc_writec));
   if (NIL_P(AV(disp)))
     AFCALL(AV(wc), arc_mkchar(c, '\"'), AV(fp));
 
@@ -118,20 +319,56 @@ static AFFDEF(string_pprint)
 }
 AFFEND
 
+/* With 64-bit longs, three characters (of 21 bits at most) are fed to
+   the hash at a time, so it only has to be mixed once for every nine
+   characters.  The hash depends only on the characters, not on how
+   wide the string is. */
+#if ULONG_MAX > 0xffffffffUL
+#define HASHRUNES 3
+#define HASHPACK(r0, r1, r2) ((unsigned long)(r0) | ((unsigned long)(r1) << 21) \
+			      | ((unsigned long)(r2) << 42))
+#endif
+
 static unsigned long string_hash(arc *c, value v, arc_hs *s)
 {
   int i;
   unsigned long len;
-
-  len = arc_strlen(c, v);
-  for (i=0; i<len; i++)
-    arc_hash_update(s, (unsigned long)arc_strindex(c, v, i));
+  string *sb;
+
+  sb = STRBODY(v);
+  len = sb->len;
+  i = 0;
+#ifdef HASHRUNES
+  if (sb->width == 1) {
+    unsigned char *p = sb->data.c1;
+
+    for (; i + HASHRUNES <= len; i += HASHRUNES)
+      arc_hash_update(s, HASHPACK(p[i], p[i+1], p[i+2]));
+  } else {
+    for (; i + HASHRUNES <= len; i += HASHRUNES)
+      arc_hash_update(s, HASHPACK(sbget(sb, i), sbget(sb, i+1),
+				  sbget(sb, i+2)));
+  }
+#endif
+  for (; i<len; i++)
+    arc_hash_update(s, (unsigned long)sbget(sb, i));
   return(len);
 }
 
+static void string_marker(arc *c, value v, int depth,
+			  void (*markfn)(arc *, value, int))
+{
+  markfn(c, STRREP(v)->wide, depth);
+}
+
 static value string_iscmp(arc *c, value v1, value v2)
 {
-  return((arc_strcmp(c, v1, v2) == 0) ? CTRUE : CNIL);
+  int len;
+
+  len = arc_strlen(c, v1);
+  if (len != arc_strlen(c, v2))
+    return(CNIL);
+  return((sbmismatch(STRBODY(v1), STRBODY(v2), len) == len) ? CTRUE : CNIL);
 }
 
 /* A string can be applied to a fixnum value */
@@ -170,14 +407,7 @@ static int string_apply(arc *c, value thr, value str)
 
 value arc_mkstringlen(arc *c, int length)
 {
-  value str;
-  string *strdata;
-
-
-  str = arc_mkobject(c, sizeof(string) + (length-1)*sizeof(Rune), T_STRING);
-  strdata = (string *)REP(str);
-  strdata->len = length;
-  return(str);
+  return(mkstringw(c, length, 1));
 }
 
 AFFDEF(arc_newstring)
@@ -189,7 +419,7 @@ AFFDEF(arc_newstring)
   int i;
   AFBEGIN;
   chr = (BOUND_P(AV(ch))) ? arc_char2rune(c, AV(ch)) : 0;
-  str = arc_mkstringlen(c, FIX2INT(AV(length)));
+  str = mkstringw(c, FIX2INT(AV(length)), RUNEWIDTH(chr));
   for (i=0; i<FIX2INT(AV(length)); i++)
     arc_strsetindex(c, str, i, chr);
   ARETURN(str);
@@ -201,10 +431,20 @@ AFFEND
 value arc_mkstring(arc *c, const Rune *data, int length)
 {
   value str;
+  int i, width;
 
-  str = arc_mkstringlen(c, length);
-  memcpy(((string *)REP(str))->str, data, length*sizeof(Rune));
-  STRREP(str)->len = length;
+  width = 1;
+  for (i=0; i<length; i++) {
+    if (RUNEWIDTH(data[i]) > width)
+      width = RUNEWIDTH(data[i]);
+  }
+  str = mkstringw(c, length, width);
+  if (width == 4) {
+    memcpy(STRREP(str)->data.c4, data, length*sizeof(Rune));
+    return(str);
+  }
+  for (i=0; i<length; i++)
+    sbset(STRREP(str), i, data[i]);
   return(str);
 }
 
@@ -212,19 +452,31 @@ value arc_mkstring(arc *c, const Rune *data, int length)
 value arc_mkstringc(arc *c, const char *s)
 {
   value str;
-  int len, ch;
-  Rune *runeptr;
+  int len, i, width;
+  const char *p;
+  Rune r;
+
+  /* ASCII needs no decoding */
+  for (p=s; *p != 0 && !(*(unsigned char *)p & 0x80); p++)
+    ;
+  if (*p == 0) {
+    str = mkstringw(c, p - s, 1);
+    memcpy(STRREP(str)->data.c1, s, p - s);
+    return(str);
+  }
 
   len = utflen(s);
-  str = arc_mkstringlen(c, len);
-  runeptr = ((string *)REP(str))->str;
-  for (;;) {
-    ch = *(unsigned char *)s;
-    if (ch == 0)
-      break;
-    s += chartorune(runeptr++, s);
+  width = 1;
+  for (p=s; *p != 0;) {
+    p += chartorune(&r, p);
+    if (RUNEWIDTH(r) > width)
+      width = RUNEWIDTH(r);
+  }
+  str = mkstringw(c, len, width);
+  for (i=0, p=s; *p != 0; i++) {
+    p += chartorune(&r, p);
+    sbset(STRREP(str), i, r);
   }
-  STRREP(str)->len = len;
   return(str);
 }
 
@@ -236,7 +488,7 @@ static AFFDEF(char_pprint)
   AFBEGIN;
   (void)visithash;
 
-  WV(wc, arc_mkaff(c, arc_writec, CNIL));
+  WV(wc, arc_aff(c, arc_writec));
   /* in disp mode, we just print out the character as is */
   if (AV(disp) == CTRUE) {
     AFCALL(AV(wc), AV(sexpr), AV(fp));
@@ -248,9 +500,9 @@ static AFFDEF(char_pprint)
   if (BOUND_P(WV(escape, arc_hash_lookup(c, VINDEX(c->builtins, BI_charesc),
 					 AV(sexpr))))) {
     /* escape character */
-    AFCALL(arc_mkaff(c, string_pprint, CNIL), arc_mkstringc(c, "#\\"), CTRUE,
-	   AV(fp));
-    AFTCALL(arc_mkaff(c, string_pprint, CNIL), AV(escape), CTRUE, AV(fp));
+    AFCALLF(string_pprint, arc_mkstringc(c, "#\\"), CTRUE,
+	    AV(fp));
+    AFTCALLF(string_pprint, AV(escape), CTRUE, AV(fp));
   }
 
   /* no escape character */
@@ -271,20 +523,18 @@ static unsigned long char_hash(arc *c, value v, arc_hs *s)
 
 static value char_iscmp(arc *c, value v1, value v2)
 {
-  return((*(Rune *)REP(v1)) == (*(Rune *)REP(v2)) ? CTRUE : CNIL);
+  return((v1 == v2) ? CTRUE : CNIL);
 }
 
+/* Characters are immediate values, so making one never allocates. */
 value arc_mkchar(arc *c, Rune r)
 {
-  value ch;
-  ch = arc_mkobject(c, sizeof(Rune), T_CHAR);
-  *((Rune *)REP(ch)) = r;
-  return(ch);
+  return(RUNE2CHAR(r));
 }
 
 Rune arc_char2rune(arc *c, value ch)
 {
-  return(*((Rune *)REP(ch)));;
+  return(CHAR2RUNE(ch));
 }
 
 /* Most of these trivial and inefficient functions should
@@ -300,26 +550,30 @@ Rune arc_strindex(arc *c, value v, int index)
 {
   if (index > STRREP(v)->len)
     return(Runeerror);
-  return(STRREP(v)->str[index]);
+  return(sbget(STRBODY(v), index));
 }
 
 Rune arc_strsetindex(arc *c, value v, int index, Rune ch)
 {
-  STRREP(v)->str[index] = ch;
+  if (RUNEWIDTH(ch) > STRBODY(v)->width)
+    widen(c, v, RUNEWIDTH(ch));
+  sbset(STRBODY(v), index, ch);
   return(ch);
 }
 
 /* XXX - this is extremely inefficient! */
 value arc_strcatc(arc *c, value v1, Rune ch)
 {
-  Rune *runeptr;
   value newstr;
-
-  newstr = arc_mkstringlen(c, STRREP(v1)->len + 1);
-  runeptr = STRREP(newstr)->str;
-  memcpy(runeptr, STRREP(v1)->str, STRREP(v1)->len*sizeof(Rune));
-  runeptr += STRREP(v1)->len;
-  *runeptr = ch;
+  string *s1;
+  int width;
+
+  s1 = STRBODY(v1);
+  width = (RUNEWIDTH(ch) > s1->width) ? RUNEWIDTH(ch) : s1->width;
+  newstr = mkstringw(c, s1->len + 1, width);
+  s1 = STRBODY(v1);
+  sbcopy(STRREP(newstr), 0, s1, 0, s1->len);
+  sbset(STRREP(newstr), s1->len, ch);
   return(newstr);
 }
 
@@ -332,23 +586,24 @@ value arc_substr(arc *c, value s, int sidx, int eidx)
   if (eidx > len)
     eidx = len;
   nlen = eidx - sidx;
-  ns = arc_mkstringlen(c, nlen);
-  memcpy(STRREP(ns)->str, STRREP(s)->str + sidx, nlen*sizeof(Rune));
+  ns = mkstringw(c, nlen, STRBODY(s)->width);
+  sbcopy(STRREP(ns), 0, STRBODY(s), sidx, nlen);
   return(ns);
 }
 
 value arc_strcat(arc *c, value v1, value v2)
 {
   value newstr;
-  int len;
-  Rune *runeptr;
-
-  len = STRREP(v1)->len + STRREP(v2)->len;
-  newstr = arc_mkstringlen(c, len);
-  runeptr = STRREP(newstr)->str;
-  memcpy(runeptr, STRREP(v1)->str, STRREP(v1)->len*sizeof(Rune));
-  runeptr += STRREP(v1)->len;
-  memcpy(runeptr, STRREP(v2)->str, STRREP(v2)->len*sizeof(Rune));
+  string *s1, *s2;
+
+  s1 = STRBODY(v1);
+  s2 = STRBODY(v2);
+  newstr = mkstringw(c, s1->len + s2->len,
+		     (s1->width > s2->width) ? s1->width : s2->width);
+  s1 = STRBODY(v1);
+  s2 = STRBODY(v2);
+  sbcopy(STRREP(newstr), 0, s1, 0, s1->len);
+  sbcopy(STRREP(newstr), s1->len, s2, 0, s2->len);
   return(newstr);
 }
 
@@ -363,18 +618,22 @@ int arc_strcmp(arc *c, value v1, value v2)
 {
   int len1, len2, len;
   int i;
+  string *s1, *s2;
 
-  len1 = arc_strlen(c, v1);
-  len2 = arc_strlen(c, v2);
+  s1 = STRBODY(v1);
+  s2 = STRBODY(v2);
+  len1 = s1->len;
+  len2 = s2->len;
   len = (len1 > len2) ? len2 : len1;
-  for (i=0; i<len; i++) {
-    int r1, r2;
-    r1 = arc_strindex(c, v1, i);
-    r2 = arc_strindex(c, v2, i);
-    if (r1 > r2)
-      return(1);
-    if (r1 < r2)
-      return(-1);
+  if (s1->width == 1 && s2->width == 1) {
+    /* byte order is code point order for Latin-1 */
+    i = memcmp(s1->data.c1, s2->data.c1, len);
+    if (i != 0)
+      return((i > 0) ? 1 : -1);
+  } else {
+    i = sbmismatch(s1, s2, len);
+    if (i < len)
+      return((sbget(s1, i) > sbget(s2, i)) ? 1 : -1);
   }
   if (len1 > len2)
     return(1);
@@ -388,10 +647,18 @@ value arc_strutflen(arc *c, value str)
   int i, count;
   char buf[UTFmax];
   Rune r;
+  string *s;
 
+  s = STRBODY(str);
   count = 0;
-  for (i=0; i<arc_strlen(c, str); i++) {
-    r = arc_strindex(c, str, i);
+  if (s->width == 1) {
+    /* Latin-1 characters take one or two bytes */
+    for (i=0; i<s->len; i++)
+      count += (s->data.c1[i] < 0x80) ? 1 : 2;
+    return(INT2FIX(count));
+  }
+  for (i=0; i<s->len; i++) {
+    r = sbget(s, i);
     count += runetochar(buf, &r);
   }
   return(INT2FIX(count));
@@ -400,12 +667,13 @@ value arc_strutflen(arc *c, value str)
 value arc_strchr(arc *c, value str, Rune ch)
 {
   int i;
+  string *s;
 
-  for (i=0; i<arc_strlen(c, str); i++) {
-    if (arc_strindex(c, str, i) == ch)
-      return(INT2FIX(i));
-  }
-  return(CNIL);
+  s = STRBODY(str);
+  if (RUNEWIDTH(ch) > s->width)
+    return(CNIL);
+  i = sbchr(s, ch);
+  return((i < 0) ? CNIL : INT2FIX(i));
 }
 
 /* Convert a string into a C string.  The pointer ptr must be big
@@ -416,10 +684,16 @@ void arc_str2cstr(arc *c, value str, char *ptr)
   int i, nc;
   char *p;
   Rune r;
+  string *s;
 
   p = ptr;
-  for (i=0; i<arc_strlen(c, str); i++) {
-    r = arc_strindex(c, str, i);
+  s = STRBODY(str);
+  for (i=0; i<s->len; i++) {
+    r = sbget(s, i);
+    if (r < 0x80) {
+      *p++ = (char)r;
+      continue;
+    }
     nc = runetochar(p, &r);
     p += nc;
   }
@@ -438,8 +712,10 @@ static AFFDEF(char_xcoerce)
       || FIX2INT(AV(stype)) == T_INT)
     ARETURN(INT2FIX(arc_char2rune(c, AV(obj))));
 
-  if (FIX2INT(AV(stype)) == T_STRING)
-    ARETURN(arc_mkstring(c, (Rune *)REP(AV(obj)), 1));
+  if (FIX2INT(AV(stype)) == T_STRING) {
+    Rune r = arc_char2rune(c, AV(obj));
+    ARETURN(arc_mkstring(c, &r, 1));
+  }
   arc_err_cstrfmt(c, "cannot coerce");
   ARETURN(CNIL);
   AFEND;
@@ -640,7 +916,7 @@ static AFFDEF(string_xcoerce)
     value num;
 
     num = coerce_num(c, AV(obj), AV(arg));
-    AFTCALL(arc_mkaff(c, arc_coerce, CNIL), num, ARC_BUILTIN(c, S_INT));
+    AFTCALLF(arc_coerce, num, ARC_BUILTIN(c, S_INT));
   }
 
   arc_err_cstrfmt(c, "cannot coerce");
@@ -661,7 +937,7 @@ typefn_t __arc_char_typefn__ = {
 };
 
 typefn_t __arc_string_typefn__ = {
-  __arc_null_marker,
+  string_marker,
   __arc_null_sweeper,
   string_pprint,
   string_hash,
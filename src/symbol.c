@@ -16,19 +16,64 @@
   You should have received a copy of the GNU Lesser General Public
   License along with this library; if not, see <http://www.gnu.org/licenses/>.
 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "arcueid.h"
+#include "alloc.h"
 #include "builtins.h"
 #include "compiler.h"
 #include "hash.h"
 
+/* Fill in the symbol array entry for a symbol from its buckets in the
+   symbol tables, growing the array if need be. */
+static void setsym(arc *c, int id, value name)
+{
+  struct arc_symbol *sp, *nsyms;
+  int nsize;
+
+  if (id >= c->symsize) {
+    nsize = (c->symsize == 0) ? 1024 : c->symsize;
+    while (nsize <= id)
+      nsize *= 2;
+    nsyms = (struct arc_symbol *)malloc(nsize*sizeof(struct arc_symbol));
+    if (nsyms == NULL) {
+      fprintf(stderr, "FATAL: failed to allocate memory\n");
+      exit(1);
+    }
+    /* The write barrier reads the symbol array without locking, so
+       the old array may not be freed until it is safe to do so, and
+       the new array has to be in place before the size is. */
+    if (c->symbols != NULL) {
+      memcpy(nsyms, c->symbols, c->symsize*sizeof(struct arc_symbol));
+      __arc_defer_free(c, c->symbols);
+    }
+    c->symbols = nsyms;
+    __atomic_store_n(&c->symsize, nsize, __ATOMIC_RELEASE);
+  }
+  sp = &c->symbols[id];
+  sp->name = name;
+  sp->fwd = arc_hash_lookup2(c, c->symtable, name);
+  sp->rev = arc_hash_lookup2(c, c->rsymtable, INT2FIX(id));
+  sp->marked = 0ULL;
+}
+
 value arc_intern(arc *c, value name)
 {
   value symid, symval;
   int symintid;
 
   if ((symid = arc_hash_lookup(c, c->symtable, name)) != CUNBOUND) {
+    symintid = FIX2INT(symid);
+    /* One of the buckets of a symbol which was not marked may have
+       been swept before the other.  Restore it if the symbol is
+       being revived. */
+    if (NIL_P(c->symbols[symintid].fwd) || NIL_P(c->symbols[symintid].rev)) {
+      arc_hash_insert(c, c->rsymtable, symid, name);
+      setsym(c, symintid, name);
+    }
     /* convert the fixnum ID into the symbol value */
-    symval = ID2SYM(FIX2INT(symid));
+    symval = ID2SYM(symintid);
     /* do not allow nil or t to have a symbol value */
     if (symval == ARC_BUILTIN(c, S_NIL))
       symval = CNIL;
@@ -42,6 +87,7 @@ value arc_intern(arc *c, value name)
   symval = ID2SYM(symintid);
   arc_hash_insert(c, c->symtable, name, symid);
   arc_hash_insert(c, c->rsymtable, symid, name);
+  setsym(c, symintid, name);
   return(symval);
 }
 
@@ -53,22 +99,27 @@ value arc_intern_cstr(arc *c, const char *name)
 
 value arc_sym2name(arc *c, value sym)
 {
-  value symid;
+  struct arc_symbol *sp;
 
-  symid = INT2FIX(SYM2ID(sym));
-  return(arc_hash_lookup(c, c->rsymtable, symid));
+  if (SYM2ID(sym) >= (unsigned long)c->symsize)
+    return(CUNBOUND);
+  sp = &c->symbols[SYM2ID(sym)];
+  return(NIL_P(sp->rev) ? CUNBOUND : sp->name);
 }
 
 value arc_unintern(arc *c, value sym)
 {
   value symid, name;
+  struct arc_symbol *sp;
 
-  symid = INT2FIX(SYM2ID(sym));
-  name = arc_hash_lookup(c, c->rsymtable, symid);
+  name = arc_sym2name(c, sym);
   if (name == CUNBOUND)
     return(CNIL);
+  symid = INT2FIX(SYM2ID(sym));
   arc_hash_delete(c, c->symtable, name);
   arc_hash_delete(c, c->rsymtable, symid);
+  sp = &c->symbols[SYM2ID(sym)];
+  sp->name = sp->fwd = sp->rev = CNIL;
   return(CTRUE);
 }
 
@@ -90,7 +141,7 @@ static char *syms[] = { "fn", "_", "quote", "quasiquote", "unquote",
 			"SOCK_RAW", "binary", "text", "append",
 			"atstrings", "lndata", "dlist", "eval",
 			"SEEK_SET", "SEEK_CUR", "SEEK_END", "loadpath*",
-			"=~" };
+			"=~", "swisstables" };
 
 static struct {
   char *str;
@@ -108,6 +159,8 @@ void arc_init_symtable(arc *c)
   c->symtable = arc_mkwtable(c, ARC_HASHBITS);
   c->rsymtable = arc_mkwtable(c, ARC_HASHBITS);
   c->lastsym = 0;
+  c->symbols = NULL;
+  c->symsize = 0;
 
   /* Set up builtin symbols */
   SVINDEX(c->builtins, BI_syms, arc_mkvector(c, S_THE_END));
@@ -133,7 +186,7 @@ static AFFDEF(symbol_pprint)
   AFBEGIN;
   (void)visithash;
   (void)disp;
-  AFTCALL(arc_mkaff(c, arc_disp, CNIL), arc_sym2name(c, AV(sexpr)), AV(fp));
+  AFTCALLF(arc_disp, arc_sym2name(c, AV(sexpr)), AV(fp));
   AFEND;
 }
 AFFEND
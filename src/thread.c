@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <time.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <string.h>
 #include <assert.h>
 #include "arcueid.h"
@@ -29,8 +30,14 @@
 #include "builtins.h"
 #include "osdep.h"
 #include "hash.h"
+#include "alloc.h"
 #include "../config.h"
 
+#ifdef HAVE_SMP
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #ifdef HAVE_ALLOCA_H
 # include <alloca.h>
 #elif defined __GNUC__
@@ -49,6 +56,9 @@ void *alloca (size_t);
 
 #define DEFAULT_QUANTUM 4096
 
+/* Largest number of workers the SMP dispatcher may use */
+#define MAX_WORKERS 64
+
 static AFFDEF(thread_pprint)
 {
   AARG(sexpr, disp, fp);
@@ -59,7 +69,7 @@ static AFFDEF(thread_pprint)
   value outstr;
   AFBEGIN;
   (void)disp;
-  WV(dw, arc_mkaff(c, __arc_disp_write, CNIL));
+  WV(dw, arc_aff(c, __arc_disp_write));
   len = snprintf(NULL, 0, "#<thread: %d>", TTID(AV(sexpr)));
   coutstr = (char *)alloca(sizeof(char)*(len+2));
   snprintf(coutstr, len+1, "#<thread: %d>", TTID(AV(sexpr)));
@@ -82,7 +92,7 @@ static void thread_marker(arc *c, value thr, int depth,
      portions of the stack only, and the stack itself has to be marked
      non-recursively thereafter.
   */
-  for (p = TSP(thr)+1; p < TSTOP(thr); p++)
+  for (p = TSP(thr)+1; p <= TSTOP(thr); p++)
     mark(c, *p, depth);
   mark(c, TSTACK(thr), -1); /* negative depth means mark only the object */
 
@@ -115,7 +125,11 @@ value arc_mkthread(arc *c)
   TQUANTA(thr) = 0;
   TTICKS(thr) = 0LL;
   TWAKEUP(thr) = 0LL;
-  TWAITFD(thr) = CNIL;
+  TWAITFD(thr) = -1;
+  TRQNEXT(thr) = CNIL;
+  TIONEXT(thr) = CNIL;
+  TTIMERIDX(thr) = -1;
+  TSCHED(thr) = 0;
   TCM(thr) = arc_mkhash(c, ARC_HASHBITS);
   TEXH(thr) = CNIL;
   TACELL(thr) = 0;
@@ -161,7 +175,7 @@ value arc_cmark(arc *c, value key)
 {
   value cm, val;
 
-  cm = TCM(c->curthread);
+  cm = TCM(__arc_curthread(c));
   val = arc_hash_lookup(c, cm, key);
   if (!BOUND_P(val))
     return(CNIL);
@@ -174,7 +188,7 @@ value arc_scmark(arc *c, value key, value val)
 {
   value cm, bind;
 
-  cm = TCM(c->curthread);
+  cm = TCM(__arc_curthread(c));
   bind = arc_hash_lookup(c, cm, key);
   if (!BOUND_P(bind))
     bind = CNIL;
@@ -187,7 +201,7 @@ value arc_ccmark(arc *c, value key)
 {
   value cm, bind, val;
 
-  cm = TCM(c->curthread);
+  cm = TCM(__arc_curthread(c));
   bind = arc_hash_lookup(c, cm, key);
   if (!BOUND_P(bind))
     return(CNIL);
@@ -201,96 +215,408 @@ value arc_ccmark(arc *c, value key)
   return(val);
 }
 
+/* The scheduler keeps every live thread on c->vmthreads, which is what
+   the garbage collector scans, but a round of the dispatcher only ever
+   touches the threads in the ready queue.  Threads that are not
+   runnable wait elsewhere: on the wait lists of a channel (chan.c), in
+   the timer heap if they are sleeping, or on the wait list of the file
+   descriptor they are waiting on.  None of these are roots: a thread
+   is taken off all of them before it is unlinked from c->vmthreads. */
+
+/* Scheduler flags are changed atomically in SMP builds, since workers
+   of the SMP dispatcher queue threads without holding schedlock. */
+#ifdef HAVE_SMP
+#define SCHED_SET(thr, f) __atomic_fetch_or(&TSCHED(thr), (f), __ATOMIC_ACQ_REL)
+#define SCHED_CLR(thr, f) __atomic_fetch_and(&TSCHED(thr), ~(f), __ATOMIC_ACQ_REL)
+#else
+#define SCHED_SET(thr, f) (TSCHED(thr) |= (f))
+#define SCHED_CLR(thr, f) (TSCHED(thr) &= ~(f))
+#endif
+
+#ifdef HAVE_SMP
+
+/* A worker of the SMP dispatcher (see smp_dispatch below) */
+struct worker {
+  arc *c;
+  int id;
+  pthread_t tid;
+  pthread_mutex_t qlock;	/* protects the run queue */
+  value runqhead;		/* run queue (head) */
+  value runqtail;		/* run queue (tail) */
+  int nrunq;			/* number of threads in the run queue */
+  value curthread;		/* thread being run by this worker */
+  int rtdepth;			/* runtime lock nesting depth */
+};
+
+static int nworkers;		/* workers of the running SMP dispatcher */
+static struct worker *workers;
+static __thread struct worker *self; /* worker of the calling thread */
+
+/* Lock ordering is rtlock, then the lock of any one object (see
+   __arc_objlock), then schedlock, then the qlock of any worker, then
+   wlock. */
+static pthread_mutex_t rtlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t schedlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t stopcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t resumecond = PTHREAD_COND_INITIALIZER;
+static int nqueued;		/* threads in all run queues */
+static int nidle;		/* workers waiting for work */
+static int nstopped;		/* workers stopped at a safepoint */
+static int nblocked;		/* workers blocked in system calls */
+static int stopreq;		/* world stop requested */
+static int smpdone;		/* dispatcher finished */
+static int gcstatus;		/* what the last collection returned */
+
+static void smp_enqueue(arc *c, value thr);
+
+/* schedlock protects the timer heap, the fd wait lists, c->vmthreads
+   and the thread counts while the SMP dispatcher is running */
+#define SCHED_LOCK() do {			\
+    if (nworkers > 0)				\
+      pthread_mutex_lock(&schedlock);		\
+  } while (0)
+
+#define SCHED_UNLOCK() do {			\
+    if (nworkers > 0)				\
+      pthread_mutex_unlock(&schedlock);	\
+  } while (0)
+
+#else
+
+#define SCHED_LOCK()
+#define SCHED_UNLOCK()
+
+#endif
+
+/* The ready queue, linked through the threads themselves */
+static void runq_add(arc *c, value thr)
+{
+#ifdef HAVE_SMP
+  if (nworkers > 0) {
+    smp_enqueue(c, thr);
+    return;
+  }
+#endif
+  if (!(TSCHED(thr) & SCHED_LIVE) || (TSCHED(thr) & SCHED_RUNQ))
+    return;
+  SCHED_SET(thr, SCHED_RUNQ);
+  TRQNEXT(thr) = CNIL;
+  if (NIL_P(c->runqtail))
+    c->runqhead = thr;
+  else
+    TRQNEXT(c->runqtail) = thr;
+  c->runqtail = thr;
+  c->nrunq++;
+}
+
+static value runq_get(arc *c)
+{
+  value thr = c->runqhead;
+
+  c->runqhead = TRQNEXT(thr);
+  if (NIL_P(c->runqhead))
+    c->runqtail = CNIL;
+  TRQNEXT(thr) = CNIL;
+  SCHED_CLR(thr, SCHED_RUNQ);
+  c->nrunq--;
+  return(thr);
+}
+
+/* The timer heap, a binary heap of sleeping threads keyed on their
+   wakeup times.  Each thread knows its own index in the heap. */
+#define TIMER_SET(c, i, thr) do {			\
+    (c)->timers[i] = (thr);				\
+    TTIMERIDX(thr) = (i);				\
+  } while (0)
+
+static void timer_up(arc *c, int i)
+{
+  value thr = c->timers[i];
+  int parent;
+
+  while (i > 0) {
+    parent = (i - 1)/2;
+    if (TWAKEUP(c->timers[parent]) <= TWAKEUP(thr))
+      break;
+    TIMER_SET(c, i, c->timers[parent]);
+    i = parent;
+  }
+  TIMER_SET(c, i, thr);
+}
+
+static void timer_down(arc *c, int i)
+{
+  value thr = c->timers[i];
+  int child;
+
+  while ((child = 2*i + 1) < c->ntimers) {
+    if (child + 1 < c->ntimers
+	&& TWAKEUP(c->timers[child + 1]) < TWAKEUP(c->timers[child]))
+      child++;
+    if (TWAKEUP(thr) <= TWAKEUP(c->timers[child]))
+      break;
+    TIMER_SET(c, i, c->timers[child]);
+    i = child;
+  }
+  TIMER_SET(c, i, thr);
+}
+
+static void timer_add(arc *c, value thr)
+{
+  if (TTIMERIDX(thr) >= 0)
+    return;
+  if (c->ntimers >= c->timersize) {
+    int n = (c->timersize == 0) ? 64 : 2*c->timersize;
+    value *nt = (value *)realloc(c->timers, n*sizeof(value));
+
+    if (nt == NULL) {
+      arc_err_cstrfmt(c, "cannot allocate timer heap");
+      return;
+    }
+    c->timers = nt;
+    c->timersize = n;
+  }
+  c->timers[c->ntimers] = thr;
+  timer_up(c, c->ntimers++);
+}
+
+static void timer_remove(arc *c, value thr)
+{
+  int i = TTIMERIDX(thr);
+
+  if (i < 0)
+    return;
+  TTIMERIDX(thr) = -1;
+  if (i == --c->ntimers)
+    return;
+  TIMER_SET(c, i, c->timers[c->ntimers]);
+  timer_down(c, i);
+  timer_up(c, TTIMERIDX(c->timers[i]));
+}
+
+/* The threads waiting on each file descriptor, indexed by fd and
+   linked through the threads themselves. */
+static void iowait_link(arc *c, value thr)
+{
+  int fd = TWAITFD(thr), n;
+
+  if (fd >= c->niowaiters) {
+    value *niow;
+
+    for (n = (c->niowaiters == 0) ? 64 : c->niowaiters; n <= fd; n *= 2)
+      ;
+    niow = (value *)realloc(c->iowaiters, n*sizeof(value));
+    if (niow == NULL) {
+      arc_err_cstrfmt(c, "cannot allocate I/O wait table");
+      return;
+    }
+    memset(niow + c->niowaiters, 0, (n - c->niowaiters)*sizeof(value));
+    c->iowaiters = niow;
+    c->niowaiters = n;
+  }
+  TIONEXT(thr) = c->iowaiters[fd];
+  c->iowaiters[fd] = thr;
+  SCHED_SET(thr, SCHED_IOWAIT);
+  c->niowait++;
+}
+
+static void iowait_cancel(arc *c, value thr)
+{
+  value *p;
+
+  if (!(TSCHED(thr) & SCHED_IOWAIT))
+    return;
+  for (p = &c->iowaiters[TWAITFD(thr)]; !NIL_P(*p); p = &TIONEXT(*p)) {
+    if (*p == thr) {
+      *p = TIONEXT(thr);
+      break;
+    }
+  }
+  TIONEXT(thr) = CNIL;
+  SCHED_CLR(thr, SCHED_IOWAIT);
+  c->niowait--;
+}
+
+/* Wake up all threads waiting on fd.  They all check for themselves
+   whether they can go ahead with their I/O or need to wait again. */
+static void iowait_wakefd(arc *c, int fd)
+{
+  value thr;
+
+  while (!NIL_P(thr = c->iowaiters[fd])) {
+    c->iowaiters[fd] = TIONEXT(thr);
+    TIONEXT(thr) = CNIL;
+    SCHED_CLR(thr, SCHED_IOWAIT);
+    c->niowait--;
+    TWAITFD(thr) = -1;
+    TSTATE(thr) = Tready;
+    runq_add(c, thr);
+  }
+}
+
+/* Take a thread off the timer heap and any fd wait list */
+static void thr_unwait(arc *c, value thr)
+{
+  timer_remove(c, thr);
+  iowait_cancel(c, thr);
+}
+
+/* Make a thread that was blocked runnable again */
+static void wakeup(arc *c, value thr)
+{
+  thr_unwait(c, thr);
+  TSTATE(thr) = Tready;
+  runq_add(c, thr);
+}
+
+void __arc_wakeup(arc *c, value thr)
+{
+  SCHED_LOCK();
+  wakeup(c, thr);
+  SCHED_UNLOCK();
+}
+
 #ifdef HAVE_SYS_EPOLL_H
 
 #include <sys/epoll.h>
 
-#define MAX_EVENTS 1048576
+/* Maximum number of events collected by a single epoll_wait.  Any
+   others stay pending for the next round. */
+#define MAX_EVENTS 256
 
-/* Version of process_iowait using epoll */
-static void process_iowait(arc *c, value iowaitdata, int eptimeout)
+/* File descriptors stay registered with epoll for as long as they are
+   open, and are armed with EPOLLONESHOT whenever a thread starts
+   waiting on one, for the events that all the threads waiting on it
+   are interested in. */
+static void iowait_add(arc *c, value thr)
 {
-  value thr, iowaittbl;
-  int niowait=0, n, nfds;
-  static int epollfd = -1;
-  struct epoll_event *epevents, ev;
-
-  if (epollfd < 0)
-    epollfd = epoll_create(MAX_EVENTS);
+  int fd = TWAITFD(thr);
+  struct epoll_event ev;
+  value w;
 
-  iowaittbl = arc_mkhash(c, ARC_HASHBITS);
-  /* add fd's in list to epollfd */
-  for (thr = iowaitdata; thr; thr = cdr(thr)) {
-    niowait++;
-    ev.events = (TWAITRW(car(thr))) ? EPOLLOUT : EPOLLIN;
-    ev.data.u64 = 0LL;
-    ev.data.fd = TWAITFD(car(thr));
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, TWAITFD(car(thr)), &ev) < 0) {
+  if (TSCHED(thr) & SCHED_IOWAIT)
+    return;
+  if (c->epollfd < 0) {
+    c->epollfd = epoll_create(MAX_EVENTS);
+    if (c->epollfd < 0) {
       int en = errno;
-      if (errno != EEXIST) {
-	arc_err_cstrfmt(c, "error setting epoll for thread on blocking fd (%s; errno=%d)", strerror(en), en);
-	return;
-      }
+      arc_err_cstrfmt(c, "error creating epoll instance (%s; errno=%d)",
+		      strerror(en), en);
+      return;
     }
-    arc_hash_insert(c, iowaittbl, INT2FIX(TWAITFD(car(thr))), car(thr));
   }
+  iowait_link(c, thr);
+  ev.events = EPOLLONESHOT;
+  for (w = c->iowaiters[fd]; !NIL_P(w); w = TIONEXT(w))
+    ev.events |= (TWAITRW(w)) ? EPOLLOUT : EPOLLIN;
+  ev.data.u64 = 0LL;
+  ev.data.fd = fd;
+  if (epoll_ctl(c->epollfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    if (errno != ENOENT
+	|| epoll_ctl(c->epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      int en = errno;
+      iowait_cancel(c, thr);
+      arc_err_cstrfmt(c, "error setting epoll for thread on blocking fd (%s; errno=%d)", strerror(en), en);
+      return;
+    }
+  }
+}
 
-  epevents = (struct epoll_event *)alloca(sizeof(struct epoll_event) * (niowait+2));
-  nfds = epoll_wait(epollfd, epevents, niowait, eptimeout);
+/* Version of process_iowait using epoll.  Only the threads whose fds
+   are ready are touched. */
+static void process_iowait(arc *c, int eptimeout)
+{
+  int n, nfds;
+  struct epoll_event epevents[MAX_EVENTS];
+
+  /* the collector thread, or another worker of the SMP dispatcher,
+     may use the heap while we are blocked */
+  if (eptimeout != 0) {
+    __arc_gc_release(c);
+    __arc_block(c);
+  }
+  nfds = epoll_wait(c->epollfd, epevents, MAX_EVENTS, eptimeout);
+  if (eptimeout != 0) {
+    __arc_unblock(c);
+    __arc_gc_acquire(c);
+  }
   if (nfds < 0) {
     int en = errno;
+    if (en == EINTR)
+      return;
     arc_err_cstrfmt(c, "error waiting for Tiowait fds (%s; errno=%d)",
 		    strerror(en), en);
     return;
   }
 
+  SCHED_LOCK();
   for (n=0; n<nfds; n++) {
-    int fd;
-    value thr;
-    fd  = epevents[n].data.fd;
-    thr = arc_hash_lookup(c, iowaittbl, INT2FIX(fd));
-    if (BOUND_P(thr)) {
-      TWAITFD(thr) = -1;
-      TSTATE(thr) = Tready;
-    }
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, &ev);
+    int fd = epevents[n].data.fd;
+
+    if (fd < c->niowaiters)
+      iowait_wakefd(c, fd);
   }
+  SCHED_UNLOCK();
 }
 
 #elif HAVE_SYS_SELECT_H
 
 #include <sys/select.h>
-#include <unistd.h>
+
+static void iowait_add(arc *c, value thr)
+{
+  if (!(TSCHED(thr) & SCHED_IOWAIT))
+    iowait_link(c, thr);
+}
 
 /* Version of process_iowait using select */
-static void process_iowait(arc *c, value iowaitdata, int eptimeout)
+static void process_iowait(arc *c, int eptimeout)
 {
   fd_set rfds, wfds;
-  struct timeval tv;
-  int retval;
+  struct timeval tv, *tvp;
+  int retval, fd, nfds;
   value thr;
-  int niowait=0, nfds;
 
   FD_ZERO(&rfds);
   FD_ZERO(&wfds);
   nfds = 0;
-  for (thr = iowaitdata; thr; thr = cdr(thr)) {
-    niowait++;
-    if (nfds < TWAITFD(car(thr)))
-      nfds = TWAITFD(car(thr));
-    if (TWAITRW(car(thr))) {
-      FD_SET(TWAITFD(car(thr)), &wfds);
-    } else {
-      FD_SET(TWAITFD(car(thr)), &rfds);
+  SCHED_LOCK();
+  for (fd=0; fd<c->niowaiters; fd++) {
+    for (thr = c->iowaiters[fd]; !NIL_P(thr); thr = TIONEXT(thr)) {
+      nfds = fd;
+      if (TWAITRW(thr)) {
+	FD_SET(fd, &wfds);
+      } else {
+	FD_SET(fd, &rfds);
+      }
     }
   }
+  SCHED_UNLOCK();
 
-  tv.tv_sec = eptimeout / 1000;
-  tv.tv_usec = (eptimeout % 1000) * 1000L;
+  tvp = NULL;
+  if (eptimeout >= 0) {
+    tv.tv_sec = eptimeout / 1000;
+    tv.tv_usec = (eptimeout % 1000) * 1000L;
+    tvp = &tv;
+  }
 
-  retval = select(nfds+1, &rfds, &wfds, NULL, &tv);
+  /* the collector thread, or another worker of the SMP dispatcher,
+     may use the heap while we are blocked */
+  if (eptimeout != 0) {
+    __arc_gc_release(c);
+    __arc_block(c);
+  }
+  retval = select(nfds+1, &rfds, &wfds, NULL, tvp);
+  if (eptimeout != 0) {
+    __arc_unblock(c);
+    __arc_gc_acquire(c);
+  }
   if (retval == -1) {
     int en = errno;
+    if (en == EINTR)
+      return;
     arc_err_cstrfmt(c, "error waiting for Tiowait fds (%s; errno=%d)",
 		    strerror(en), en);
     return;
@@ -301,16 +627,12 @@ static void process_iowait(arc *c, value iowaitdata, int eptimeout)
     return;
 
   /* Wake up all the waiting threads with fds for which select said ok */
-  for (thr = iowaitdata; thr; thr = cdr(thr)) {
-    int result;
-
-    result = (TWAITRW(car(thr))) ? FD_ISSET(TWAITFD(car(thr)), &wfds)
-      : FD_ISSET(TWAITFD(car(thr)), &rfds);
-    if (result) {
-      TWAITFD(car(thr)) = -1;
-      TSTATE(car(thr)) = Tready;
-    }
+  SCHED_LOCK();
+  for (fd=0; fd<=nfds; fd++) {
+    if (FD_ISSET(fd, &rfds) || FD_ISSET(fd, &wfds))
+      iowait_wakefd(c, fd);
   }
+  SCHED_UNLOCK();
 }
 
 #else
@@ -323,9 +645,622 @@ static void process_iowait(arc *c, value iowaitdata, int eptimeout)
 extern value __arc_send_rvchan(arc *c, value chan, value val);
 extern int __arc_recv_rvchan(arc *c, value thr);
 
-/* Main dispatcher.  Will run each thread in the thread list for
-   at most c->quanta cycles or until the thread leaves ready state.
-   Also runs garbage collections periodically.  This should
+/* Finish off a thread that is in Trelease or Tbroken state.  It stays
+   on c->vmthreads until unlink_dead gets to it. */
+static void reap(arc *c, value thr)
+{
+  SCHED_LOCK();
+  if (!(TSCHED(thr) & SCHED_LIVE)) {
+    SCHED_UNLOCK();
+    return;
+  }
+  SCHED_CLR(thr, SCHED_LIVE);
+  thr_unwait(c, thr);
+  c->nthreads--;
+  c->ndead++;
+  SCHED_UNLOCK();
+  /* This will serve to wake up all the threads waiting on
+     the return value channel of the thread, so they can pick
+     up the return value now that it is available. */
+  if (TYPE(TRVCH(thr)) == T_CHAN)
+    __arc_send_rvchan(c, TRVCH(thr), TVALR(thr));
+  __arc_rootwb(TRVCH(thr), TVALR(thr));
+  TRVCH(thr) = TVALR(thr);
+  /* It will no longer be scanned as a root. */
+  __arc_unroot(c, thr);
+}
+
+/* Unlink all dead threads from c->vmthreads */
+static void unlink_dead(arc *c)
+{
+  value vmqueue, prev = CNIL;
+
+  for (vmqueue = c->vmthreads; vmqueue; vmqueue = cdr(vmqueue)) {
+    if (TSCHED(car(vmqueue)) & SCHED_LIVE) {
+      prev = vmqueue;
+      continue;
+    }
+    if (prev == CNIL) {
+      __arc_rootwb(c->vmthreads, cdr(vmqueue));
+      c->vmthreads = cdr(vmqueue);
+    } else {
+      scdr(prev, cdr(vmqueue));
+    }
+  }
+  __arc_rootwb(c->vmthrtail, prev);
+  c->vmthrtail = prev;
+  c->ndead = 0;
+}
+
+#ifdef HAVE_SMP
+
+/* The SMP dispatcher.  When c->nworkers is greater than one, the
+   dispatcher runs threads on that many workers, the calling OS thread
+   being worker 0 and the others being pthreads started for as long as
+   the dispatcher runs.  Each worker has a run queue of its own, to
+   which it adds the threads it makes runnable, and a worker whose
+   queue is empty steals from the queues of the others.
+
+   Bytecode runs on all workers at once.  C functions, which may touch
+   any shared runtime state, run under the runtime lock (see
+   __arc_thr_trampoline), as do reaping and the handful of
+   instructions which look up globals by name.  The exceptions are
+   the C functions which only touch objects with locks of their own,
+   channels and tables, and which are registered with
+   __arc_aff_unlocked.  Ports have locks of their own as well, so that
+   the runtime lock can be let go while a port waits in a system call.
+   Each worker allocates from an allocation buffer of its own (see
+   alloc.c).
+
+   Worker 0 also wakes sleeping threads and polls for I/O.  Garbage
+   collection is done by whichever worker finds that it has filled
+   its share of the nursery, or by worker 0 when there is nothing
+   else to do, and only while the world is stopped: the other workers
+   stop at a safepoint between the quanta of the threads they run,
+   and a worker waiting for work or blocked in a system call (see
+   __arc_block) counts as stopped.
+
+   A thread is only ever run by one worker at a time.  A thread made
+   runnable while it is still being run (e.g. by a channel operation
+   on another worker, just after it put itself on the wait list of the
+   channel) is only flagged with SCHED_WAKE, and its worker queues it
+   again when its quantum is up.  Killing or breaking a thread which is
+   being run is likewise deferred until the end of its quantum. */
+
+/* Longest time in milliseconds worker 0 waits for I/O while other
+   workers are busy, as they may put threads to sleep meanwhile */
+#define SMP_INTERVAL 2
+
+/* Times an object lock is tried before its worker starts yielding
+   the CPU between tries */
+#define OBJLOCK_SPINS 100
+
+static void thr_break(arc *c, value thr);
+
+void __arc_rtlock(arc *c)
+{
+  if (self == NULL || self->rtdepth++ > 0)
+    return;
+  pthread_mutex_lock(&rtlock);
+}
+
+void __arc_rtunlock(arc *c)
+{
+  if (self == NULL || --self->rtdepth > 0)
+    return;
+  pthread_mutex_unlock(&rtlock);
+}
+
+/* Release the runtime lock after an error longjmps out of code which
+   held it */
+void __arc_rtreset(arc *c)
+{
+  if (self == NULL || self->rtdepth == 0)
+    return;
+  self->rtdepth = 0;
+  pthread_mutex_unlock(&rtlock);
+}
+
+/* Let go of the runtime lock however deeply it is held, returning the
+   depth for __arc_rtacquire */
+int __arc_rtrelease(arc *c)
+{
+  int depth;
+
+  if (self == NULL || self->rtdepth == 0)
+    return(0);
+  depth = self->rtdepth;
+  self->rtdepth = 0;
+  pthread_mutex_unlock(&rtlock);
+  return(depth);
+}
+
+/* Take the runtime lock again after __arc_rtrelease, keeping errno as
+   __arc_unblock does */
+void __arc_rtacquire(arc *c, int depth)
+{
+  int en = errno;
+
+  if (self == NULL || depth == 0)
+    return;
+  pthread_mutex_lock(&rtlock);
+  self->rtdepth = depth;
+  errno = en;
+}
+
+/* Count the calling worker as stopped while it waits in a system
+   call.  Until __arc_unblock it must not touch any value, as the heap
+   may be collected meanwhile. */
+void __arc_block(arc *c)
+{
+  if (self == NULL)
+    return;
+  pthread_mutex_lock(&wlock);
+  nblocked++;
+  pthread_cond_signal(&stopcond);
+  pthread_mutex_unlock(&wlock);
+}
+
+/* Wait for the world to be started again if it was stopped.  errno
+   is kept for the caller, which is usually about to look at what its
+   system call left there. */
+void __arc_unblock(arc *c)
+{
+  int en = errno;
+
+  if (self == NULL)
+    return;
+  pthread_mutex_lock(&wlock);
+  while (stopreq)
+    pthread_cond_wait(&resumecond, &wlock);
+  nblocked--;
+  pthread_mutex_unlock(&wlock);
+  errno = en;
+}
+
+/* Locks of channels, tables and ports.  A lock is a word of the
+   object, INT2FIX(1) while it is held.  They are only held for short
+   stretches of C code which do not yield, raise errors or call AFFs,
+   and no other object lock is taken while one is held.  A worker
+   waiting for one does not count as blocked, even though the holder
+   may be blocked in a system call (see BLOCK_BEGIN), as the waiter
+   may hold the runtime lock, which other workers may be waiting for
+   on their way to a safepoint.  The holder lets go of the lock before
+   it waits for the world to be started again, so the world is only
+   kept from stopping until then. */
+void __arc_objlock(arc *c, value *lk)
+{
+  value f;
+  int i;
+
+  for (i=0;; i++) {
+    f = INT2FIX(0);
+    if (__atomic_compare_exchange_n(lk, &f, INT2FIX(1), 0, __ATOMIC_ACQUIRE,
+				    __ATOMIC_RELAXED))
+      return;
+    if (i >= OBJLOCK_SPINS)
+      sched_yield();
+  }
+}
+
+static void smp_enqueue(arc *c, value thr)
+{
+  struct worker *w = (self != NULL) ? self : &workers[0];
+  int f, nf;
+
+  f = __atomic_load_n(&TSCHED(thr), __ATOMIC_ACQUIRE);
+  do {
+    if (!(f & SCHED_LIVE) || (f & (SCHED_RUNQ|SCHED_WAKE)))
+      return;
+    nf = f | ((f & SCHED_RUNNING) ? SCHED_WAKE : SCHED_RUNQ);
+  } while (!__atomic_compare_exchange_n(&TSCHED(thr), &f, nf, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  if (nf & SCHED_WAKE)
+    return;
+
+  pthread_mutex_lock(&w->qlock);
+  TRQNEXT(thr) = CNIL;
+  if (NIL_P(w->runqtail))
+    w->runqhead = thr;
+  else
+    TRQNEXT(w->runqtail) = thr;
+  w->runqtail = thr;
+  w->nrunq++;
+  pthread_mutex_unlock(&w->qlock);
+
+  /* Idle workers check nqueued after counting themselves idle, so
+     either they see this thread, or it sees them. */
+  __atomic_add_fetch(&nqueued, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&nidle, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&wlock);
+    pthread_cond_signal(&workcond);
+    pthread_mutex_unlock(&wlock);
+  }
+}
+
+/* Take the first thread off the run queue of a worker, marking it as
+   being run */
+static value smp_dequeue(struct worker *w)
+{
+  value thr;
+
+  if (__atomic_load_n(&w->nrunq, __ATOMIC_RELAXED) == 0)
+    return(CNIL);
+  pthread_mutex_lock(&w->qlock);
+  thr = w->runqhead;
+  if (!NIL_P(thr)) {
+    w->runqhead = TRQNEXT(thr);
+    if (NIL_P(w->runqhead))
+      w->runqtail = CNIL;
+    TRQNEXT(thr) = CNIL;
+    w->nrunq--;
+    __atomic_sub_fetch(&nqueued, 1, __ATOMIC_SEQ_CST);
+    SCHED_SET(thr, SCHED_RUNNING);
+    SCHED_CLR(thr, SCHED_RUNQ);
+  }
+  pthread_mutex_unlock(&w->qlock);
+  return(thr);
+}
+
+/* Steal a thread from the worker with the longest run queue */
+static value smp_steal(struct worker *w)
+{
+  int i, n, best = -1, bestn = 0;
+
+  for (i=0; i<nworkers; i++) {
+    n = __atomic_load_n(&workers[i].nrunq, __ATOMIC_RELAXED);
+    if (i != w->id && n > bestn) {
+      best = i;
+      bestn = n;
+    }
+  }
+  return((best < 0) ? CNIL : smp_dequeue(&workers[best]));
+}
+
+/* Stop here if worker 0 wants to stop the world */
+static void safepoint(void)
+{
+  pthread_mutex_lock(&wlock);
+  while (stopreq) {
+    nstopped++;
+    pthread_cond_signal(&stopcond);
+    pthread_cond_wait(&resumecond, &wlock);
+    nstopped--;
+  }
+  pthread_mutex_unlock(&wlock);
+}
+
+/* Stop every other worker.  If some other worker is already stopping
+   the world, this stops at a safepoint for it instead, and returns
+   zero. */
+static int stop_world(void)
+{
+  pthread_mutex_lock(&wlock);
+  if (stopreq) {
+    pthread_mutex_unlock(&wlock);
+    safepoint();
+    return(0);
+  }
+  __atomic_store_n(&stopreq, 1, __ATOMIC_SEQ_CST);
+  while (nstopped + nidle + nblocked < nworkers - 1)
+    pthread_cond_wait(&stopcond, &wlock);
+  pthread_mutex_unlock(&wlock);
+  return(1);
+}
+
+static void start_world(void)
+{
+  pthread_mutex_lock(&wlock);
+  __atomic_store_n(&stopreq, 0, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&resumecond);
+  pthread_cond_broadcast(&workcond);
+  pthread_mutex_unlock(&wlock);
+}
+
+/* Wait for work, for at most timeout milliseconds if timeout is not
+   negative.  Returns nonzero if the dispatcher has finished. */
+static int smp_idle(int timeout)
+{
+  struct timespec ts;
+  unsigned long long deadline;
+  int done, expired = 0;
+
+  pthread_mutex_lock(&wlock);
+  /* worker 0 may be waiting to stop the world */
+  __atomic_add_fetch(&nidle, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_signal(&stopcond);
+  if (timeout >= 0) {
+    deadline = __arc_milliseconds() + timeout;
+    ts.tv_sec = deadline / 1000;
+    ts.tv_nsec = (deadline % 1000) * 1000000L;
+  }
+  /* Even once the timeout is up, a stopped world has to be started
+     again before this worker goes on. */
+  while (!smpdone && (stopreq || (!expired && __atomic_load_n(&nqueued, __ATOMIC_SEQ_CST) == 0))) {
+    if (timeout < 0 || expired) {
+      pthread_cond_wait(&workcond, &wlock);
+    } else if (pthread_cond_timedwait(&workcond, &wlock, &ts) == ETIMEDOUT) {
+      expired = 1;
+    }
+  }
+  __atomic_sub_fetch(&nidle, 1, __ATOMIC_SEQ_CST);
+  done = smpdone;
+  pthread_mutex_unlock(&wlock);
+  return(done);
+}
+
+/* Run a thread for one quantum on worker w, and put it where it
+   belongs afterwards */
+static void smp_run(arc *c, struct worker *w, value thr)
+{
+  int f;
+  enum threadstate state;
+
+  w->curthread = thr;
+  switch (TSTATE(thr)) {
+  case Tready:
+    if (TQUANTA(thr) <= 0)
+      TQUANTA(thr) = c->quantum;
+    __arc_thr_trampoline(c, thr, TR_RESUME);
+    break;
+  case Tcritical:
+    while (TSTATE(thr) == Tcritical) {
+      if (TQUANTA(thr) <= 0)
+	TQUANTA(thr) = c->quantum;
+      __arc_thr_trampoline(c, thr, TR_RESUME);
+    }
+    break;
+  default:
+    break;
+  }
+
+  /* Kills and breaks which came in while it was running */
+  f = SCHED_CLR(thr, SCHED_KILL|SCHED_BREAK);
+  if (f & SCHED_KILL) {
+    TSTATE(thr) = Tbroken;
+  } else if (f & SCHED_BREAK) {
+    __arc_rtlock(c);
+    SCHED_LOCK();
+    thr_break(c, thr);
+    SCHED_UNLOCK();
+    __arc_rtunlock(c);
+  }
+
+  SCHED_LOCK();
+  state = TSTATE(thr);
+  switch (state) {
+  case Tsleep:
+    timer_add(c, thr);
+    break;
+  case Tiowait:
+    iowait_add(c, thr);
+    break;
+  default:
+    break;
+  }
+  f = SCHED_CLR(thr, SCHED_RUNNING|SCHED_WAKE);
+  SCHED_UNLOCK();
+
+  switch (state) {
+  case Tready:
+  case Tcritical:
+    smp_enqueue(c, thr);
+    break;
+  case Trelease:
+  case Tbroken:
+    if (!(f & SCHED_WAKE)) {
+      __arc_rtlock(c);
+      reap(c, thr);
+      __arc_rtunlock(c);
+      break;
+    }
+    /* fall through */
+  default:
+    if (f & SCHED_WAKE)
+      smp_enqueue(c, thr);
+    break;
+  }
+}
+
+/* Collect garbage with the world stopped */
+static void smp_collect(arc *c)
+{
+  if (!stop_world())
+    return;
+  gcstatus = c->gc(c);
+  if (c->ndead > 0 && c->ndead >= c->nthreads)
+    unlink_dead(c);
+  start_world();
+}
+
+/* Whether the calling worker has allocated its share of the nursery
+   since the last collection */
+static int nursery_full(arc *c)
+{
+  return(__arc_mm_buffered(c) >= NURSERY_SIZE / nworkers);
+}
+
+static void *worker_main(void *arg)
+{
+  struct worker *w = (struct worker *)arg;
+  arc *c = w->c;
+  value thr;
+
+  self = w;
+  __arc_mm_attach(c);
+  for (;;) {
+    if (__atomic_load_n(&stopreq, __ATOMIC_ACQUIRE))
+      safepoint();
+    thr = smp_dequeue(w);
+    if (NIL_P(thr))
+      thr = smp_steal(w);
+    if (!NIL_P(thr)) {
+      smp_run(c, w, thr);
+      if (nursery_full(c))
+	smp_collect(c);
+    } else if (smp_idle(-1)) {
+      break;
+    }
+  }
+  __arc_mm_detach(c);
+  return(NULL);
+}
+
+/* The loop of worker 0.  Returns when there are no more threads which
+   could run: none are queued or being run, and none are sleeping or
+   waiting for I/O. */
+static void coordinate(arc *c, struct worker *w)
+{
+  value thr;
+  unsigned long long now;
+  int timeout, busy, done;
+
+  for (;;) {
+    if (__atomic_load_n(&stopreq, __ATOMIC_ACQUIRE))
+      safepoint();
+
+    /* Wake up sleeping threads whose wakeup time has been reached */
+    SCHED_LOCK();
+    if (c->ntimers > 0) {
+      now = __arc_milliseconds();
+      while (c->ntimers > 0 && TWAKEUP(c->timers[0]) <= now) {
+	thr = c->timers[0];
+	wakeup(c, thr);
+	SVALR(thr, CNIL);
+      }
+    }
+    SCHED_UNLOCK();
+
+    thr = smp_dequeue(w);
+    if (NIL_P(thr))
+      thr = smp_steal(w);
+    if (!NIL_P(thr))
+      smp_run(c, w, thr);
+
+    /* Collect whenever this worker fills its share of the nursery,
+       and continuously while no worker has anything to do and the
+       collector still has work. */
+    if (nursery_full(c)
+	|| (NIL_P(thr) && gcstatus == 0
+	    && __atomic_load_n(&nidle, __ATOMIC_SEQ_CST) == nworkers - 1))
+      smp_collect(c);
+    if (!NIL_P(thr))
+      continue;
+
+    SCHED_LOCK();
+    pthread_mutex_lock(&wlock);
+    busy = nworkers - 1 - nidle;
+    done = (busy == 0 && nqueued == 0 && c->ntimers == 0 && c->niowait == 0);
+    if (done) {
+      smpdone = 1;
+      pthread_cond_broadcast(&workcond);
+    }
+    pthread_mutex_unlock(&wlock);
+
+    /* Nothing to run here.  Wait until the next thread has to wake
+       up, but not for too long if other workers are busy, as they may
+       put threads to sleep. */
+    timeout = -1;
+    now = __arc_milliseconds();
+    if ((gcstatus == 0 && busy == 0)
+	|| __atomic_load_n(&nqueued, __ATOMIC_SEQ_CST) > 0) {
+      timeout = 0;
+    } else if (c->ntimers > 0) {
+      timeout = (TWAKEUP(c->timers[0]) > now)
+	? (int)(TWAKEUP(c->timers[0]) - now) : 0;
+    }
+    if (busy > 0 && (timeout < 0 || timeout > SMP_INTERVAL))
+      timeout = SMP_INTERVAL;
+    SCHED_UNLOCK();
+    if (done)
+      return;
+
+    if (c->niowait > 0)
+      process_iowait(c, timeout);
+    else if (timeout != 0)
+      smp_idle(timeout);
+  }
+}
+
+static void smp_dispatch(arc *c)
+{
+  int i, ret;
+
+  workers = (struct worker *)calloc(c->nworkers, sizeof(struct worker));
+  if (workers == NULL) {
+    arc_err_cstrfmt(c, "cannot allocate dispatcher workers");
+    return;
+  }
+  for (i=0; i<c->nworkers; i++) {
+    workers[i].c = c;
+    workers[i].id = i;
+    pthread_mutex_init(&workers[i].qlock, NULL);
+    workers[i].runqhead = workers[i].runqtail = CNIL;
+    workers[i].curthread = CNIL;
+  }
+  nqueued = nidle = nstopped = nblocked = stopreq = smpdone = 0;
+  gcstatus = 0;
+  nworkers = c->nworkers;
+
+  /* The threads which are ready go to worker 0 to begin with, and the
+     others soon steal them. */
+  while (c->nrunq > 0)
+    smp_enqueue(c, runq_get(c));
+
+  self = &workers[0];
+  __arc_mm_attach(c);
+  for (i=1; i<c->nworkers; i++) {
+    ret = pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+    if (ret != 0) {
+      fprintf(stderr, "WARNING: failed to start dispatcher worker (%s)\n",
+	      strerror(ret));
+      pthread_mutex_lock(&wlock);
+      nworkers = i;
+      pthread_mutex_unlock(&wlock);
+      break;
+    }
+  }
+  coordinate(c, &workers[0]);
+  for (i=1; i<nworkers; i++)
+    pthread_join(workers[i].tid, NULL);
+  __arc_mm_detach(c);
+  self = NULL;
+  for (i=0; i<c->nworkers; i++)
+    pthread_mutex_destroy(&workers[i].qlock);
+  free(workers);
+  workers = NULL;
+  nworkers = 0;
+  if (c->ndead > 0)
+    unlink_dead(c);
+}
+
+#else
+
+/* Without the SMP dispatcher there is no runtime lock to let go of,
+   and no other worker to stop */
+int __arc_rtrelease(arc *c)
+{
+  return(0);
+}
+
+void __arc_rtacquire(arc *c, int depth)
+{
+}
+
+void __arc_block(arc *c)
+{
+}
+
+void __arc_unblock(arc *c)
+{
+}
+
+#endif
+
+/* Main dispatcher.  Each round runs every thread in the ready queue
+   for at most c->quanta cycles or until the thread leaves ready
+   state, wakes up sleeping threads whose time has come, and checks
+   for I/O.  Also runs garbage collections periodically.  This should
    be called with at least one thread already in the run queue.
    Terminates when no more threads are available.
 
@@ -337,70 +1272,36 @@ extern int __arc_recv_rvchan(arc *c, value thr);
 void arc_thread_dispatch(arc *c)
 {
   value thr;
-  int nthreads, blockedthreads, iowait, sleepthreads, runthreads;
-  int stoppedthreads, need_select;
-  unsigned long long minsleep;
-  value iowaitdata;
-  int eptimeout, gcstatus=0;
-  value vmqueue, prev;
-
+  int nready, eptimeout, gcstatus=0;
+  unsigned long long now;
+
+  /* The thread which was current before dispatching began is about
+     to be replaced as c->curthread */
+  __arc_unroot(c, c->curthread);
+#ifdef HAVE_SMP
+  if (c->nworkers > 1) {
+    smp_dispatch(c);
+    return;
+  }
+#endif
   for (;;) {
-    nthreads = blockedthreads = iowait = stoppedthreads = 0;
-    sleepthreads = runthreads = need_select = 0;
-    minsleep = ULLONG_MAX;
-    iowaitdata = CNIL;
-    prev = CNIL;
-    /* XXX - see if we need more extensive use of the write barrier when
-       doing these thread manipulations */
-    for (vmqueue = c->vmthreads; vmqueue; vmqueue = cdr(vmqueue)) {
-      thr = car(vmqueue);
-      __arc_wb(c->curthread, thr);
+    /* Wake up sleeping threads whose wakeup time has been reached */
+    if (c->ntimers > 0) {
+      now = __arc_milliseconds();
+      while (c->ntimers > 0 && TWAKEUP(c->timers[0]) <= now) {
+	thr = c->timers[0];
+	__arc_wakeup(c, thr);
+	SVALR(thr, CNIL);
+      }
+    }
+
+    /* Run the threads that are ready now.  Threads made ready while
+       this is going on get their turn in the next round. */
+    for (nready = c->nrunq; nready > 0; nready--) {
+      thr = runq_get(c);
+      __arc_rootwb(c->curthread, thr);
       c->curthread = thr;
-      ++nthreads;
       switch (TSTATE(thr)) {
-	/* Remove a thread in Trelease or Tbroken state from the
-	   queue. */
-      case Trelease:
-      case Tbroken:
-	stoppedthreads++;
-	/* This will serve to wake up all the threads waiting on
-	   the return value channel of the thread, so they can pick
-	   up the return value now that it is available. */
-	if (TYPE(TRVCH(thr)) == T_CHAN)
-	  __arc_send_rvchan(c, TRVCH(thr), TVALR(thr));
-	__arc_wb(TRVCH(thr), TVALR(thr));
-	TRVCH(thr) = TVALR(thr);
-	/* unlink the thread from the queue */
-	if (prev == CNIL) {
-	  __arc_wb(c->vmthreads, cdr(vmqueue));
-	  c->vmthreads = cdr(vmqueue);
-	} else {
-	  scdr(prev, cdr(vmqueue));
-	}
-	if (NIL_P(cdr(vmqueue))) {
-	  __arc_wb(c->vmthrtail, prev);
-	  c->vmthrtail = prev;
-	}
-	goto finished;
-	break;
-      case Talt:
-      case Tsend:
-      case Trecv:
-	/* increment count of threads in blocked states */
-	++blockedthreads;
-	break;
-      case Tsleep:
-	/* Wake up a sleeping thread if the wakeup time is reached */
-	if (__arc_milliseconds() >= TWAKEUP(thr)) {
-	  TSTATE(thr) = Tready;
-	  SVALR(thr, CNIL);
-	} else {
-	  sleepthreads++;
-	  if (TWAKEUP(thr) < minsleep)
-	    minsleep = TWAKEUP(thr);
-	  goto finish_thread;
-	}
-	/* fall through and let the awakened thread run */
       case Tready:
 	/* let the thread run */
 	if (TQUANTA(thr) <= 0)
@@ -416,59 +1317,82 @@ void arc_thread_dispatch(arc *c)
 	  __arc_thr_trampoline(c, thr, TR_RESUME);
 	}
 	break;
+      default:
+	break;
+      }
+
+      /* Put the thread where it belongs given its state now */
+      switch (TSTATE(thr)) {
+      case Tready:
+      case Tcritical:
+	runq_add(c, thr);
+	break;
+      case Tsleep:
+	timer_add(c, thr);
+	break;
       case Tiowait:
-	/* Build up the list of threads for which I/O is pending */
-	iowait++;
-	need_select = 1;
-	iowaitdata = cons(c, thr, iowaitdata);
+	iowait_add(c, thr);
+	break;
+      case Trelease:
+      case Tbroken:
+	/* unless something put it back on the ready queue, in which
+	   case it gets reaped when it comes up again */
+	if (!(TSCHED(thr) & SCHED_RUNQ))
+	  reap(c, thr);
+	break;
+      case Talt:
+      case Tsend:
+      case Trecv:
+	/* on the wait list of a channel */
 	break;
       }
-    finish_thread:
-      if (RUNNABLE(thr))
-	runthreads++;
-      prev = vmqueue;
-    finished:
-      ;
     }
+    if (c->ndead > 0 && c->ndead >= c->nthreads)
+      unlink_dead(c);
+
     /* XXX - should we print a warning message if we abort when all
        threads are blocked?  I suppose it should be up to the caller
        to decide whether this is a bad thing or no.  It isn't an
        issue for the REPL. */
-    if (nthreads == 0 || nthreads == blockedthreads)
+    if (c->nrunq == 0 && c->ntimers == 0 && c->niowait == 0) {
+      if (c->ndead > 0)
+	unlink_dead(c);
       return;
+    }
 
-    /* We have now finished running all threads.  See if we need to
-       do some post-cleanup work */
-    if (need_select) {
-      if (gcstatus == 0) {
-	/* do not wait if the garbage collector reports it still needs
-	   to do something. */
+    if (c->niowait > 0) {
+      if (gcstatus == 0 || c->nrunq > 0) {
+	/* do not wait if there are any other threads which can run,
+	   or if the garbage collector reports it still needs to do
+	   something. */
 	eptimeout = 0;
-      } else if ((iowait + blockedthreads) == nthreads) {
+      } else if (c->ntimers == 0) {
 	/* If all threads are blocked on I/O or are waiting on channels,
-	   make epoll wait indefinitely until I/O is possible. */
+	   wait indefinitely until I/O is possible. */
 	eptimeout = -1;
-      } else if ((iowait + sleepthreads + blockedthreads) == nthreads) {
-	/* If all threads are either asleep, blocked, or waiting on
-	 I/O, wait for at most the time until the first sleep expires. */
-	eptimeout = (minsleep - __arc_milliseconds());
       } else {
-	/* do not wait if there are any other threads which can run */
-	eptimeout = 0;
+	/* Otherwise wait for at most the time until the first sleep
+	   expires. */
+	now = __arc_milliseconds();
+	eptimeout = (TWAKEUP(c->timers[0]) > now)
+	  ? (int)(TWAKEUP(c->timers[0]) - now) : 0;
       }
-      process_iowait(c, iowaitdata, eptimeout);
-    }
-
-    /* If all threads are asleep, use nanosleep to wait the the shortest
-       time until it's time for a thread to wake up */
-    if (sleepthreads == nthreads) {
+      process_iowait(c, eptimeout);
+    } else if (c->nrunq == 0 && gcstatus != 0) {
+      /* If all threads are asleep, use nanosleep to wait the the
+	 shortest time until it's time for a thread to wake up */
       unsigned long long st;
       struct timespec req;
 
-      st = minsleep - __arc_milliseconds();
-      req.tv_sec = st/1000;
-      req.tv_nsec = ((st % 1000) * 1000000L);
-      nanosleep(&req, NULL);
+      now = __arc_milliseconds();
+      if (TWAKEUP(c->timers[0]) > now) {
+	st = TWAKEUP(c->timers[0]) - now;
+	req.tv_sec = st/1000;
+	req.tv_nsec = ((st % 1000) * 1000000L);
+	__arc_gc_release(c);
+	nanosleep(&req, NULL);
+	__arc_gc_acquire(c);
+      }
     }
     /* Perform garbage collection: should be done after every cycle
        with VCGC, as though it were a thread in our scheduler. */
@@ -497,11 +1421,16 @@ value arc_spawn(arc *c, value thunk)
      terminates right then and there and is never enqueued. */
   if (tfn->apply(c, thr, TVALR(thr)) != TR_RESUME) {
     TSTATE(thr) = Trelease;
-    __arc_wb(TRVCH(thr), TVALR(thr));
+    __arc_rootwb(TRVCH(thr), TVALR(thr));
     TRVCH(thr) = TVALR(thr);
   } else {
     /* Otherwise, queue the new thread and enqueue it in the dispatcher. */
+    SCHED_LOCK();
     __arc_enqueue(c, thr, &c->vmthreads, &c->vmthrtail);
+    SCHED_SET(thr, SCHED_LIVE);
+    c->nthreads++;
+    SCHED_UNLOCK();
+    runq_add(c, thr);
   }
   return(thr);
 }
@@ -512,8 +1441,8 @@ AFFDEF(arc_sleep)
   value timetowake;
   AFBEGIN;
 
-  AFCALL(arc_mkaff(c, arc_coerce, CNIL), AV(sleeptime),
-	 ARC_BUILTIN(c, S_FLONUM));
+  AFCALLF(arc_coerce, AV(sleeptime),
+	  ARC_BUILTIN(c, S_FLONUM));
   timetowake = AFCRV;
   if (REPFLO(timetowake) < 0.0) {
     arc_err_cstrfmt(c, "negative sleep time");
@@ -537,8 +1466,9 @@ AFFDEF(arc_atomic_cell)
   AOARG(val);
   AFBEGIN;
   if (!BOUND_P(AV(val)))
-    ARETURN((TACELL(thr) == 0) ? CNIL : CTRUE);
-  TACELL(thr) = (NIL_P(AV(val))) ? 0 : 1;
+    ARETURN((__atomic_load_n(&TACELL(thr), __ATOMIC_ACQUIRE) == 0)
+	    ? CNIL : CTRUE);
+  __atomic_store_n(&TACELL(thr), (NIL_P(AV(val))) ? 0 : 1, __ATOMIC_RELEASE);
   ARETURN(AV(val));
   AFEND;
 }
@@ -550,13 +1480,22 @@ AFFDEF(arc_kill_thread)
   AVAR(achan);
   AFBEGIN;
   TYPECHECK(AV(tthr), T_THREAD);
-  TSTATE(AV(tthr)) = Tbroken;
-  if (TACELL(AV(tthr))) {
-    /* release atomic cell */
-    TACELL(AV(tthr)) = 0;
+  /* The dispatcher reaps the thread the next time it comes up in the
+     ready queue. */
+  SCHED_LOCK();
+  if (TSCHED(AV(tthr)) & SCHED_RUNNING) {
+    SCHED_SET(AV(tthr), SCHED_KILL);
+  } else {
+    thr_unwait(c, AV(tthr));
+    TSTATE(AV(tthr)) = Tbroken;
+    runq_add(c, AV(tthr));
+  }
+  SCHED_UNLOCK();
+  /* release atomic cell */
+  if (__atomic_exchange_n(&TACELL(AV(tthr)), 0, __ATOMIC_ACQ_REL)) {
     WV(achan, arc_gbind_cstr(c, "__achan__"));
     if (BOUND_P(AV(achan))) {
-      AFCALL(arc_mkaff(c, arc_recv_channel, CNIL), AV(achan));
+      AFCALLF(arc_recv_channel, AV(achan));
     }
   }
   ARETURN(AV(tthr));
@@ -571,17 +1510,17 @@ AFFEND
 
    This function cannot break a thread that is waiting to send to
    or receive from a channel. */
-value arc_break_thread(arc *c, value tthr)
+static void thr_break(arc *c, value tthr)
 {
   typefn_t *tfn;
 
   /* do nothing if the thread is in either state */
   if (!(TSTATE(tthr) == Tready || TSTATE(tthr) == Tsleep
 	|| TSTATE(tthr) == Tiowait))
-    return(tthr);
+    return;
 
   /* force the thread to become ready */
-  TSTATE(tthr) = Tready;
+  wakeup(c, tthr);
 
   /* make the thread resume at a call to arc_err */
   SVALR(tthr, arc_mkaff(c, arc_err, CNIL));
@@ -589,6 +1528,16 @@ value arc_break_thread(arc *c, value tthr)
   SFUNR(tthr, TVALR(tthr));
   tfn = __arc_typefn(c, TVALR(tthr));
   tfn->apply(c, tthr, TVALR(tthr));
+}
+
+value arc_break_thread(arc *c, value tthr)
+{
+  SCHED_LOCK();
+  if (TSCHED(tthr) & SCHED_RUNNING)
+    SCHED_SET(tthr, SCHED_BREAK);
+  else
+    thr_break(c, tthr);
+  SCHED_UNLOCK();
   return(tthr);
 }
 
@@ -597,18 +1546,28 @@ AFFDEF(arc_join_thread)
   AARG(jthr);
   AFBEGIN;
   while (TYPE(TRVCH(AV(jthr))) == T_CHAN) {
-    AFCALL(arc_mkaff(c, __arc_recv_rvchan, CNIL), TRVCH(AV(jthr)));
+    AFCALLF(__arc_recv_rvchan, TRVCH(AV(jthr)));
   }
   ARETURN(TRVCH(AV(jthr)));
   AFEND;
 }
 AFFEND
 
-value arc_current_thread(arc *c)
+/* The thread being run by the calling worker of the dispatcher */
+value __arc_curthread(arc *c)
 {
+#ifdef HAVE_SMP
+  if (self != NULL)
+    return(self->curthread);
+#endif
   return(c->curthread);
 }
 
+value arc_current_thread(arc *c)
+{
+  return(__arc_curthread(c));
+}
+
 void arc_init_threads(arc *c)
 {
   c->vmthreads = CNIL;
@@ -617,6 +1576,47 @@ void arc_init_threads(arc *c)
   c->tid_nonce = 0;
   c->stksize = TSTKSIZE;
   c->quantum = DEFAULT_QUANTUM;
+  c->nworkers = 1;
+#ifdef HAVE_SMP
+  {
+    char *nw = getenv("ARCUEID_WORKERS");
+
+    if (nw != NULL && atoi(nw) > 1)
+      c->nworkers = (atoi(nw) > MAX_WORKERS) ? MAX_WORKERS : atoi(nw);
+  }
+  /* Channels have locks of their own, and atomic cells are atomic */
+  __arc_aff_unlocked(arc_recv_channel);
+  __arc_aff_unlocked(arc_send_channel);
+  __arc_aff_unlocked(arc_atomic_cell);
+#endif
+  c->runqhead = CNIL;
+  c->runqtail = CNIL;
+  c->nrunq = 0;
+  c->nthreads = 0;
+  c->ndead = 0;
+  c->timers = NULL;
+  c->ntimers = 0;
+  c->timersize = 0;
+  c->epollfd = -1;
+  c->iowaiters = NULL;
+  c->niowaiters = 0;
+  c->niowait = 0;
+}
+
+void arc_deinit_threads(arc *c)
+{
+  if (c->epollfd >= 0)
+    close(c->epollfd);
+  c->epollfd = -1;
+  free(c->iowaiters);
+  c->iowaiters = NULL;
+  c->niowaiters = 0;
+  c->niowait = 0;
+  free(c->timers);
+  c->timers = NULL;
+  c->ntimers = c->timersize = 0;
+  c->runqhead = c->runqtail = CNIL;
+  c->nrunq = 0;
 }
 
 typefn_t __arc_thread_typefn__ = {
@@ -645,14 +1645,16 @@ static value vector_doubledown(arc *c, value curr)
 static void grow_stack(arc *c, value thr)
 {
   value old_stack;
-  int tsfnofs;
+  int tsfnofs, tspofs;
 
   tsfnofs = TSTOP(thr) - TSFN(thr);
+  tspofs = TSTOP(thr) - TSP(thr);
   old_stack = TSTACK(thr);
   TSTACK(thr) = vector_doubledown(c, old_stack);
   TSBASE(thr) = &XVINDEX(TSTACK(thr), 0);
   TSTOP(thr) = &XVINDEX(TSTACK(thr), VECLEN(TSTACK(thr))-1);
   TSFN(thr) = TSTOP(thr) - tsfnofs;
+  TSP(thr) = TSTOP(thr) - tspofs;
 }
 
 inline void __arc_stackcheck(value thr)
@@ -683,6 +1685,6 @@ inline void __arc_stackcheck(value thr)
   /* XXX - if initial stack size is set too low, or under certain
      circumstances doing this may be insufficient to free up enough
      stack space.  May be necessary to resize the stack.  */
-  if (TSP(thr) <= TSBASE(thr));
-  grow_stack(c, thr);
+  if (TSP(thr) <= TSBASE(thr))
+    grow_stack(c, thr);
 }
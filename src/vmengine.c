@@ -36,6 +36,25 @@
 void *alloca (size_t);
 #endif
 
+/* With the SMP dispatcher, bytecode runs on several workers at once,
+   but C functions (builtins, AFFs, the applicators of non-closure
+   types) and the few instructions which touch shared runtime state
+   must hold the runtime lock.  The exceptions are tables, whose
+   applicator only looks them up under their own locks, and the AFFs
+   registered with __arc_aff_unlocked.  RTLOCKED tells whether fn has
+   to be applied or resumed with the lock held. */
+#ifdef HAVE_SMP
+#define RTLOCK(c) __arc_rtlock(c)
+#define RTUNLOCK(c) __arc_rtunlock(c)
+#define RTLOCKED(c, fn) (TYPE(fn) == T_CCODE ? !__arc_ccode_unlocked(c, fn) \
+			 : (TYPE(fn) != T_CLOS && TYPE(fn) != T_TABLE	\
+			    && TYPE(fn) != T_WTABLE))
+#else
+#define RTLOCK(c)
+#define RTUNLOCK(c)
+#define RTLOCKED(c, fn) 0
+#endif
+
 static value apply_return(arc *c, value thr)
 {
   value cont;
@@ -87,6 +106,11 @@ void __arc_thr_trampoline(arc *c, value thr, enum tr_states_t state)
   int jmpval;
 
   jmpval = setjmp(TEJMP(thr));
+#ifdef HAVE_SMP
+  /* an error may have been raised while holding the runtime lock */
+  if (jmpval != 0)
+    __arc_rtreset(c);
+#endif
   if (jmpval == 2) {
     TQUANTA(thr) = 0;
     TSTATE(thr) = Tbroken;
@@ -101,7 +125,17 @@ void __arc_thr_trampoline(arc *c, value thr, enum tr_states_t state)
     switch (state) {
     case TR_RESUME:
       /* Resume execution of the current virtual machine state. */
-      state = (TYPE(TFUNR(thr)) == T_CCODE) ? __arc_resume_aff(c, thr) : __arc_vmengine(c, thr);
+      if (TYPE(TFUNR(thr)) == T_CCODE) {
+	if (RTLOCKED(c, TFUNR(thr))) {
+	  RTLOCK(c);
+	  state = __arc_resume_aff(c, thr);
+	  RTUNLOCK(c);
+	} else {
+	  state = __arc_resume_aff(c, thr);
+	}
+      } else {
+	state = __arc_vmengine(c, thr);
+      }
       break;
     case TR_SUSPEND:
       /* just return to the dispatcher */
@@ -110,7 +144,13 @@ void __arc_thr_trampoline(arc *c, value thr, enum tr_states_t state)
       /* If the state of the trampoline becomes TR_FNAPP, we will attempt
 	 to apply the function in the value register, with arguments on
 	 the stack, whatever type of function it happens to be. */
-      state = apply_vr(c, thr);
+      if (RTLOCKED(c, TVALR(thr))) {
+	RTLOCK(c);
+	state = apply_vr(c, thr);
+	RTUNLOCK(c);
+      } else {
+	state = apply_vr(c, thr);
+      }
       break;
     case TR_RC:
     default:
@@ -194,6 +234,25 @@ void __arc_init_tracing(arc *c)
 
 #endif
 
+#ifdef HAVE_VMPROFILE
+
+unsigned long long __arc_vmprof_count[VMPROF_NOPS];
+unsigned long long __arc_vmprof_pairs[VMPROF_NOPS][VMPROF_NOPS];
+
+/* Count an instruction about to be executed.  Pairs are only counted
+   within a single run of the virtual machine. */
+#define VMPROFILE(inst) do {					\
+    int op = FIX2INT(inst);					\
+    __arc_vmprof_count[op]++;					\
+    if (vmprev >= 0)						\
+      __arc_vmprof_pairs[vmprev][op]++;				\
+    vmprev = op;						\
+  } while (0)
+
+#else
+#define VMPROFILE(inst)
+#endif
+
 /* instruction decoding macros */
 #ifdef HAVE_THREADED_INTERPRETER
 /* threaded interpreter */
@@ -205,11 +264,13 @@ void __arc_init_tracing(arc *c)
       goto endquantum;						\
     if (__arc_vmtrace)						\
       trace(c, thr);						\
+    VMPROFILE(*TIPP(thr));					\
     goto *(JTBASE + jumptbl[*TIPP(thr)++]); }
 #else
 #define NEXT {							\
     if (--TQUANTA(thr) <= 0)					\
       goto endquantum;						\
+    VMPROFILE(*TIPP(thr));					\
     goto *(JTBASE + jumptbl[*TIPP(thr)++]); }
 #endif
 
@@ -219,6 +280,136 @@ void __arc_init_tracing(arc *c)
 #define NEXT break
 #endif
 
+/* Instruction bodies shared between the basic instructions and the
+   superinstructions built from them. */
+#define DO_PUSH() CPUSH(thr, TVALR(thr))
+
+#define DO_LDI() SVALR(thr, *TIPP(thr)++)
+
+#define DO_LDL() do {							\
+    value lidx = *TIPP(thr)++;						\
+    SVALR(thr, CODE_LITERAL(CLOS_CODE(TFUNR(thr)), FIX2INT(lidx)));	\
+  } while (0)
+
+#define DO_LDG() do {							\
+    value tmp, tmpstr;							\
+    char *cstr;								\
+									\
+    tmp = CODE_LITERAL(CLOS_CODE(TFUNR(thr)), FIX2INT(*TIPP(thr)++));	\
+    /* The compiler gives us the binding cell of the global, but a	\
+       bare symbol still has to be looked up. */			\
+    if (SYMBOL_P(tmp)) {						\
+      RTLOCK(c);							\
+      SVALR(thr, arc_gbind(c, tmp));					\
+      RTUNLOCK(c);							\
+    } else {								\
+      SVALR(thr, car(tmp));						\
+    }									\
+    if (TVALR(thr) == CUNBOUND) {					\
+      tmpstr = arc_sym2name(c, SYMBOL_P(tmp) ? tmp : cdr(tmp));	\
+      cstr = alloca(sizeof(char)*(FIX2INT(arc_strutflen(c, tmpstr)) + 1)); \
+      arc_str2cstr(c, tmpstr, cstr);					\
+      arc_err_cstrfmt(c, "Unbound symbol: _%s", cstr);			\
+      SVALR(thr, CNIL);							\
+    }									\
+  } while (0)
+
+#define DO_LDE() do {							\
+    int ienv, iindx;							\
+									\
+    ienv = FIX2INT(*TIPP(thr)++);					\
+    iindx = FIX2INT(*TIPP(thr)++);					\
+    SVALR(thr, __arc_getenv(c, thr, ienv, iindx));			\
+  } while (0)
+
+#define DO_LDE0() do {							\
+    int iindx;								\
+    value val;								\
+									\
+    iindx = FIX2INT(*TIPP(thr)++);					\
+    if (ENV_P(TENVR(thr))) {						\
+      value *base = TSTOP(thr) - ((int)(TENVR(thr) >> 4));		\
+      int count = FIX2INT(*(base + 1));					\
+      val = *(base + count + 1 - iindx);				\
+    } else {								\
+      val = XVINDEX(TENVR(thr), iindx+1);				\
+    }									\
+    SVALR(thr, val);							\
+  } while (0)
+
+#define DO_CONT() do {							\
+    int icofs = FIX2INT(*TIPP(thr)++);					\
+    value *target = TIPP(thr) + icofs - 2;				\
+									\
+    /* Compute the absolute target */					\
+    icofs = target - &XVINDEX(CODE_CODE(CLOS_CODE(TFUNR(thr))), 0);	\
+    SCONR(thr, __arc_mkcont(c, thr, icofs));				\
+  } while (0)
+
+#define DO_MENV() do {							\
+    int n = FIX2INT(*TIPP(thr)++);					\
+									\
+    __arc_menv(c, thr, n);						\
+    TARGC(thr) = n;							\
+  } while (0)
+
+#define DO_CLS() do {							\
+    if (ENV_P(TENVR(thr)))						\
+      SENVR(thr, __arc_env2heap(c, thr, TENVR(thr)));			\
+    SVALR(thr, arc_mkclos(c, TVALR(thr), TENVR(thr)));			\
+  } while (0)
+
+#define DO_ADD() do {							\
+    /* I really hate how the + operator has been so overloaded */	\
+    value arg1, arg2;							\
+									\
+    arg1 = CPOP(thr);							\
+    arg2 = TVALR(thr);							\
+									\
+    if (TYPE(arg1) == T_STRING) {					\
+      /* we fake a call to __arc_add2_string */				\
+      SCONR(thr, __arc_mkcont(c, thr, TIPP(thr)				\
+			      - &XVINDEX(CODE_CODE(CLOS_CODE(TFUNR(thr))), \
+					 0)));				\
+      CPUSH(thr, arg1);							\
+      CPUSH(thr, arg2);							\
+      TARGC(thr) = 2;							\
+      SVALR(thr, arc_mkaff(c, __arc_add2_string, CNIL));		\
+      return(TR_FNAPP);							\
+    } else {								\
+      SVALR(thr, __arc_add2(c, arg1, arg2));				\
+    }									\
+  } while (0)
+
+#define DO_SUB() SVALR(thr, __arc_sub2(c, CPOP(thr), TVALR(thr)))
+
+/* The second instruction of a superinstruction keeps its opcode word,
+   so that jumps and continuations landing on it still work.  The
+   superinstruction itself just steps over it, charging the quantum
+   for the first instruction so scheduling is unchanged by fusion. */
+#define SKIPINST() (TIPP(thr)++, TQUANTA(thr)--)
+
+/* Quickening: rewrite the opcode of the instruction being executed.
+   Only valid for instructions with no operands.  The code vector only
+   ever gets a fixnum stored into it, so no write barrier is needed. */
+#define QUICKEN(inst) (*(TIPP(thr)-1) = INT2FIX(inst))
+
+/* True if both operands of a binary arithmetic instruction are fixnums */
+#define FXOPS_P() (FIXNUM_P(*(TSP(thr)+1)) && FIXNUM_P(TVALR(thr)))
+
+/* Fixnum fast path for binary arithmetic, using one of the
+   __arc_fx* functions from arith.h.  The operands must already be
+   known to be fixnums.  Falls through to the generic slow path, which
+   does promotion, if the result overflows. */
+#define FXARITH(fxop) {							\
+    value fxr;								\
+    if (!fxop(*(TSP(thr)+1), TVALR(thr), &fxr)) {			\
+      TSP(thr)++;							\
+      SVALR(thr, fxr);							\
+      NEXT;								\
+    }									\
+  }
+
 /* The actual virtual machine engine.  Fits into the trampoline just
    like a normal function. */
 int __arc_vmengine(arc *c, value thr)
@@ -230,6 +421,9 @@ int __arc_vmengine(arc *c, value thr)
 #else
   value curr_instr;
 #endif
+#ifdef HAVE_VMPROFILE
+  int vmprev = -1;
+#endif
 
 #ifdef HAVE_THREADED_INTERPRETER
 #ifdef HAVE_TRACING
@@ -238,61 +432,47 @@ int __arc_vmengine(arc *c, value thr)
     trace(c, thr);
   }
 #endif
+  VMPROFILE(*TIPP(thr));
   goto *(void *)(JTBASE + jumptbl[*TIPP(thr)++]);
 #else
   for (;;) {
     curr_instr = *TIPP(thr)++;
+    VMPROFILE(curr_instr);
     switch (FIX2INT(curr_instr)) {
 #endif
     INST(inop):
       NEXT;
     INST(ipush):
-      CPUSH(thr, TVALR(thr));
+      DO_PUSH();
       NEXT;
     INST(ipop):
       SVALR(thr, CPOP(thr));
       NEXT;
     INST(ildi):
-      SVALR(thr, *TIPP(thr)++);
+      DO_LDI();
       NEXT;
-    INST(ildl): {
-	value lidx = *TIPP(thr)++;
-	SVALR(thr, CODE_LITERAL(CLOS_CODE(TFUNR(thr)), FIX2INT(lidx)));
-      }
+    INST(ildl):
+      DO_LDL();
       NEXT;
     INST(ildg):
+      DO_LDG();
+      NEXT;
+    INST(istg):
       {
-	value tmp, tmpstr;
-	char *cstr;
+	value tmp;
 
 	tmp = CODE_LITERAL(CLOS_CODE(TFUNR(thr)), FIX2INT(*TIPP(thr)++));
-	/* XXX - should we use the more general hash lookup?  Don't think
-	   it should be possible to use anything besides symbols to index
-	   the global top-level environment. */
-	SVALR(thr, arc_gbind(c, tmp));
-	if (TVALR(thr) == CUNBOUND) {
-	  tmpstr = arc_sym2name(c, tmp);
-	  cstr = alloca(sizeof(char)*(FIX2INT(arc_strutflen(c, tmpstr)) + 1));
-	  arc_str2cstr(c, tmpstr, cstr);
-	  /* arc_print_string(c, arc_prettyprint(c, tmp)); printf("\n"); */
-	  arc_err_cstrfmt(c, "Unbound symbol: _%s", cstr);
-	  SVALR(thr, CNIL);
+	if (SYMBOL_P(tmp)) {
+	  RTLOCK(c);
+	  arc_bindsym(c, tmp, TVALR(thr));
+	  RTUNLOCK(c);
+	} else {
+	  scar(tmp, TVALR(thr));
 	}
       }
       NEXT;
-    INST(istg):
-      arc_bindsym(c, CODE_LITERAL(CLOS_CODE(TFUNR(thr)),
-				  FIX2INT(*TIPP(thr)++)),
-		  TVALR(thr));
-      NEXT;
     INST(ilde):
-      {
-	int ienv, iindx;
-
-	ienv = FIX2INT(*TIPP(thr)++);
-	iindx = FIX2INT(*TIPP(thr)++);
-	SVALR(thr, __arc_getenv(c, thr, ienv, iindx));
-      }
+      DO_LDE();
       NEXT;
     INST(iste):
       {
@@ -304,20 +484,7 @@ int __arc_vmengine(arc *c, value thr)
       }
       NEXT;
     INST(ilde0):
-      {
-	int iindx;
-	value val;
-
-	iindx = FIX2INT(*TIPP(thr)++);
-	if (ENV_P(TENVR(thr))) {
-	  value *base = TSTOP(thr) - ((int)(TENVR(thr) >> 4));
-	  int count = FIX2INT(*(base + 1));
-	  val = *(base + count + 1 - iindx);
-	} else {
-	  val = XVINDEX(TENVR(thr), iindx+1);
-	}
-	SVALR(thr, val);
-      }
+      DO_LDE0();
       NEXT;
     INST(iste0):
       {
@@ -329,22 +496,16 @@ int __arc_vmengine(arc *c, value thr)
 	  value *base = TSTOP(thr) - ((int)(TENVR(thr) >> 4));
 	  int count = FIX2INT(*(base + 1));
 	  ptr = (base + count + 1 - iindx);
+	  __arc_rootwb(*ptr, TVALR(thr));
 	} else {
 	  ptr = &XVINDEX(TENVR(thr), iindx+1);
+	  __arc_wb(*ptr, TVALR(thr));
 	}
-	__arc_wb(*ptr, TVALR(thr));
 	*ptr = TVALR(thr);
       }
       NEXT;
     INST(icont):
-      {
-	int icofs = FIX2INT(*TIPP(thr)++);
-	value *target = TIPP(thr) + icofs - 2;
-
-	/* Compute the absolute target */
-	icofs = target - &XVINDEX(CODE_CODE(CLOS_CODE(TFUNR(thr))), 0);
-	SCONR(thr, __arc_mkcont(c, thr, icofs));
-      }
+      DO_CONT();
       NEXT;
     INST(ienv):
       {
@@ -444,32 +605,22 @@ int __arc_vmengine(arc *c, value thr)
       goto endquantum;
       NEXT;
     INST(iadd):
-      {
-	/* I really hate how the + operator has been so overloaded */
-	value arg1, arg2;
-
-	arg1 = CPOP(thr);
-	arg2 = TVALR(thr);
-
-	if (TYPE(arg1) == T_STRING) {
-	  /* we fake a call to __arc_add2_string */
-	  SCONR(thr, __arc_mkcont(c, thr, TIPP(thr)
-				  - &XVINDEX(CODE_CODE(CLOS_CODE(TFUNR(thr))),
-					     0)));
-	  CPUSH(thr, arg1);
-	  CPUSH(thr, arg2);
-	  TARGC(thr) = 2;
-	  SVALR(thr, arc_mkaff(c, __arc_add2_string, CNIL));
-	  return(TR_FNAPP);
-	} else {
-	  SVALR(thr, __arc_add2(c, arg1, arg2));
-	}
+      if (FXOPS_P()) {
+	QUICKEN(iaddfx);
+	FXARITH(__arc_fxadd);
       }
+      DO_ADD();
       NEXT;
     INST(isub):
-      SVALR(thr, __arc_sub2(c, CPOP(thr), TVALR(thr)));
+      if (FXOPS_P()) {
+	QUICKEN(isubfx);
+	FXARITH(__arc_fxsub);
+      }
+      DO_SUB();
       NEXT;
     INST(imul):
+      if (FXOPS_P())
+	FXARITH(__arc_fxmul);
       SVALR(thr, __arc_mul2(c, CPOP(thr), TVALR(thr)));
       NEXT;
     INST(idiv):
@@ -507,19 +658,13 @@ int __arc_vmengine(arc *c, value thr)
       SVALR(thr, *(TSP(thr)+1));
       NEXT;
     INST(icls):
-      if (ENV_P(TENVR(thr)))
-	SENVR(thr, __arc_env2heap(c, thr, TENVR(thr)));
-      SVALR(thr, arc_mkclos(c, TVALR(thr), TENVR(thr)));
+      DO_CLS();
       NEXT;
     INST(iconsr):
       SVALR(thr, cons(c, TVALR(thr), CPOP(thr)));
       NEXT;
-    INST(imenv): {
-	int n = FIX2INT(*TIPP(thr)++);
-
-	__arc_menv(c, thr, n);
-	TARGC(thr) = n;
-      }
+    INST(imenv):
+      DO_MENV();
       NEXT;
     INST(idcar):
       if (NIL_P(TVALR(thr)) || TVALR(thr) == CUNBOUND)
@@ -558,6 +703,82 @@ int __arc_vmengine(arc *c, value thr)
 	}
       }
       NEXT;
+      /* Quickened arithmetic.  If the operands turn out not to be
+	 fixnums after all, go back to the generic instruction. */
+    INST(iaddfx):
+      if (FXOPS_P())
+	FXARITH(__arc_fxadd)
+      else
+	QUICKEN(iadd);
+      DO_ADD();
+      NEXT;
+    INST(isubfx):
+      if (FXOPS_P())
+	FXARITH(__arc_fxsub)
+      else
+	QUICKEN(isub);
+      DO_SUB();
+      NEXT;
+      /* Superinstructions */
+    INST(ipushldg):
+      DO_PUSH();
+      SKIPINST();
+      DO_LDG();
+      NEXT;
+    INST(ildgapply):
+      DO_LDG();
+      SKIPINST();
+      TARGC(thr) = FIX2INT(*TIPP(thr)++);
+      return(TR_FNAPP);
+    INST(ilde0push):
+      DO_LDE0();
+      SKIPINST();
+      DO_PUSH();
+      NEXT;
+    INST(icontlde0):
+      DO_CONT();
+      SKIPINST();
+      DO_LDE0();
+      NEXT;
+    INST(ipushldi):
+      DO_PUSH();
+      SKIPINST();
+      DO_LDI();
+      NEXT;
+    INST(ildipush):
+      DO_LDI();
+      SKIPINST();
+      DO_PUSH();
+      NEXT;
+    INST(imenvapply):
+      DO_MENV();
+      SKIPINST();
+      TARGC(thr) = FIX2INT(*TIPP(thr)++);
+      return(TR_FNAPP);
+    INST(ildlcls):
+      DO_LDL();
+      SKIPINST();
+      DO_CLS();
+      NEXT;
+    INST(ildepush):
+      DO_LDE();
+      SKIPINST();
+      DO_PUSH();
+      NEXT;
+    INST(ildiadd):
+      DO_LDI();
+      SKIPINST();
+      if (FIXNUM_P(*(TSP(thr)+1)))
+	FXARITH(__arc_fxadd);
+      DO_ADD();
+      NEXT;
+    INST(ildisub):
+      DO_LDI();
+      SKIPINST();
+      if (FIXNUM_P(*(TSP(thr)+1)))
+	FXARITH(__arc_fxsub);
+      DO_SUB();
+      NEXT;
 #ifndef HAVE_THREADED_INTERPRETER
     default:
 #else
@@ -633,14 +854,14 @@ AFFDEF(__arc_reroot)
   AFBEGIN;
   if (TCH(thr) == AV(there))
     ARETURN(CNIL);
-  AFCALL(arc_mkaff(c, __arc_reroot, CNIL), cdr(AV(there)));
+  AFCALLF(__arc_reroot, cdr(AV(there)));
   WV(before, car(car(AV(there))));
   WV(after, cdr(car(AV(there))));
   scar(TCH(thr), cons(c, AV(after), AV(before)));
   scdr(TCH(thr), AV(there));
   scar(AV(there), INT2FIX(0xdead));
   scdr(AV(there), CNIL);
-  __arc_wb(TCH(thr), AV(there));
+  __arc_rootwb(TCH(thr), AV(there));
   TCH(thr) = AV(there);
   AFTCALL2(AV(before), CNIL);
   AFEND;
@@ -662,12 +883,12 @@ static AFFDEF(contwrapper)
     /* We have an inter-thread continuation restore.  We need to also
        bring back whatever the TBCH and so forth were before. This is
        not normally saved in a continuation except in this case. */
-    __arc_wb(TCH(thr), __arc_getenv(c, thr, 1, 3));
+    __arc_rootwb(TCH(thr), __arc_getenv(c, thr, 1, 3));
     TCH(thr) = __arc_getenv(c, thr, 1, 3);
-    __arc_wb(TBCH(thr), __arc_getenv(c, thr, 1, 4));
+    __arc_rootwb(TBCH(thr), __arc_getenv(c, thr, 1, 4));
     TBCH(thr) = __arc_getenv(c, thr, 1, 4);
   }
-  AFCALL(arc_mkaff(c, __arc_reroot, CNIL), __arc_getenv(c, thr, 1, 3));
+  AFCALLF(__arc_reroot, __arc_getenv(c, thr, 1, 3));
   /* call the continuation in the environment of arc_callcc */
   cont = __arc_getenv(c, thr, 1, 1);
   /* special case -- when ccc is a tail call */
@@ -712,12 +933,12 @@ AFFDEF(arc_dynamic_wind)
   AFBEGIN;
 
   WV(here, TCH(thr));
-  AFCALL(arc_mkaff(c, __arc_reroot, CNIL),
-	 cons(c, cons(c, AV(before), AV(after)), AV(here)));
+  AFCALLF(__arc_reroot,
+	  cons(c, cons(c, AV(before), AV(after)), AV(here)));
   AFCALL2(AV(during), CNIL);
   WV(ret, AFCRV);
   /* execute the after clauses if the during thunk returns normally */
-  AFCALL(arc_mkaff(c, __arc_reroot, CNIL), AV(here));
+  AFCALLF(__arc_reroot, AV(here));
   ARETURN(AV(ret));
   AFEND;
 }
@@ -22,6 +22,7 @@
 
 #include <setjmp.h>
 #include <assert.h>
+#include "../config.h"
 
 enum vminst {
   inop=0,
@@ -33,7 +34,7 @@ enum vminst {
   istg=70,
   ilde=135,
   iste=136,
-  icont=137,
+  icont=73,
   ienv=202,
   ienvr=203,
   iapply=76,
@@ -63,7 +64,25 @@ enum vminst {
   idcdr=39,
   ispl=40,
   ilde0=105,
-  iste0=106
+  iste0=106,
+  /* Superinstructions, formed by the peephole pass in codegen.c.  A
+     superinstruction replaces only the opcode of the first instruction
+     of the pair, so its operand count covers the operands of both
+     instructions plus the opcode word of the second. */
+  ipushldg=158,
+  ildgapply=224,
+  ilde0push=161,
+  icontlde0=235,
+  ipushldi=172,
+  ildipush=173,
+  imenvapply=238,
+  ildlcls=175,
+  ildepush=240,
+  ildiadd=177,
+  ildisub=178,
+  /* Quickened instructions, rewritten in place by iadd and isub */
+  iaddfx=51,
+  isubfx=52
 };
 
 #define CODE_CODE(c) (VINDEX((c), 0))
@@ -103,6 +122,15 @@ extern value arc_mkcctx(arc *c);
 extern value arc_cctx_mksrc(arc *c, value cctx);
 extern value __arc_code_lineno(arc *c, value fun, value *ipptr);
 
+/* Bytecode profiler (--enable-vm-profile).  Counts of the instructions
+   executed, and of the pairs of instructions executed one after the
+   other, indexed by opcode. */
+#define VMPROF_NOPS 256
+extern unsigned long long __arc_vmprof_count[VMPROF_NOPS];
+extern unsigned long long __arc_vmprof_pairs[VMPROF_NOPS][VMPROF_NOPS];
+extern value arc_vm_profile(arc *c);
+extern value arc_vm_profile_reset(arc *c);
+
 enum threadstate {
   Talt,				/* blocked in alt instruction */
   Tsend,			/* waiting to send */
@@ -149,8 +177,24 @@ struct vmthread_t {
   value conthere;		/* here for this thread */
   value baseconthere;		/* base cont here */
   int atomic_cell;		/* atomic cell -- do we hold the channel? */
+
+  /* Scheduler bookkeeping.  These links are not marked: a thread is
+     only ever on these lists while it is also on c->vmthreads. */
+  value rqnext;			/* next thread in the ready queue */
+  value iownext;		/* next thread waiting on the same fd */
+  int timeridx;			/* index in the timer heap, or -1 */
+  int sched;			/* scheduler flags */
 };
 
+/* Scheduler flags */
+#define SCHED_LIVE 1		/* spawned and not yet reaped */
+#define SCHED_RUNQ 2		/* on the ready queue */
+#define SCHED_IOWAIT 4		/* on the wait list of an fd */
+#define SCHED_RUNNING 8		/* being run by a worker (SMP) */
+#define SCHED_WAKE 16		/* made ready while running (SMP) */
+#define SCHED_KILL 32		/* killed while running (SMP) */
+#define SCHED_BREAK 64		/* broken while running (SMP) */
+
 
 static inline value TFUNR(value t)
 {
@@ -159,7 +203,7 @@ static inline value TFUNR(value t)
 
 static inline value SFUNR(value t, value nv)
 {
-  __arc_wb(((struct vmthread_t *)REP(t))->funr, nv);
+  __arc_rootwb(((struct vmthread_t *)REP(t))->funr, nv);
   ((struct vmthread_t *)REP(t))->funr = nv;
   return(nv);
 }
@@ -171,7 +215,7 @@ static inline value TENVR(value t)
 
 static inline value SENVR(value t, value nv)
 {
-  __arc_wb(((struct vmthread_t *)REP(t))->envr, nv);
+  __arc_rootwb(((struct vmthread_t *)REP(t))->envr, nv);
   ((struct vmthread_t *)REP(t))->envr = nv;
   return(nv);
 }
@@ -183,7 +227,7 @@ static inline value TVALR(value t)
 
 static inline value SVALR(value t, value nv)
 {
-  __arc_wb((((struct vmthread_t *)REP(t))->valr), nv);
+  __arc_rootwb((((struct vmthread_t *)REP(t))->valr), nv);
   (((struct vmthread_t *)REP(t))->valr) = nv;
   return(nv);
 }
@@ -195,7 +239,7 @@ static inline value TCONR(value t)
 
 static inline value SCONR(value t, value nv)
 {
-  __arc_wb(((struct vmthread_t *)REP(t))->conr, nv);
+  __arc_rootwb(((struct vmthread_t *)REP(t))->conr, nv);
   ((struct vmthread_t *)REP(t))->conr = nv;
   return(nv);
 }
@@ -222,6 +266,11 @@ static inline value SCONR(value t, value nv)
 #define TACELL(t) (((struct vmthread_t *)REP(t))->atomic_cell)
 #define TRVCH(t) (((struct vmthread_t *)REP(t))->rvch)
 
+#define TRQNEXT(t) (((struct vmthread_t *)REP(t))->rqnext)
+#define TIONEXT(t) (((struct vmthread_t *)REP(t))->iownext)
+#define TTIMERIDX(t) (((struct vmthread_t *)REP(t))->timeridx)
+#define TSCHED(t) (((struct vmthread_t *)REP(t))->sched)
+
 #define TCH(t) (((struct vmthread_t *)REP(t))->conthere)
 #define TBCH(t) (((struct vmthread_t *)REP(t))->baseconthere)
 
@@ -309,6 +358,44 @@ extern value arc_ccmark(arc *c, value key);
 extern value arc_mkthread(arc *c);
 extern void arc_thread_dispatch(arc *c);
 extern value arc_spawn(arc *c, value thunk);
+extern void __arc_wakeup(arc *c, value thr);
+extern value __arc_curthread(arc *c);
+extern void __arc_rtlock(arc *c);
+extern void __arc_rtunlock(arc *c);
+extern void __arc_rtreset(arc *c);
+extern int __arc_rtrelease(arc *c);
+extern void __arc_rtacquire(arc *c, int depth);
+extern void __arc_block(arc *c);
+extern void __arc_unblock(arc *c);
+extern void __arc_objlock(arc *c, value *lk);
+extern void __arc_aff_unlocked(int (*xaff)(arc *, value));
+extern int __arc_ccode_unlocked(arc *c, value cfn);
+
+/* Locks of channels, tables and ports (see __arc_objlock) */
+#ifdef HAVE_SMP
+#define OBJLOCK(c, lk) __arc_objlock((c), &(lk))
+#define OBJUNLOCK(c, lk) __atomic_store_n(&(lk), INT2FIX(0), __ATOMIC_RELEASE)
+#else
+#define OBJLOCK(c, lk)
+#define OBJUNLOCK(c, lk)
+#endif
+
+/* Bracket a system call or other long stretch of C code which touches
+   no values, so that other workers of the SMP dispatcher may run
+   meanwhile and the world may be stopped.  rtd is an int variable to
+   keep the depth of the runtime lock in.  The lock of a port may be
+   taken before BLOCK_BEGIN, to keep its buffer from being changed
+   meanwhile, but it must be let go before BLOCK_END, which takes the
+   runtime lock again. */
+#define BLOCK_BEGIN(c, rtd) do {		\
+    (rtd) = __arc_rtrelease(c);			\
+    __arc_block(c);				\
+  } while (0)
+
+#define BLOCK_END(c, rtd) do {			\
+    __arc_unblock(c);				\
+    __arc_rtacquire((c), (rtd));		\
+  } while (0)
 extern value arc_current_thread(arc *c);
 extern value arc_break_thread(arc *c, value thr);
 extern int arc_kill_thread(arc *c, value thr);
@@ -0,0 +1,269 @@
+/*
+  Copyright (C) 2013 Rafael R. Sevilla
+
+  This file is part of Arcueid
+
+  Arcueid is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Hash table throughput benchmarks.  The first ones fill and read
+   tables from Arc code, using only the core special forms and
+   builtins so that they run without arc.arc.  After them the C
+   interface to hash tables is timed directly, with fixnum and string
+   keys, for both ordinary and Swiss tables.  Run with make bench. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/arcueid.h"
+#include "../src/vmengine.h"
+#include "../src/builtins.h"
+#include "../src/hash.h"
+#include "../src/io.h"
+#include "../src/compiler.h"
+#include "../src/osdep.h"
+#include "../config.h"
+
+extern void __arc_print_string(arc *c, value ppstr);
+
+arc cc;
+arc *c;
+
+#define CPUSH_(val) CPUSH(c->curthread, val)
+
+#define XCALL(fname, ...) do {				\
+    SVALR(c->curthread, arc_mkaff(c, fname, CNIL));	\
+    TARGC(c->curthread) = NARGS(__VA_ARGS__);		\
+    FOR_EACH(CPUSH_, __VA_ARGS__);			\
+    __arc_thr_trampoline(c, c->curthread, TR_FNAPP);	\
+  } while (0)
+
+AFFDEF(compile_something)
+{
+  AARG(something);
+  value sexpr;
+  AVAR(sio);
+  AFBEGIN;
+  WV(sio, arc_instring(c, AV(something), CNIL));
+  AFCALL(arc_mkaff(c, arc_sread, CNIL), AV(sio), CNIL);
+  sexpr = AFCRV;
+  AFTCALL(arc_mkaff(c, arc_compile, CNIL), sexpr, arc_mkcctx(c), CNIL, CTRUE);
+  AFEND;
+}
+AFFEND
+
+/* Functions used by the benchmarks below */
+static const char *defs[] = {
+  /* (fill h i n) binds the keys i to n-1 in h to themselves, and
+     (fills h i n) does the same with the keys as strings */
+  "(assign fill (fn (h i n) (if (is i n) h ((fn () (sref h i i) (fill h (+ i 1) n))))))",
+  "(assign fills (fn (h i n) (if (is i n) h ((fn () (sref h i (coerce i (quote string))) (fills h (+ i 1) n))))))",
+  /* (sumt h i n acc) adds up the values of keys i to n-1 in h, and
+     (sumts h i n acc) does the same with the keys as strings */
+  "(assign sumt (fn (h i n acc) (if (is i n) acc (sumt h (+ i 1) n (+ acc (h i))))))",
+  "(assign sumts (fn (h i n acc) (if (is i n) acc (sumts h (+ i 1) n (+ acc (h (coerce i (quote string))))))))",
+};
+
+static const struct {
+  const char *name;
+  const char *def;
+  const char *run;
+} benchmarks[] = {
+  { "table", "nil", "(len (fill (table) 0 200000))" },
+  { "table", "(assign tf* (fill (table) 0 200000))",
+    "(sumt tf* 0 200000 0)" },
+  { "table", "nil", "(len (fills (table) 0 100000))" },
+  { "table", "(assign ts* (fills (table) 0 100000))",
+    "(sumts ts* 0 100000 0)" },
+  { "swiss", "nil", "(len (fill (swisstable) 0 200000))" },
+  { "swiss", "(assign tf* (fill (swisstable) 0 200000))",
+    "(sumt tf* 0 200000 0)" },
+  { "swiss", "nil", "(len (fills (swisstable) 0 100000))" },
+  { "swiss", "(assign ts* (fills (swisstable) 0 100000))",
+    "(sumts ts* 0 100000 0)" },
+};
+
+/* Compile and run expr to completion on a thread of its own */
+static void run(const char *expr)
+{
+  value cctx, code;
+
+  c->curthread = arc_mkthread(c);
+  TQUANTA(c->curthread) = 65536;
+  XCALL(compile_something, arc_mkstringc(c, expr));
+  cctx = TVALR(c->curthread);
+  code = arc_cctx2code(c, cctx);
+  arc_spawn(c, arc_mkclos(c, code, CNIL));
+  arc_thread_dispatch(c);
+}
+
+/* Number of keys the C interface is timed with, how many times each
+   table is read, and how many keys go through the table in the churn
+   benchmark, which keeps KLIVE of them at a time */
+#define KFIXNUMS (1 << 18)
+#define KSTRINGS (1 << 16)
+#define KREPS 10
+#define KCHURN (1 << 16)
+#define KLIVE (1 << 12)
+
+static const char *engine;
+
+static value mktbl(void)
+{
+  if (engine[0] == 's')
+    return(arc_mkstable(c, ARC_HASHBITS));
+  return(arc_mkhash(c, ARC_HASHBITS));
+}
+
+static void report(const char *name, const char *keys,
+		   unsigned long long t0, long n, long r)
+{
+  char buf[64];
+
+  snprintf(buf, sizeof(buf), "%s %s", name, keys);
+  printf("%-8s %-20s %8llu ms  %6.1f ns/op  => %ld\n", engine, buf,
+	 __arc_milliseconds() - t0,
+	 (double)(__arc_milliseconds() - t0) * 1e6 / n, r);
+}
+
+/* Time insertion, lookup of keys which are and are not there, update
+   and deletion on a table with the n keys in keys.  The keys in
+   misses are not in the table. */
+static void bench_table(const char *name, value keys, value misses, int n)
+{
+  value tbl;
+  int i, j;
+  long r;
+  unsigned long long t0;
+
+  tbl = mktbl();
+  t0 = __arc_milliseconds();
+  for (i=0; i<n; i++)
+    arc_hash_insert(c, tbl, VINDEX(keys, i), INT2FIX(i));
+  report("insert", name, t0, n, arc_hash_length(c, tbl));
+
+  t0 = __arc_milliseconds();
+  for (j=0, r=0; j<KREPS; j++) {
+    /* stride through the keys so that the slots are not visited in
+       the order they were filled */
+    for (i=0; i<n; i++)
+      r += FIX2INT(arc_hash_lookup(c, tbl, VINDEX(keys, (int)(((long)i*7919) % n))));
+  }
+  report("hit", name, t0, (long)n*KREPS, r / KREPS);
+
+  t0 = __arc_milliseconds();
+  for (j=0, r=0; j<KREPS; j++) {
+    for (i=0; i<n; i++)
+      r += !BOUND_P(arc_hash_lookup(c, tbl, VINDEX(misses, i)));
+  }
+  report("miss", name, t0, (long)n*KREPS, r / KREPS);
+
+  t0 = __arc_milliseconds();
+  for (i=0; i<n; i++)
+    arc_hash_insert(c, tbl, VINDEX(keys, i), INT2FIX(i+1));
+  report("update", name, t0, n, arc_hash_length(c, tbl));
+
+  t0 = __arc_milliseconds();
+  for (i=0; i<n; i++)
+    arc_hash_delete(c, tbl, VINDEX(keys, i));
+  report("delete", name, t0, n, arc_hash_length(c, tbl));
+}
+
+/* Like a store of sessions: every new key replaces the oldest of the
+   KLIVE keys in the table, so deletions are as frequent as insertions.
+   The lookups are of the live keys and of keys which have gone. */
+static void bench_churn(void)
+{
+  value tbl;
+  int i;
+  long r;
+  unsigned long long t0;
+
+  tbl = mktbl();
+  for (i=0; i<KLIVE; i++)
+    arc_hash_insert(c, tbl, INT2FIX(i), INT2FIX(i));
+  t0 = __arc_milliseconds();
+  for (i=KLIVE; i<KCHURN; i++) {
+    arc_hash_delete(c, tbl, INT2FIX(i - KLIVE));
+    arc_hash_insert(c, tbl, INT2FIX(i), INT2FIX(i));
+  }
+  report("churn", "fixnum", t0, KCHURN - KLIVE, arc_hash_length(c, tbl));
+
+  t0 = __arc_milliseconds();
+  for (i=KCHURN-2*KLIVE, r=0; i<KCHURN; i++)
+    r += BOUND_P(arc_hash_lookup(c, tbl, INT2FIX(i)));
+  report("churned", "fixnum", t0, 2*KLIVE, r);
+}
+
+static void bench_kernels(void)
+{
+  value keys, misses;
+  int i;
+  char buf[32];
+
+  keys = arc_mkvector(c, KFIXNUMS);
+  misses = arc_mkvector(c, KFIXNUMS);
+  for (i=0; i<KFIXNUMS; i++) {
+    SVINDEX(keys, i, INT2FIX(i));
+    SVINDEX(misses, i, INT2FIX(-i-1));
+  }
+  bench_table("fixnum", keys, misses, KFIXNUMS);
+
+  keys = arc_mkvector(c, KSTRINGS);
+  misses = arc_mkvector(c, KSTRINGS);
+  for (i=0; i<KSTRINGS; i++) {
+    snprintf(buf, sizeof(buf), "session-%08d", i);
+    SVINDEX(keys, i, arc_mkstringc(c, buf));
+    snprintf(buf, sizeof(buf), "missing-%08d", i);
+    SVINDEX(misses, i, arc_mkstringc(c, buf));
+  }
+  bench_table("string", keys, misses, KSTRINGS);
+  bench_churn();
+}
+
+static void errhandler(arc *c, value thr, value str)
+{
+  fprintf(stderr, "Error\n");
+  __arc_print_string(c, str);
+  abort();
+}
+
+int main(void)
+{
+  int i;
+  unsigned long long t0, t1;
+  char buf[1024];
+
+  c = &cc;
+  arc_init(c);
+  c->errhandler = errhandler;
+
+  for (i=0; i<(int)(sizeof(defs)/sizeof(defs[0])); i++)
+    run(defs[i]);
+  for (i=0; i<(int)(sizeof(benchmarks)/sizeof(benchmarks[0])); i++) {
+    run(benchmarks[i].def);
+    snprintf(buf, sizeof(buf), "(assign bench-result* %s)",
+	     benchmarks[i].run);
+    t0 = __arc_milliseconds();
+    run(buf);
+    t1 = __arc_milliseconds();
+    printf("%-8s %-20s %8llu ms  => %ld\n", benchmarks[i].name,
+	   benchmarks[i].run, t1 - t0,
+	   FIX2INT(arc_gbind_cstr(c, "bench-result*")));
+  }
+  engine = "table";
+  bench_kernels();
+  engine = "swiss";
+  bench_kernels();
+  arc_deinit(c);
+  return(EXIT_SUCCESS);
+}
@@ -0,0 +1,124 @@
+/*
+  Copyright (C) 2013 Rafael R. Sevilla
+
+  This file is part of Arcueid
+
+  Arcueid is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Numeric microbenchmarks for the virtual machine.  These only use
+   the core special forms and builtins, so they run without arc.arc.
+   Run with make bench. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/arcueid.h"
+#include "../src/vmengine.h"
+#include "../src/builtins.h"
+#include "../src/io.h"
+#include "../src/compiler.h"
+#include "../src/osdep.h"
+#include "../config.h"
+
+extern void __arc_print_string(arc *c, value ppstr);
+
+arc cc;
+arc *c;
+
+#define CPUSH_(val) CPUSH(c->curthread, val)
+
+#define XCALL(fname, ...) do {				\
+    SVALR(c->curthread, arc_mkaff(c, fname, CNIL));	\
+    TARGC(c->curthread) = NARGS(__VA_ARGS__);		\
+    FOR_EACH(CPUSH_, __VA_ARGS__);			\
+    __arc_thr_trampoline(c, c->curthread, TR_FNAPP);	\
+  } while (0)
+
+AFFDEF(compile_something)
+{
+  AARG(something);
+  value sexpr;
+  AVAR(sio);
+  AFBEGIN;
+  WV(sio, arc_instring(c, AV(something), CNIL));
+  AFCALL(arc_mkaff(c, arc_sread, CNIL), AV(sio), CNIL);
+  sexpr = AFCRV;
+  AFTCALL(arc_mkaff(c, arc_compile, CNIL), sexpr, arc_mkcctx(c), CNIL, CTRUE);
+  AFEND;
+}
+AFFEND
+
+static const struct {
+  const char *name;
+  const char *def;
+  const char *run;
+} benchmarks[] = {
+  { "fib",
+    "(assign fib (fn (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))",
+    "(fib 27)" },
+  { "tak",
+    "(assign tak (fn (x y z) (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z)))",
+    "(tak 22 16 8)" },
+  { "sum",
+    "(assign sum (fn (i acc) (if (is i 0) acc (sum (- i 1) (+ acc i)))))",
+    "(sum 2000000 0)" },
+  { "sumsq",
+    "(assign sumsq (fn (i acc) (if (is i 0) acc (sumsq (- i 1) (+ acc (* i i))))))",
+    "(sumsq 1000000 0)" },
+};
+
+/* Compile and run expr to completion on a thread of its own */
+static void run(const char *expr)
+{
+  value cctx, code;
+
+  c->curthread = arc_mkthread(c);
+  TQUANTA(c->curthread) = 65536;
+  XCALL(compile_something, arc_mkstringc(c, expr));
+  cctx = TVALR(c->curthread);
+  code = arc_cctx2code(c, cctx);
+  arc_spawn(c, arc_mkclos(c, code, CNIL));
+  arc_thread_dispatch(c);
+}
+
+static void errhandler(arc *c, value thr, value str)
+{
+  fprintf(stderr, "Error\n");
+  __arc_print_string(c, str);
+  abort();
+}
+
+int main(void)
+{
+  int i;
+  unsigned long long t0, t1;
+  char buf[1024];
+
+  c = &cc;
+  arc_init(c);
+  c->errhandler = errhandler;
+
+  for (i=0; i<(int)(sizeof(benchmarks)/sizeof(benchmarks[0])); i++) {
+    run(benchmarks[i].def);
+    snprintf(buf, sizeof(buf), "(assign bench-result* %s)",
+	     benchmarks[i].run);
+    t0 = __arc_milliseconds();
+    run(buf);
+    t1 = __arc_milliseconds();
+    printf("%-8s %-20s %8llu ms  => %ld\n", benchmarks[i].name,
+	   benchmarks[i].run, t1 - t0,
+	   FIX2INT(arc_gbind_cstr(c, "bench-result*")));
+  }
+  arc_deinit(c);
+  return(EXIT_SUCCESS);
+}
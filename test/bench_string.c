@@ -0,0 +1,180 @@
+/*
+  Copyright (C) 2013 Rafael R. Sevilla
+
+  This file is part of Arcueid
+
+  Arcueid is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* String microbenchmarks.  Like the numeric ones these only use the
+   core special forms and builtins, so they run without arc.arc.  The
+   tostring benchmarks do by hand what (tostring ...) expands into.
+   After them the search, comparison, hashing and substring functions
+   are timed directly on long strings of each width.  Run with make
+   bench. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/arcueid.h"
+#include "../src/vmengine.h"
+#include "../src/builtins.h"
+#include "../src/hash.h"
+#include "../src/io.h"
+#include "../src/compiler.h"
+#include "../src/osdep.h"
+#include "../config.h"
+
+extern void __arc_print_string(arc *c, value ppstr);
+
+arc cc;
+arc *c;
+
+#define CPUSH_(val) CPUSH(c->curthread, val)
+
+#define XCALL(fname, ...) do {				\
+    SVALR(c->curthread, arc_mkaff(c, fname, CNIL));	\
+    TARGC(c->curthread) = NARGS(__VA_ARGS__);		\
+    FOR_EACH(CPUSH_, __VA_ARGS__);			\
+    __arc_thr_trampoline(c, c->curthread, TR_FNAPP);	\
+  } while (0)
+
+AFFDEF(compile_something)
+{
+  AARG(something);
+  value sexpr;
+  AVAR(sio);
+  AFBEGIN;
+  WV(sio, arc_instring(c, AV(something), CNIL));
+  AFCALL(arc_mkaff(c, arc_sread, CNIL), AV(sio), CNIL);
+  sexpr = AFCRV;
+  AFTCALL(arc_mkaff(c, arc_compile, CNIL), sexpr, arc_mkcctx(c), CNIL, CTRUE);
+  AFEND;
+}
+AFFEND
+
+static const struct {
+  const char *name;
+  const char *def;
+  const char *run;
+} benchmarks[] = {
+  /* 1 MB through an output string port, 16 characters at a time */
+  { "tostring",
+    "(assign wr16 (fn (s i) (if (is i 0) (inside s) ((fn () (disp \"0123456789abcdef\" s) (wr16 s (- i 1)))))))",
+    "(len (wr16 (outstring) 65536))" },
+  /* and a character at a time */
+  { "tostringc",
+    "(assign wr1 (fn (s i) (if (is i 0) (inside s) ((fn () (writec #\\x s) (wr1 s (- i 1)))))))",
+    "(len (wr1 (outstring) 1048576))" },
+};
+
+/* Compile and run expr to completion on a thread of its own */
+static void run(const char *expr)
+{
+  value cctx, code;
+
+  c->curthread = arc_mkthread(c);
+  TQUANTA(c->curthread) = 65536;
+  XCALL(compile_something, arc_mkstringc(c, expr));
+  cctx = TVALR(c->curthread);
+  code = arc_cctx2code(c, cctx);
+  arc_spawn(c, arc_mkclos(c, code, CNIL));
+  arc_thread_dispatch(c);
+}
+
+/* Length of the strings the string functions are timed on, and how
+   many times each is run */
+#define KLEN (1 << 20)
+#define KREPS 100
+
+static void bench_kernels(void)
+{
+  static const struct {
+    const char *name;
+    Rune base;
+  } widths[] = { { "latin1", 'a' }, { "ucs2", 0x3042 }, { "ucs4", 0x1f600 } };
+  value s1, s2;
+  int w, i;
+  long r;
+  unsigned long long t0;
+  char buf[64];
+
+  for (w=0; w<3; w++) {
+    /* two equal strings, with the only occurrence of base+26 at the end */
+    s1 = arc_mkstringlen(c, KLEN);
+    for (i=0; i<KLEN; i++)
+      arc_strsetindex(c, s1, i, widths[w].base + (i % 26));
+    arc_strsetindex(c, s1, KLEN-1, widths[w].base + 26);
+    s2 = arc_substr(c, s1, 0, KLEN);
+
+    t0 = __arc_milliseconds();
+    for (i=0, r=0; i<KREPS; i++)
+      r += FIX2INT(arc_strchr(c, s1, widths[w].base + 26));
+    snprintf(buf, sizeof(buf), "strchr %s", widths[w].name);
+    printf("%-8s %-20s %8llu ms  => %ld\n", "kernel", buf,
+	   __arc_milliseconds() - t0, r / KREPS);
+
+    t0 = __arc_milliseconds();
+    for (i=0, r=0; i<KREPS; i++)
+      r += arc_strcmp(c, s1, s2);
+    snprintf(buf, sizeof(buf), "strcmp %s", widths[w].name);
+    printf("%-8s %-20s %8llu ms  => %ld\n", "kernel", buf,
+	   __arc_milliseconds() - t0, r);
+
+    t0 = __arc_milliseconds();
+    for (i=0, r=0; i<KREPS; i++)
+      r ^= (long)arc_hash(c, s1);
+    snprintf(buf, sizeof(buf), "hash %s", widths[w].name);
+    printf("%-8s %-20s %8llu ms  => %ld\n", "kernel", buf,
+	   __arc_milliseconds() - t0, (long)(arc_hash(c, s1) == arc_hash(c, s2)));
+
+    t0 = __arc_milliseconds();
+    for (i=0, r=0; i<KREPS/10; i++)
+      r += arc_strlen(c, arc_substr(c, s1, 1, KLEN));
+    snprintf(buf, sizeof(buf), "substr %s", widths[w].name);
+    printf("%-8s %-20s %8llu ms  => %ld\n", "kernel", buf,
+	   __arc_milliseconds() - t0, r / (KREPS/10));
+  }
+}
+
+static void errhandler(arc *c, value thr, value str)
+{
+  fprintf(stderr, "Error\n");
+  __arc_print_string(c, str);
+  abort();
+}
+
+int main(void)
+{
+  int i;
+  unsigned long long t0, t1;
+  char buf[1024];
+
+  c = &cc;
+  arc_init(c);
+  c->errhandler = errhandler;
+
+  for (i=0; i<(int)(sizeof(benchmarks)/sizeof(benchmarks[0])); i++) {
+    run(benchmarks[i].def);
+    snprintf(buf, sizeof(buf), "(assign bench-result* %s)",
+	     benchmarks[i].run);
+    t0 = __arc_milliseconds();
+    run(buf);
+    t1 = __arc_milliseconds();
+    printf("%-8s %-20s %8llu ms  => %ld\n", benchmarks[i].name,
+	   benchmarks[i].run, t1 - t0,
+	   FIX2INT(arc_gbind_cstr(c, "bench-result*")));
+  }
+  bench_kernels();
+  arc_deinit(c);
+  return(EXIT_SUCCESS);
+}
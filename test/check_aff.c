@@ -93,6 +93,53 @@ START_TEST(test_aff_doubler)
 }
 END_TEST
 
+/* Calls subtractor twice through the shared AFF object for it */
+AFFDEF(shared_doubler)
+{
+  AARG(a, b);
+  AVAR(first);
+  AFBEGIN;
+
+  AFCALLF(subtractor, AV(a), AV(b));
+  WV(first, AFCRV);
+  AFCALLF(subtractor, AV(a), AV(b));
+  ARETURN(INT2FIX(FIX2INT(AV(first)) + FIX2INT(AFCRV)));
+  AFEND;
+}
+AFFEND
+
+START_TEST(test_aff_shared)
+{
+  value thr, aff;
+  int i;
+
+  /* the same object every time, and a different one for another
+     function */
+  aff = arc_aff(c, subtractor);
+  fail_unless(arc_aff(c, subtractor) == aff);
+  fail_if(arc_aff(c, doubler) == aff);
+
+  /* which can be applied again and again */
+  thr = arc_mkthread(c);
+  for (i=0; i<3; i++) {
+    SVALR(thr, arc_aff(c, subtractor));
+    CPUSH(thr, INT2FIX(10));
+    CPUSH(thr, INT2FIX(i));
+    TARGC(thr) = 2;
+    __arc_thr_trampoline(c, thr, TR_FNAPP);
+    fail_unless(TVALR(thr) == INT2FIX(10 - i));
+  }
+
+  SVALR(thr, arc_aff(c, shared_doubler));
+  CPUSH(thr, INT2FIX(5));
+  CPUSH(thr, INT2FIX(2));
+  TARGC(thr) = 2;
+  __arc_thr_trampoline(c, thr, TR_FNAPP);
+  fail_unless(TVALR(thr) == INT2FIX(6));
+  fail_unless(arc_aff(c, subtractor) == aff);
+}
+END_TEST
+
 int main(void)
 {
   int number_failed;
@@ -106,6 +153,7 @@ int main(void)
   tcase_add_test(tc_aff, test_aff_simple);
   tcase_add_test(tc_aff, test_aff_subtractor);
   tcase_add_test(tc_aff, test_aff_doubler);
+  tcase_add_test(tc_aff, test_aff_shared);
 
   suite_add_tcase(s, tc_aff);
   sr = srunner_create(s);
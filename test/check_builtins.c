@@ -1240,6 +1240,47 @@ START_TEST(test_sref)
 }
 END_TEST
 
+START_TEST(test_gc_stats)
+{
+  value thr, cctx, clos, code, ret, val, entry;
+  static const char *fields[] = {
+    "epochs", "passes", "minors", "quantum", "memory", "gc-usec",
+    "gc-thread-usec", "swept", "freed", "pages-released", "mark-usec",
+    "sweep-usec", "epoch-minors", "minor-swept", "minor-freed",
+    "promoted", "minor-usec"
+  };
+  int i, prev;
+
+  thr = arc_mkthread(c);
+  TEST("(gc-stats)");
+  fail_unless(TYPE(ret) == T_TABLE);
+  for (i=0; i<(int)(sizeof(fields)/sizeof(fields[0])); i++) {
+    val = arc_hash_lookup(c, ret, arc_intern_cstr(c, fields[i]));
+    fail_unless(TYPE(val) == T_FIXNUM || TYPE(val) == T_BIGNUM);
+  }
+  val = arc_hash_lookup(c, ret, arc_intern_cstr(c, "types"));
+  fail_unless(TYPE(val) == T_TABLE);
+  val = arc_hash_lookup(c, val, arc_intern_cstr(c, "cons"));
+  fail_unless(FIXNUM_P(val) && FIX2INT(val) > 0);
+
+  /* (size page-size pages slots used) for each size in use */
+  TEST("(bibop-stats)");
+  fail_unless(TYPE(ret) == T_CONS);
+  for (prev = -1; !NIL_P(ret); ret = cdr(ret)) {
+    entry = car(ret);
+    for (i=0, val=entry; i<5; i++, val=cdr(val))
+      fail_unless(FIXNUM_P(car(val)));
+    fail_unless(NIL_P(val));
+    fail_unless(FIX2INT(car(cdr(cdr(entry)))) > 0);
+    fail_unless(FIX2INT(car(cdr(cdr(cdr(cdr(entry))))))
+		<= FIX2INT(car(cdr(cdr(cdr(entry))))));
+    /* sizes are in ascending order */
+    fail_unless(FIX2INT(car(entry)) > prev);
+    prev = FIX2INT(car(entry));
+  }
+}
+END_TEST
+
 int main(void)
 {
   int number_failed;
@@ -1295,6 +1336,7 @@ int main(void)
   tcase_add_test(tc_bif, test_uniq);
   tcase_add_test(tc_bif, test_ccc);
   tcase_add_test(tc_bif, test_sref);
+  tcase_add_test(tc_bif, test_gc_stats);
 
   suite_add_tcase(s, tc_bif);
   sr = srunner_create(s);
@@ -1,4 +1,4 @@
-/* 
+/*
   Copyright (C) 2013 Rafael R. Sevilla
 
   This file is part of Arcueid
@@ -26,60 +26,80 @@
 #include "../src/arith.h"
 #include "../src/builtins.h"
 #include "../src/vmengine.h"
+#include "../src/hash.h"
+#include "../src/osdep.h"
 #include "../config.h"
 
 arc cc;
 arc *c;
 
-#define MAX_BIBOP 512
+/* The only root is whatever the test puts here, along with the
+   symbol tables and the like if the test created them. */
+static value root = CNIL;
 
-struct mm_ctx {
-  /* The BiBOP free list */
-  Bhdr *bibop_fl[MAX_BIBOP+1];
-  /* The actual BiBOP pages */
-  Bhdr *bibop_pages[MAX_BIBOP+1];
+static void markroots(arc *c)
+{
+  __arc_markprop(c, root);
+  __arc_markprop(c, c->symtable);
+  __arc_markprop(c, c->rsymtable);
+  __arc_markprop(c, c->builtins);
+  __arc_markprop(c, c->typedesc);
+}
+
+/* Count all allocated objects, young or old */
+static int count_objects(void)
+{
+  struct bibop_page *pg;
+  Lhdr *l;
+  Bhdr *h;
+  int i, count = 0;
 
-  /* The allocated list */
-  Bhdr *alloc_head;
-  int nprop;
-};
+  for (i=0; i<=MAX_BIBOP; i++)
+    for (pg = BIBOPPG(c)[i]; pg; pg = pg->next)
+      count += pg->nobj - pg->nfree;
+  for (l = LARGEHEAD(c); l; l = L2NL(l))
+    count++;
+  for (i=0; i<NYOUNG(c); i++) {
+    D2B(h, (void *)YOUNG(c)[i]);
+    if (BLARGEP(h))
+      count++;
+  }
+  return(count);
+}
 
+/* Number of epochs after which an unreachable object is certain to
+   have been swept */
+#define COLLECT_EPOCHS 3
 
-/* Do nothing: root marking is done by individual tests */
-static void markroots(arc *c)
+/* Run the collector until n more epochs have been completed */
+static void gc_epochs(int n)
 {
+  unsigned long long target = MMVAR(c, gcepochs) + n;
+
+  while (MMVAR(c, gcepochs) < target)
+    c->gc(c);
 }
 
 START_TEST(test_gc_cons)
 {
   value r;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
 
   r = cons(c, CNIL, CNIL);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(r) == T_CONS);
   fail_unless(NIL_P(car(r)));
   fail_unless(NIL_P(cdr(r)));
 
-  __arc_markprop(c, r);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
+  root = r;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(r) == T_CONS);
   fail_unless(NIL_P(car(r)));
   fail_unless(NIL_P(cdr(r)));
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
@@ -88,68 +108,46 @@ END_TEST
 START_TEST(test_gc_bignum)
 {
   value bn;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
   char *str;
 
   bn = arc_mkbignuml(c, 0);
   mpz_set_str(REPBNUM(bn), "10000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000", 10);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(bn) == T_BIGNUM);
   str = alloca(mpz_sizeinbase(REPBNUM(bn), 10) + 2);
   mpz_get_str(str, 10, REPBNUM(bn));
   fail_unless(strcmp(str, "10000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000") == 0);
 
-  __arc_markprop(c, bn);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  root = bn;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 1);
   mpz_get_str(str, 10, REPBNUM(bn));
   fail_unless(strcmp(str, "10000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000") == 0);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 START_TEST(test_gc_rational)
 {
   value q;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
 
   q = arc_mkrationall(c, 1, 2);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(q) == T_RATIONAL);
   fail_unless(mpq_cmp_si(REPRAT(q), 1, 2) == 0);
 
-  __arc_markprop(c, q);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  root = q;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(q) == T_RATIONAL);
   fail_unless(mpq_cmp_si(REPRAT(q), 1, 2) == 0);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
@@ -158,343 +156,240 @@ END_TEST
 START_TEST(test_gc_flonum)
 {
   value r;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
 
   r = arc_mkflonum(c, 1.0);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(r) == T_FLONUM);
   fail_unless(REPFLO(r) == 1.0);
 
-  __arc_markprop(c, r);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  root = r;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(r) == T_FLONUM);
   fail_unless(REPFLO(r) == 1.0);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 START_TEST(test_gc_complex)
 {
   value z;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
 
   z = arc_mkcomplex(c, 1.0 + I*2.0);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(z) == T_COMPLEX);
   fail_unless(creal(REPCPX(z)) == 1.0);
   fail_unless(cimag(REPCPX(z)) == 2.0);
 
-  __arc_markprop(c, z);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  root = z;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(z) == T_COMPLEX);
   fail_unless(creal(REPCPX(z)) == 1.0);
   fail_unless(cimag(REPCPX(z)) == 2.0);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 START_TEST(test_gc_char)
 {
   value ch;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
 
+  /* Characters are immediate, and should never allocate anything */
   ch = arc_mkchar(c, 'a');
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  fail_unless(count_objects() == 0);
   fail_unless(TYPE(ch) == T_CHAR);
   fail_unless(arc_char2rune(c, ch) == 'a');
+  fail_unless(arc_mkchar(c, 'a') == ch);
+  fail_unless(arc_char2rune(c, arc_mkchar(c, 0x10ffff)) == 0x10ffff);
 
-  __arc_markprop(c, ch);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  root = ch;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
   fail_unless(TYPE(ch) == T_CHAR);
   fail_unless(arc_char2rune(c, ch) == 'a');
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 START_TEST(test_gc_string)
 {
   value str;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
 
   str = arc_mkstringc(c, "foo");
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(str) == T_STRING);
   fail_unless(arc_strcmp(c, str, arc_mkstringc(c, "foo")) == 0);
 
   /* This should collect the string we created to do
      the comparison! */
-  __arc_markprop(c, str);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  root = str;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(str) == T_STRING);
   fail_unless(arc_strcmp(c, str, arc_mkstringc(c, "foo")) == 0);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
-}
-END_TEST
-
-START_TEST(test_gc_symbol)
-{
-  value sym, conscell;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
-
-  /* This is a bit tricky */
-  c->lastsym = 0;
-  c->symtable = arc_mkwtable(c, ARC_HASHBITS);
-  c->rsymtable = arc_mkwtable(c, ARC_HASHBITS);
-  c->builtins = arc_mkvector(c, BI_last+1);
-  SVINDEX(c->builtins, BI_syms, arc_mkvector(c, S_THE_END));
-  SARC_BUILTIN(c, S_NIL, arc_intern_cstr(c, "nil"));
-  SARC_BUILTIN(c, S_T, arc_intern_cstr(c, "t"));
-
-  /* The above should have produced four items:
-     1. The symbol table
-     2. The reverse symbol table
-     3. The vector for the symbol table data
-     4. The vector for the reverse symbol table
-     5. The builtins vector
-     6. The builtin symbols vector
-     7. The string representation of nil
-     8. The string representation of t
-     9. The hash bucket in symtable for nil
-     10. The hash bucket in rsymtable for nil
-     11. The hash bucket in symtable for t
-     12. The hash bucket in rsymtable for t
-   */
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 12);
-
-  /* Interning a symbol should produce three additional allocated
-     blocks:
-
-     1. The string representation of the symbol
-     2. The hash bucket in the symbol table for it
-     3. The hash bucket in the reverse symbol table for it
-  */
-  sym = arc_intern_cstr(c, "foo");
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 15);
-  fail_unless(TYPE(sym) == T_SYMBOL);
-
-  /* Storing the symbol in a cons brings the total to 16 */
-  conscell = cons(c, sym, CNIL);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 16);
-
-  /* Marking the cons should maintain the symbol */
-  __arc_markprop(c, conscell);
-  __arc_markprop(c, c->symtable);
-  __arc_markprop(c, c->rsymtable);
-  __arc_markprop(c, c->builtins);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 16);
-  fail_unless(TYPE(sym) == T_SYMBOL);
-  /* The symbol's representation should not change */
-  fail_unless(sym == arc_intern_cstr(c, "foo"));
-
-  /* Now, if we do NOT mark the cons cell containing it, that should
-     remove the symbol's buckets from the tables in addition to removing
-     the cons cell, bringing our allocated total down to 12 again. */
-  __arc_markprop(c, c->symtable);
-  __arc_markprop(c, c->rsymtable);
-  __arc_markprop(c, c->builtins);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 12);
-  /* Interning the same string once again should produce a different
-     representation from the old (now invalid) one. */
-  fail_if(sym == arc_intern_cstr(c, "foo"));
-
-  /* new intern of foo should have produced three new items */
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 15);
-
-  /* Marking nothing should clear all the allocated memory completely */
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 START_TEST(test_gc_vector)
 {
   value vec;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count, i;
+  Bhdr *h;
+  int i;
 
   vec = arc_mkvector(c, 10);
   for (i=0; i<10; i++)
     SVINDEX(vec, i, INT2FIX(i));
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(vec) == T_VECTOR);
   for (i=0; i<10; i++)
     fail_unless(VINDEX(vec, i) == INT2FIX(i));
 
-  __arc_markprop(c, vec);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 1);
+  root = vec;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 1);
   fail_unless(TYPE(vec) == T_VECTOR);
   for (i=0; i<10; i++)
     fail_unless(VINDEX(vec, i) == INT2FIX(i));
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
+
+  /* the size of a large object is not limited by the header word */
+  vec = arc_mkvector(c, 100000);
+  D2B(h, (void *)vec);
+  fail_unless(BLARGEP(h));
+  fail_unless(BSIZE(h) >= 100000*sizeof(value));
+  fail_unless(((value)vec & (ALIGN - 1)) == 0);
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
-
 START_TEST(test_gc_table)
 {
   value tbl;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count, i;
+  int i, base;
 
-  /* Making a hash produces two blocks */
   tbl = arc_mkhash(c, ARC_HASHBITS);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 2);
+  base = count_objects();
 
-  /* each one produces an additional block for the hash bucket */
+  /* entries are kept in the table vector, so as long as the table
+     does not have to grow, inserting should allocate nothing */
   for (i=0; i<10; i++)
     arc_hash_insert(c, tbl, INT2FIX(i), INT2FIX(i+1));
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 12);
+  fail_unless(count_objects() == base);
   fail_unless(TYPE(tbl) == T_TABLE);
   for (i=0; i<10; i++)
     fail_unless(arc_hash_lookup(c, tbl, INT2FIX(i)) == INT2FIX(i+1));
 
-  __arc_markprop(c, tbl);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 12);
+  root = tbl;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == base);
   fail_unless(TYPE(tbl) == T_TABLE);
   for (i=0; i<10; i++)
     fail_unless(arc_hash_lookup(c, tbl, INT2FIX(i)) == INT2FIX(i+1));
 
-  /* Try removing the bindings */
+  /* Keys and values which are objects live exactly as long as their
+     entries do */
   for (i=0; i<10; i++)
-    arc_hash_delete(c, tbl, INT2FIX(i));
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 12);
-  fail_unless(TYPE(tbl) == T_TABLE);
+    arc_hash_insert(c, tbl, INT2FIX(i), cons(c, INT2FIX(i), CNIL));
+  fail_unless(count_objects() == base + 10);
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == base + 10);
   for (i=0; i<10; i++)
-    fail_unless(arc_hash_lookup(c, tbl, INT2FIX(i)) == CUNBOUND);
+    fail_unless(car(arc_hash_lookup(c, tbl, INT2FIX(i))) == INT2FIX(i));
 
-  /* garbage collection should remove the dangling buckets */
-  __arc_markprop(c, tbl);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 2);
+  /* Try removing the bindings.  Garbage collection should then
+     remove the values which were in them. */
+  for (i=0; i<10; i++)
+    arc_hash_delete(c, tbl, INT2FIX(i));
   fail_unless(TYPE(tbl) == T_TABLE);
   for (i=0; i<10; i++)
     fail_unless(arc_hash_lookup(c, tbl, INT2FIX(i)) == CUNBOUND);
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == base);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
+}
+END_TEST
+
+START_TEST(test_gc_symbol)
+{
+  value sym, conscell;
+  int base;
+
+  /* This is a bit tricky */
+  c->lastsym = 0;
+  c->symtable = arc_mkwtable(c, ARC_HASHBITS);
+  c->rsymtable = arc_mkwtable(c, ARC_HASHBITS);
+  c->builtins = arc_mkvector(c, BI_last+1);
+  SVINDEX(c->builtins, BI_syms, arc_mkvector(c, S_THE_END));
+  SARC_BUILTIN(c, S_NIL, arc_intern_cstr(c, "nil"));
+  SARC_BUILTIN(c, S_T, arc_intern_cstr(c, "t"));
+  base = count_objects();
+
+  /* Interning a symbol should produce three additional allocated
+     blocks:
+
+     1. The string representation of the symbol
+     2. The hash bucket in the symbol table for it
+     3. The hash bucket in the reverse symbol table for it
+  */
+  sym = arc_intern_cstr(c, "foo");
+  fail_unless(count_objects() == base + 3);
+  fail_unless(TYPE(sym) == T_SYMBOL);
+
+  /* Storing the symbol in a cons brings the total up by one more */
+  conscell = cons(c, sym, CNIL);
+  fail_unless(count_objects() == base + 4);
+
+  /* Marking the cons should maintain the symbol */
+  root = conscell;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == base + 4);
+  fail_unless(TYPE(sym) == T_SYMBOL);
+  /* The symbol's representation should not change */
+  fail_unless(sym == arc_intern_cstr(c, "foo"));
+
+  /* Now, if we do NOT mark the cons cell containing it, that should
+     remove the symbol's buckets from the tables in addition to removing
+     the cons cell. */
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == base);
+  /* Interning the same string once again should produce a different
+     representation from the old (now invalid) one. */
+  fail_if(sym == arc_intern_cstr(c, "foo"));
+  fail_unless(count_objects() == base + 3);
+
+  /* Marking nothing should clear all the allocated memory completely */
+  c->symtable = c->rsymtable = c->builtins = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 START_TEST(test_gc_tagged)
 {
   value tagged;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
+  int base;
 
   /* This is a bit tricky */
   c->lastsym = 0;
@@ -505,27 +400,7 @@ START_TEST(test_gc_tagged)
   SVINDEX(c->builtins, BI_syms, arc_mkvector(c, S_THE_END));
   SARC_BUILTIN(c, S_NIL, arc_intern_cstr(c, "nil"));
   SARC_BUILTIN(c, S_T, arc_intern_cstr(c, "t"));
-
-  /* The above should have produced four items:
-     1. The symbol table
-     2. The reverse symbol table
-     3. The vector for the symbol table data
-     4. The vector for the reverse symbol table
-     5. The builtins vector
-     6. The builtin symbols vector
-     7. The string representation of nil
-     8. The string representation of t
-     9. The hash bucket in symtable for nil
-     10. The hash bucket in rsymtable for nil
-     11. The hash bucket in symtable for t
-     12. The hash bucket in rsymtable for t
-     13. The typedesc hash
-     14. The typedesc hash vector
-   */
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 14);
+  base = count_objects();
 
   /* Annotate created the following objects:
 
@@ -535,73 +410,48 @@ START_TEST(test_gc_tagged)
      4. The bucket in the rsymtable for the tag
   */
   tagged = arc_annotate(c, arc_intern_cstr(c, "tagged"), INT2FIX(3));
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 18);
+  fail_unless(count_objects() == base + 4);
   fail_unless(TYPE(tagged) == T_TAGGED);
   fail_unless(arc_type(c, tagged) == arc_intern_cstr(c, "tagged"));
   fail_unless(arc_rep(c, tagged) == INT2FIX(3));
 
-  __arc_markprop(c, tagged);
-  __arc_markprop(c, c->symtable);
-  __arc_markprop(c, c->rsymtable);
-  __arc_markprop(c, c->builtins);
-  __arc_markprop(c, c->typedesc);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 18);
+  root = tagged;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == base + 4);
   fail_unless(TYPE(tagged) == T_TAGGED);
   fail_unless(arc_type(c, tagged) == arc_intern_cstr(c, "tagged"));
   fail_unless(arc_rep(c, tagged) == INT2FIX(3));
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  c->symtable = c->rsymtable = c->builtins = c->typedesc = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 START_TEST(test_gc_fn_ff)
 {
   value fn;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count;
 
   fn = arc_mkaff(c, arc_iso, arc_mkstringc(c, "iso"));
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 2);
+  fail_unless(count_objects() == 2);
   fail_unless(TYPE(fn) == T_CCODE);
 
-
-  __arc_markprop(c, fn);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 2);
+  root = fn;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 2);
   fail_unless(TYPE(fn) == T_CCODE);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 START_TEST(test_gc_fn)
 {
   value cctx, code;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count, lptr;
+  int lptr;
 
   cctx = arc_mkcctx(c);
   lptr = arc_literal(c, cctx, arc_mkflonum(c, 3.1415926535));
@@ -616,56 +466,151 @@ START_TEST(test_gc_fn)
 
      Everything else involved in making it should have become garbage.
   */
-  __arc_markprop(c, code);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 3);
+  root = code;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 3);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
 }
 END_TEST
 
 #define NUM_CONSES 256
 
+#ifdef HAVE_GC_THREAD
+
+/* A mutator which never gives the heap to the collector thread still
+   has to collect incrementally by itself. */
+START_TEST(test_gc_thread_busy)
+{
+  value r;
+
+  fail_unless(arc_gc_thread(c, CTRUE) == CTRUE);
+  r = cons(c, CNIL, CNIL);
+  root = r;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 1);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
+  fail_unless(NIL_P(arc_gc_thread(c, CNIL)));
+}
+END_TEST
+
+#endif
+
+/* Run the collector until it has done a minor collection */
+static void gc_minor(void)
+{
+  unsigned long long target = MMVAR(c, minors) + 1;
+
+  while (MMVAR(c, minors) < target)
+    c->gc(c);
+}
+
+/* Young objects reachable only through old objects, stored there with
+   scar and SVINDEX, must be remembered by the write barrier and so
+   survive a minor collection. */
+START_TEST(test_gc_old_to_young)
+{
+  value old, young1, young2;
+
+  root = cons(c, arc_mkvector(c, 2), CNIL);
+  gc_minor();
+  fail_unless(count_objects() == 2);
+
+  /* the garbage shows that a minor collection really happened */
+  cons(c, CNIL, CNIL);
+  young1 = cons(c, INT2FIX(1), CNIL);
+  young2 = cons(c, INT2FIX(2), CNIL);
+  scdr(root, young1);
+  old = car(root);
+  SVINDEX(old, 0, young2);
+  fail_unless(count_objects() == 5);
+  gc_minor();
+  fail_unless(count_objects() == 4);
+  fail_unless(cdr(root) == young1);
+  fail_unless(car(young1) == INT2FIX(1));
+  fail_unless(VINDEX(old, 0) == young2);
+  fail_unless(car(young2) == INT2FIX(2));
+
+  /* they are old now, and survive full collections too */
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 4);
+  fail_unless(car(cdr(root)) == INT2FIX(1));
+  fail_unless(car(VINDEX(car(root), 0)) == INT2FIX(2));
+
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
+}
+END_TEST
+
 START_TEST(test_gc_lots_of_conses)
 {
   value list;
-  struct mm_ctx *mmctx = (struct mm_ctx *)c->alloc_ctx;
-  Bhdr *ptr;
-  int count, i;
+  int i;
 
   list = CNIL;
   for (i=0; i<NUM_CONSES; i++)
     list = cons(c, INT2FIX(i), list);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == NUM_CONSES);
+  fail_unless(count_objects() == NUM_CONSES);
 
-  __arc_markprop(c, list);
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == NUM_CONSES);
+  root = list;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == NUM_CONSES);
 
-  c->gc(c);
-  count = 0;
-  for (ptr = mmctx->alloc_head; ptr; ptr = B2NB(ptr))
-    count++;
-  fail_unless(count == 0);
+  root = CNIL;
+  gc_epochs(COLLECT_EPOCHS);
+  fail_unless(count_objects() == 0);
   /* The BiBOP page lists should also be emptied by this operation */
   for (i=0; i<=MAX_BIBOP; i++)
-    fail_unless(mmctx->bibop_pages[i] == NULL);
+    fail_unless(BIBOPPG(c)[i] == NULL);
 }
 END_TEST
 
+/* Benchmark: the time and number of epochs needed to mark a very long
+   list.  Marking uses an explicit mark stack, so each epoch should
+   take only a small, fixed number of passes over the heap no matter
+   how long the list is. */
+#define MARK_LIST_LENGTH 10000000
+
+START_TEST(test_gc_mark_long_list)
+{
+  value list, p;
+  unsigned long long epochs, passes, start, elapsed;
+  int i, ncalls;
+
+  list = CNIL;
+  for (i=0; i<MARK_LIST_LENGTH; i++)
+    list = cons(c, INT2FIX(i), list);
+  root = list;
+  /* promote the list out of the nursery before timing */
+  gc_epochs(1);
+
+  epochs = MMVAR(c, gcepochs);
+  passes = MMVAR(c, gcpasses);
+  start = __arc_milliseconds();
+  ncalls = 0;
+  /* the list is marked in full during the second of these */
+  while (MMVAR(c, gcepochs) < epochs + 2) {
+    c->gc(c);
+    ncalls++;
+  }
+  elapsed = __arc_milliseconds() - start;
+  printf("marked %d-element list: %llu epochs, %llu passes, %d collector calls, %llu ms\n",
+	 MARK_LIST_LENGTH, MMVAR(c, gcepochs) - epochs,
+	 MMVAR(c, gcpasses) - passes, ncalls, elapsed);
+  fail_unless(MMVAR(c, gcpasses) - passes <= 8);
+
+  i = MARK_LIST_LENGTH;
+  for (p = list; !NIL_P(p); p = cdr(p))
+    fail_unless(car(p) == INT2FIX(--i));
+  fail_unless(i == 0);
+  fail_unless(count_objects() == MARK_LIST_LENGTH);
+}
+END_TEST
 
 int main(void)
 {
@@ -677,6 +622,8 @@ int main(void)
   c = &cc;
   arc_init_memmgr(c);
   arc_init_datatypes(c);
+  c->symtable = c->rsymtable = c->builtins = c->typedesc = CNIL;
+  c->ctrue = (value)2;	/* stand-in for CTRUE, as in arc_init */
   c->markroots = markroots;
 
   tcase_add_test(tc_gc, test_gc_cons);
@@ -689,14 +636,20 @@ int main(void)
 
   tcase_add_test(tc_gc, test_gc_char);
   tcase_add_test(tc_gc, test_gc_string);
-  tcase_add_test(tc_gc, test_gc_symbol);
   tcase_add_test(tc_gc, test_gc_vector);
   tcase_add_test(tc_gc, test_gc_table);
+  tcase_add_test(tc_gc, test_gc_symbol);
   tcase_add_test(tc_gc, test_gc_tagged);
   tcase_add_test(tc_gc, test_gc_fn_ff);
   tcase_add_test(tc_gc, test_gc_fn);
 
+  tcase_add_test(tc_gc, test_gc_old_to_young);
+#ifdef HAVE_GC_THREAD
+  tcase_add_test(tc_gc, test_gc_thread_busy);
+#endif
   tcase_add_test(tc_gc, test_gc_lots_of_conses);
+  tcase_add_test(tc_gc, test_gc_mark_long_list);
+  tcase_set_timeout(tc_gc, 600);
 
   suite_add_tcase(s, tc_gc);
   sr = srunner_create(s);
@@ -189,6 +189,130 @@ START_TEST(test_hash_expansion)
 }
 END_TEST
 
+START_TEST(test_hash_swiss)
+{
+  value hash, thr, key;
+  int i, j;
+
+  thr = arc_mkthread(c);
+  hash = arc_mkstable(c, 2);
+  for (i=0; i<EXPANSION_LIMIT; i++)
+    arc_hash_insert(c, hash, INT2FIX(i), INT2FIX(i+1));
+  for (i=0; i<EXPANSION_LIMIT; i++)
+    fail_unless(arc_hash_lookup(c, hash, INT2FIX(i)) == INT2FIX(i+1));
+  fail_unless(arc_hash_length(c, hash) == EXPANSION_LIMIT);
+
+  /* delete the odd keys, and put them back */
+  for (i=1; i<EXPANSION_LIMIT; i+=2)
+    fail_unless(arc_hash_delete(c, hash, INT2FIX(i)) == INT2FIX(i+1));
+  fail_unless(arc_hash_length(c, hash) == EXPANSION_LIMIT/2);
+  for (i=0; i<EXPANSION_LIMIT; i++)
+    fail_unless(arc_hash_lookup(c, hash, INT2FIX(i))
+		== ((i & 1) ? CUNBOUND : INT2FIX(i+1)));
+  for (i=1; i<EXPANSION_LIMIT; i+=2)
+    arc_hash_insert(c, hash, INT2FIX(i), INT2FIX(i));
+  for (i=0; i<EXPANSION_LIMIT; i++)
+    fail_unless(arc_hash_lookup(c, hash, INT2FIX(i))
+		== INT2FIX((i & 1) ? i : i+1));
+
+  /* A table whose keys keep changing, leaving tombstones behind, must
+     still find all of its keys */
+  hash = arc_mkstable(c, 6);
+  for (j=0; j<64; j++) {
+    for (i=0; i<32; i++)
+      arc_hash_insert(c, hash, INT2FIX(j*32 + i), INT2FIX(i));
+    for (i=0; i<32; i++)
+      fail_unless(arc_hash_lookup(c, hash, INT2FIX(j*32 + i)) == INT2FIX(i));
+    for (i=0; i<32; i++)
+      arc_hash_delete(c, hash, INT2FIX(j*32 + i));
+  }
+  fail_unless(arc_hash_length(c, hash) == 0);
+
+  /* keys which are compared with iso */
+  key = cons(c, INT2FIX(1), cons(c, arc_mkstringc(c, "foo"), CNIL));
+  XCALL(arc_xhash_insert, hash, key, INT2FIX(24));
+  XCALL(arc_xhash_lookup, hash,
+	cons(c, INT2FIX(1), cons(c, arc_mkstringc(c, "foo"), CNIL)));
+  fail_unless(TVALR(thr) == INT2FIX(24));
+  XCALL(arc_xhash_delete, hash, key);
+  fail_unless(TVALR(thr) == INT2FIX(24));
+  XCALL(arc_xhash_lookup, hash, key);
+  fail_unless(TVALR(thr) == CUNBOUND);
+}
+END_TEST
+
+/* Keys of a custom type which all hash the same, counting how many
+   times they are hashed */
+static int nhashes;
+
+static unsigned long clash_hash(arc *c, value v, arc_hs *s)
+{
+  nhashes++;
+  arc_hash_update(s, 42);
+  return(1);
+}
+
+static value clash_iscmp(arc *c, value v1, value v2)
+{
+  return((*(int *)REP(v1) == *(int *)REP(v2)) ? CTRUE : CNIL);
+}
+
+static typefn_t clash_typefn = {
+  __arc_null_marker,
+  __arc_null_sweeper,
+  NULL,
+  clash_hash,
+  clash_iscmp,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+static value mkclash(arc *c, int n)
+{
+  value v;
+
+  v = arc_mkobject(c, sizeof(int), T_CUSTOM);
+  *(int *)REP(v) = n;
+  return(v);
+}
+
+#define NCLASH 40
+
+static void clash_keys(value hash)
+{
+  value thr;
+  int i;
+
+  thr = arc_mkthread(c);
+  nhashes = 0;
+  for (i=0; i<NCLASH; i++)
+    XCALL(arc_xhash_insert, hash, mkclash(c, i), INT2FIX(i));
+  fail_unless(nhashes == NCLASH);
+  fail_unless(arc_hash_length(c, hash) == NCLASH);
+  for (i=0; i<NCLASH; i++) {
+    XCALL(arc_xhash_lookup, hash, mkclash(c, i));
+    fail_unless(TVALR(thr) == INT2FIX(i));
+  }
+  /* inserting them again replaces what they are bound to */
+  for (i=0; i<NCLASH; i++)
+    XCALL(arc_xhash_insert, hash, mkclash(c, i), INT2FIX(i+1));
+  fail_unless(arc_hash_length(c, hash) == NCLASH);
+  for (i=0; i<NCLASH; i++) {
+    XCALL(arc_xhash_lookup, hash, mkclash(c, i));
+    fail_unless(TVALR(thr) == INT2FIX(i+1));
+  }
+}
+
+START_TEST(test_hash_collisions)
+{
+  c->typefns[T_CUSTOM] = &clash_typefn;
+  clash_keys(arc_mkhash(c, 2));
+  clash_keys(arc_mkstable(c, 2));
+}
+END_TEST
+
 int main(void)
 {
   int number_failed;
@@ -204,6 +328,8 @@ int main(void)
   tcase_add_test(tc_hash, test_hash_vector_keys);
   tcase_add_test(tc_hash, test_hash_hash_keys);
   tcase_add_test(tc_hash, test_hash_expansion);
+  tcase_add_test(tc_hash, test_hash_swiss);
+  tcase_add_test(tc_hash, test_hash_collisions);
 
   suite_add_tcase(s, tc_hash);
   sr = srunner_create(s);
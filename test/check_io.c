@@ -17,6 +17,13 @@
   along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 #include <check.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "../src/arcueid.h"
 #include "../src/vmengine.h"
 #include "../src/io.h"
@@ -165,6 +172,375 @@ START_TEST(test_fio_readc)
 }
 END_TEST
 
+START_TEST(test_fio_readline)
+{
+  value thr, fio, ret;
+  int i, j, k;
+
+  thr = arc_mkthread(c);
+  XCALL(arc_infile, arc_mkstringc(c, "./rfile.txt"));
+  fio = ret;
+  fail_if(fio == CNIL);
+  for (i=0, j=0;; i++) {
+    XCALL(arc_readline, fio);
+    if (NIL_P(ret))
+      break;
+    fail_unless(TYPE(ret) == T_STRING);
+    for (k=0; codes[j] != 0x0a; j++, k++)
+      fail_unless(arc_strindex(c, ret, k) == codes[j]);
+    fail_unless(arc_strlen(c, ret) == k);
+    j++;
+  }
+  fail_unless(i == 3);
+
+  /* the offset does not include what is still in the read buffer */
+  XCALL(arc_seek, fio, INT2FIX(0));
+  XCALL(arc_readline, fio);
+  fail_unless(arc_strlen(c, ret) == 12);
+  XCALL(arc_tell, fio);
+  fail_unless(FIX2INT(ret) == 13);
+  XCALL(arc_readb, fio);
+  fail_unless(FIX2INT(ret) == bytevals[13]);
+  XCALL(arc_seek, fio, INT2FIX(-2), INT2FIX(SEEK_CUR));
+  XCALL(arc_readc, fio);
+  fail_unless(arc_char2rune(c, ret) == 0x0a);
+  XCALL(arc_close, fio);
+}
+END_TEST
+
+/* U+0080 decodes to the same value as Runeerror, so it must not be
+   taken for the end of what is in the read buffer */
+START_TEST(test_fio_read_u0080)
+{
+  value thr, fio, ret;
+  FILE *fp;
+  static const Rune u0080[] = { 'a', 0x80, 'b', '\n' };
+  int i;
+
+  fp = fopen("./u0080.txt", "w");
+  fputs("a\xc2\x80" "b\n", fp);
+  fclose(fp);
+  thr = arc_mkthread(c);
+  XCALL(arc_infile, arc_mkstringc(c, "./u0080.txt"));
+  fio = ret;
+  for (i=0; i<4; i++) {
+    XCALL(arc_readc, fio);
+    fail_unless(arc_char2rune(c, ret) == u0080[i]);
+  }
+  XCALL(arc_readc, fio);
+  fail_unless(NIL_P(ret));
+  XCALL(arc_close, fio);
+
+  XCALL(arc_infile, arc_mkstringc(c, "./u0080.txt"));
+  fio = ret;
+  XCALL(arc_readline, fio);
+  fail_unless(arc_strlen(c, ret) == 3);
+  for (i=0; i<3; i++)
+    fail_unless(arc_strindex(c, ret, i) == u0080[i]);
+  XCALL(arc_readline, fio);
+  fail_unless(NIL_P(ret));
+  XCALL(arc_close, fio);
+  unlink("./u0080.txt");
+}
+END_TEST
+
+/* A line much longer than the read buffer, with a wide character
+   only near its end */
+START_TEST(test_fio_readline_long)
+{
+  value thr, fio, ret;
+  FILE *fp;
+  int i;
+
+  fp = fopen("./longline.txt", "w");
+  for (i=0; i<100000; i++)
+    fputc('a' + i % 26, fp);
+  fputs("\xe2\x82\xac\nxy\n", fp);
+  fclose(fp);
+  thr = arc_mkthread(c);
+  XCALL(arc_infile, arc_mkstringc(c, "./longline.txt"));
+  fio = ret;
+  XCALL(arc_readline, fio);
+  fail_unless(arc_strlen(c, ret) == 100001);
+  for (i=0; i<100000; i++)
+    fail_unless(arc_strindex(c, ret, i) == 'a' + i % 26);
+  fail_unless(arc_strindex(c, ret, 100000) == 0x20ac);
+  XCALL(arc_readline, fio);
+  fail_unless(arc_strlen(c, ret) == 2);
+  fail_unless(arc_strindex(c, ret, 1) == 'y');
+  XCALL(arc_readline, fio);
+  fail_unless(NIL_P(ret));
+  XCALL(arc_close, fio);
+  unlink("./longline.txt");
+}
+END_TEST
+
+START_TEST(test_fio_readbytes)
+{
+  value thr, fio, ret;
+  int i;
+
+  thr = arc_mkthread(c);
+  XCALL(arc_infile, arc_mkstringc(c, "./rfile.txt"));
+  fio = ret;
+  fail_if(fio == CNIL);
+  XCALL(arc_readbytes, INT2FIX(5), fio);
+  fail_unless(TYPE(ret) == T_VECTOR);
+  fail_unless(VECLEN(ret) == 5);
+  for (i=0; i<5; i++)
+    fail_unless(FIX2INT(XVINDEX(ret, i)) == bytevals[i]);
+  XCALL(arc_readbytes, INT2FIX(65536), fio);
+  fail_unless(VECLEN(ret) == sizeof(bytevals) - 5);
+  for (i=0; i<VECLEN(ret); i++)
+    fail_unless(FIX2INT(XVINDEX(ret, i)) == bytevals[i+5]);
+  XCALL(arc_readbytes, INT2FIX(1), fio);
+  fail_unless(NIL_P(ret));
+  XCALL(arc_close, fio);
+
+  /* a character put back is read as the bytes that encode it */
+  XCALL(arc_infile, arc_mkstringc(c, "./rfile.txt"));
+  fio = ret;
+  XCALL(arc_readline, fio);
+  XCALL(arc_readc, fio);
+  fail_unless(arc_char2rune(c, ret) == codes[13]);
+  XCALL(arc_ungetc, ret, fio);
+  XCALL(arc_readbytes, INT2FIX(1), fio);
+  fail_unless(VECLEN(ret) == 1);
+  fail_unless(FIX2INT(XVINDEX(ret, 0)) == bytevals[13]);
+  XCALL(arc_readbytes, INT2FIX(3), fio);
+  fail_unless(VECLEN(ret) == 3);
+  for (i=0; i<3; i++)
+    fail_unless(FIX2INT(XVINDEX(ret, i)) == bytevals[i+14]);
+  XCALL(arc_close, fio);
+}
+END_TEST
+
+START_TEST(test_fio_copy_port)
+{
+  value thr, fio, out, ret;
+  int i;
+
+  thr = arc_mkthread(c);
+  XCALL(arc_infile, arc_mkstringc(c, "./rfile.txt"));
+  fio = ret;
+  XCALL(arc_readb, fio);
+  XCALL(arc_outfile, arc_mkstringc(c, "./cfile.txt"));
+  out = ret;
+  XCALL(arc_copy_port, fio, out);
+  fail_unless(FIX2INT(ret) == sizeof(bytevals) - 1);
+  XCALL(arc_close, fio);
+  XCALL(arc_close, out);
+  XCALL(arc_infile, arc_mkstringc(c, "./cfile.txt"));
+  fio = ret;
+  XCALL(arc_readbytes, INT2FIX(65536), fio);
+  fail_unless(VECLEN(ret) == sizeof(bytevals) - 1);
+  for (i=0; i<VECLEN(ret); i++)
+    fail_unless(FIX2INT(XVINDEX(ret, i)) == bytevals[i+1]);
+  XCALL(arc_close, fio);
+  unlink("./cfile.txt");
+
+  /* string ports are copied without the kernel */
+  XCALL(arc_infile, arc_mkstringc(c, "./rfile.txt"));
+  fio = ret;
+  out = arc_outstring(c, CNIL);
+  XCALL(arc_copy_port, fio, out, INT2FIX(3));
+  fail_unless(FIX2INT(ret) == 3);
+  XCALL(arc_readb, fio);
+  fail_unless(FIX2INT(ret) == bytevals[3]);
+
+  /* a character put back is copied as the bytes that encode it,
+     even when only some of them are wanted */
+  XCALL(arc_readc, fio);
+  XCALL(arc_ungetc, arc_mkchar(c, codes[13]), fio);
+  out = arc_outstring(c, CNIL);
+  XCALL(arc_copy_port, fio, out, INT2FIX(1));
+  fail_unless(FIX2INT(ret) == 1);
+  fail_unless(arc_strindex(c, arc_inside(c, out), 0) == bytevals[13]);
+  XCALL(arc_readb, fio);
+  fail_unless(FIX2INT(ret) == bytevals[14]);
+  XCALL(arc_readb, fio);
+  fail_unless(FIX2INT(ret) == bytevals[5]);
+  XCALL(arc_close, fio);
+
+  /* the characters of a string port are copied UTF-8 encoded, and
+     none is split by the byte count */
+  fio = arc_instring(c, arc_mkstring(c, codes + 13, 15), CNIL);
+  XCALL(arc_outfile, arc_mkstringc(c, "./cfile.txt"));
+  out = ret;
+  XCALL(arc_copy_port, fio, out, INT2FIX(3));
+  fail_unless(FIX2INT(ret) == 2);
+  XCALL(arc_readc, fio);
+  fail_unless(arc_char2rune(c, ret) == codes[14]);
+  XCALL(arc_copy_port, fio, out);
+  fail_unless(FIX2INT(ret) == 24);
+  XCALL(arc_close, out);
+  XCALL(arc_infile, arc_mkstringc(c, "./cfile.txt"));
+  fio = ret;
+  XCALL(arc_readbytes, INT2FIX(65536), fio);
+  fail_unless(VECLEN(ret) == 26);
+  for (i=0; i<2; i++)
+    fail_unless(FIX2INT(XVINDEX(ret, i)) == bytevals[i+13]);
+  for (i=2; i<VECLEN(ret); i++)
+    fail_unless(FIX2INT(XVINDEX(ret, i)) == bytevals[i+15]);
+  XCALL(arc_close, fio);
+  unlink("./cfile.txt");
+}
+END_TEST
+
+START_TEST(test_sio_readstring)
+{
+  value thr, sio, ret;
+  int i;
+
+  thr = arc_mkthread(c);
+  sio = arc_instring(c, arc_mkstring(c, codes, sizeof(codes)/sizeof(Rune)),
+		     CNIL);
+  XCALL(arc_readstring, INT2FIX(13), sio);
+  fail_unless(TYPE(ret) == T_STRING);
+  fail_unless(arc_strlen(c, ret) == 13);
+  for (i=0; i<13; i++)
+    fail_unless(arc_strindex(c, ret, i) == codes[i]);
+  XCALL(arc_readstring, INT2FIX(1000), sio);
+  fail_unless(arc_strlen(c, ret) == sizeof(codes)/sizeof(Rune) - 13);
+  XCALL(arc_readstring, INT2FIX(1), sio);
+  fail_unless(NIL_P(ret));
+
+  sio = arc_outstring(c, CNIL);
+  XCALL(arc_writebytes, arc_mkvector(c, 0), sio);
+  ret = arc_mkvector(c, 3);
+  for (i=0; i<3; i++)
+    XVINDEX(ret, i) = INT2FIX(codes[i]);
+  XCALL(arc_writebytes, ret, sio);
+  ret = arc_inside(c, sio);
+  fail_unless(arc_strlen(c, ret) == 3);
+  for (i=0; i<3; i++)
+    fail_unless(arc_strindex(c, ret, i) == codes[i]);
+}
+END_TEST
+
+START_TEST(test_sio_outstring)
+{
+  value thr, sio, ret, str;
+  int i;
+
+  thr = arc_mkthread(c);
+  sio = arc_outstring(c, CNIL);
+  for (i=0; i<1000; i++)
+    XCALL(arc_writec, arc_mkchar(c, codes[i % 3]), sio);
+  str = arc_inside(c, sio);
+  fail_unless(arc_strlen(c, str) == 1000);
+  for (i=0; i<1000; i++)
+    fail_unless(arc_strindex(c, str, i) == codes[i % 3]);
+  fail_unless(arc_inside(c, sio) == str);
+  /* writing more leaves what inside returned before alone */
+  XCALL(arc_writec, arc_mkchar(c, codes[3]), sio);
+  fail_unless(arc_strlen(c, str) == 1000);
+  ret = arc_inside(c, sio);
+  fail_unless(arc_strlen(c, ret) == 1001);
+  fail_unless(arc_strindex(c, ret, 1000) == codes[3]);
+}
+END_TEST
+
+/* A client on the loopback interface trickles a line to a thread
+   reading from a socket, while another thread keeps counting.  The
+   socket listens on whatever port the system gives it. */
+static int trickle_count, trickle_done, trickle_ok;
+
+static AFFDEF(trickle_reader)
+{
+  AVAR(conn);
+  value line;
+  AFBEGIN;
+  AFCALL(arc_mkaff(c, arc_socket_accept, CNIL),
+	 arc_gbind_cstr(c, "trickle-sock"));
+  /* keep the output port too, as sweeping it closes the socket */
+  WV(conn, AFCRV);
+  AFCALL(arc_mkaff(c, arc_readline, CNIL), car(AV(conn)));
+  line = AFCRV;
+  trickle_ok = (TYPE(line) == T_STRING && arc_strlen(c, line) == 5
+		&& arc_strindex(c, line, 0) == 'h'
+		&& arc_strindex(c, line, 4) == 'o');
+  trickle_done = 1;
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+static AFFDEF(trickle_counter)
+{
+  AFBEGIN;
+  while (!trickle_done) {
+    trickle_count++;
+    AYIELD();
+  }
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+static void trickle_client(int port)
+{
+  struct sockaddr_in sa;
+  int fd, i;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  for (i=0; connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0; i++) {
+    if (i > 100)
+      _exit(1);
+    usleep(10000);
+  }
+  if (write(fd, "hel", 3) != 3)
+    _exit(1);
+  usleep(100000);
+  if (write(fd, "lo\n", 3) != 3)
+    _exit(1);
+  close(fd);
+  _exit(0);
+}
+
+START_TEST(test_sock_trickle)
+{
+  value thr, ret, sock;
+  pid_t pid;
+  struct sockaddr_storage ss;
+  socklen_t sslen = sizeof(ss);
+  int port;
+
+  thr = arc_mkthread(c);
+  XCALL(arc_open_socket, INT2FIX(0));
+  fail_unless(TYPE(ret) == T_INPORT);
+  sock = ret;
+  arc_bindcstr(c, "trickle-sock", sock);
+  SVALR(thr, VINDEX(IO(sock)->io_ops, IO_fd));
+  TARGC(thr) = 1;
+  CPUSH(thr, sock);
+  __arc_thr_trampoline(c, thr, TR_FNAPP);
+  fail_unless(getsockname(FIX2INT(TVALR(thr)), (struct sockaddr *)&ss,
+			  &sslen) == 0);
+  if (ss.ss_family == AF_INET6)
+    port = ntohs(((struct sockaddr_in6 *)&ss)->sin6_port);
+  else
+    port = ntohs(((struct sockaddr_in *)&ss)->sin_port);
+  fail_unless(port > 0);
+  pid = fork();
+  fail_if(pid < 0);
+  if (pid == 0)
+    trickle_client(port);
+  arc_spawn(c, arc_mkaff(c, trickle_reader, CNIL));
+  arc_spawn(c, arc_mkaff(c, trickle_counter, CNIL));
+  arc_thread_dispatch(c);
+  waitpid(pid, NULL, 0);
+  fail_unless(trickle_done);
+  fail_unless(trickle_ok);
+  /* the counter kept running while the reader was waiting */
+  fail_unless(trickle_count > 100);
+}
+END_TEST
+
 int main(void)
 {
   int number_failed;
@@ -179,6 +555,14 @@ int main(void)
   tcase_add_test(tc_io, test_sio_readc);
   tcase_add_test(tc_io, test_fio_readb);
   tcase_add_test(tc_io, test_fio_readc);
+  tcase_add_test(tc_io, test_fio_readline);
+  tcase_add_test(tc_io, test_fio_readline_long);
+  tcase_add_test(tc_io, test_fio_read_u0080);
+  tcase_add_test(tc_io, test_fio_readbytes);
+  tcase_add_test(tc_io, test_fio_copy_port);
+  tcase_add_test(tc_io, test_sio_readstring);
+  tcase_add_test(tc_io, test_sio_outstring);
+  tcase_add_test(tc_io, test_sock_trickle);
 
   suite_add_tcase(s, tc_io);
   sr = srunner_create(s);
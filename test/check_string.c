@@ -22,6 +22,7 @@
 #include <math.h>
 #include <stdio.h>
 #include "../src/arcueid.h"
+#include "../src/hash.h"
 #include "../config.h"
 
 #ifdef HAVE_ALLOCA_H
@@ -86,6 +87,71 @@ START_TEST(test_compare_strings)
 }
 END_TEST
 
+START_TEST(test_string_widths)
+{
+  value str1, str2;
+  Rune runes[] = { 0x1f600, 0xe9, 0x3042 };
+  int i;
+
+  /* a Latin-1 string widens as wider characters are stored in it */
+  str1 = arc_mkstringc(c, "abc");
+  arc_strsetindex(c, str1, 1, 0xe9);
+  fail_unless(arc_strindex(c, str1, 1) == 0xe9);
+  arc_strsetindex(c, str1, 2, 0x3042);
+  arc_strsetindex(c, str1, 0, 0x1f600);
+  fail_unless(arc_strlen(c, str1) == 3);
+  for (i=0; i<3; i++)
+    fail_unless(arc_strindex(c, str1, i) == runes[i]);
+  fail_unless(FIX2INT(arc_strutflen(c, str1)) == 9);
+  fail_unless(arc_strchr(c, str1, 0x3042) == INT2FIX(2));
+  fail_unless(NIL_P(arc_strchr(c, str1, 'a')));
+
+  /* strings are equal whatever their width */
+  str2 = arc_mkstring(c, runes, 3);
+  fail_unless(arc_strcmp(c, str1, str2) == 0);
+  fail_unless(arc_hash(c, str1) == arc_hash(c, str2));
+  str1 = arc_mkstringc(c, "caf\xc3\xa9");
+  str2 = arc_strcat(c, arc_mkstringc(c, "caf"), arc_mkstringc(c, "\xc3\xa9"));
+  fail_unless(arc_strcmp(c, str1, str2) == 0);
+  str2 = arc_mkstringc(c, "caf");
+  arc_strsetindex(c, str2, 0, 0x3042);
+  fail_unless(arc_strcmp(c, str1, str2) < 0);
+  fail_unless(arc_strcmp(c, arc_substr(c, str2, 1, 3),
+			 arc_substr(c, str1, 1, 3)) == 0);
+  fail_unless(arc_hash(c, arc_substr(c, str2, 1, 3))
+	      == arc_hash(c, arc_substr(c, str1, 1, 3)));
+}
+END_TEST
+
+/* Long enough for the vectorised search and comparison to be used */
+START_TEST(test_string_kernels)
+{
+  value str1, str2;
+  Rune base[] = { 'a', 0x3042, 0x1f600 };
+  int i, j, k, len = 100;
+
+  for (k=0; k<3; k++) {
+    str1 = arc_mkstringlen(c, len);
+    for (i=0; i<len; i++)
+      arc_strsetindex(c, str1, i, base[k] + (i % 7));
+    for (i=0; i<len; i++) {
+      str2 = arc_substr(c, str1, 0, len);
+      fail_unless(arc_strcmp(c, str1, str2) == 0);
+      fail_unless(arc_is2(c, str1, str2) == CTRUE);
+      fail_unless(arc_hash(c, str1) == arc_hash(c, str2));
+      arc_strsetindex(c, str2, i, base[k] + 7);
+      fail_unless(arc_strcmp(c, str1, str2) < 0);
+      fail_unless(arc_strcmp(c, str2, str1) > 0);
+      fail_unless(arc_is2(c, str1, str2) == CNIL);
+      fail_unless(arc_strchr(c, str2, base[k] + 7) == INT2FIX(i));
+      for (j=0; j<7 && j<i; j++)
+	fail_unless(arc_strchr(c, str2, base[k] + j) == INT2FIX(j));
+    }
+    fail_unless(NIL_P(arc_strchr(c, str1, base[k] + 8)));
+  }
+}
+END_TEST
+
 int main(void)
 {
   int number_failed;
@@ -100,6 +166,8 @@ int main(void)
 
   tcase_add_test(tc_str, test_make_strings);
   tcase_add_test(tc_str, test_compare_strings);
+  tcase_add_test(tc_str, test_string_widths);
+  tcase_add_test(tc_str, test_string_kernels);
 
   suite_add_tcase(s, tc_str);
   sr = srunner_create(s);
@@ -0,0 +1,369 @@
+/*
+  Copyright (C) 2013 Rafael R. Sevilla
+
+  This file is part of Arcueid
+
+  Arcueid is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <check.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../src/arcueid.h"
+#include "../src/vmengine.h"
+#include "../src/arith.h"
+#include "../config.h"
+
+arc cc;
+arc *c;
+
+static int errors;
+
+/* Errors in threads only break the thread that raised them */
+static void errhandler(arc *c, value thr, value str)
+{
+  errors++;
+}
+
+#define SLEEP(ms) AFCALLF(arc_sleep, arc_mkflonum(c, (ms)/1000.0))
+
+/* Sleeping threads wake up in the order of their wakeup times, not
+   the order in which they went to sleep. */
+static const int delays[] = { 50, 10, 40, 20, 30 };
+#define NDELAYS ((int)(sizeof(delays)/sizeof(delays[0])))
+static int nstarted, nwoken, woken[NDELAYS];
+
+static AFFDEF(sleeper)
+{
+  AVAR(id);
+  AFBEGIN;
+  WV(id, INT2FIX(nstarted++));
+  SLEEP(delays[FIX2INT(AV(id))]);
+  woken[nwoken++] = FIX2INT(AV(id));
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+START_TEST(test_sleep_order)
+{
+  static const int order[] = { 1, 3, 4, 2, 0 };
+  int i;
+
+  nstarted = nwoken = 0;
+  for (i=0; i<NDELAYS; i++)
+    arc_spawn(c, arc_mkaff(c, sleeper, CNIL));
+  arc_thread_dispatch(c);
+  fail_unless(nwoken == NDELAYS);
+  for (i=0; i<NDELAYS; i++)
+    fail_unless(woken[i] == order[i]);
+  fail_unless(c->ntimers == 0);
+}
+END_TEST
+
+/* Enough sleepers to make the timer heap grow several times over,
+   which must still wake them in order */
+#define NSLEEPERS 1000
+static unsigned long long wakeups[NSLEEPERS];
+
+static AFFDEF(many_sleeper)
+{
+  AFBEGIN;
+  SLEEP((nstarted++ * 37) % 50);
+  wakeups[nwoken++] = TWAKEUP(thr);
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+START_TEST(test_many_sleepers)
+{
+  int i;
+
+  nstarted = nwoken = 0;
+  for (i=0; i<NSLEEPERS; i++)
+    arc_spawn(c, arc_mkaff(c, many_sleeper, CNIL));
+  arc_thread_dispatch(c);
+  fail_unless(nwoken == NSLEEPERS);
+  fail_unless(c->timersize >= NSLEEPERS);
+  for (i=1; i<NSLEEPERS; i++)
+    fail_unless(wakeups[i-1] <= wakeups[i]);
+  fail_unless(c->ntimers == 0);
+}
+END_TEST
+
+/* A thread waiting on a pipe is woken when something is written to
+   it, and again for the next write, after it has waited again. */
+static int pipefd[2], nread, nwaits, nwritten;
+
+static AFFDEF(pipe_reader)
+{
+  char ch;
+  AFBEGIN;
+  while (nread < 2) {
+    if (read(pipefd[0], &ch, 1) == 1) {
+      nread++;
+      continue;
+    }
+    nwaits++;
+    AIOWAITR(pipefd[0]);
+  }
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+static AFFDEF(pipe_writer)
+{
+  AFBEGIN;
+  SLEEP(20);
+  nwritten += write(pipefd[1], "a", 1);
+  SLEEP(20);
+  nwritten += write(pipefd[1], "b", 1);
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+static void open_pipe(void)
+{
+  fail_unless(pipe(pipefd) == 0);
+  fcntl(pipefd[0], F_SETFL, fcntl(pipefd[0], F_GETFL) | O_NONBLOCK);
+}
+
+static void close_pipe(void)
+{
+  close(pipefd[0]);
+  close(pipefd[1]);
+}
+
+START_TEST(test_iowait_rearm)
+{
+  open_pipe();
+  nread = nwaits = nwritten = 0;
+  arc_spawn(c, arc_mkaff(c, pipe_reader, CNIL));
+  arc_spawn(c, arc_mkaff(c, pipe_writer, CNIL));
+  arc_thread_dispatch(c);
+  fail_unless(nwritten == 2);
+  fail_unless(nread == 2);
+  fail_unless(nwaits >= 2);
+  fail_unless(c->niowait == 0);
+  close_pipe();
+}
+END_TEST
+
+/* A thread waiting on a pipe which never becomes readable is killed
+   or broken by another thread.  It has to be taken off the wait list
+   of the fd, or the dispatcher would wait for it forever. */
+static int killed, waiting;
+
+static AFFDEF(stuck_reader)
+{
+  char ch;
+  AFBEGIN;
+  while (read(pipefd[0], &ch, 1) != 1)
+    AIOWAITR(pipefd[0]);
+  ARETURN(CTRUE);
+  AFEND;
+}
+AFFEND
+
+static AFFDEF(killer)
+{
+  AVAR(victim);
+  AFBEGIN;
+  WV(victim, arc_gbind_cstr(c, "victim"));
+  SLEEP(20);
+  waiting = (TSTATE(AV(victim)) == Tiowait && c->niowait == 1);
+  if (killed)
+    AFCALLF(arc_kill_thread, AV(victim));
+  else
+    arc_break_thread(c, AV(victim));
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+static void stop_reader(int kill)
+{
+  value victim;
+
+  open_pipe();
+  errors = 0;
+  killed = kill;
+  waiting = 0;
+  victim = arc_spawn(c, arc_mkaff(c, stuck_reader, CNIL));
+  arc_bindcstr(c, "victim", victim);
+  arc_spawn(c, arc_mkaff(c, killer, CNIL));
+  arc_thread_dispatch(c);
+  fail_unless(waiting);
+  fail_unless(arc_dead(c, victim) == CTRUE);
+  fail_unless(errors == (kill ? 0 : 1));
+  fail_unless(c->niowait == 0);
+  fail_unless(NIL_P(c->iowaiters[pipefd[0]]));
+
+  /* the fd can still be waited on afterwards */
+  nread = nwaits = nwritten = 0;
+  arc_spawn(c, arc_mkaff(c, pipe_reader, CNIL));
+  arc_spawn(c, arc_mkaff(c, pipe_writer, CNIL));
+  arc_thread_dispatch(c);
+  fail_unless(nread == 2);
+  close_pipe();
+}
+
+START_TEST(test_kill_iowait)
+{
+  stop_reader(1);
+}
+END_TEST
+
+START_TEST(test_break_iowait)
+{
+  stop_reader(0);
+}
+END_TEST
+
+#ifdef HAVE_SMP
+
+/* Several workers of the SMP dispatcher send and receive on the same
+   channel at once, without the runtime lock.  Every value sent must
+   be received exactly once. */
+#define NWORKERS 4
+#define NPEERS 4
+#define NMSGS 500
+static long nrecvd, recvsum;
+
+static AFFDEF(producer)
+{
+  AVAR(ch, i);
+  AFBEGIN;
+  WV(ch, arc_gbind_cstr(c, "testchan"));
+  for (WV(i, INT2FIX(0)); FIX2INT(AV(i)) < NMSGS;
+       WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
+    AFCALLF(arc_send_channel, AV(ch), AV(i));
+  }
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+static AFFDEF(consumer)
+{
+  AVAR(ch, i);
+  AFBEGIN;
+  WV(ch, arc_gbind_cstr(c, "testchan"));
+  for (WV(i, INT2FIX(0)); FIX2INT(AV(i)) < NMSGS;
+       WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
+    AFCALLF(arc_recv_channel, AV(ch));
+    __atomic_add_fetch(&nrecvd, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&recvsum, FIX2INT(AFCRV), __ATOMIC_SEQ_CST);
+  }
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+START_TEST(test_smp_channel)
+{
+  int i;
+
+  errors = 0;
+  nrecvd = recvsum = 0;
+  arc_bindcstr(c, "testchan", arc_mkchan(c));
+  for (i=0; i<NPEERS; i++) {
+    arc_spawn(c, arc_mkaff(c, producer, CNIL));
+    arc_spawn(c, arc_mkaff(c, consumer, CNIL));
+  }
+  c->nworkers = NWORKERS;
+  arc_thread_dispatch(c);
+  c->nworkers = 1;
+  fail_unless(errors == 0);
+  fail_unless(nrecvd == NPEERS*NMSGS);
+  fail_unless(recvsum == (long)NPEERS*NMSGS*(NMSGS-1)/2);
+}
+END_TEST
+
+/* Threads on several workers take turns holding the lock that
+   atomic-invoke uses, an atomic cell and the __achan__ channel, to
+   increment a counter, going to sleep in the middle of each
+   increment so that the others get to run.  No increment may be
+   lost. */
+#define NINCRS 100
+static int counter;
+
+static AFFDEF(incrementer)
+{
+  AVAR(ch, i, v);
+  AFBEGIN;
+  WV(ch, arc_gbind_cstr(c, "__achan__"));
+  for (WV(i, INT2FIX(0)); FIX2INT(AV(i)) < NINCRS;
+       WV(i, INT2FIX(FIX2INT(AV(i)) + 1))) {
+    AFCALLF(arc_atomic_cell, CTRUE);
+    AFCALLF(arc_send_channel, AV(ch), CTRUE);
+    WV(v, INT2FIX(counter));
+    SLEEP(0);
+    counter = FIX2INT(AV(v)) + 1;
+    AFCALLF(arc_recv_channel, AV(ch));
+    AFCALLF(arc_atomic_cell, CNIL);
+  }
+  ARETURN(CNIL);
+  AFEND;
+}
+AFFEND
+
+START_TEST(test_smp_atomic)
+{
+  int i;
+
+  errors = 0;
+  counter = 0;
+  for (i=0; i<2*NPEERS; i++)
+    arc_spawn(c, arc_mkaff(c, incrementer, CNIL));
+  c->nworkers = NWORKERS;
+  arc_thread_dispatch(c);
+  c->nworkers = 1;
+  fail_unless(errors == 0);
+  fail_unless(counter == 2*NPEERS*NINCRS);
+}
+END_TEST
+
+#endif
+
+int main(void)
+{
+  int number_failed;
+  Suite *s = suite_create("Threads");
+  TCase *tc_thr = tcase_create("Threads");
+  SRunner *sr;
+
+  c = &cc;
+  arc_init(c);
+  c->errhandler = errhandler;
+
+  tcase_add_test(tc_thr, test_sleep_order);
+  tcase_add_test(tc_thr, test_many_sleepers);
+  tcase_add_test(tc_thr, test_iowait_rearm);
+  tcase_add_test(tc_thr, test_kill_iowait);
+  tcase_add_test(tc_thr, test_break_iowait);
+#ifdef HAVE_SMP
+  tcase_add_test(tc_thr, test_smp_channel);
+  tcase_add_test(tc_thr, test_smp_atomic);
+#endif
+
+  suite_add_tcase(s, tc_thr);
+  sr = srunner_create(s);
+  srunner_run_all(sr, CK_NORMAL);
+  number_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+  return((number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -198,6 +198,45 @@ START_TEST(test_stg)
 }
 END_TEST
 
+/* ldg and stg with the binding cell the compiler uses as the literal */
+START_TEST(test_gcell)
+{
+  value cctx, code, clos, thr;
+  value sym = arc_intern_cstr(c, "bar");
+  value cell = arc_gcell(c, sym);
+  int lptr;
+
+  fail_unless(arc_gcell(c, sym) == cell);
+  fail_unless(arc_bound(c, sym) == CNIL);
+  cctx = arc_mkcctx(c);
+  lptr = arc_literal(c, cctx, cell);
+  arc_emit1(c, cctx, ildi, INT2FIX(31337), CNIL);
+  arc_emit1(c, cctx, istg, INT2FIX(lptr), CNIL);
+  arc_emit(c, cctx, inil, CNIL);
+  arc_emit1(c, cctx, ildg, INT2FIX(lptr), CNIL);
+  arc_emit(c, cctx, ihlt, CNIL);
+  code = arc_cctx2code(c, cctx);
+  clos = arc_mkclos(c, code, CNIL);
+  thr = arc_mkthread(c);
+  XCALL0(clos);
+  fail_unless(TSTATE(thr) == Trelease);
+  fail_unless(TVALR(thr) == INT2FIX(31337));
+  fail_unless(arc_gbind(c, sym) == INT2FIX(31337));
+
+  /* Rebinding the symbol is seen through the cell */
+  arc_bindsym(c, sym, INT2FIX(42));
+  cctx = arc_mkcctx(c);
+  lptr = arc_literal(c, cctx, cell);
+  arc_emit1(c, cctx, ildg, INT2FIX(lptr), CNIL);
+  arc_emit(c, cctx, ihlt, CNIL);
+  code = arc_cctx2code(c, cctx);
+  clos = arc_mkclos(c, code, CNIL);
+  thr = arc_mkthread(c);
+  XCALL0(clos);
+  fail_unless(TVALR(thr) == INT2FIX(42));
+}
+END_TEST
+
 /* Environment instructions */
 START_TEST(test_envs)
 {
@@ -498,6 +537,62 @@ START_TEST(test_add)
 }
 END_TEST
 
+START_TEST(test_superinst)
+{
+  value cctx, code, clos;
+  value thr;
+
+  cctx = arc_mkcctx(c);
+  arc_emit1(c, cctx, ildi, INT2FIX(2), CNIL);
+  arc_emit(c, cctx, ipush, CNIL);
+  arc_emit1(c, cctx, ildi, INT2FIX(3), CNIL);
+  arc_emit(c, cctx, iadd, CNIL);
+  arc_emit(c, cctx, ihlt, CNIL);
+  code = arc_cctx2code(c, cctx);
+  /* Only the first opcode of each pair is rewritten */
+  fail_unless(VINDEX(CODE_CODE(code), 0) == INT2FIX(ildipush));
+  fail_unless(VINDEX(CODE_CODE(code), 2) == INT2FIX(ipush));
+  fail_unless(VINDEX(CODE_CODE(code), 3) == INT2FIX(ildiadd));
+  fail_unless(VINDEX(CODE_CODE(code), 5) == INT2FIX(iadd));
+  clos = arc_mkclos(c, code, CNIL);
+  thr = arc_mkthread(c);
+  XCALL0(clos);
+  fail_unless(TQUANTA(thr) == QUANTA-4);
+  fail_unless(TSTATE(thr) == Trelease);
+  fail_unless(TVALR(thr) == INT2FIX(5));
+}
+END_TEST
+
+START_TEST(test_quicken)
+{
+  value cctx, code, clos;
+  value thr;
+
+  cctx = arc_mkcctx(c);
+  arc_emit1(c, cctx, ildl, INT2FIX(0), CNIL);
+  arc_emit(c, cctx, ipush, CNIL);
+  arc_emit1(c, cctx, ildl, INT2FIX(1), CNIL);
+  arc_emit(c, cctx, isub, CNIL);
+  arc_emit(c, cctx, ihlt, CNIL);
+  arc_literal(c, cctx, INT2FIX(2));
+  arc_literal(c, cctx, INT2FIX(3));
+  code = arc_cctx2code(c, cctx);
+  clos = arc_mkclos(c, code, CNIL);
+  thr = arc_mkthread(c);
+  XCALL0(clos);
+  fail_unless(TVALR(thr) == INT2FIX(-1));
+  fail_unless(VINDEX(CODE_CODE(code), 5) == INT2FIX(isubfx));
+
+  /* Non-fixnum operands turn it back into a generic isub */
+  SCODE_LITERAL(code, 1, arc_mkflonum(c, 0.5));
+  thr = arc_mkthread(c);
+  XCALL0(clos);
+  fail_unless(TYPE(TVALR(thr)) == T_FLONUM);
+  fail_unless(REPFLO(TVALR(thr)) == 1.5);
+  fail_unless(VINDEX(CODE_CODE(code), 5) == INT2FIX(isub));
+}
+END_TEST
+
 START_TEST(test_sub)
 {
   value cctx, code, clos;
@@ -540,6 +635,36 @@ START_TEST(test_mul)
 }
 END_TEST
 
+START_TEST(test_arith_overflow)
+{
+  value cctx, code, clos;
+  value thr;
+
+  /* Overflow out of the fixnum fast paths gets promoted */
+  cctx = arc_mkcctx(c);
+  arc_emit1(c, cctx, ildl, INT2FIX(0), CNIL);
+  arc_emit(c, cctx, ipush, CNIL);
+  arc_emit1(c, cctx, ildl, INT2FIX(0), CNIL);
+  arc_emit(c, cctx, imul, CNIL);
+  arc_emit(c, cctx, ipush, CNIL);
+  arc_emit1(c, cctx, ildl, INT2FIX(1), CNIL);
+  arc_emit(c, cctx, iadd, CNIL);
+  arc_emit(c, cctx, ihlt, CNIL);
+  arc_literal(c, cctx, INT2FIX(FIXNUM_MAX/2 + 1));
+  arc_literal(c, cctx, INT2FIX(-FIXNUM_MAX));
+  code = arc_cctx2code(c, cctx);
+  clos = arc_mkclos(c, code, CNIL);
+  thr = arc_mkthread(c);
+  XCALL0(clos);
+  fail_unless(TSTATE(thr) == Trelease);
+#ifdef HAVE_GMP_H
+  fail_unless(TYPE(TVALR(thr)) == T_BIGNUM);
+#else
+  fail_unless(TYPE(TVALR(thr)) == T_FLONUM);
+#endif
+}
+END_TEST
+
 START_TEST(test_div)
 {
   value cctx, code, clos;
@@ -946,6 +1071,7 @@ int main(void)
   tcase_add_test(tc_vm, test_ldl);
   tcase_add_test(tc_vm, test_ldg);
   tcase_add_test(tc_vm, test_stg);
+  tcase_add_test(tc_vm, test_gcell);
   tcase_add_test(tc_vm, test_push);
   tcase_add_test(tc_vm, test_pop);
   tcase_add_test(tc_vm, test_envs);
@@ -960,7 +1086,10 @@ int main(void)
   tcase_add_test(tc_vm, test_hlt);
   tcase_add_test(tc_vm, test_add);
   tcase_add_test(tc_vm, test_sub);
+  tcase_add_test(tc_vm, test_superinst);
+  tcase_add_test(tc_vm, test_quicken);
   tcase_add_test(tc_vm, test_mul);
+  tcase_add_test(tc_vm, test_arith_overflow);
   tcase_add_test(tc_vm, test_div);
   tcase_add_test(tc_vm, test_cons);
   tcase_add_test(tc_vm, test_car);